@@ -0,0 +1,93 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/adaptive_sampler.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// Weight of a new latency report in the smoothed latency.
+constexpr double kLatencySmoothingFactor = 0.2;
+// Number of latency reports between two adjustments of the ratio, so that a
+// backlog has a chance to drain before the ratio is lowered further.
+constexpr int kNumReportsPerAdjustment = 10;
+constexpr double kDecreaseFactor = 0.7;
+// Fraction of 'max_ratio' added per adjustment while the latency is fine.
+constexpr double kIncreaseFraction = 0.1;
+// The ratio is only increased if the latency is below this fraction of
+// 'max_latency_sec'.
+constexpr double kRecoveryLatencyFraction = 0.5;
+
+}  // namespace
+
+AdaptiveSampler::AdaptiveSampler(const double max_ratio,
+                                 const double min_ratio,
+                                 const double max_latency_sec)
+    : max_ratio_(max_ratio),
+      min_ratio_(min_ratio),
+      max_latency_sec_(max_latency_sec),
+      ratio_(max_ratio) {
+  CHECK_GE(min_ratio, 0.);
+  CHECK_LE(min_ratio, max_ratio);
+  CHECK_LE(max_ratio, 1.);
+  CHECK_GE(max_latency_sec, 0.);
+}
+
+bool AdaptiveSampler::Pulse() {
+  ++num_pulses_;
+  if (static_cast<double>(num_samples_) / num_pulses_ < ratio_) {
+    ++num_samples_;
+    return true;
+  }
+  return false;
+}
+
+bool AdaptiveSampler::ReportLatency(const double latency_sec) {
+  if (max_latency_sec_ == 0.) {
+    return false;
+  }
+  latency_sec_ = (1. - kLatencySmoothingFactor) * latency_sec_ +
+                 kLatencySmoothingFactor * latency_sec;
+  if (++num_reports_since_adjustment_ < kNumReportsPerAdjustment) {
+    return false;
+  }
+  const double old_ratio = ratio_;
+  if (latency_sec_ > max_latency_sec_) {
+    SetRatio(std::max(min_ratio_, ratio_ * kDecreaseFactor));
+  } else if (latency_sec_ < kRecoveryLatencyFraction * max_latency_sec_) {
+    SetRatio(std::min(max_ratio_, ratio_ + kIncreaseFraction * max_ratio_));
+  }
+  num_reports_since_adjustment_ = 0;
+  return ratio_ != old_ratio;
+}
+
+void AdaptiveSampler::SetRatio(const double ratio) {
+  if (ratio == ratio_) {
+    return;
+  }
+  ratio_ = ratio;
+  // Start counting anew, otherwise the history at the old ratio would bias
+  // which pulses are sampled for a long time.
+  num_pulses_ = 0;
+  num_samples_ = 0;
+}
+
+}  // namespace cartographer_ros
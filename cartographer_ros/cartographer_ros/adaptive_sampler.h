@@ -0,0 +1,63 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_ADAPTIVE_SAMPLER_H_
+#define CARTOGRAPHER_ROS_ADAPTIVE_SAMPLER_H_
+
+#include "cartographer/common/port.h"
+
+namespace cartographer_ros {
+
+// Signals when a sample should be taken from a stream of data, like
+// 'cartographer::common::FixedRatioSampler'. The ratio is lowered towards
+// 'min_ratio' while the reported latency exceeds 'max_latency_sec' and is
+// restored to 'max_ratio' once the latency has recovered. If
+// 'max_latency_sec' is 0, the ratio stays at 'max_ratio'.
+class AdaptiveSampler {
+ public:
+  AdaptiveSampler(double max_ratio, double min_ratio, double max_latency_sec);
+
+  AdaptiveSampler(const AdaptiveSampler&) = delete;
+  AdaptiveSampler& operator=(const AdaptiveSampler&) = delete;
+
+  // Returns true if this pulse should result in a sample.
+  bool Pulse();
+
+  // Reports the latency of a sample. Returns true if the ratio was changed.
+  bool ReportLatency(double latency_sec);
+
+  // Returns the currently applied ratio.
+  double ratio() const { return ratio_; }
+
+  // Returns the smoothed latency in seconds.
+  double latency_sec() const { return latency_sec_; }
+
+ private:
+  void SetRatio(double ratio);
+
+  const double max_ratio_;
+  const double min_ratio_;
+  const double max_latency_sec_;
+  double ratio_;
+  double latency_sec_ = 0.;
+  int num_reports_since_adjustment_ = 0;
+  ::cartographer::common::int64 num_pulses_ = 0;
+  ::cartographer::common::int64 num_samples_ = 0;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_ADAPTIVE_SAMPLER_H_
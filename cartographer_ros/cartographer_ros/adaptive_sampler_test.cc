@@ -0,0 +1,58 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/adaptive_sampler.h"
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+int CountSamples(const int num_pulses, AdaptiveSampler* const sampler) {
+  int num_samples = 0;
+  for (int i = 0; i < num_pulses; ++i) {
+    if (sampler->Pulse()) {
+      ++num_samples;
+    }
+  }
+  return num_samples;
+}
+
+TEST(AdaptiveSamplerTest, BehavesLikeFixedRatioSamplerWhenDisabled) {
+  AdaptiveSampler sampler(0.5, 0.1, 0.);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_FALSE(sampler.ReportLatency(10.));
+  }
+  EXPECT_EQ(0.5, sampler.ratio());
+  EXPECT_EQ(50, CountSamples(100, &sampler));
+}
+
+TEST(AdaptiveSamplerTest, LowersAndRestoresRatio) {
+  AdaptiveSampler sampler(1., 0.2, 0.1);
+  for (int i = 0; i < 1000; ++i) {
+    sampler.ReportLatency(1.);
+  }
+  EXPECT_EQ(0.2, sampler.ratio());
+  EXPECT_EQ(20, CountSamples(100, &sampler));
+  for (int i = 0; i < 1000; ++i) {
+    sampler.ReportLatency(0.);
+  }
+  EXPECT_EQ(1., sampler.ratio());
+  EXPECT_EQ(100, CountSamples(100, &sampler));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -15,14 +15,22 @@
  */
 
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "cartographer/common/configuration_file_resolver.h"
 #include "cartographer/common/make_unique.h"
 #include "cartographer/common/math.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/io/file_writer.h"
 #include "cartographer/io/points_processor.h"
 #include "cartographer/io/points_processor_pipeline_builder.h"
@@ -32,6 +40,9 @@
 #include "cartographer/sensor/range_data.h"
 #include "cartographer/transform/transform_interpolation_buffer.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/pipelined_bag_reader.h"
+#include "cartographer_ros/points_batch_cache.h"
+#include "cartographer_ros/queued_points_processor.h"
 #include "cartographer_ros/ros_map_writing_points_processor.h"
 #include "cartographer_ros/split_string.h"
 #include "cartographer_ros/time_conversion.h"
@@ -40,8 +51,6 @@
 #include "glog/logging.h"
 #include "ros/ros.h"
 #include "ros/time.h"
-#include "rosbag/bag.h"
-#include "rosbag/view.h"
 #include "tf2_eigen/tf2_eigen.h"
 #include "tf2_msgs/TFMessage.h"
 #include "tf2_ros/buffer.h"
@@ -64,6 +73,16 @@ DEFINE_string(pose_graph_filename, "",
               "Proto stream file containing the pose graph.");
 DEFINE_bool(use_bag_transforms, true,
             "Whether to read and use the transforms from the bag.");
+DEFINE_double(transform_time_granularity_sec, 1e-3,
+              "Points of a message which are at most this far apart in time "
+              "are transformed into the map frame with the same transform.");
+DEFINE_bool(cache_points_batches, true,
+            "If the pipeline needs several passes, only read the bags once "
+            "and replay the transformed points from a file next to the "
+            "outputs. The file is removed at the end.");
+DEFINE_int32(num_threads, 4,
+             "Number of threads decoding the messages and, separately, "
+             "transforming their points into the map frame.");
 DEFINE_string(output_file_prefix, "",
               "Will be prefixed to all output file names and can be used to "
               "define the output directory. If empty, the first bag filename "
@@ -73,28 +92,58 @@ namespace cartographer_ros {
 namespace {
 
 constexpr char kTfStaticTopic[] = "/tf_static";
+constexpr size_t kMaxQueuedMessages = 256;
+constexpr size_t kMaxPendingBatches = 64;
+constexpr size_t kMaxQueuedBatches = 16;
 namespace carto = ::cartographer;
 
+// Returns the points of 'message' and the time their relative times refer to.
+template <typename T>
+std::tuple<carto::sensor::PointCloudWithIntensities, carto::common::Time>
+ToTimedPointCloud(const T& message) {
+  return std::make_tuple(ToPointCloudWithIntensities(message),
+                         FromRos(message.header.stamp));
+}
+
+std::tuple<carto::sensor::PointCloudWithIntensities, carto::common::Time>
+ToTimedPointCloud(const sensor_msgs::PointCloud2& message) {
+  return ToPointCloudWithIntensities(message);
+}
+
 template <typename T>
 std::unique_ptr<carto::io::PointsBatch> HandleMessage(
     const T& message, const std::string& tracking_frame,
     const tf2_ros::Buffer& tf_buffer,
     const carto::transform::TransformInterpolationBuffer&
         transform_interpolation_buffer) {
-  const carto::common::Time start_time = FromRos(message.header.stamp);
+  carto::sensor::PointCloudWithIntensities point_cloud;
+  carto::common::Time start_time;
+  std::tie(point_cloud, start_time) = ToTimedPointCloud(message);
 
   auto points_batch = carto::common::make_unique<carto::io::PointsBatch>();
   points_batch->start_time = start_time;
   points_batch->frame_id = message.header.frame_id;
 
-  carto::sensor::PointCloudWithIntensities point_cloud =
-      ToPointCloudWithIntensities(message);
   CHECK_EQ(point_cloud.intensities.size(), point_cloud.points.size());
+  const size_t num_points = point_cloud.points.size();
+  points_batch->points.reserve(num_points);
+  points_batch->intensities.reserve(num_points);
 
-  for (size_t i = 0; i < point_cloud.points.size(); ++i) {
+  // Looking up the transforms dominates the cost of a message, so points are
+  // split into blocks of nearly simultaneous points that share a transform.
+  size_t block_begin = 0;
+  while (block_begin < num_points) {
+    const float block_relative_time = point_cloud.points[block_begin][3];
+    size_t block_end = block_begin + 1;
+    while (block_end < num_points &&
+           std::abs(point_cloud.points[block_end][3] - block_relative_time) <=
+               FLAGS_transform_time_granularity_sec) {
+      ++block_end;
+    }
     const carto::common::Time time =
-        start_time + carto::common::FromSeconds(point_cloud.points[i][3]);
+        start_time + carto::common::FromSeconds(block_relative_time);
     if (!transform_interpolation_buffer.Has(time)) {
+      block_begin = block_end;
       continue;
     }
     const carto::transform::Rigid3d tracking_to_map =
@@ -104,11 +153,19 @@ std::unique_ptr<carto::io::PointsBatch> HandleMessage(
             tracking_frame, message.header.frame_id, ToRos(time)));
     const carto::transform::Rigid3f sensor_to_map =
         (tracking_to_map * sensor_to_tracking).cast<float>();
-    points_batch->points.push_back(sensor_to_map *
-                                   point_cloud.points[i].head<3>());
-    points_batch->intensities.push_back(point_cloud.intensities[i]);
+    // A rotation matrix is cheaper to apply to many points than a quaternion.
+    const Eigen::Matrix3f rotation =
+        sensor_to_map.rotation().toRotationMatrix();
+    const Eigen::Vector3f& translation = sensor_to_map.translation();
+    for (size_t i = block_begin; i < block_end; ++i) {
+      points_batch->points.push_back(rotation *
+                                         point_cloud.points[i].head<3>() +
+                                     translation);
+      points_batch->intensities.push_back(point_cloud.intensities[i]);
+    }
     // We use the last transform for the origin, which is approximately correct.
-    points_batch->origin = sensor_to_map * Eigen::Vector3f::Zero();
+    points_batch->origin = translation;
+    block_begin = block_end;
   }
   if (points_batch->points.empty()) {
     return nullptr;
@@ -116,6 +173,182 @@ std::unique_ptr<carto::io::PointsBatch> HandleMessage(
   return points_batch;
 }
 
+// Creates the batches of messages on a pool of threads and hands them to the
+// next processor in the order in which they were scheduled. At most
+// 'max_pending_batches' are created ahead.
+class PointsBatchCreator {
+ public:
+  using CreateFunction =
+      std::function<std::unique_ptr<carto::io::PointsBatch>()>;
+
+  PointsBatchCreator(const int num_threads, const size_t max_pending_batches,
+                     carto::io::PointsProcessor* const next)
+      : max_pending_batches_(max_pending_batches),
+        next_(next),
+        thread_pool_(num_threads) {
+    CHECK_GT(max_pending_batches_, 0);
+  }
+
+  // Waits until all batches have been handed on.
+  ~PointsBatchCreator() { HandOnBatches(0); }
+
+  PointsBatchCreator(const PointsBatchCreator&) = delete;
+  PointsBatchCreator& operator=(const PointsBatchCreator&) = delete;
+
+  // Schedules 'create', which may return nullptr if there are no points.
+  void Schedule(CreateFunction create) EXCLUDES(mutex_) {
+    HandOnBatches(max_pending_batches_ - 1);
+    auto pending_batch = std::make_shared<PendingBatch>();
+    {
+      carto::common::MutexLocker lock(&mutex_);
+      pending_batches_.push_back(pending_batch);
+    }
+    thread_pool_.Schedule([this, pending_batch, create]() {
+      std::unique_ptr<carto::io::PointsBatch> points_batch = create();
+      carto::common::MutexLocker lock(&mutex_);
+      pending_batch->points_batch = std::move(points_batch);
+      pending_batch->done = true;
+    });
+  }
+
+ private:
+  struct PendingBatch {
+    bool done = false;
+    std::unique_ptr<carto::io::PointsBatch> points_batch;
+  };
+
+  // Hands on all created batches at the front, waiting for as many as needed
+  // to leave at most 'max_pending' batches.
+  void HandOnBatches(const size_t max_pending) EXCLUDES(mutex_) {
+    for (;;) {
+      std::unique_ptr<carto::io::PointsBatch> points_batch;
+      {
+        carto::common::MutexLocker lock(&mutex_);
+        lock.Await([this, max_pending]() REQUIRES(mutex_) {
+          return pending_batches_.size() <= max_pending ||
+                 pending_batches_.front()->done;
+        });
+        if (pending_batches_.empty() || !pending_batches_.front()->done) {
+          return;
+        }
+        points_batch = std::move(pending_batches_.front()->points_batch);
+        pending_batches_.pop_front();
+      }
+      if (points_batch != nullptr) {
+        next_->Process(std::move(points_batch));
+      }
+    }
+  }
+
+  const size_t max_pending_batches_;
+  carto::io::PointsProcessor* const next_;
+  carto::common::Mutex mutex_;
+  std::deque<std::shared_ptr<PendingBatch>> pending_batches_
+      GUARDED_BY(mutex_);
+  carto::common::ThreadPool thread_pool_;
+};
+
+// Creates the batches of points of all bags in the map frame and hands them
+// to 'next'.
+void ProcessBags(const carto::mapping::proto::PoseGraph& pose_graph_proto,
+                 const std::vector<std::string>& bag_filenames,
+                 const std::string& urdf_filename,
+                 const std::string& tracking_frame,
+                 carto::io::PointsProcessor* const next) {
+  for (size_t trajectory_id = 0; trajectory_id < bag_filenames.size();
+       ++trajectory_id) {
+    const carto::mapping::proto::Trajectory& trajectory_proto =
+        pose_graph_proto.trajectory(trajectory_id);
+    const std::string& bag_filename = bag_filenames[trajectory_id];
+    LOG(INFO) << "Processing " << bag_filename << "...";
+    if (trajectory_proto.node_size() == 0) {
+      continue;
+    }
+    tf2_ros::Buffer tf_buffer;
+    if (!urdf_filename.empty()) {
+      ReadStaticTransformsFromUrdf(urdf_filename, &tf_buffer);
+    }
+
+    const carto::transform::TransformInterpolationBuffer
+        transform_interpolation_buffer(trajectory_proto);
+    PipelinedBagReader bag_reader(
+        bag_filename,
+        [](const rosbag::MessageInstance& message) {
+          return (FLAGS_use_bag_transforms &&
+                  message.isType<tf2_msgs::TFMessage>()) ||
+                 message.isType<sensor_msgs::PointCloud2>() ||
+                 message.isType<sensor_msgs::MultiEchoLaserScan>() ||
+                 message.isType<sensor_msgs::LaserScan>();
+        },
+        FLAGS_num_threads, kMaxQueuedMessages, "" /* frame_prefix */);
+    const ::ros::Time begin_time = bag_reader.begin_time();
+    const double duration_in_seconds =
+        (bag_reader.end_time() - begin_time).toSec();
+    PointsBatchCreator points_batch_creator(
+        FLAGS_num_threads, kMaxPendingBatches, next);
+
+    // We need to keep 'tf_buffer' small because it becomes very inefficient
+    // otherwise. We make sure that tf_messages are published before any data
+    // messages, so that tf lookups always work.
+    std::deque<PipelinedBagReader::Message> delayed_messages;
+    // We publish tf messages one second earlier than other messages. Under
+    // the assumption of higher frequency tf this should ensure that tf can
+    // always interpolate.
+    const ::ros::Duration kDelay(1.);
+    PipelinedBagReader::Message message;
+    while (bag_reader.GetNextMessage(&message)) {
+      if (message.tf_message != nullptr) {
+        for (const auto& transform : message.tf_message->transforms) {
+          try {
+            tf_buffer.setTransform(transform, "unused_authority",
+                                   message.topic == kTfStaticTopic);
+          } catch (const tf2::TransformException& ex) {
+            LOG(WARNING) << ex.what();
+          }
+        }
+      }
+
+      while (!delayed_messages.empty() &&
+             delayed_messages.front().time < message.time - kDelay) {
+        // The lookups only need the transforms which are already in
+        // 'tf_buffer', so the messages can be transformed concurrently.
+        const PipelinedBagReader::Message delayed_message =
+            std::move(delayed_messages.front());
+        delayed_messages.pop_front();
+        points_batch_creator.Schedule([&tracking_frame, &tf_buffer,
+                                       &transform_interpolation_buffer,
+                                       trajectory_id, delayed_message]() {
+          std::unique_ptr<carto::io::PointsBatch> points_batch;
+          if (delayed_message.point_cloud2 != nullptr) {
+            points_batch = HandleMessage(*delayed_message.point_cloud2,
+                                         tracking_frame, tf_buffer,
+                                         transform_interpolation_buffer);
+          } else if (delayed_message.multi_echo_laser_scan != nullptr) {
+            points_batch = HandleMessage(
+                *delayed_message.multi_echo_laser_scan, tracking_frame,
+                tf_buffer, transform_interpolation_buffer);
+          } else if (delayed_message.laser_scan != nullptr) {
+            points_batch = HandleMessage(*delayed_message.laser_scan,
+                                         tracking_frame, tf_buffer,
+                                         transform_interpolation_buffer);
+          }
+          if (points_batch != nullptr) {
+            points_batch->trajectory_id = trajectory_id;
+          }
+          return points_batch;
+        });
+      }
+      const ::ros::Time message_time = message.time;
+      if (message.tf_message == nullptr) {
+        delayed_messages.push_back(std::move(message));
+      }
+      LOG_EVERY_N(INFO, 100000)
+          << "Processed " << (message_time - begin_time).toSec() << " of "
+          << duration_in_seconds << " bag time seconds...";
+    }
+  }
+}
+
 void Run(const std::string& pose_graph_filename,
          const std::vector<std::string>& bag_filenames,
          const std::string& configuration_directory,
@@ -165,93 +398,57 @@ void Run(const std::string& pose_graph_filename,
         return RosMapWritingPointsProcessor::FromDictionary(file_writer_factory,
                                                             dictionary, next);
       });
+  builder.Register(
+      QueuedPointsProcessor::kConfigurationFileActionName,
+      [](::cartographer::common::LuaParameterDictionary* const dictionary,
+         ::cartographer::io::PointsProcessor* const next)
+          -> std::unique_ptr<::cartographer::io::PointsProcessor> {
+        return QueuedPointsProcessor::FromDictionary(dictionary, next);
+      });
 
   std::vector<std::unique_ptr<carto::io::PointsProcessor>> pipeline =
       builder.CreatePipeline(
           lua_parameter_dictionary.GetDictionary("pipeline").get());
 
+  // The pipeline runs on a thread of its own, while this thread reads the bags
+  // and the points are transformed on a pool of threads.
+  QueuedPointsProcessor queued_pipeline(kMaxQueuedBatches,
+                                        pipeline.back().get());
+
   const std::string tracking_frame =
       lua_parameter_dictionary.GetString("tracking_frame");
-  do {
-    for (size_t trajectory_id = 0; trajectory_id < bag_filenames.size();
-         ++trajectory_id) {
-      const carto::mapping::proto::Trajectory& trajectory_proto =
-          pose_graph_proto.trajectory(trajectory_id);
-      const std::string& bag_filename = bag_filenames[trajectory_id];
-      LOG(INFO) << "Processing " << bag_filename << "...";
-      if (trajectory_proto.node_size() == 0) {
-        continue;
-      }
-      tf2_ros::Buffer tf_buffer;
-      if (!urdf_filename.empty()) {
-        ReadStaticTransformsFromUrdf(urdf_filename, &tf_buffer);
-      }
-
-      const carto::transform::TransformInterpolationBuffer
-          transform_interpolation_buffer(trajectory_proto);
-      rosbag::Bag bag;
-      bag.open(bag_filename, rosbag::bagmode::Read);
-      rosbag::View view(bag);
-      const ::ros::Time begin_time = view.getBeginTime();
-      const double duration_in_seconds =
-          (view.getEndTime() - begin_time).toSec();
-
-      // We need to keep 'tf_buffer' small because it becomes very inefficient
-      // otherwise. We make sure that tf_messages are published before any data
-      // messages, so that tf lookups always work.
-      std::deque<rosbag::MessageInstance> delayed_messages;
-      // We publish tf messages one second earlier than other messages. Under
-      // the assumption of higher frequency tf this should ensure that tf can
-      // always interpolate.
-      const ::ros::Duration kDelay(1.);
-      for (const rosbag::MessageInstance& message : view) {
-        if (FLAGS_use_bag_transforms && message.isType<tf2_msgs::TFMessage>()) {
-          auto tf_message = message.instantiate<tf2_msgs::TFMessage>();
-          for (const auto& transform : tf_message->transforms) {
-            try {
-              tf_buffer.setTransform(transform, "unused_authority",
-                                     message.getTopic() == kTfStaticTopic);
-            } catch (const tf2::TransformException& ex) {
-              LOG(WARNING) << ex.what();
-            }
-          }
-        }
-
-        while (!delayed_messages.empty() && delayed_messages.front().getTime() <
-                                                message.getTime() - kDelay) {
-          const rosbag::MessageInstance& delayed_message =
-              delayed_messages.front();
-
-          std::unique_ptr<carto::io::PointsBatch> points_batch;
-          if (delayed_message.isType<sensor_msgs::PointCloud2>()) {
-            points_batch = HandleMessage(
-                *delayed_message.instantiate<sensor_msgs::PointCloud2>(),
-                tracking_frame, tf_buffer, transform_interpolation_buffer);
-          } else if (delayed_message
-                         .isType<sensor_msgs::MultiEchoLaserScan>()) {
-            points_batch = HandleMessage(
-                *delayed_message.instantiate<sensor_msgs::MultiEchoLaserScan>(),
-                tracking_frame, tf_buffer, transform_interpolation_buffer);
-          } else if (delayed_message.isType<sensor_msgs::LaserScan>()) {
-            points_batch = HandleMessage(
-                *delayed_message.instantiate<sensor_msgs::LaserScan>(),
-                tracking_frame, tf_buffer, transform_interpolation_buffer);
-          }
-          if (points_batch != nullptr) {
-            points_batch->trajectory_id = trajectory_id;
-            pipeline.back()->Process(std::move(points_batch));
-          }
-          delayed_messages.pop_front();
-        }
-        delayed_messages.push_back(message);
-        LOG_EVERY_N(INFO, 100000)
-            << "Processed " << (message.getTime() - begin_time).toSec()
-            << " of " << duration_in_seconds << " bag time seconds...";
-      }
-      bag.close();
+  // The batches of the first pass are created from the bags. If the pipeline
+  // needs more passes, they read them back from a cache instead.
+  std::unique_ptr<PointsBatchCacheWriter> cache_writer;
+  const std::string cache_filename = file_prefix + "points_batches.cache";
+  carto::io::PointsProcessor* pass_output = &queued_pipeline;
+  if (FLAGS_cache_points_batches) {
+    cache_writer = carto::common::make_unique<PointsBatchCacheWriter>(
+        cache_filename, &queued_pipeline);
+    pass_output = cache_writer.get();
+  }
+  bool read_from_cache = false;
+  for (;;) {
+    if (read_from_cache) {
+      LOG(INFO) << "Processing the cached points batches...";
+      ReadPointsBatchCache(cache_filename, pass_output);
+    } else {
+      ProcessBags(pose_graph_proto, bag_filenames, urdf_filename,
+                  tracking_frame, pass_output);
     }
-  } while (pipeline.back()->Flush() ==
-           carto::io::PointsProcessor::FlushResult::kRestartStream);
+    if (pass_output->Flush() !=
+        carto::io::PointsProcessor::FlushResult::kRestartStream) {
+      break;
+    }
+    if (cache_writer != nullptr) {
+      read_from_cache = true;
+      pass_output = &queued_pipeline;
+    }
+  }
+  if (cache_writer != nullptr) {
+    CHECK_EQ(std::remove(cache_filename.c_str()), 0)
+        << "Could not remove '" << cache_filename << "'.";
+  }
 }
 
 }  // namespace
@@ -0,0 +1,487 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks of the sensor data and visualization hot paths. Next to the
+// time per call, each benchmark reports the number of heap allocations per
+// call.
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/time.h"
+#include "cartographer/mapping/id.h"
+#include "cartographer/mapping/pose_graph.h"
+#include "cartographer/mapping/trajectory_builder.h"
+#include "cartographer/mapping/trajectory_node.h"
+#include "cartographer/sensor/data.h"
+#include "cartographer_ros/ingest_statistics.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/pose_graph_markers.h"
+#include "cartographer_ros/sensor_bridge.h"
+#include "cartographer_ros/tf_bridge.h"
+#include "cartographer_ros/time_conversion.h"
+#include "geometry_msgs/msg/transform_stamped.hpp"
+#include "rclcpp/clock.hpp"
+#include "sensor_msgs/msg/laser_scan.hpp"
+#include "sensor_msgs/msg/multi_echo_laser_scan.hpp"
+#include "sensor_msgs/msg/point_cloud2.hpp"
+#include "tf2_ros/buffer.h"
+
+namespace {
+
+std::atomic<size_t> num_allocations{0};
+
+}  // namespace
+
+void* operator new(const std::size_t size) {
+  ++num_allocations;
+  void* const pointer = std::malloc(size == 0 ? 1 : size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void* const pointer) noexcept { std::free(pointer); }
+
+void operator delete(void* const pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+namespace cartographer_ros {
+namespace {
+
+// A typical 2D scanner with a 270 degree field of view.
+constexpr int kNumLaserScanBeams = 1080;
+constexpr int kNumEchoes = 3;
+// A 128 beam 3D scanner with 1024 columns.
+constexpr int kNumPointCloudBeams = 128;
+constexpr int kNumPointCloudColumns = 1024;
+constexpr char kTrackingFrame[] = "base_link";
+constexpr char kStaticFrame[] = "horizontal_laser_link";
+constexpr char kMovingFrame[] = "rotating_laser_link";
+constexpr int kNumMovingTransforms = 1000;
+constexpr double kMovingTransformPeriodSec = 0.01;
+// A pose graph of a long mapping session.
+constexpr int kNumPoseGraphNodes = 100000;
+constexpr int kNumNodesPerSubmap = 45;
+constexpr int kNumNodesPerInterSubmapConstraint = 10;
+
+// Reports the allocations since 'num_allocations_before' per iteration.
+void ReportAllocations(const size_t num_allocations_before,
+                       benchmark::State* const state) {
+  state->counters["allocations_per_call"] =
+      static_cast<double>(num_allocations - num_allocations_before) /
+      state->iterations();
+}
+
+float BeamRange(const int index) { return 1.f + 0.01f * (index % 1000); }
+
+sensor_msgs::msg::LaserScan CreateLaserScan() {
+  sensor_msgs::msg::LaserScan msg;
+  msg.header.frame_id = kStaticFrame;
+  msg.angle_min = -0.75f * static_cast<float>(M_PI);
+  msg.angle_increment = 1.5f * static_cast<float>(M_PI) / kNumLaserScanBeams;
+  msg.angle_max =
+      msg.angle_min + (kNumLaserScanBeams - 1) * msg.angle_increment;
+  msg.time_increment = 2.5e-5f;
+  msg.range_min = 0.1f;
+  msg.range_max = 30.f;
+  for (int i = 0; i < kNumLaserScanBeams; ++i) {
+    msg.ranges.push_back(BeamRange(i));
+    msg.intensities.push_back(100.f);
+  }
+  return msg;
+}
+
+sensor_msgs::msg::MultiEchoLaserScan CreateMultiEchoLaserScan() {
+  const sensor_msgs::msg::LaserScan laser_scan = CreateLaserScan();
+  sensor_msgs::msg::MultiEchoLaserScan msg;
+  msg.header = laser_scan.header;
+  msg.angle_min = laser_scan.angle_min;
+  msg.angle_max = laser_scan.angle_max;
+  msg.angle_increment = laser_scan.angle_increment;
+  msg.time_increment = laser_scan.time_increment;
+  msg.range_min = laser_scan.range_min;
+  msg.range_max = laser_scan.range_max;
+  for (int i = 0; i < kNumLaserScanBeams; ++i) {
+    sensor_msgs::msg::LaserEcho ranges;
+    sensor_msgs::msg::LaserEcho intensities;
+    for (int echo = 0; echo < kNumEchoes; ++echo) {
+      ranges.echoes.push_back(BeamRange(i) + echo);
+      intensities.echoes.push_back(100.f);
+    }
+    msg.ranges.push_back(ranges);
+    msg.intensities.push_back(intensities);
+  }
+  return msg;
+}
+
+sensor_msgs::msg::PointField CreatePointField(const std::string& name,
+                                              const uint32_t offset,
+                                              const uint8_t datatype) {
+  sensor_msgs::msg::PointField field;
+  field.name = name;
+  field.offset = offset;
+  field.datatype = datatype;
+  field.count = 1;
+  return field;
+}
+
+// Creates a cloud in the layout of common 3D scanners, with a per point time
+// in nanoseconds since the start of the scan.
+sensor_msgs::msg::PointCloud2 CreatePointCloud2() {
+  struct RawPoint {
+    float x, y, z;
+    uint32_t t;
+    uint16_t intensity;
+  };
+  sensor_msgs::msg::PointCloud2 msg;
+  msg.header.frame_id = kMovingFrame;
+  msg.height = kNumPointCloudBeams;
+  msg.width = kNumPointCloudColumns;
+  msg.fields = {
+      CreatePointField("x", 0, sensor_msgs::msg::PointField::FLOAT32),
+      CreatePointField("y", 4, sensor_msgs::msg::PointField::FLOAT32),
+      CreatePointField("z", 8, sensor_msgs::msg::PointField::FLOAT32),
+      CreatePointField("t", 12, sensor_msgs::msg::PointField::UINT32),
+      CreatePointField("intensity", 16, sensor_msgs::msg::PointField::UINT16)};
+  msg.point_step = sizeof(RawPoint);
+  msg.row_step = msg.point_step * msg.width;
+  msg.data.resize(msg.row_step * msg.height);
+  for (int row = 0; row < kNumPointCloudBeams; ++row) {
+    const float elevation =
+        0.4f * (row - 0.5f * kNumPointCloudBeams) / kNumPointCloudBeams;
+    for (int column = 0; column < kNumPointCloudColumns; ++column) {
+      const float azimuth =
+          2.f * static_cast<float>(M_PI) * column / kNumPointCloudColumns;
+      const float range = BeamRange(row * kNumPointCloudColumns + column);
+      const RawPoint point{range * std::cos(azimuth) * std::cos(elevation),
+                           range * std::sin(azimuth) * std::cos(elevation),
+                           range * std::sin(elevation),
+                           static_cast<uint32_t>(column * 97656), 100};
+      std::memcpy(&msg.data[row * msg.row_step + column * msg.point_step],
+                  &point, sizeof(RawPoint));
+    }
+  }
+  return msg;
+}
+
+::cartographer::sensor::TimedPointCloud CreateTimedPointCloud() {
+  return std::get<0>(ToPointCloudWithIntensities(CreatePointCloud2())).points;
+}
+
+geometry_msgs::msg::TransformStamped CreateTransform(
+    const std::string& child_frame_id, const ::cartographer::common::Time time,
+    const double yaw) {
+  geometry_msgs::msg::TransformStamped transform;
+  transform.header.frame_id = kTrackingFrame;
+  transform.header.stamp = ToRos(time);
+  transform.child_frame_id = child_frame_id;
+  transform.transform.translation.x = 0.1;
+  transform.transform.translation.z = 0.3;
+  transform.transform.rotation.z = std::sin(0.5 * yaw);
+  transform.transform.rotation.w = std::cos(0.5 * yaw);
+  return transform;
+}
+
+::cartographer::common::Time StartTime() {
+  return ::cartographer::common::FromUniversal(1000 * 1000 * 1000);
+}
+
+::cartographer::common::Time MovingTransformTime(const double index) {
+  return StartTime() + ::cartographer::common::FromSeconds(
+                           index * kMovingTransformPeriodSec);
+}
+
+// Fills 'buffer' with a static frame and a frame rotating at 100 Hz for 10 s.
+void FillTfBuffer(tf2_ros::Buffer* const buffer) {
+  buffer->setTransform(CreateTransform(kStaticFrame, StartTime(), 0.),
+                       "benchmark", true /* is_static */);
+  for (int i = 0; i < kNumMovingTransforms; ++i) {
+    buffer->setTransform(
+        CreateTransform(kMovingFrame, MovingTransformTime(i), 0.1 * i),
+        "benchmark", false /* is_static */);
+  }
+}
+
+// Drops all sensor data, so that only the work of the SensorBridge is measured.
+class NullTrajectoryBuilder
+    : public ::cartographer::mapping::TrajectoryBuilder {
+ public:
+  void AddSensorData(
+      const std::string& /* sensor_id */,
+      std::unique_ptr<::cartographer::sensor::Data> data) override {
+    benchmark::DoNotOptimize(data.get());
+  }
+};
+
+// A single trajectory in which each node is inserted into two submaps, and
+// every few nodes are also constrained to an earlier submap.
+struct SyntheticPoseGraph {
+  ::cartographer::mapping::MapById<::cartographer::mapping::NodeId,
+                                   ::cartographer::mapping::TrajectoryNode>
+      nodes;
+  ::cartographer::mapping::MapById<
+      ::cartographer::mapping::SubmapId,
+      ::cartographer::mapping::PoseGraph::SubmapData>
+      submaps;
+  std::vector<::cartographer::mapping::PoseGraph::Constraint> constraints;
+};
+
+::cartographer::transform::Rigid3d PoseOnCircle(const int index) {
+  const double angle = 1e-3 * index;
+  return ::cartographer::transform::Rigid3d::Translation(
+      Eigen::Vector3d(100. * std::cos(angle), 100. * std::sin(angle), 0.));
+}
+
+SyntheticPoseGraph CreateSyntheticPoseGraph() {
+  using ::cartographer::mapping::NodeId;
+  using ::cartographer::mapping::PoseGraph;
+  using ::cartographer::mapping::SubmapId;
+  SyntheticPoseGraph pose_graph;
+  const auto constant_data =
+      std::make_shared<const ::cartographer::mapping::TrajectoryNode::Data>();
+  const int num_submaps = kNumPoseGraphNodes / kNumNodesPerSubmap + 1;
+  for (int i = 0; i < num_submaps; ++i) {
+    pose_graph.submaps.Insert(
+        SubmapId{0, i},
+        PoseGraph::SubmapData{nullptr, PoseOnCircle(i * kNumNodesPerSubmap)});
+  }
+  for (int i = 0; i < kNumPoseGraphNodes; ++i) {
+    const NodeId node_id{0, i};
+    pose_graph.nodes.Insert(node_id, ::cartographer::mapping::TrajectoryNode{
+                                         constant_data, PoseOnCircle(i)});
+    const int submap_index = i / kNumNodesPerSubmap;
+    for (const int index : {submap_index - 1, submap_index}) {
+      if (index >= 0) {
+        pose_graph.constraints.push_back(PoseGraph::Constraint{
+            SubmapId{0, index}, node_id,
+            {::cartographer::transform::Rigid3d::Identity(), 1., 1.},
+            PoseGraph::Constraint::INTRA_SUBMAP});
+      }
+    }
+    if (i % kNumNodesPerInterSubmapConstraint == 0) {
+      pose_graph.constraints.push_back(PoseGraph::Constraint{
+          SubmapId{0, (7 * i) % num_submaps}, node_id,
+          {::cartographer::transform::Rigid3d::Identity(), 1., 1.},
+          PoseGraph::Constraint::INTER_SUBMAP});
+    }
+  }
+  return pose_graph;
+}
+
+void BM_LaserScanToPointCloud(benchmark::State& state) {
+  const sensor_msgs::msg::LaserScan msg = CreateLaserScan();
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_LaserScanToPointCloud);
+
+void BM_LaserScanToPointCloudWithGeometry(benchmark::State& state) {
+  const sensor_msgs::msg::LaserScan msg = CreateLaserScan();
+  const LaserScanGeometry geometry = ComputeLaserScanGeometry(msg);
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg, geometry));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_LaserScanToPointCloudWithGeometry);
+
+void BM_MultiEchoLaserScanToPointCloud(benchmark::State& state) {
+  const sensor_msgs::msg::MultiEchoLaserScan msg = CreateMultiEchoLaserScan();
+  const LaserScanGeometry geometry = ComputeLaserScanGeometry(msg);
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg, geometry));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_MultiEchoLaserScanToPointCloud);
+
+void BM_PointCloud2ToPointCloud(benchmark::State& state) {
+  const sensor_msgs::msg::PointCloud2 msg = CreatePointCloud2();
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_PointCloud2ToPointCloud);
+
+void BM_PointCloud2ToPointCloudWithLayout(benchmark::State& state) {
+  const sensor_msgs::msg::PointCloud2 msg = CreatePointCloud2();
+  const PointCloud2Layout layout = ComputePointCloud2Layout(msg);
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(ToPointCloudWithIntensities(msg, layout));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_PointCloud2ToPointCloudWithLayout);
+
+void BM_ToPointCloud2Message(benchmark::State& state) {
+  const ::cartographer::sensor::TimedPointCloud point_cloud =
+      CreateTimedPointCloud();
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        ToPointCloud2Message(0 /* timestamp */, kTrackingFrame, point_cloud));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_ToPointCloud2Message);
+
+void BM_TransformedToPointCloud2Message(benchmark::State& state) {
+  ::cartographer::sensor::PointCloud point_cloud;
+  for (const Eigen::Vector4f& point : CreateTimedPointCloud()) {
+    point_cloud.push_back(point.head<3>());
+  }
+  const ::cartographer::transform::Rigid3f transform(
+      Eigen::Vector3f(1.f, 2.f, 0.f),
+      Eigen::Quaternionf(Eigen::AngleAxisf(0.3f, Eigen::Vector3f::UnitZ())));
+  sensor_msgs::msg::PointCloud2 msg;
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    ToPointCloud2Message(0 /* timestamp */, kTrackingFrame, transform,
+                         point_cloud, &msg);
+    benchmark::DoNotOptimize(msg.data.data());
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_TransformedToPointCloud2Message);
+
+void BM_LookupStaticTransformToTracking(benchmark::State& state) {
+  tf2_ros::Buffer buffer(std::make_shared<rclcpp::Clock>(RCL_SYSTEM_TIME));
+  FillTfBuffer(&buffer);
+  const TfBridge tf_bridge(kTrackingFrame, 0. /* timeout */, &buffer);
+  int i = 0;
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(tf_bridge.LookupToTracking(
+        MovingTransformTime(++i % kNumMovingTransforms), kStaticFrame));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_LookupStaticTransformToTracking);
+
+void BM_LookupMovingTransformToTracking(benchmark::State& state) {
+  tf2_ros::Buffer buffer(std::make_shared<rclcpp::Clock>(RCL_SYSTEM_TIME));
+  FillTfBuffer(&buffer);
+  const TfBridge tf_bridge(kTrackingFrame, 0. /* timeout */, &buffer);
+  int i = 0;
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    // Halfway between two transforms, so that tf has to interpolate.
+    benchmark::DoNotOptimize(tf_bridge.LookupToTracking(
+        MovingTransformTime(++i % (kNumMovingTransforms - 1) + 0.5),
+        kMovingFrame));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_LookupMovingTransformToTracking);
+
+// Converts, subdivides and transforms a laser scan into the tracking frame,
+// with the number of subdivisions as the argument.
+void BM_SensorBridgeHandleLaserScan(benchmark::State& state) {
+  tf2_ros::Buffer buffer(std::make_shared<rclcpp::Clock>(RCL_SYSTEM_TIME));
+  FillTfBuffer(&buffer);
+  ::cartographer::common::Mutex trajectory_builder_mutex;
+  NullTrajectoryBuilder trajectory_builder;
+  IngestStatistics ingest_statistics([] { return StartTime(); });
+  SensorBridge sensor_bridge(
+      0 /* trajectory_id */, state.range(0), 0. /* voxel_filter_size */,
+      kTrackingFrame, 0. /* lookup_transform_timeout_sec */, &buffer,
+      &trajectory_builder_mutex, &trajectory_builder, &ingest_statistics);
+  auto msg = std::make_shared<sensor_msgs::msg::LaserScan>(CreateLaserScan());
+  msg->header.stamp = ToRos(StartTime());
+  const sensor_msgs::msg::LaserScan::ConstSharedPtr const_msg = msg;
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    sensor_bridge.HandleLaserScanMessage("scan", const_msg);
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_SensorBridgeHandleLaserScan)->Arg(1)->Arg(10);
+
+// Builds the trajectory node markers of the whole pose graph, as after each
+// optimization.
+void BM_UpdateTrajectoryNodeMarkersAfterOptimization(benchmark::State& state) {
+  const SyntheticPoseGraph pose_graph = CreateSyntheticPoseGraph();
+  const builtin_interfaces::msg::Time stamp = ToRos(StartTime());
+  TrajectoryNodeMarkers markers;
+  int optimization_generation = 0;
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    UpdateTrajectoryNodeMarkers(0 /* trajectory_id */, pose_graph.nodes,
+                                ++optimization_generation, kTrackingFrame,
+                                stamp, &markers);
+    benchmark::DoNotOptimize(markers.marker.points.data());
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_UpdateTrajectoryNodeMarkersAfterOptimization);
+
+// Updates the trajectory node markers of the whole pose graph when no nodes
+// were added since the last update.
+void BM_UpdateTrajectoryNodeMarkersWithoutNewNodes(benchmark::State& state) {
+  const SyntheticPoseGraph pose_graph = CreateSyntheticPoseGraph();
+  const builtin_interfaces::msg::Time stamp = ToRos(StartTime());
+  TrajectoryNodeMarkers markers;
+  UpdateTrajectoryNodeMarkers(0 /* trajectory_id */, pose_graph.nodes,
+                              0 /* optimization_generation */, kTrackingFrame,
+                              stamp, &markers);
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    UpdateTrajectoryNodeMarkers(0 /* trajectory_id */, pose_graph.nodes,
+                                0 /* optimization_generation */, kTrackingFrame,
+                                stamp, &markers);
+    benchmark::DoNotOptimize(markers.marker.points.data());
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_UpdateTrajectoryNodeMarkersWithoutNewNodes);
+
+void BM_ComputeConstraintList(benchmark::State& state) {
+  const SyntheticPoseGraph pose_graph = CreateSyntheticPoseGraph();
+  const builtin_interfaces::msg::Time stamp = ToRos(StartTime());
+  const size_t num_allocations_before = num_allocations;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        ComputeConstraintList(pose_graph.constraints, pose_graph.nodes,
+                              pose_graph.submaps, kTrackingFrame, stamp));
+  }
+  ReportAllocations(num_allocations_before, &state);
+}
+BENCHMARK(BM_ComputeConstraintList)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace cartographer_ros
+
+BENCHMARK_MAIN();
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/ingest_statistics.h"
+
+#include <algorithm>
+
+namespace cartographer_ros {
+
+namespace {
+
+// Upper bounds of all but the last latency histogram bucket.
+constexpr double kLatencyBucketBoundsSec[] = {1e-3, 2e-3, 5e-3, 1e-2, 2e-2,
+                                              5e-2, 0.1,  0.2,  0.5,  1.};
+
+}  // namespace
+
+constexpr int IngestStatistics::kNumLatencyBuckets;
+
+IngestStatistics::IngestStatistics(
+    std::function<::cartographer::common::Time()> now)
+    : now_(std::move(now)) {
+  static_assert(sizeof(kLatencyBucketBoundsSec) / sizeof(double) + 1 ==
+                    kNumLatencyBuckets,
+                "Number of latency buckets does not match the bounds.");
+}
+
+void IngestStatistics::RecordReceived(const int trajectory_id,
+                                      const std::string& sensor_id) {
+  const auto now = std::chrono::steady_clock::now();
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  SensorStatistics* const statistics =
+      GetSensorStatistics(trajectory_id, sensor_id);
+  ++statistics->num_received;
+  if (statistics->has_last_received_time) {
+    const double interarrival_sec =
+        std::chrono::duration<double>(now - statistics->last_received_time)
+            .count();
+    statistics->min_interarrival_sec =
+        std::min(statistics->min_interarrival_sec, interarrival_sec);
+    statistics->max_interarrival_sec =
+        std::max(statistics->max_interarrival_sec, interarrival_sec);
+  }
+  statistics->has_last_received_time = true;
+  statistics->last_received_time = now;
+}
+
+void IngestStatistics::RecordSampledOut(const int trajectory_id,
+                                        const std::string& sensor_id) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  ++GetSensorStatistics(trajectory_id, sensor_id)->num_sampled_out;
+}
+
+void IngestStatistics::RecordTransformUnavailable(
+    const int trajectory_id, const std::string& sensor_id) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  ++GetSensorStatistics(trajectory_id, sensor_id)->num_transform_unavailable;
+}
+
+void IngestStatistics::RecordSamplingRatio(const int trajectory_id,
+                                           const std::string& sensor_id,
+                                           const double ratio) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  GetSensorStatistics(trajectory_id, sensor_id)->sampling_ratio = ratio;
+}
+
+void IngestStatistics::RecordHandedOver(
+    const int trajectory_id, const std::string& sensor_id,
+    const ::cartographer::common::Time time) {
+  const double latency_sec = ::cartographer::common::ToSeconds(now_() - time);
+  const int bucket =
+      std::lower_bound(std::begin(kLatencyBucketBoundsSec),
+                       std::end(kLatencyBucketBoundsSec), latency_sec) -
+      std::begin(kLatencyBucketBoundsSec);
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  SensorStatistics* const statistics =
+      GetSensorStatistics(trajectory_id, sensor_id);
+  ++statistics->num_handed_over;
+  statistics->latency_sum_sec += latency_sec;
+  statistics->max_latency_sec =
+      std::max(statistics->max_latency_sec, latency_sec);
+  ++statistics->latency_histogram[bucket];
+}
+
+cartographer_ros_msgs::msg::IngestStatistics
+IngestStatistics::TakeStatistics() {
+  cartographer_ros_msgs::msg::IngestStatistics msg;
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  for (auto& entry : sensors_) {
+    SensorStatistics& statistics = entry.second;
+    cartographer_ros_msgs::msg::SensorIngestStatistics sensor_msg;
+    sensor_msg.trajectory_id = entry.first.first;
+    sensor_msg.sensor_id = entry.first.second;
+    sensor_msg.num_received = statistics.num_received;
+    sensor_msg.num_sampled_out = statistics.num_sampled_out;
+    sensor_msg.num_transform_unavailable = statistics.num_transform_unavailable;
+    sensor_msg.num_handed_over = statistics.num_handed_over;
+    if (statistics.num_handed_over > 0) {
+      sensor_msg.mean_latency_sec =
+          statistics.latency_sum_sec / statistics.num_handed_over;
+    }
+    sensor_msg.max_latency_sec = statistics.max_latency_sec;
+    sensor_msg.latency_histogram_bounds_sec.assign(
+        std::begin(kLatencyBucketBoundsSec), std::end(kLatencyBucketBoundsSec));
+    sensor_msg.latency_histogram.assign(statistics.latency_histogram.begin(),
+                                        statistics.latency_histogram.end());
+    if (statistics.max_interarrival_sec > 0.) {
+      sensor_msg.min_interarrival_sec = statistics.min_interarrival_sec;
+    }
+    sensor_msg.max_interarrival_sec = statistics.max_interarrival_sec;
+    sensor_msg.sampling_ratio = statistics.sampling_ratio;
+    msg.sensors.push_back(sensor_msg);
+
+    // Keep the last received time so the next interarrival is still measured.
+    SensorStatistics reset_statistics;
+    reset_statistics.has_last_received_time = statistics.has_last_received_time;
+    reset_statistics.last_received_time = statistics.last_received_time;
+    reset_statistics.sampling_ratio = statistics.sampling_ratio;
+    statistics = reset_statistics;
+  }
+  return msg;
+}
+
+IngestStatistics::SensorStatistics* IngestStatistics::GetSensorStatistics(
+    const int trajectory_id, const std::string& sensor_id) {
+  return &sensors_[std::make_pair(trajectory_id, sensor_id)];
+}
+
+}  // namespace cartographer_ros
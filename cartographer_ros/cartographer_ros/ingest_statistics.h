@@ -0,0 +1,97 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_INGEST_STATISTICS_H_
+#define CARTOGRAPHER_ROS_INGEST_STATISTICS_H_
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/port.h"
+#include "cartographer/common/time.h"
+#include "cartographer_ros_msgs/msg/ingest_statistics.hpp"
+
+namespace cartographer_ros {
+
+// Collects per-sensor counters and latency histograms of sensor data on its
+// way from the ROS callbacks to the trajectory builders. Thread-safe.
+class IngestStatistics {
+ public:
+  // 'now' returns the time to measure latencies against, i.e. the ROS time.
+  explicit IngestStatistics(std::function<::cartographer::common::Time()> now);
+
+  IngestStatistics(const IngestStatistics&) = delete;
+  IngestStatistics& operator=(const IngestStatistics&) = delete;
+
+  void RecordReceived(int trajectory_id, const std::string& sensor_id)
+      EXCLUDES(mutex_);
+  void RecordSampledOut(int trajectory_id, const std::string& sensor_id)
+      EXCLUDES(mutex_);
+  void RecordTransformUnavailable(int trajectory_id,
+                                  const std::string& sensor_id)
+      EXCLUDES(mutex_);
+  // Records the current 'ratio' of the adaptive sampler of 'sensor_id'.
+  void RecordSamplingRatio(int trajectory_id, const std::string& sensor_id,
+                           double ratio) EXCLUDES(mutex_);
+  // Records that data of 'sensor_id' at 'time' was handed to the trajectory
+  // builder.
+  void RecordHandedOver(int trajectory_id, const std::string& sensor_id,
+                        ::cartographer::common::Time time) EXCLUDES(mutex_);
+
+  // Returns the statistics collected since the last call and resets them.
+  cartographer_ros_msgs::msg::IngestStatistics TakeStatistics()
+      EXCLUDES(mutex_);
+
+ private:
+  static constexpr int kNumLatencyBuckets = 11;
+
+  struct SensorStatistics {
+    ::cartographer::common::int64 num_received = 0;
+    ::cartographer::common::int64 num_sampled_out = 0;
+    ::cartographer::common::int64 num_transform_unavailable = 0;
+    ::cartographer::common::int64 num_handed_over = 0;
+    double latency_sum_sec = 0.;
+    double max_latency_sec = 0.;
+    std::array<::cartographer::common::int64, kNumLatencyBuckets>
+        latency_histogram{};
+    bool has_last_received_time = false;
+    std::chrono::steady_clock::time_point last_received_time;
+    double min_interarrival_sec = std::numeric_limits<double>::infinity();
+    double max_interarrival_sec = 0.;
+    // Kept over resets, -1 until recorded.
+    double sampling_ratio = -1.;
+  };
+
+  SensorStatistics* GetSensorStatistics(int trajectory_id,
+                                        const std::string& sensor_id)
+      REQUIRES(mutex_);
+
+  const std::function<::cartographer::common::Time()> now_;
+
+  ::cartographer::common::Mutex mutex_;
+  std::map<std::pair<int, std::string>, SensorStatistics> sensors_
+      GUARDED_BY(mutex_);
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_INGEST_STATISTICS_H_
@@ -16,56 +16,287 @@
 
 #include "cartographer_ros/map_builder_bridge.h"
 
-#include "cartographer/io/color.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <thread>
+
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/port.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/io/proto_stream.h"
+#include "cartographer/mapping/proto/serialization.pb.h"
+#include "cartographer/mapping/trajectory_node.h"
+#include "cartographer/sensor/fixed_frame_pose_data.h"
+#include "cartographer/sensor/imu_data.h"
+#include "cartographer/sensor/odometry_data.h"
+#include "cartographer/transform/transform.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/pose_graph_markers.h"
+#include "cartographer_ros/submap_texture_filter.h"
 
 namespace cartographer_ros {
 
 namespace {
 
-constexpr double kTrajectoryLineStripMarkerScale = 0.07;
-constexpr double kConstraintMarkerScale = 0.025;
+// Memory bound of the cached submap textures served by HandleSubmapQuery().
+constexpr size_t kSubmapTextureCacheMaxNumBytes = 64 << 20;
+// Changes of the local to global transforms below this are rounding errors, not
+// the result of an optimization.
+constexpr double kLocalToGlobalTransformTolerance = 1e-9;
+// Same as in cartographer/io/proto_stream.cc.
+constexpr cartographer::common::uint64 kProtoStreamMagic = 0x7b1d1f7b5bf501db;
+constexpr size_t kMapReadBufferSizeInBytes = 8 << 20;
+// Bounds the memory used by parsed records waiting to be added to the pose
+// graph.
+constexpr size_t kMaxMapRecordsInFlightPerThread = 16;
+
+double SecondsSince(const std::chrono::steady_clock::time_point& start_time) {
+  return std::chrono::duration_cast<std::chrono::duration<double>>(
+             std::chrono::steady_clock::now() - start_time)
+      .count();
+}
+
+// Reads the records of a proto stream written by
+// cartographer::io::ProtoStreamWriter without decompressing them, unlike
+// cartographer::io::ProtoStreamReader, so that they can be decompressed and
+// parsed on other threads.
+class CompressedProtoStreamReader {
+ public:
+  explicit CompressedProtoStreamReader(const std::string& filename)
+      : buffer_(kMapReadBufferSizeInBytes) {
+    in_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+    in_.open(filename, std::ios::in | std::ios::binary);
+    cartographer::common::uint64 magic;
+    if (!ReadSize(&magic) || magic != kProtoStreamMagic) {
+      in_.setstate(std::ios::failbit);
+    }
+    CHECK(in_.good()) << "Failed to open proto stream '" << filename << "'.";
+  }
+
+  // Returns false at the end of the stream.
+  bool Read(std::string* const compressed_record) {
+    cartographer::common::uint64 size;
+    if (!ReadSize(&size)) {
+      return false;
+    }
+    compressed_record->resize(size);
+    return static_cast<bool>(in_.read(&compressed_record->front(), size));
+  }
+
+  bool eof() const { return in_.eof(); }
 
-::std_msgs::msg::ColorRGBA ToMessage(const cartographer::io::FloatColor& color) {
-  ::std_msgs::msg::ColorRGBA result;
-  result.r = color[0];
-  result.g = color[1];
-  result.b = color[2];
-  result.a = 1.f;
-  return result;
+ private:
+  bool ReadSize(cartographer::common::uint64* const size) {
+    *size = 0;
+    for (int i = 0; i != 8; ++i) {
+      *size >>= 8;
+      *size += static_cast<cartographer::common::uint64>(in_.get()) << 56;
+    }
+    return !in_.fail();
+  }
+
+  std::vector<char> buffer_;
+  std::ifstream in_;
+};
+
+template <typename ProtoType>
+void ParseCompressedRecord(const std::string& compressed_record,
+                           ProtoType* const proto) {
+  std::string record;
+  cartographer::common::FastGunzipString(compressed_record, &record);
+  CHECK(proto->ParseFromString(record));
 }
 
-visualization_msgs::msg::Marker CreateTrajectoryMarker(const int trajectory_id,
-                                                       const std::string& frame_id,
-                                                       rclcpp::Clock::SharedPtr& clock) {
-  visualization_msgs::msg::Marker marker;
-  marker.ns = "Trajectory " + std::to_string(trajectory_id);
-  marker.id = 0;
-  marker.type = visualization_msgs::msg::Marker::LINE_STRIP;
-  marker.header.stamp = clock->now();
-  marker.header.frame_id = frame_id;
-  marker.color = ToMessage(cartographer::io::GetColor(trajectory_id));
-  marker.scale.x = kTrajectoryLineStripMarkerScale;
-  marker.pose.orientation.w = 1.;
-  marker.pose.position.z = 0.05;
-  return marker;
+// Where the records of a map go in the pose graph, the same as in
+// cartographer::mapping::MapBuilder::LoadMap().
+struct MapLayout {
+  std::map<int, int> trajectory_remapping;
+  cartographer::mapping::MapById<cartographer::mapping::SubmapId,
+                                 cartographer::transform::Rigid3d>
+      submap_poses;
+  cartographer::mapping::MapById<cartographer::mapping::NodeId,
+                                 cartographer::transform::Rigid3d>
+      node_poses;
+};
+
+// Adds the record 'proto' of a map to 'pose_graph'.
+void AddSerializedData(
+    const MapLayout& layout,
+    cartographer::mapping::proto::SerializedData* const proto,
+    cartographer::mapping::PoseGraph* const pose_graph) {
+  if (proto->has_node()) {
+    auto* const node_id = proto->mutable_node()->mutable_node_id();
+    node_id->set_trajectory_id(
+        layout.trajectory_remapping.at(node_id->trajectory_id()));
+    pose_graph->AddNodeFromProto(
+        layout.node_poses.at(cartographer::mapping::NodeId{
+            node_id->trajectory_id(), node_id->node_index()}),
+        proto->node());
+  }
+  if (proto->has_submap()) {
+    auto* const submap_id = proto->mutable_submap()->mutable_submap_id();
+    submap_id->set_trajectory_id(
+        layout.trajectory_remapping.at(submap_id->trajectory_id()));
+    pose_graph->AddSubmapFromProto(
+        layout.submap_poses.at(cartographer::mapping::SubmapId{
+            submap_id->trajectory_id(), submap_id->submap_index()}),
+        proto->submap());
+  }
+  if (proto->has_imu_data()) {
+    pose_graph->AddImuData(
+        layout.trajectory_remapping.at(proto->imu_data().trajectory_id()),
+        cartographer::sensor::FromProto(proto->imu_data().imu_data()));
+  }
+  if (proto->has_odometry_data()) {
+    pose_graph->AddOdometryData(
+        layout.trajectory_remapping.at(proto->odometry_data().trajectory_id()),
+        cartographer::sensor::FromProto(
+            proto->odometry_data().odometry_data()));
+  }
+  if (proto->has_fixed_frame_pose_data()) {
+    pose_graph->AddFixedFramePoseData(
+        layout.trajectory_remapping.at(
+            proto->fixed_frame_pose_data().trajectory_id()),
+        cartographer::sensor::FromProto(
+            proto->fixed_frame_pose_data().fixed_frame_pose_data()));
+  }
+}
+
+// The state in the format of MapBuilder::SerializeState(). What local SLAM
+// keeps modifying, i.e. the active submaps, is serialized when the snapshot is
+// taken. Everything else is immutable or copied, and serialized later.
+struct StateSnapshot {
+  cartographer::mapping::proto::PoseGraph pose_graph;
+  cartographer::mapping::proto::AllTrajectoryBuilderOptions
+      all_trajectory_builder_options;
+  cartographer::mapping::MapById<cartographer::mapping::SubmapId,
+                                 cartographer::mapping::PoseGraph::SubmapData>
+      submaps;
+  // Keyed by the IDs of the active ones of 'submaps'.
+  std::map<cartographer::mapping::SubmapId,
+           cartographer::mapping::proto::SerializedData>
+      active_submaps;
+  cartographer::mapping::MapById<cartographer::mapping::NodeId,
+                                 cartographer::mapping::TrajectoryNode>
+      nodes;
+  cartographer::sensor::MapByTime<cartographer::sensor::ImuData> imu_data;
+  cartographer::sensor::MapByTime<cartographer::sensor::OdometryData>
+      odometry_data;
+  cartographer::sensor::MapByTime<cartographer::sensor::FixedFramePoseData>
+      fixed_frame_pose_data;
+};
+
+cartographer::mapping::proto::SerializedData ToSerializedSubmap(
+    const cartographer::mapping::SubmapId& submap_id,
+    const cartographer::mapping::Submap& submap) {
+  cartographer::mapping::proto::SerializedData proto;
+  auto* const submap_proto = proto.mutable_submap();
+  submap_proto->mutable_submap_id()->set_trajectory_id(submap_id.trajectory_id);
+  submap_proto->mutable_submap_id()->set_submap_index(submap_id.submap_index);
+  submap.ToProto(submap_proto, true /* include_probability_grid_data */);
+  return proto;
 }
 
-void PushAndResetLineMarker(visualization_msgs::msg::Marker* marker,
-                            std::vector<visualization_msgs::msg::Marker>* markers) {
-  if (marker->points.size() > 1) {
-    markers->push_back(*marker);
-    ++marker->id;
+// Has to be called with the lock held under which local SLAM inserts into the
+// submaps.
+std::unique_ptr<StateSnapshot> TakeStateSnapshot(
+    cartographer::mapping::MapBuilder* const map_builder) {
+  auto snapshot = cartographer::common::make_unique<StateSnapshot>();
+  cartographer::mapping::PoseGraph* const pose_graph =
+      map_builder->pose_graph();
+  snapshot->pose_graph = pose_graph->ToProto();
+  for (const auto& options : map_builder->GetAllTrajectoryBuilderOptions()) {
+    *snapshot->all_trajectory_builder_options.add_options_with_sensor_ids() =
+        options;
+  }
+  snapshot->submaps = pose_graph->GetAllSubmapData();
+  for (const auto& submap_id_data : snapshot->submaps) {
+    if (!submap_id_data.data.submap->finished()) {
+      snapshot->active_submaps.emplace(
+          submap_id_data.id,
+          ToSerializedSubmap(submap_id_data.id, *submap_id_data.data.submap));
+    }
+  }
+  snapshot->nodes = pose_graph->GetTrajectoryNodes();
+  snapshot->imu_data = pose_graph->GetImuData();
+  snapshot->odometry_data = pose_graph->GetOdometryData();
+  snapshot->fixed_frame_pose_data = pose_graph->GetFixedFramePoseData();
+  return snapshot;
+}
+
+void WriteStateSnapshot(const StateSnapshot& snapshot,
+                        cartographer::io::ProtoStreamWriter* const writer) {
+  writer->WriteProto(snapshot.pose_graph);
+  writer->WriteProto(snapshot.all_trajectory_builder_options);
+  // In the order of their IDs, like MapBuilder::SerializeState().
+  for (const auto& submap_id_data : snapshot.submaps) {
+    const auto it = snapshot.active_submaps.find(submap_id_data.id);
+    if (it != snapshot.active_submaps.end()) {
+      writer->WriteProto(it->second);
+    } else {
+      writer->WriteProto(
+          ToSerializedSubmap(submap_id_data.id, *submap_id_data.data.submap));
+    }
+  }
+  for (const auto& node_id_data : snapshot.nodes) {
+    cartographer::mapping::proto::SerializedData proto;
+    auto* const node_proto = proto.mutable_node();
+    node_proto->mutable_node_id()->set_trajectory_id(
+        node_id_data.id.trajectory_id);
+    node_proto->mutable_node_id()->set_node_index(node_id_data.id.node_index);
+    *node_proto->mutable_node_data() =
+        cartographer::mapping::ToProto(*node_id_data.data.constant_data);
+    writer->WriteProto(proto);
+  }
+  for (const int trajectory_id : snapshot.imu_data.trajectory_ids()) {
+    for (const auto& imu_data : snapshot.imu_data.trajectory(trajectory_id)) {
+      cartographer::mapping::proto::SerializedData proto;
+      auto* const imu_data_proto = proto.mutable_imu_data();
+      imu_data_proto->set_trajectory_id(trajectory_id);
+      *imu_data_proto->mutable_imu_data() =
+          cartographer::sensor::ToProto(imu_data);
+      writer->WriteProto(proto);
+    }
+  }
+  for (const int trajectory_id : snapshot.odometry_data.trajectory_ids()) {
+    for (const auto& odometry_data :
+         snapshot.odometry_data.trajectory(trajectory_id)) {
+      cartographer::mapping::proto::SerializedData proto;
+      auto* const odometry_data_proto = proto.mutable_odometry_data();
+      odometry_data_proto->set_trajectory_id(trajectory_id);
+      *odometry_data_proto->mutable_odometry_data() =
+          cartographer::sensor::ToProto(odometry_data);
+      writer->WriteProto(proto);
+    }
+  }
+  for (const int trajectory_id :
+       snapshot.fixed_frame_pose_data.trajectory_ids()) {
+    for (const auto& fixed_frame_pose_data :
+         snapshot.fixed_frame_pose_data.trajectory(trajectory_id)) {
+      cartographer::mapping::proto::SerializedData proto;
+      auto* const fixed_frame_pose_data_proto =
+          proto.mutable_fixed_frame_pose_data();
+      fixed_frame_pose_data_proto->set_trajectory_id(trajectory_id);
+      *fixed_frame_pose_data_proto->mutable_fixed_frame_pose_data() =
+          cartographer::sensor::ToProto(fixed_frame_pose_data);
+      writer->WriteProto(proto);
+    }
   }
-  marker->points.clear();
 }
 
 }  // namespace
 
 MapBuilderBridge::MapBuilderBridge(const NodeOptions& node_options,
-                                   tf2_ros::Buffer* const tf_buffer)
-    : node_options_(node_options),
+                                   tf2_ros::Buffer* const tf_buffer,
+                                   IngestStatistics* const ingest_statistics,
+                                   RuntimeStatistics* const runtime_statistics,
+                                   LocalPoseCallback local_pose_callback)
+    : lock_statistics_(runtime_statistics->AddLock("MapBuilderBridge::mutex_")),
+      node_options_(node_options),
+      local_pose_callback_(std::move(local_pose_callback)),
       map_builder_(
           node_options.map_builder_options,
           cartographer::mapping::MapBuilder::LocalSlamResultCallback(
@@ -74,29 +305,194 @@ MapBuilderBridge::MapBuilderBridge(const NodeOptions& node_options,
                   const ::cartographer::common::Time time,
                   const ::cartographer::transform::Rigid3d local_pose,
                   ::cartographer::sensor::RangeData range_data_in_local,
-                  const std::unique_ptr<const ::cartographer::mapping::NodeId>)
-                  EXCLUDES(mutex_) {
+                  const std::unique_ptr<const ::cartographer::mapping::NodeId>
+                      insertion_result) EXCLUDES(mutex_) {
+                    if (insertion_result != nullptr) {
+                      ++num_nodes_added_;
+                    }
+                    local_pose_callback_(trajectory_id, time, local_pose);
                     std::shared_ptr<const TrajectoryState::LocalSlamData>
                         local_slam_data =
                             std::make_shared<TrajectoryState::LocalSlamData>(
                                 TrajectoryState::LocalSlamData{
                                     time, local_pose,
                                     std::move(range_data_in_local)});
-                    cartographer::common::MutexLocker lock(&mutex_);
+                    TimedMutexLocker lock(&mutex_, lock_statistics_);
                     trajectory_state_data_[trajectory_id] =
                         std::move(local_slam_data);
                   })),
-      tf_buffer_(tf_buffer) {}
+      tf_buffer_(tf_buffer),
+      ingest_statistics_(ingest_statistics),
+      submap_texture_cache_(kSubmapTextureCacheMaxNumBytes) {}
+
+MapBuilderBridge::~MapBuilderBridge() {
+  WaitForSerialization();
+  cartographer::common::MutexLocker lock(&serialization_mutex_);
+  if (serialization_thread_.joinable()) {
+    serialization_thread_.join();
+  }
+}
 
 void MapBuilderBridge::LoadMap(const std::string& map_filename) {
+  {
+    // The snapshot being written does not change by loading, but both use the
+    // disk and parsing uses all cores. Maps are usually loaded at startup, so
+    // this only happens if a state was written before.
+    cartographer::common::MutexLocker lock(&serialization_mutex_);
+    if (serializing_) {
+      LOG(INFO) << "Waiting for the state being written before loading.";
+      lock.Await(
+          [this]() REQUIRES(serialization_mutex_) { return !serializing_; });
+    }
+  }
   LOG(INFO) << "Loading map '" << map_filename << "'...";
-  cartographer::io::ProtoStreamReader stream(map_filename);
-  map_builder_.LoadMap(&stream);
+  const auto start_time = std::chrono::steady_clock::now();
+  CompressedProtoStreamReader reader(map_filename);
+  std::string compressed_record;
+  cartographer::mapping::proto::PoseGraph pose_graph_proto;
+  CHECK(reader.Read(&compressed_record));
+  ParseCompressedRecord(compressed_record, &pose_graph_proto);
+  cartographer::mapping::proto::AllTrajectoryBuilderOptions
+      all_builder_options_proto;
+  CHECK(reader.Read(&compressed_record));
+  ParseCompressedRecord(compressed_record, &all_builder_options_proto);
+  CHECK_EQ(pose_graph_proto.trajectory_size(),
+           all_builder_options_proto.options_with_sensor_ids_size());
+
+  // The same as cartographer::mapping::MapBuilder::LoadMap(), which parses the
+  // records on a single thread.
+  cartographer::mapping::PoseGraph* const pose_graph =
+      map_builder_.pose_graph();
+  MapLayout layout;
+  {
+    cartographer::common::MutexLocker lock(&trajectory_builder_mutex_);
+    for (auto& trajectory_proto : *pose_graph_proto.mutable_trajectory()) {
+      const int new_trajectory_id =
+          map_builder_.AddTrajectoryForDeserialization(
+              all_builder_options_proto.options_with_sensor_ids(
+                  trajectory_proto.trajectory_id()));
+      CHECK(layout.trajectory_remapping
+                .emplace(trajectory_proto.trajectory_id(), new_trajectory_id)
+                .second)
+          << "Duplicate trajectory ID: " << trajectory_proto.trajectory_id();
+      trajectory_proto.set_trajectory_id(new_trajectory_id);
+      pose_graph->FreezeTrajectory(new_trajectory_id);
+    }
+  }
+  for (auto& constraint_proto : *pose_graph_proto.mutable_constraint()) {
+    constraint_proto.mutable_submap_id()->set_trajectory_id(
+        layout.trajectory_remapping.at(
+            constraint_proto.submap_id().trajectory_id()));
+    constraint_proto.mutable_node_id()->set_trajectory_id(
+        layout.trajectory_remapping.at(
+            constraint_proto.node_id().trajectory_id()));
+  }
+  for (const auto& trajectory_proto : pose_graph_proto.trajectory()) {
+    for (const auto& submap_proto : trajectory_proto.submap()) {
+      layout.submap_poses.Insert(
+          cartographer::mapping::SubmapId{trajectory_proto.trajectory_id(),
+                                          submap_proto.submap_index()},
+          cartographer::transform::ToRigid3(submap_proto.pose()));
+    }
+    for (const auto& node_proto : trajectory_proto.node()) {
+      layout.node_poses.Insert(
+          cartographer::mapping::NodeId{trajectory_proto.trajectory_id(),
+                                        node_proto.node_index()},
+          cartographer::transform::ToRigid3(node_proto.pose()));
+    }
+  }
+
+  // Records are decompressed and parsed on the thread pool, and added to the
+  // pose graph on this thread in the order they were read. Only a bounded
+  // number of parsed records is kept in memory at any time.
+  const size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  const size_t max_pending_records =
+      kMaxMapRecordsInFlightPerThread * num_threads;
+  cartographer::common::Mutex mutex;
+  std::map<size_t,
+           std::unique_ptr<cartographer::mapping::proto::SerializedData>>
+      parsed_records;
+  size_t num_records_read = 0;
+  size_t num_records_added = 0;
+  size_t num_bytes = 0;
+  double read_seconds = 0.;
+  double parse_seconds = 0.;
+  double add_seconds = 0.;
+  // Adds the parsed records following the last added one, waiting for them
+  // while more than 'max_pending' are pending.
+  const auto add_parsed_records = [&](const size_t max_pending) {
+    while (num_records_added != num_records_read) {
+      const size_t index = num_records_added;
+      std::unique_ptr<cartographer::mapping::proto::SerializedData> proto;
+      {
+        cartographer::common::MutexLocker lock(&mutex);
+        if (num_records_read - num_records_added > max_pending) {
+          lock.Await([&parsed_records, index]() REQUIRES(mutex) {
+            return parsed_records.count(index) != 0;
+          });
+        }
+        const auto it = parsed_records.find(index);
+        if (it == parsed_records.end()) {
+          return;
+        }
+        proto = std::move(it->second);
+        parsed_records.erase(it);
+      }
+      const auto add_start_time = std::chrono::steady_clock::now();
+      AddSerializedData(layout, proto.get(), pose_graph);
+      add_seconds += SecondsSince(add_start_time);
+      ++num_records_added;
+    }
+  };
+  {
+    cartographer::common::ThreadPool thread_pool(num_threads);
+    for (;;) {
+      const auto read_start_time = std::chrono::steady_clock::now();
+      auto compressed_data = std::make_shared<std::string>();
+      const bool has_record = reader.Read(compressed_data.get());
+      read_seconds += SecondsSince(read_start_time);
+      if (!has_record) {
+        break;
+      }
+      num_bytes += compressed_data->size();
+      const size_t index = num_records_read++;
+      thread_pool.Schedule([&mutex, &parsed_records, &parse_seconds, index,
+                            compressed_data]() {
+        const auto parse_start_time = std::chrono::steady_clock::now();
+        auto proto = cartographer::common::make_unique<
+            cartographer::mapping::proto::SerializedData>();
+        ParseCompressedRecord(*compressed_data, proto.get());
+        const double seconds = SecondsSince(parse_start_time);
+        cartographer::common::MutexLocker lock(&mutex);
+        parsed_records[index] = std::move(proto);
+        parse_seconds += seconds;
+      });
+      add_parsed_records(max_pending_records);
+    }
+    add_parsed_records(0);
+  }
+  CHECK(reader.eof());
+  const auto constraints_start_time = std::chrono::steady_clock::now();
+  pose_graph->AddSerializedConstraints(
+      cartographer::mapping::FromProto(pose_graph_proto.constraint()));
+  add_seconds += SecondsSince(constraints_start_time);
+  // Loaded nodes are not counted as added, so the markers are updated anyway.
+  trajectory_node_list_generation_ = -1;
+  constraint_list_generation_ = -1;
+
+  LOG(INFO) << "Loaded " << layout.submap_poses.size() << " submaps and "
+            << layout.node_poses.size() << " nodes from " << num_records_read
+            << " records of " << num_bytes / 1e6 << " MB in "
+            << SecondsSince(start_time) << " s. Reading took " << read_seconds
+            << " s, parsing " << parse_seconds << " s on " << num_threads
+            << " threads combined and adding to the pose graph "
+            << add_seconds << " s.";
 }
 
 int MapBuilderBridge::AddTrajectory(
     const std::unordered_set<std::string>& expected_sensor_ids,
     const TrajectoryOptions& trajectory_options) {
+  cartographer::common::MutexLocker lock(&trajectory_builder_mutex_);
   const int trajectory_id = map_builder_.AddTrajectoryBuilder(
       expected_sensor_ids, trajectory_options.trajectory_builder_options);
   LOG(INFO) << "Added trajectory with ID '" << trajectory_id << "'.";
@@ -105,10 +501,13 @@ int MapBuilderBridge::AddTrajectory(
   CHECK_EQ(sensor_bridges_.count(trajectory_id), 0);
   sensor_bridges_[trajectory_id] =
       cartographer::common::make_unique<SensorBridge>(
-          trajectory_options.num_subdivisions_per_laser_scan,
+          trajectory_id, trajectory_options.num_subdivisions_per_laser_scan,
+          trajectory_options.rangefinder_voxel_filter_size,
           trajectory_options.tracking_frame,
           node_options_.lookup_transform_timeout_sec, tf_buffer_,
-          map_builder_.GetTrajectoryBuilder(trajectory_id));
+          &trajectory_builder_mutex_,
+          map_builder_.GetTrajectoryBuilder(trajectory_id),
+          ingest_statistics_);
   auto emplace_result =
       trajectory_options_.emplace(trajectory_id, trajectory_options);
   CHECK(emplace_result.second == true);
@@ -120,7 +519,10 @@ void MapBuilderBridge::FinishTrajectory(const int trajectory_id) {
 
   // Make sure there is a trajectory with 'trajectory_id'.
   CHECK_EQ(sensor_bridges_.count(trajectory_id), 1);
-  map_builder_.FinishTrajectory(trajectory_id);
+  {
+    cartographer::common::MutexLocker lock(&trajectory_builder_mutex_);
+    map_builder_.FinishTrajectory(trajectory_id);
+  }
   sensor_bridges_.erase(trajectory_id);
 }
 
@@ -131,30 +533,130 @@ void MapBuilderBridge::RunFinalOptimization() {
 
 void MapBuilderBridge::SerializeState(const std::string& filename) {
   cartographer::io::ProtoStreamWriter writer(filename);
-  map_builder_.SerializeState(&writer);
+  {
+    // The active submaps are serialized as well.
+    cartographer::common::MutexLocker lock(&trajectory_builder_mutex_);
+    map_builder_.SerializeState(&writer);
+  }
   CHECK(writer.Close()) << "Could not write state.";
 }
 
+bool MapBuilderBridge::SerializeStateAsync(
+    const std::string& filename,
+    std::function<void(const std::string& error_message)> callback) {
+  cartographer::common::MutexLocker lock(&serialization_mutex_);
+  if (serializing_) {
+    return false;
+  }
+  // The previous thread is done once 'serializing_' is reset.
+  if (serialization_thread_.joinable()) {
+    serialization_thread_.join();
+  }
+  serializing_ = true;
+  std::shared_ptr<const StateSnapshot> snapshot;
+  {
+    cartographer::common::MutexLocker lock(&trajectory_builder_mutex_);
+    snapshot = TakeStateSnapshot(&map_builder_);
+  }
+  serialization_thread_ = std::thread([this, filename, callback, snapshot]() {
+    LOG(INFO) << "Writing state to '" << filename << "' in the background...";
+    const std::string temporary_filename = filename + ".tmp";
+    std::string error_message;
+    {
+      cartographer::io::ProtoStreamWriter writer(temporary_filename);
+      WriteStateSnapshot(*snapshot, &writer);
+      if (!writer.Close()) {
+        error_message = "Could not write '" + temporary_filename + "'.";
+      }
+    }
+    if (error_message.empty() &&
+        std::rename(temporary_filename.c_str(), filename.c_str()) != 0) {
+      error_message = "Could not rename '" + temporary_filename + "' to '" +
+                      filename + "'.";
+    }
+    if (error_message.empty()) {
+      LOG(INFO) << "Wrote state to '" << filename << "'.";
+    } else {
+      LOG(ERROR) << error_message;
+    }
+    callback(error_message);
+    cartographer::common::MutexLocker lock(&serialization_mutex_);
+    serializing_ = false;
+  });
+  return true;
+}
+
+void MapBuilderBridge::WaitForSerialization() {
+  cartographer::common::MutexLocker lock(&serialization_mutex_);
+  lock.Await([this]() REQUIRES(serialization_mutex_) { return !serializing_; });
+}
+
 bool MapBuilderBridge::HandleSubmapQuery(
     const std::shared_ptr<::cartographer_ros_msgs::srv::SubmapQuery::Request> request,
     std::shared_ptr<::cartographer_ros_msgs::srv::SubmapQuery::Response> response) {
+  int submap_version;
+  const auto textures = GetSubmapTextures(
+      cartographer::mapping::SubmapId{request->trajectory_id,
+                                      request->submap_index},
+      &submap_version);
+  if (textures == nullptr) {
+    return false;
+  }
+  response->submap_version = submap_version;
+  const SubmapTextureFilter filter = FromSubmapQueryRequest(*request);
+  if (filter.IsIdentity()) {
+    response->textures = *textures;
+    return true;
+  }
+  response->textures = FilterSubmapTextures(
+      *textures,
+      map_builder_.pose_graph()
+          ->GetSubmapData(cartographer::mapping::SubmapId{
+              request->trajectory_id, request->submap_index})
+          .pose,
+      filter);
+  if (response->textures.empty()) {
+    response->error_message = "No texture matches the requested indices.";
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<const SubmapTextureCache::Textures>
+MapBuilderBridge::GetSubmapTextures(
+    const cartographer::mapping::SubmapId& submap_id,
+    int* const submap_version) {
+  const auto submap_data = map_builder_.pose_graph()->GetSubmapData(submap_id);
+  if (submap_data.submap != nullptr) {
+    {
+      // Local SLAM inserts into active submaps under this lock.
+      cartographer::common::MutexLocker lock(&trajectory_builder_mutex_);
+      *submap_version = submap_data.submap->num_range_data();
+    }
+    auto textures = submap_texture_cache_.Get(submap_id, *submap_version);
+    if (textures != nullptr) {
+      return textures;
+    }
+  }
+
   cartographer::mapping::proto::SubmapQuery::Response response_proto;
-  cartographer::mapping::SubmapId submap_id{request->trajectory_id,
-                                            request->submap_index};
-  const std::string error =
-      map_builder_.SubmapToProto(submap_id, &response_proto);
+  std::string error;
+  {
+    cartographer::common::MutexLocker lock(&trajectory_builder_mutex_);
+    error = map_builder_.SubmapToProto(submap_id, &response_proto);
+  }
   if (!error.empty()) {
     LOG(ERROR) << error;
-    return false;
+    return nullptr;
   }
 
   CHECK(response_proto.textures_size() > 0)
       << "empty textures given for submap: " << submap_id;
 
-  response->submap_version = response_proto.submap_version();
+  auto textures = std::make_shared<SubmapTextureCache::Textures>();
   for (const auto& texture_proto : response_proto.textures()) {
-    response->textures.emplace_back();
-    auto& texture = response->textures.back();
+    textures->emplace_back();
+    auto& texture = textures->back();
     texture.cells.insert(texture.cells.begin(), texture_proto.cells().begin(),
                          texture_proto.cells().end());
     texture.width = texture_proto.width();
@@ -163,15 +665,19 @@ bool MapBuilderBridge::HandleSubmapQuery(
     texture.slice_pose = ToGeometryMsgPose(
         cartographer::transform::ToRigid3(texture_proto.slice_pose()));
   }
-  return true;
+  *submap_version = response_proto.submap_version();
+  submap_texture_cache_.Insert(submap_id, *submap_version, textures);
+  return textures;
 }
 
 cartographer_ros_msgs::msg::SubmapList MapBuilderBridge::GetSubmapList(rclcpp::Clock::SharedPtr& clock) {
   cartographer_ros_msgs::msg::SubmapList submap_list;
   submap_list.header.stamp = clock->now();
   submap_list.header.frame_id = node_options_.map_frame;
-  for (const auto& submap_id_data :
-       map_builder_.pose_graph()->GetAllSubmapData()) {
+  const auto all_submap_data = map_builder_.pose_graph()->GetAllSubmapData();
+  // The versions of active submaps change as local SLAM inserts into them.
+  cartographer::common::MutexLocker lock(&trajectory_builder_mutex_);
+  for (const auto& submap_id_data : all_submap_data) {
     cartographer_ros_msgs::msg::SubmapEntry submap_entry;
     submap_entry.trajectory_id = submap_id_data.id.trajectory_id;
     submap_entry.submap_index = submap_id_data.id.submap_index;
@@ -182,6 +688,12 @@ cartographer_ros_msgs::msg::SubmapList MapBuilderBridge::GetSubmapList(rclcpp::C
   return submap_list;
 }
 
+cartographer::mapping::MapById<cartographer::mapping::SubmapId,
+                               cartographer::mapping::PoseGraph::SubmapData>
+MapBuilderBridge::GetAllSubmapData() {
+  return map_builder_.pose_graph()->GetAllSubmapData();
+}
+
 std::unordered_map<int, MapBuilderBridge::TrajectoryState>
 MapBuilderBridge::GetTrajectoryStates() {
   std::unordered_map<int, TrajectoryState> trajectory_states;
@@ -191,7 +703,7 @@ MapBuilderBridge::GetTrajectoryStates() {
 
     std::shared_ptr<const TrajectoryState::LocalSlamData> local_slam_data;
     {
-      cartographer::common::MutexLocker lock(&mutex_);
+      TimedMutexLocker lock(&mutex_, lock_statistics_);
       if (trajectory_state_data_.count(trajectory_id) == 0) {
         continue;
       }
@@ -211,128 +723,117 @@ MapBuilderBridge::GetTrajectoryStates() {
   return trajectory_states;
 }
 
-visualization_msgs::msg::MarkerArray MapBuilderBridge::GetTrajectoryNodeList(rclcpp::Clock::SharedPtr& clock) {
-  visualization_msgs::msg::MarkerArray trajectory_node_list;
+int MapBuilderBridge::GetOptimizationGeneration() {
+  bool changed = false;
+  for (const auto& entry : trajectory_options_) {
+    const int trajectory_id = entry.first;
+    const cartographer::transform::Rigid3d local_to_global =
+        map_builder_.pose_graph()->GetLocalToGlobalTransform(trajectory_id);
+    auto it = local_to_global_transforms_.find(trajectory_id);
+    if (it == local_to_global_transforms_.end()) {
+      local_to_global_transforms_.emplace(trajectory_id, local_to_global);
+      continue;
+    }
+    const cartographer::transform::Rigid3d delta =
+        it->second.inverse() * local_to_global;
+    if (delta.translation().norm() > kLocalToGlobalTransformTolerance ||
+        cartographer::transform::GetAngle(delta) >
+            kLocalToGlobalTransformTolerance) {
+      changed = true;
+    }
+    it->second = local_to_global;
+  }
+  if (changed) {
+    ++optimization_generation_;
+    num_nodes_added_at_optimization_ = num_nodes_added_;
+    has_optimized_ = true;
+    last_optimization_time_ = std::chrono::steady_clock::now();
+  }
+  return optimization_generation_;
+}
+
+void MapBuilderBridge::AddPoseGraphStatistics(
+    cartographer_ros_msgs::msg::RuntimeStatistics* const statistics) {
+  GetOptimizationGeneration();
+  const cartographer::common::int64 num_nodes_added = num_nodes_added_;
+  statistics->num_nodes_added = num_nodes_added;
+  statistics->num_nodes_since_optimization =
+      num_nodes_added - num_nodes_added_at_optimization_;
+  statistics->seconds_since_optimization =
+      has_optimized_ ? SecondsSince(last_optimization_time_) : -1.;
+}
+
+void MapBuilderBridge::AddSubmapTextureCacheStatistics(
+    cartographer_ros_msgs::msg::RuntimeStatistics* const statistics) const {
+  const cartographer::common::int64 num_hits = submap_texture_cache_.num_hits();
+  const cartographer::common::int64 num_queries =
+      num_hits + submap_texture_cache_.num_misses();
+  statistics->submap_texture_cache_hit_ratio =
+      num_queries > 0 ? static_cast<double>(num_hits) / num_queries : -1.;
+  statistics->submap_texture_cache_bytes = submap_texture_cache_.num_bytes();
+}
+
+const visualization_msgs::msg::MarkerArray&
+MapBuilderBridge::GetTrajectoryNodeList(rclcpp::Clock::SharedPtr& clock) {
+  // Until nodes are added or the global poses move, the last markers are still
+  // accurate, so the nodes of the pose graph are not even copied.
+  const int optimization_generation = GetOptimizationGeneration();
+  const cartographer::common::int64 num_nodes_added = num_nodes_added_;
+  if (optimization_generation == trajectory_node_list_generation_ &&
+      num_nodes_added == trajectory_node_list_num_nodes_added_) {
+    return trajectory_node_list_;
+  }
+  trajectory_node_list_generation_ = optimization_generation;
+  trajectory_node_list_num_nodes_added_ = num_nodes_added;
+  trajectory_node_list_.markers.clear();
   const auto nodes = map_builder_.pose_graph()->GetTrajectoryNodes();
+  const auto stamp = clock->now();
   for (const int trajectory_id : nodes.trajectory_ids()) {
-    visualization_msgs::msg::Marker marker =
-        CreateTrajectoryMarker(trajectory_id, node_options_.map_frame, clock);
-
-    for (const auto& node_id_data : nodes.trajectory(trajectory_id)) {
-      if (node_id_data.data.constant_data == nullptr) {
-        PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
-        continue;
-      }
-      const ::geometry_msgs::msg::Point node_point =
-          ToGeometryMsgPoint(node_id_data.data.global_pose.translation());
-      marker.points.push_back(node_point);
-      // Work around the 16384 point limit in RViz by splitting the
-      // trajectory into multiple markers.
-      if (marker.points.size() == 16384) {
-        PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
-        // Push back the last point, so the two markers appear connected.
-        marker.points.push_back(node_point);
-      }
+    TrajectoryNodeMarkers& cached = trajectory_node_markers_[trajectory_id];
+    UpdateTrajectoryNodeMarkers(trajectory_id, nodes, optimization_generation,
+                                node_options_.map_frame, stamp, &cached);
+    trajectory_node_list_.markers.insert(trajectory_node_list_.markers.end(),
+                                         cached.markers.begin(),
+                                         cached.markers.end());
+    if (cached.marker.points.size() > 1) {
+      trajectory_node_list_.markers.push_back(cached.marker);
     }
-    PushAndResetLineMarker(&marker, &trajectory_node_list.markers);
   }
-  return trajectory_node_list;
+  for (auto& marker : trajectory_node_list_.markers) {
+    marker.header.stamp = stamp;
+  }
+  return trajectory_node_list_;
 }
 
-visualization_msgs::msg::MarkerArray MapBuilderBridge::GetConstraintList(rclcpp::Clock::SharedPtr& clock) {
-  visualization_msgs::msg::MarkerArray constraint_list;
-  int marker_id = 0;
-  visualization_msgs::msg::Marker constraint_intra_marker;
-  constraint_intra_marker.id = marker_id++;
-  constraint_intra_marker.ns = "Intra constraints";
-  constraint_intra_marker.type = visualization_msgs::msg::Marker::LINE_LIST;
-  constraint_intra_marker.header.stamp = clock->now();
-  constraint_intra_marker.header.frame_id = node_options_.map_frame;
-  constraint_intra_marker.scale.x = kConstraintMarkerScale;
-  constraint_intra_marker.pose.orientation.w = 1.0;
-
-  visualization_msgs::msg::Marker residual_intra_marker = constraint_intra_marker;
-  residual_intra_marker.id = marker_id++;
-  residual_intra_marker.ns = "Intra residuals";
-  // This and other markers which are less numerous are set to be slightly
-  // above the intra constraints marker in order to ensure that they are
-  // visible.
-  residual_intra_marker.pose.position.z = 0.1;
-
-  visualization_msgs::msg::Marker constraint_inter_marker = constraint_intra_marker;
-  constraint_inter_marker.id = marker_id++;
-  constraint_inter_marker.ns = "Inter constraints";
-  constraint_inter_marker.pose.position.z = 0.1;
-
-  visualization_msgs::msg::Marker residual_inter_marker = constraint_intra_marker;
-  residual_inter_marker.id = marker_id++;
-  residual_inter_marker.ns = "Inter residuals";
-  residual_inter_marker.pose.position.z = 0.1;
-
-  const auto trajectory_nodes = map_builder_.pose_graph()->GetTrajectoryNodes();
-  const auto submap_data = map_builder_.pose_graph()->GetAllSubmapData();
-  const auto constraints = map_builder_.pose_graph()->constraints();
-
-  for (const auto& constraint : constraints) {
-    visualization_msgs::msg::Marker *constraint_marker, *residual_marker;
-    std_msgs::msg::ColorRGBA color_constraint, color_residual;
-    if (constraint.tag ==
-        cartographer::mapping::PoseGraph::Constraint::INTRA_SUBMAP) {
-      constraint_marker = &constraint_intra_marker;
-      residual_marker = &residual_intra_marker;
-      // Color mapping for submaps of various trajectories - add trajectory id
-      // to ensure different starting colors. Also add a fixed offset of 25
-      // to avoid having identical colors as trajectories.
-      color_constraint = ToMessage(
-          cartographer::io::GetColor(constraint.submap_id.submap_index +
-                                     constraint.submap_id.trajectory_id + 25));
-      color_residual.a = 1.0;
-      color_residual.r = 1.0;
-    } else {
-      constraint_marker = &constraint_inter_marker;
-      residual_marker = &residual_inter_marker;
-      // Bright yellow
-      color_constraint.a = 1.0;
-      color_constraint.r = color_constraint.g = 1.0;
-      // Bright cyan
-      color_residual.a = 1.0;
-      color_residual.b = color_residual.g = 1.0;
-    }
+const visualization_msgs::msg::MarkerArray& MapBuilderBridge::GetConstraintList(
+    rclcpp::Clock::SharedPtr& clock) {
+  // Constraints are added for new nodes right away, while the constraints
+  // found in the background are added and trimmed right before an
+  // optimization. So until nodes are added or the global poses move, the last
+  // markers are still accurate, and the constraints are not even copied.
+  const int optimization_generation = GetOptimizationGeneration();
+  const cartographer::common::int64 num_nodes_added = num_nodes_added_;
+  if (optimization_generation != constraint_list_generation_ ||
+      num_nodes_added != constraint_list_num_nodes_added_) {
+    constraint_list_ = ComputeConstraintList(
+        map_builder_.pose_graph()->constraints(),
+        map_builder_.pose_graph()->GetTrajectoryNodes(),
+        map_builder_.pose_graph()->GetAllSubmapData(), node_options_.map_frame,
+        clock->now());
+    constraint_list_generation_ = optimization_generation;
+    constraint_list_num_nodes_added_ = num_nodes_added;
+  }
+  return constraint_list_;
+}
 
-    for (int i = 0; i < 2; ++i) {
-      constraint_marker->colors.push_back(color_constraint);
-      residual_marker->colors.push_back(color_residual);
-    }
+cartographer::common::Mutex* MapBuilderBridge::trajectory_builder_mutex() {
+  return &trajectory_builder_mutex_;
+}
 
-    const auto submap_it = submap_data.find(constraint.submap_id);
-    if (submap_it == submap_data.end()) {
-      continue;
-    }
-    const auto& submap_pose = submap_it->data.pose;
-    const auto node_it = trajectory_nodes.find(constraint.node_id);
-    if (node_it == trajectory_nodes.end()) {
-      continue;
-    }
-    const auto& trajectory_node_pose = node_it->data.global_pose;
-    const cartographer::transform::Rigid3d constraint_pose =
-        submap_pose * constraint.pose.zbar_ij;
-
-    constraint_marker->points.push_back(
-        ToGeometryMsgPoint(submap_pose.translation()));
-    constraint_marker->points.push_back(
-        ToGeometryMsgPoint(constraint_pose.translation()));
-
-    residual_marker->points.push_back(
-        ToGeometryMsgPoint(constraint_pose.translation()));
-    residual_marker->points.push_back(
-        ToGeometryMsgPoint(trajectory_node_pose.translation()));
-  }
-
-  constraint_list.markers.push_back(constraint_intra_marker);
-  constraint_list.markers.push_back(residual_intra_marker);
-  constraint_list.markers.push_back(constraint_inter_marker);
-  constraint_list.markers.push_back(residual_inter_marker);
-  return constraint_list;
+void MapBuilderBridge::ClearTransformCaches() {
+  for (const auto& entry : sensor_bridges_) {
+    entry.second->tf_bridge().ClearCache();
+  }
 }
 
 SensorBridge* MapBuilderBridge::sensor_bridge(const int trajectory_id) {
@@ -17,17 +17,28 @@
 #ifndef CARTOGRAPHER_ROS_MAP_BUILDER_BRIDGE_H_
 #define CARTOGRAPHER_ROS_MAP_BUILDER_BRIDGE_H_
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "cartographer/mapping/map_builder.h"
+#include "cartographer/mapping/pose_graph.h"
 #include "cartographer/mapping/proto/trajectory_builder_options.pb.h"
+#include "cartographer_ros/ingest_statistics.h"
 #include "cartographer_ros/node_options.h"
+#include "cartographer_ros/pose_graph_markers.h"
+#include "cartographer_ros/runtime_statistics.h"
 #include "cartographer_ros/sensor_bridge.h"
+#include "cartographer_ros/submap_texture_cache.h"
 #include "cartographer_ros/tf_bridge.h"
 #include "cartographer_ros/trajectory_options.h"
+#include "cartographer_ros_msgs/msg/runtime_statistics.hpp"
 #include "cartographer_ros_msgs/msg/submap_entry.hpp"
 #include "cartographer_ros_msgs/msg/submap_list.hpp"
 #include "cartographer_ros_msgs/srv/submap_query.hpp"
@@ -60,41 +71,131 @@ class MapBuilderBridge {
     TrajectoryOptions trajectory_options;
   };
 
-  MapBuilderBridge(const NodeOptions& node_options, tf2_ros::Buffer* tf_buffer);
+  // Called on the thread adding sensor data whenever local SLAM estimated a
+  // new 'local_pose' of 'trajectory_id' at 'time'. No locks of the bridge are
+  // held.
+  using LocalPoseCallback = std::function<void(
+      int trajectory_id, ::cartographer::common::Time time,
+      const ::cartographer::transform::Rigid3d& local_pose)>;
+
+  MapBuilderBridge(const NodeOptions& node_options, tf2_ros::Buffer* tf_buffer,
+                   IngestStatistics* ingest_statistics,
+                   RuntimeStatistics* runtime_statistics,
+                   LocalPoseCallback local_pose_callback);
+
+  ~MapBuilderBridge();
 
   MapBuilderBridge(const MapBuilderBridge&) = delete;
   MapBuilderBridge& operator=(const MapBuilderBridge&) = delete;
 
+  // Loading a map waits for a state still being written in the background.
+  // The records of the map are decompressed and parsed on a thread pool, and
+  // added to the pose graph in the order of the stream.
   void LoadMap(const std::string& map_filename);
   int AddTrajectory(const std::unordered_set<std::string>& expected_sensor_ids,
                     const TrajectoryOptions& trajectory_options);
   void FinishTrajectory(int trajectory_id);
   void RunFinalOptimization();
   void SerializeState(const std::string& filename);
+  // Starts writing the state to 'filename' on a background thread, or returns
+  // false if a state is still being written. Only the active submaps, which
+  // local SLAM keeps modifying, are serialized right away under the trajectory
+  // builder lock. The rest is immutable or copied, and serialized in the
+  // background while sensor data keeps being added. The state is written to a
+  // temporary file which is renamed once complete, so 'filename' never holds a
+  // partial state. 'callback' is called on the background thread with an empty
+  // error message on success.
+  bool SerializeStateAsync(
+      const std::string& filename,
+      std::function<void(const std::string& error_message)> callback)
+      EXCLUDES(serialization_mutex_);
+  // Waits until the state started by SerializeStateAsync() is written.
+  void WaitForSerialization() EXCLUDES(serialization_mutex_);
 
   bool HandleSubmapQuery(
       const std::shared_ptr<::cartographer_ros_msgs::srv::SubmapQuery::Request> request,
       std::shared_ptr<::cartographer_ros_msgs::srv::SubmapQuery::Response> response);
+  // Returns the compressed textures of 'submap_id' and sets 'submap_version'
+  // to their version, or returns nullptr if the submap does not exist.
+  std::shared_ptr<const SubmapTextureCache::Textures> GetSubmapTextures(
+      const cartographer::mapping::SubmapId& submap_id, int* submap_version);
 
   cartographer_ros_msgs::msg::SubmapList GetSubmapList(rclcpp::Clock::SharedPtr& clock);
+  // Returns the submaps and their global poses. Drawing them does not need the
+  // bridge, since the pose graph hands out shared pointers to the submaps.
+  cartographer::mapping::MapById<cartographer::mapping::SubmapId,
+                                 cartographer::mapping::PoseGraph::SubmapData>
+  GetAllSubmapData();
   std::unordered_map<int, TrajectoryState> GetTrajectoryStates()
       EXCLUDES(mutex_);
-  visualization_msgs::msg::MarkerArray GetTrajectoryNodeList(rclcpp::Clock::SharedPtr& clock);
-  visualization_msgs::msg::MarkerArray GetConstraintList(rclcpp::Clock::SharedPtr& clock);
+  // Returns the trajectory node markers, which are only updated after nodes
+  // were added or the pose graph has been optimized.
+  const visualization_msgs::msg::MarkerArray& GetTrajectoryNodeList(
+      rclcpp::Clock::SharedPtr& clock);
+  // Returns the constraint markers, which are only recomputed after the pose
+  // graph has been optimized or nodes were added.
+  const visualization_msgs::msg::MarkerArray& GetConstraintList(
+      rclcpp::Clock::SharedPtr& clock);
+  // Fills in the pose graph fields of 'statistics'. Since optimizations are
+  // detected by polling, this is as precise as the period it is called with.
+  void AddPoseGraphStatistics(
+      cartographer_ros_msgs::msg::RuntimeStatistics* statistics);
+  // Fills in the submap texture cache fields of 'statistics'.
+  void AddSubmapTextureCacheStatistics(
+      cartographer_ros_msgs::msg::RuntimeStatistics* statistics) const;
 
   SensorBridge* sensor_bridge(int trajectory_id);
+  // Drops the cached transforms of all sensor bridges.
+  void ClearTransformCaches();
+  // Held while local SLAM inserts into the active submaps, so it has to be held
+  // to read them. Finished submaps do not change anymore.
+  cartographer::common::Mutex* trajectory_builder_mutex();
 
  private:
+  // Returns a counter which is increased whenever the global poses in the pose
+  // graph changed, i.e. after an optimization. The pose graph does not tell us,
+  // so we detect it by a change of the local to global transforms.
+  int GetOptimizationGeneration();
+
+  RuntimeStatistics::LockStatistics* const lock_statistics_;
   cartographer::common::Mutex mutex_;
+  // Serializes sensor data and trajectory changes going into 'map_builder_',
+  // whose sensor collator is shared by all trajectories.
+  cartographer::common::Mutex trajectory_builder_mutex_;
   const NodeOptions node_options_;
+  const LocalPoseCallback local_pose_callback_;
   std::unordered_map<int, std::shared_ptr<const TrajectoryState::LocalSlamData>>
       trajectory_state_data_ GUARDED_BY(mutex_);
   cartographer::mapping::MapBuilder map_builder_;
   tf2_ros::Buffer* const tf_buffer_;
+  IngestStatistics* const ingest_statistics_;
+  // Textures of submaps whose version did not change are served from here.
+  SubmapTextureCache submap_texture_cache_;
 
   // These are keyed with 'trajectory_id'.
   std::unordered_map<int, TrajectoryOptions> trajectory_options_;
   std::unordered_map<int, std::unique_ptr<SensorBridge>> sensor_bridges_;
+  std::unordered_map<int, cartographer::transform::Rigid3d>
+      local_to_global_transforms_;
+  std::unordered_map<int, TrajectoryNodeMarkers> trajectory_node_markers_;
+  visualization_msgs::msg::MarkerArray trajectory_node_list_;
+  int trajectory_node_list_generation_ = -1;
+  cartographer::common::int64 trajectory_node_list_num_nodes_added_ = 0;
+  int optimization_generation_ = 0;
+  // Nodes local SLAM added to the pose graph, in total and when the last
+  // optimization was detected.
+  std::atomic<cartographer::common::int64> num_nodes_added_{0};
+  cartographer::common::int64 num_nodes_added_at_optimization_ = 0;
+  bool has_optimized_ = false;
+  std::chrono::steady_clock::time_point last_optimization_time_;
+  visualization_msgs::msg::MarkerArray constraint_list_;
+  int constraint_list_generation_ = -1;
+  cartographer::common::int64 constraint_list_num_nodes_added_ = 0;
+
+  cartographer::common::Mutex serialization_mutex_;
+  bool serializing_ GUARDED_BY(serialization_mutex_) = false;
+  // Joined by the destructor, and before the next state is written.
+  std::thread serialization_thread_ GUARDED_BY(serialization_mutex_);
 };
 
 }  // namespace cartographer_ros
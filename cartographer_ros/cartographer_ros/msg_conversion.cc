@@ -16,6 +16,11 @@
 
 #include "cartographer_ros/msg_conversion.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
 #include "cartographer/common/port.h"
 #include "cartographer/common/time.h"
 #include "cartographer/transform/proto/transform.pb.h"
@@ -48,32 +53,41 @@ constexpr float kPointCloudComponentFourMagic = 1.;
 using ::cartographer::sensor::PointCloudWithIntensities;
 using ::cartographer::transform::Rigid3d;
 
+// Sets up 'msg' for 'num_points' points. The existing data buffer of 'msg' is
+// reused if it is large enough.
+void PreparePointCloud2Message(const int64_t timestamp,
+                               const std::string& frame_id,
+                               const int num_points,
+                               sensor_msgs::msg::PointCloud2* const msg) {
+  msg->header.stamp = ToRos(::cartographer::common::FromUniversal(timestamp));
+  msg->header.frame_id = frame_id;
+  msg->height = 1;
+  msg->width = num_points;
+  msg->fields.resize(3);
+  msg->fields[0].name = "x";
+  msg->fields[0].offset = 0;
+  msg->fields[0].datatype = sensor_msgs::msg::PointField::FLOAT32;
+  msg->fields[0].count = 1;
+  msg->fields[1].name = "y";
+  msg->fields[1].offset = 4;
+  msg->fields[1].datatype = sensor_msgs::msg::PointField::FLOAT32;
+  msg->fields[1].count = 1;
+  msg->fields[2].name = "z";
+  msg->fields[2].offset = 8;
+  msg->fields[2].datatype = sensor_msgs::msg::PointField::FLOAT32;
+  msg->fields[2].count = 1;
+  msg->is_bigendian = false;
+  msg->point_step = 16;
+  msg->row_step = 16 * msg->width;
+  msg->is_dense = true;
+  msg->data.resize(16 * num_points);
+}
+
 sensor_msgs::msg::PointCloud2 PreparePointCloud2Message(const int64_t timestamp,
                                                    const std::string& frame_id,
                                                    const int num_points) {
   sensor_msgs::msg::PointCloud2 msg;
-  msg.header.stamp = ToRos(::cartographer::common::FromUniversal(timestamp));
-  msg.header.frame_id = frame_id;
-  msg.height = 1;
-  msg.width = num_points;
-  msg.fields.resize(3);
-  msg.fields[0].name = "x";
-  msg.fields[0].offset = 0;
-  msg.fields[0].datatype = sensor_msgs::msg::PointField::FLOAT32;
-  msg.fields[0].count = 1;
-  msg.fields[1].name = "y";
-  msg.fields[1].offset = 4;
-  msg.fields[1].datatype = sensor_msgs::msg::PointField::FLOAT32;
-  msg.fields[1].count = 1;
-  msg.fields[2].name = "z";
-  msg.fields[2].offset = 8;
-  msg.fields[2].datatype = sensor_msgs::msg::PointField::FLOAT32;
-  msg.fields[2].count = 1;
-  msg.is_bigendian = false;
-  msg.point_step = 16;
-  msg.row_step = 16 * msg.width;
-  msg.is_dense = true;
-  msg.data.resize(16 * num_points);
+  PreparePointCloud2Message(timestamp, frame_id, num_points, &msg);
   return msg;
 }
 
@@ -93,52 +107,171 @@ float GetFirstEcho(const sensor_msgs::msg::LaserEcho& echo) {
 
 // For sensor_msgs::LaserScan and sensor_msgs::MultiEchoLaserScan.
 template <typename LaserMessageType>
-PointCloudWithIntensities LaserScanToPointCloudWithIntensities(
-    const LaserMessageType& msg) {
-  CHECK_GE(msg.range_min, 0.f);
-  CHECK_GE(msg.range_max, msg.range_min);
+LaserScanGeometry ComputeGeometry(const LaserMessageType& msg) {
   if (msg.angle_increment > 0.f) {
     CHECK_GT(msg.angle_max, msg.angle_min);
   } else {
     CHECK_GT(msg.angle_min, msg.angle_max);
   }
+  const int num_beams = msg.ranges.size();
+  LaserScanGeometry geometry;
+  geometry.angle_min = msg.angle_min;
+  geometry.angle_increment = msg.angle_increment;
+  geometry.time_increment = msg.time_increment;
+  geometry.cos_angles.resize(num_beams);
+  geometry.sin_angles.resize(num_beams);
+  geometry.times.resize(num_beams);
+  for (int i = 0; i < num_beams; ++i) {
+    const double angle = static_cast<double>(msg.angle_min) +
+                         i * static_cast<double>(msg.angle_increment);
+    geometry.cos_angles[i] = std::cos(angle);
+    geometry.sin_angles[i] = std::sin(angle);
+    geometry.times[i] = i * msg.time_increment;
+  }
+  return geometry;
+}
+
+template <typename LaserMessageType>
+bool MatchesGeometry(const LaserScanGeometry& geometry,
+                     const LaserMessageType& msg) {
+  return geometry.angle_min == msg.angle_min &&
+         geometry.angle_increment == msg.angle_increment &&
+         geometry.time_increment == msg.time_increment &&
+         static_cast<size_t>(geometry.cos_angles.size()) == msg.ranges.size();
+}
+
+// For sensor_msgs::LaserScan and sensor_msgs::MultiEchoLaserScan.
+template <typename LaserMessageType>
+PointCloudWithIntensities LaserScanToPointCloudWithIntensities(
+    const LaserMessageType& msg, const LaserScanGeometry& geometry) {
+  CHECK_GE(msg.range_min, 0.f);
+  CHECK_GE(msg.range_max, msg.range_min);
+  CHECK(MatchesGeometry(geometry, msg));
+  const size_t num_beams = msg.ranges.size();
+  const bool has_intensities = !msg.intensities.empty();
+  if (has_intensities) {
+    CHECK_EQ(msg.intensities.size(), num_beams);
+  }
+
+  // Beams without an echo get NaN which never passes the range gate below.
+  Eigen::ArrayXf ranges(num_beams);
+  for (size_t i = 0; i < num_beams; ++i) {
+    ranges[i] = HasEcho(msg.ranges[i])
+                    ? GetFirstEcho(msg.ranges[i])
+                    : std::numeric_limits<float>::quiet_NaN();
+  }
+  const Eigen::ArrayXf xs = ranges * geometry.cos_angles;
+  const Eigen::ArrayXf ys = ranges * geometry.sin_angles;
+  const Eigen::Array<bool, Eigen::Dynamic, 1> in_range =
+      (ranges >= msg.range_min) && (ranges <= msg.range_max);
+
   PointCloudWithIntensities point_cloud;
-  float angle = msg.angle_min;
-  for (size_t i = 0; i < msg.ranges.size(); ++i) {
-    const auto& echoes = msg.ranges[i];
-    if (HasEcho(echoes)) {
-      const float first_echo = GetFirstEcho(echoes);
-      if (msg.range_min <= first_echo && first_echo <= msg.range_max) {
-        const Eigen::AngleAxisf rotation(angle, Eigen::Vector3f::UnitZ());
-        Eigen::Vector4f point;
-        point << rotation * (first_echo * Eigen::Vector3f::UnitX()),
-            i * msg.time_increment;
-        point_cloud.points.push_back(point);
-        if (msg.intensities.size() > 0) {
-          CHECK_EQ(msg.intensities.size(), msg.ranges.size());
-          const auto& echo_intensities = msg.intensities[i];
-          CHECK(HasEcho(echo_intensities));
-          point_cloud.intensities.push_back(GetFirstEcho(echo_intensities));
-        } else {
-          point_cloud.intensities.push_back(0.f);
-        }
-      }
+  point_cloud.points.reserve(num_beams);
+  point_cloud.intensities.reserve(num_beams);
+  for (size_t i = 0; i < num_beams; ++i) {
+    if (!in_range[i]) {
+      continue;
+    }
+    point_cloud.points.emplace_back(xs[i], ys[i], 0.f, geometry.times[i]);
+    if (has_intensities) {
+      const auto& echo_intensities = msg.intensities[i];
+      CHECK(HasEcho(echo_intensities));
+      point_cloud.intensities.push_back(GetFirstEcho(echo_intensities));
+    } else {
+      point_cloud.intensities.push_back(0.f);
     }
-    angle += msg.angle_increment;
   }
   return point_cloud;
 }
 
-bool PointCloud2HasField(const sensor_msgs::msg::PointCloud2& pc2,
-                         const std::string& field_name) {
-  for (const auto& field : pc2.fields) {
-    if (field.name == field_name) {
+template <typename T>
+float ReadAs(const uint8_t* const data, const bool swap_bytes) {
+  uint8_t bytes[sizeof(T)];
+  std::memcpy(bytes, data, sizeof(T));
+  if (swap_bytes) {
+    std::reverse(bytes, bytes + sizeof(T));
+  }
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return static_cast<float>(value);
+}
+
+bool IsSupportedDatatype(const uint8_t datatype) {
+  switch (datatype) {
+    case sensor_msgs::msg::PointField::INT8:
+    case sensor_msgs::msg::PointField::UINT8:
+    case sensor_msgs::msg::PointField::INT16:
+    case sensor_msgs::msg::PointField::UINT16:
+    case sensor_msgs::msg::PointField::INT32:
+    case sensor_msgs::msg::PointField::UINT32:
+    case sensor_msgs::msg::PointField::FLOAT32:
+    case sensor_msgs::msg::PointField::FLOAT64:
       return true;
-    }
   }
   return false;
 }
 
+// Only called for fields found by FindField(), which rejects unsupported
+// datatypes.
+float ReadField(const uint8_t* const point,
+                const PointCloud2Layout::Field& field) {
+  const uint8_t* const data = point + field.offset;
+  switch (field.datatype) {
+    case sensor_msgs::msg::PointField::INT8:
+      return ReadAs<int8_t>(data, field.swap_bytes);
+    case sensor_msgs::msg::PointField::UINT8:
+      return ReadAs<uint8_t>(data, field.swap_bytes);
+    case sensor_msgs::msg::PointField::INT16:
+      return ReadAs<int16_t>(data, field.swap_bytes);
+    case sensor_msgs::msg::PointField::UINT16:
+      return ReadAs<uint16_t>(data, field.swap_bytes);
+    case sensor_msgs::msg::PointField::INT32:
+      return ReadAs<int32_t>(data, field.swap_bytes);
+    case sensor_msgs::msg::PointField::UINT32:
+      return ReadAs<uint32_t>(data, field.swap_bytes);
+    case sensor_msgs::msg::PointField::FLOAT32:
+      return ReadAs<float>(data, field.swap_bytes);
+    case sensor_msgs::msg::PointField::FLOAT64:
+      return ReadAs<double>(data, field.swap_bytes);
+  }
+  return std::numeric_limits<float>::quiet_NaN();
+}
+
+bool IsIntegerDatatype(const uint8_t datatype) {
+  return datatype != sensor_msgs::msg::PointField::FLOAT32 &&
+         datatype != sensor_msgs::msg::PointField::FLOAT64;
+}
+
+bool IsBigEndianHost() {
+  const uint16_t value = 1;
+  uint8_t first_byte;
+  std::memcpy(&first_byte, &value, 1);
+  return first_byte == 0;
+}
+
+PointCloud2Layout::Field FindField(const sensor_msgs::msg::PointCloud2& msg,
+                                   const std::string& field_name) {
+  PointCloud2Layout::Field result;
+  for (const auto& field : msg.fields) {
+    if (field.name != field_name) {
+      continue;
+    }
+    if (!IsSupportedDatatype(field.datatype)) {
+      // A rejected time field makes all points share the message stamp.
+      LOG(WARNING) << "Ignoring PointCloud2 field '" << field_name
+                   << "' with unsupported datatype " << int{field.datatype}
+                   << ".";
+      break;
+    }
+    result.present = true;
+    result.offset = field.offset;
+    result.datatype = field.datatype;
+    result.swap_bytes = msg.is_bigendian != IsBigEndianHost();
+    break;
+  }
+  return result;
+}
+
 }  // namespace
 
 sensor_msgs::msg::PointCloud2 ToPointCloud2Message(
@@ -158,40 +291,144 @@ sensor_msgs::msg::PointCloud2 ToPointCloud2Message(
   return msg;
 }
 
+void ToPointCloud2Message(const int64_t timestamp, const std::string& frame_id,
+                          const ::cartographer::transform::Rigid3f& transform,
+                          const ::cartographer::sensor::PointCloud& point_cloud,
+                          sensor_msgs::msg::PointCloud2* const msg) {
+  PreparePointCloud2Message(timestamp, frame_id, point_cloud.size(), msg);
+  if (point_cloud.empty()) {
+    return;
+  }
+  // Viewing the points and the message data as matrices lets Eigen transform
+  // all points with vectorized code and write them to their final place.
+  const Eigen::Map<const Eigen::Matrix3Xf> points(point_cloud.front().data(), 3,
+                                                  point_cloud.size());
+  Eigen::Map<Eigen::Matrix4Xf> data(reinterpret_cast<float*>(msg->data.data()),
+                                    4, point_cloud.size());
+  data.topRows<3>().noalias() = transform.rotation().toRotationMatrix() * points;
+  data.topRows<3>().colwise() += transform.translation();
+  data.row(3).setConstant(kPointCloudComponentFourMagic);
+}
+
+LaserScanGeometry ComputeLaserScanGeometry(
+    const sensor_msgs::msg::LaserScan& msg) {
+  return ComputeGeometry(msg);
+}
+
+LaserScanGeometry ComputeLaserScanGeometry(
+    const sensor_msgs::msg::MultiEchoLaserScan& msg) {
+  return ComputeGeometry(msg);
+}
+
+bool GeometryMatches(const LaserScanGeometry& geometry,
+                     const sensor_msgs::msg::LaserScan& msg) {
+  return MatchesGeometry(geometry, msg);
+}
+
+bool GeometryMatches(const LaserScanGeometry& geometry,
+                     const sensor_msgs::msg::MultiEchoLaserScan& msg) {
+  return MatchesGeometry(geometry, msg);
+}
+
 PointCloudWithIntensities ToPointCloudWithIntensities(
     const sensor_msgs::msg::LaserScan& msg) {
-  return LaserScanToPointCloudWithIntensities(msg);
+  return LaserScanToPointCloudWithIntensities(msg, ComputeGeometry(msg));
 }
 
 PointCloudWithIntensities ToPointCloudWithIntensities(
     const sensor_msgs::msg::MultiEchoLaserScan& msg) {
-  return LaserScanToPointCloudWithIntensities(msg);
+  return LaserScanToPointCloudWithIntensities(msg, ComputeGeometry(msg));
 }
 
 PointCloudWithIntensities ToPointCloudWithIntensities(
-    const sensor_msgs::msg::PointCloud2& message) {
+    const sensor_msgs::msg::LaserScan& msg, const LaserScanGeometry& geometry) {
+  return LaserScanToPointCloudWithIntensities(msg, geometry);
+}
+
+PointCloudWithIntensities ToPointCloudWithIntensities(
+    const sensor_msgs::msg::MultiEchoLaserScan& msg,
+    const LaserScanGeometry& geometry) {
+  return LaserScanToPointCloudWithIntensities(msg, geometry);
+}
+
+PointCloud2Layout ComputePointCloud2Layout(
+    const sensor_msgs::msg::PointCloud2& msg) {
+  PointCloud2Layout layout;
+  layout.fields = msg.fields;
+  layout.point_step = msg.point_step;
+  layout.is_bigendian = msg.is_bigendian;
+  layout.x = FindField(msg, "x");
+  layout.y = FindField(msg, "y");
+  layout.z = FindField(msg, "z");
+  CHECK(layout.x.present && layout.y.present && layout.z.present)
+      << "PointCloud2 messages need to have 'x', 'y' and 'z' fields.";
+  layout.intensity = FindField(msg, "intensity");
+  layout.time = FindField(msg, "time");
+  if (!layout.time.present) {
+    layout.time = FindField(msg, "t");
+  }
+  // Integer time fields, e.g. 't' of Ouster drivers, are in nanoseconds.
+  if (layout.time.present && IsIntegerDatatype(layout.time.datatype)) {
+    layout.time.scale = 1e-9f;
+  }
+  return layout;
+}
+
+bool LayoutMatches(const PointCloud2Layout& layout,
+                   const sensor_msgs::msg::PointCloud2& msg) {
+  return layout.x.present && layout.point_step == msg.point_step &&
+         layout.is_bigendian == msg.is_bigendian && layout.fields == msg.fields;
+}
+
+std::tuple<PointCloudWithIntensities, ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::msg::PointCloud2& message) {
+  return ToPointCloudWithIntensities(message,
+                                     ComputePointCloud2Layout(message));
+}
+
+std::tuple<PointCloudWithIntensities, ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::msg::PointCloud2& message,
+                            const PointCloud2Layout& layout) {
+  DCHECK(LayoutMatches(layout, message));
+  const size_t num_points = message.width * message.height;
+  CHECK_LE(message.row_step * message.height, message.data.size());
+  CHECK_LE(message.point_step * message.width, message.row_step);
+
   PointCloudWithIntensities point_cloud;
-  // We check for intensity field here to avoid run-time warnings if we pass in
-  // a PointCloud2 without intensity.
-  if (PointCloud2HasField(message, "intensity")) {
-    pcl::PointCloud<pcl::PointXYZI> pcl_point_cloud;
-    pcl::fromROSMsg(message, pcl_point_cloud);
-    for (const auto& point : pcl_point_cloud) {
-      point_cloud.points.emplace_back(point.x, point.y, point.z, 0.f);
-      point_cloud.intensities.push_back(point.intensity);
+  point_cloud.points.reserve(num_points);
+  point_cloud.intensities.reserve(num_points);
+  float max_time = -std::numeric_limits<float>::infinity();
+  for (uint32_t row = 0; row < message.height; ++row) {
+    const uint8_t* point = message.data.data() + row * message.row_step;
+    for (uint32_t column = 0; column < message.width;
+         ++column, point += message.point_step) {
+      const float x = ReadField(point, layout.x);
+      const float y = ReadField(point, layout.y);
+      const float z = ReadField(point, layout.z);
+      if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) {
+        continue;
+      }
+      const float time = layout.time.present
+                             ? layout.time.scale * ReadField(point, layout.time)
+                             : 0.f;
+      max_time = std::max(max_time, time);
+      point_cloud.points.emplace_back(x, y, z, time);
+      // If we don't have an intensity field, fill in 1.0.
+      point_cloud.intensities.push_back(
+          layout.intensity.present ? ReadField(point, layout.intensity) : 1.f);
     }
-  } else {
-    pcl::PointCloud<pcl::PointXYZ> pcl_point_cloud;
-    pcl::fromROSMsg(message, pcl_point_cloud);
-
-    // If we don't have an intensity field, just copy XYZ and fill in
-    // 1.0.
-    for (const auto& point : pcl_point_cloud) {
-      point_cloud.points.emplace_back(point.x, point.y, point.z, 0.f);
-      point_cloud.intensities.push_back(1.0);
+  }
+
+  // Cartographer expects the last point at time 0 and earlier points at
+  // negative times, so the stamp is moved to the last point.
+  ::cartographer::common::Time timestamp = FromRos(message.header.stamp);
+  if (!point_cloud.points.empty() && max_time != 0.f) {
+    timestamp += ::cartographer::common::FromSeconds(max_time);
+    for (Eigen::Vector4f& point : point_cloud.points) {
+      point[3] -= max_time;
     }
   }
-  return point_cloud;
+  return std::make_tuple(std::move(point_cloud), timestamp);
 }
 
 Rigid3d ToRigid3d(const geometry_msgs::msg::TransformStamped& transform) {
@@ -17,14 +17,14 @@
 #ifndef CARTOGRAPHER_ROS_MSG_CONVERSION_H_
 #define CARTOGRAPHER_ROS_MSG_CONVERSION_H_
 
+#include <tuple>
+#include <vector>
+
 #include "cartographer/common/port.h"
+#include "cartographer/common/time.h"
 #include "cartographer/sensor/point_cloud.h"
 #include "cartographer/transform/rigid_transform.h"
-
-#include "pcl/point_cloud.h"
-#include "pcl/point_types.h"
-
-#include <pcl_conversions/pcl_conversions.h>
+#include "Eigen/Core"
 
 #include <geometry_msgs/msg/point.hpp>
 #include <geometry_msgs/msg/pose.hpp>
@@ -36,13 +36,78 @@
 #include <sensor_msgs/msg/laser_scan.hpp>
 #include <sensor_msgs/msg/multi_echo_laser_scan.hpp>
 #include <sensor_msgs/msg/point_cloud2.hpp>
+#include <sensor_msgs/msg/point_field.hpp>
 
 namespace cartographer_ros {
 
+// Where the fields Cartographer reads live inside each point of a
+// sensor_msgs::PointCloud2. Parsing 'fields' once and reusing the result for
+// all messages of a sensor lets us walk 'data' directly.
+struct PointCloud2Layout {
+  struct Field {
+    bool present = false;
+    uint32_t offset = 0;
+    uint8_t datatype = 0;
+    // Multiplied with the raw value, e.g. to convert nanoseconds to seconds.
+    float scale = 1.f;
+    // Set if the byte order of the message differs from the host.
+    bool swap_bytes = false;
+  };
+
+  // The message layout this was computed from, used to detect changes.
+  std::vector<sensor_msgs::msg::PointField> fields;
+  uint32_t point_step = 0;
+  bool is_bigendian = false;
+
+  Field x;
+  Field y;
+  Field z;
+  Field intensity;
+  // Per-point time relative to the header stamp, from a 'time' or 't' field.
+  Field time;
+};
+
+// Per-beam directions and time offsets of a laser scan. Scanners rarely change
+// their geometry, so this is computed once per sensor and reused.
+struct LaserScanGeometry {
+  float angle_min = 0.f;
+  float angle_increment = 0.f;
+  float time_increment = 0.f;
+  Eigen::ArrayXf cos_angles;
+  Eigen::ArrayXf sin_angles;
+  Eigen::ArrayXf times;
+};
+
+LaserScanGeometry ComputeLaserScanGeometry(
+    const sensor_msgs::msg::LaserScan& msg);
+LaserScanGeometry ComputeLaserScanGeometry(
+    const sensor_msgs::msg::MultiEchoLaserScan& msg);
+
+// Returns true if 'geometry' can be used to convert 'msg'.
+bool GeometryMatches(const LaserScanGeometry& geometry,
+                     const sensor_msgs::msg::LaserScan& msg);
+bool GeometryMatches(const LaserScanGeometry& geometry,
+                     const sensor_msgs::msg::MultiEchoLaserScan& msg);
+
+PointCloud2Layout ComputePointCloud2Layout(
+    const sensor_msgs::msg::PointCloud2& msg);
+
+// Returns true if 'layout' can be used to decode 'msg'.
+bool LayoutMatches(const PointCloud2Layout& layout,
+                   const sensor_msgs::msg::PointCloud2& msg);
+
 sensor_msgs::msg::PointCloud2 ToPointCloud2Message(
     int64_t timestamp, const std::string& frame_id,
     const ::cartographer::sensor::TimedPointCloud& point_cloud);
 
+// Transforms 'point_cloud' by 'transform' while writing it into 'msg' in a
+// single pass. The data buffer of 'msg' is reused, so repeatedly writing into
+// the same message does not allocate once it is large enough.
+void ToPointCloud2Message(int64_t timestamp, const std::string& frame_id,
+                          const ::cartographer::transform::Rigid3f& transform,
+                          const ::cartographer::sensor::PointCloud& point_cloud,
+                          sensor_msgs::msg::PointCloud2* msg);
+
 geometry_msgs::msg::Transform ToGeometryMsgTransform(
     const ::cartographer::transform::Rigid3d& rigid3d);
 
@@ -57,8 +122,28 @@ geometry_msgs::msg::Point ToGeometryMsgPoint(const Eigen::Vector3d& vector3d);
 ::cartographer::sensor::PointCloudWithIntensities ToPointCloudWithIntensities(
     const sensor_msgs::msg::MultiEchoLaserScan& msg);
 
+// Same as above, but using a previously computed 'geometry'.
+::cartographer::sensor::PointCloudWithIntensities ToPointCloudWithIntensities(
+    const sensor_msgs::msg::LaserScan& msg, const LaserScanGeometry& geometry);
+
 ::cartographer::sensor::PointCloudWithIntensities ToPointCloudWithIntensities(
-    const sensor_msgs::msg::PointCloud2& message);
+    const sensor_msgs::msg::MultiEchoLaserScan& msg,
+    const LaserScanGeometry& geometry);
+
+// Returns the points of 'message' and the time of its last point, relative to
+// which the point times are given, i.e. they are 0 or negative.
+std::tuple<::cartographer::sensor::PointCloudWithIntensities,
+           ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::msg::PointCloud2& message);
+
+// Decodes 'message' in a single pass using a previously computed 'layout'.
+// Points with non-finite coordinates are skipped. If there is no intensity
+// field, intensities are 1. If there is no time field, times are 0 and the
+// header stamp is returned.
+std::tuple<::cartographer::sensor::PointCloudWithIntensities,
+           ::cartographer::common::Time>
+ToPointCloudWithIntensities(const sensor_msgs::msg::PointCloud2& message,
+                            const PointCloud2Layout& layout);
 
 ::cartographer::transform::Rigid3d ToRigid3d(
     const geometry_msgs::msg::TransformStamped& transform);
@@ -16,16 +16,21 @@
 
 #include "cartographer_ros/msg_conversion.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <tuple>
 
+#include "cartographer_ros/time_conversion.h"
 #include "gtest/gtest.h"
-#include "sensor_msgs/LaserScan.h"
+#include "sensor_msgs/msg/laser_scan.hpp"
+#include "sensor_msgs/msg/point_cloud2.hpp"
 
 namespace cartographer_ros {
 namespace {
 
 TEST(MsgConversion, LaserScanToPointCloud) {
-  sensor_msgs::LaserScan laser_scan;
+  sensor_msgs::msg::LaserScan laser_scan;
   for (int i = 0; i < 8; ++i) {
     laser_scan.ranges.push_back(1.f);
   }
@@ -59,7 +64,7 @@ TEST(MsgConversion, LaserScanToPointCloud) {
 }
 
 TEST(MsgConversion, LaserScanToPointCloudWithInfinityAndNaN) {
-  sensor_msgs::LaserScan laser_scan;
+  sensor_msgs::msg::LaserScan laser_scan;
   laser_scan.ranges.push_back(1.f);
   laser_scan.ranges.push_back(std::numeric_limits<float>::infinity());
   laser_scan.ranges.push_back(2.f);
@@ -79,5 +84,126 @@ TEST(MsgConversion, LaserScanToPointCloudWithInfinityAndNaN) {
       point_cloud[1].isApprox(Eigen::Vector4f(-3.f, 0.f, 0.f, 0.f), 1e-6));
 }
 
+sensor_msgs::msg::PointField CreatePointField(const std::string& name,
+                                              const uint32_t offset,
+                                              const uint8_t datatype) {
+  sensor_msgs::msg::PointField field;
+  field.name = name;
+  field.offset = offset;
+  field.datatype = datatype;
+  field.count = 1;
+  return field;
+}
+
+TEST(MsgConversion, PointCloud2ToPointCloudWithTimeAndIntensity) {
+  struct RawPoint {
+    float x, y, z;
+    uint32_t t;
+    uint16_t intensity;
+  };
+  const std::vector<RawPoint> raw_points = {
+      {1.f, 2.f, 3.f, 0, 100},
+      {std::numeric_limits<float>::quiet_NaN(), 0.f, 0.f, 1000, 200},
+      {4.f, 5.f, 6.f, 2000000, 300}};
+
+  sensor_msgs::msg::PointCloud2 msg;
+  msg.height = 1;
+  msg.width = raw_points.size();
+  msg.fields = {CreatePointField("x", 0, sensor_msgs::msg::PointField::FLOAT32),
+                CreatePointField("y", 4, sensor_msgs::msg::PointField::FLOAT32),
+                CreatePointField("z", 8, sensor_msgs::msg::PointField::FLOAT32),
+                CreatePointField("t", 12, sensor_msgs::msg::PointField::UINT32),
+                CreatePointField("intensity", 16,
+                                 sensor_msgs::msg::PointField::UINT16)};
+  msg.point_step = sizeof(RawPoint);
+  msg.row_step = msg.point_step * msg.width;
+  msg.data.resize(msg.row_step);
+  for (size_t i = 0; i < raw_points.size(); ++i) {
+    std::memcpy(&msg.data[i * msg.point_step], &raw_points[i],
+                sizeof(RawPoint));
+  }
+
+  const PointCloud2Layout layout = ComputePointCloud2Layout(msg);
+  EXPECT_TRUE(LayoutMatches(layout, msg));
+  ::cartographer::sensor::PointCloudWithIntensities point_cloud;
+  ::cartographer::common::Time time;
+  std::tie(point_cloud, time) = ToPointCloudWithIntensities(msg, layout);
+  ASSERT_EQ(2, point_cloud.points.size());
+  ASSERT_EQ(2, point_cloud.intensities.size());
+  // Times are relative to the last point, which the returned time refers to.
+  EXPECT_TRUE(
+      point_cloud.points[0].isApprox(Eigen::Vector4f(1.f, 2.f, 3.f, -2e-3f)));
+  EXPECT_TRUE(
+      point_cloud.points[1].isApprox(Eigen::Vector4f(4.f, 5.f, 6.f, 0.f)));
+  EXPECT_NEAR(2e-3, ::cartographer::common::ToSeconds(
+                        time - FromRos(msg.header.stamp)),
+              1e-6);
+  EXPECT_EQ(100.f, point_cloud.intensities[0]);
+  EXPECT_EQ(300.f, point_cloud.intensities[1]);
+
+  msg.fields.pop_back();
+  EXPECT_FALSE(LayoutMatches(layout, msg));
+  const auto without_intensity = std::get<0>(ToPointCloudWithIntensities(msg));
+  ASSERT_EQ(2, without_intensity.intensities.size());
+  EXPECT_EQ(1.f, without_intensity.intensities[0]);
+}
+
+TEST(MsgConversion, BigEndianPointCloud2WithUnsupportedTimeField) {
+  const std::vector<float> coordinates = {1.f, 2.f, 3.f, 4.f, 5.f, 6.f};
+  sensor_msgs::msg::PointCloud2 msg;
+  msg.height = 1;
+  msg.width = 2;
+  msg.is_bigendian = true;
+  // Datatype 0 is not a valid PointField datatype.
+  msg.fields = {CreatePointField("x", 0, sensor_msgs::msg::PointField::FLOAT32),
+                CreatePointField("y", 4, sensor_msgs::msg::PointField::FLOAT32),
+                CreatePointField("z", 8, sensor_msgs::msg::PointField::FLOAT32),
+                CreatePointField("time", 12, 0)};
+  msg.point_step = 16;
+  msg.row_step = msg.point_step * msg.width;
+  msg.data.resize(msg.row_step);
+  for (size_t i = 0; i < coordinates.size(); ++i) {
+    uint8_t* const data = &msg.data[(i / 3) * msg.point_step + (i % 3) * 4];
+    std::memcpy(data, &coordinates[i], sizeof(float));
+    std::reverse(data, data + sizeof(float));
+  }
+
+  const PointCloud2Layout layout = ComputePointCloud2Layout(msg);
+  EXPECT_FALSE(layout.time.present);
+  ::cartographer::sensor::PointCloudWithIntensities point_cloud;
+  ::cartographer::common::Time time;
+  std::tie(point_cloud, time) = ToPointCloudWithIntensities(msg, layout);
+  ASSERT_EQ(2, point_cloud.points.size());
+  EXPECT_TRUE(
+      point_cloud.points[0].isApprox(Eigen::Vector4f(1.f, 2.f, 3.f, 0.f)));
+  EXPECT_TRUE(
+      point_cloud.points[1].isApprox(Eigen::Vector4f(4.f, 5.f, 6.f, 0.f)));
+  EXPECT_EQ(FromRos(msg.header.stamp), time);
+}
+
+TEST(MsgConversion, TransformedPointCloudToPointCloud2) {
+  const ::cartographer::transform::Rigid3f transform(
+      Eigen::Vector3f(1.f, 2.f, 3.f),
+      Eigen::Quaternionf(Eigen::AngleAxisf(0.5f, Eigen::Vector3f::UnitZ())));
+  const ::cartographer::sensor::PointCloud point_cloud = {
+      Eigen::Vector3f(1.f, 0.f, 0.f), Eigen::Vector3f(-2.f, 3.f, 4.f)};
+  sensor_msgs::msg::PointCloud2 msg;
+  ToPointCloud2Message(0, "map", transform, point_cloud, &msg);
+  ASSERT_EQ(2, msg.width);
+  ASSERT_EQ(2 * msg.point_step, msg.data.size());
+  const float* const data = reinterpret_cast<const float*>(msg.data.data());
+  for (size_t i = 0; i != point_cloud.size(); ++i) {
+    const Eigen::Vector3f expected = transform * point_cloud[i];
+    EXPECT_TRUE(Eigen::Map<const Eigen::Vector3f>(data + 4 * i)
+                    .isApprox(expected));
+    EXPECT_EQ(1.f, data[4 * i + 3]);
+  }
+
+  // Writing fewer points into the same message shrinks it.
+  ToPointCloud2Message(0, "map", transform, {point_cloud[1]}, &msg);
+  EXPECT_EQ(1, msg.width);
+  EXPECT_EQ(msg.point_step, msg.data.size());
+}
+
 }  // namespace
 }  // namespace cartographer_ros
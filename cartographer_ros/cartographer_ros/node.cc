@@ -16,9 +16,12 @@
 
 #include "cartographer_ros/node.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "Eigen/Core"
@@ -32,8 +35,10 @@
 #include "cartographer/transform/rigid_transform.h"
 #include "cartographer/transform/transform.h"
 #include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/occupancy_grid.h"
 #include "cartographer_ros/sensor_bridge.h"
 #include "cartographer_ros/tf_bridge.h"
+#include "cartographer_ros/tiled_submap_compositor.h"
 #include "cartographer_ros/time_conversion.h"
 #include "glog/logging.h"
 
@@ -52,6 +57,8 @@ namespace cartographer_ros {
 
 namespace {
 
+constexpr int kOccupancyGridTileSizeInPixels = 256;
+
 cartographer_ros_msgs::msg::SensorTopics DefaultSensorTopics() {
   cartographer_ros_msgs::msg::SensorTopics topics;
   topics.laser_scan_topic = kLaserScanTopic;
@@ -63,20 +70,41 @@ cartographer_ros_msgs::msg::SensorTopics DefaultSensorTopics() {
 }
 
 // Subscribes to the 'topic' for 'trajectory_id' using the 'node_handle' and
-// calls 'handler' on the 'node' to handle messages. Returns the subscriber.
+// calls 'handler' on the 'node' to handle messages in 'callback_group'.
+// Returns the subscriber.
 template <typename MessageType>
 ::rclcpp::SubscriptionBase::SharedPtr SubscribeWithHandler(
     void (Node::*handler)(int, const std::string&,
                           const typename MessageType::ConstSharedPtr),
     const int trajectory_id, const std::string& topic,
     ::rclcpp::Node::SharedPtr node_handle, Node* const node,
-    rmw_qos_profile_t custom_qos_profile) {
+    rmw_qos_profile_t custom_qos_profile,
+    ::rclcpp::callback_group::CallbackGroup::SharedPtr callback_group) {
+  // Taking a ConstSharedPtr lets publishers in the same process hand over
+  // their messages without a copy if intra-process communication is enabled.
   return node_handle->create_subscription<MessageType>(
       topic,
       [node, handler, trajectory_id, topic](const typename MessageType::ConstSharedPtr msg) {
             (node->*handler)(trajectory_id, topic, msg);
       },
-      custom_qos_profile);
+      custom_qos_profile, callback_group);
+}
+
+// Returns after how many submap lists a full list is published.
+int ComputeSubmapListFullUpdateInterval(const NodeOptions& options) {
+  if (options.submap_list_full_update_period_sec <= 0.) {
+    return 1;
+  }
+  return std::max(1, static_cast<int>(std::lround(
+                         options.submap_list_full_update_period_sec /
+                         options.submap_publish_period_sec)));
+}
+
+// Returns how many poses cover 'pose_history_duration_sec'.
+size_t ComputePoseHistorySize(const NodeOptions& options) {
+  return std::max<size_t>(
+      1, static_cast<size_t>(std::ceil(options.pose_history_duration_sec /
+                                       options.pose_publish_period_sec)));
 }
 
 }  // namespace
@@ -87,20 +115,38 @@ using carto::transform::Rigid3d;
 
 Node::Node(const NodeOptions& node_options, rclcpp::Node::SharedPtr node_handle, tf2_ros::Buffer* const tf_buffer)
     : node_options_(node_options),
-      map_builder_bridge_(node_options_, tf_buffer),
-      node_handle_(node_handle) {
-  carto::common::MutexLocker lock(&mutex_);
+      ingest_statistics_([this] { return FromRos(clock_->now()); }),
+      lock_statistics_(runtime_statistics_.AddLock("Node::mutex_")),
+      map_builder_bridge_(
+          node_options_, tf_buffer, &ingest_statistics_, &runtime_statistics_,
+          [this](const int trajectory_id, const carto::common::Time time,
+                 const Rigid3d& local_pose) {
+            AddLocalPoseToExtrapolator(trajectory_id, time, local_pose);
+          }),
+      submap_list_encoder_(ComputeSubmapListFullUpdateInterval(node_options_)),
+      node_handle_(node_handle),
+      occupancy_grid_compositor_(node_options_.occupancy_grid_resolution,
+                                 kOccupancyGridTileSizeInPixels) {
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   rmw_qos_profile_t custom_qos_profile = rmw_qos_profile_default;
 
   custom_qos_profile.depth = 50;
   custom_qos_profile.reliability = RMW_QOS_POLICY_RELIABILITY_BEST_EFFORT;
   custom_qos_profile.history = RMW_QOS_POLICY_HISTORY_KEEP_LAST;
 
+  publishing_callback_group_ = node_handle_->create_callback_group(
+      ::rclcpp::callback_group::CallbackGroupType::MutuallyExclusive);
+  service_callback_group_ = node_handle_->create_callback_group(
+      ::rclcpp::callback_group::CallbackGroupType::MutuallyExclusive);
+
   submap_list_publisher_ =
       node_handle_->create_publisher<::cartographer_ros_msgs::msg::SubmapList>(
           kSubmapListTopic, custom_qos_profile);
       // node_handle_.advertise<::cartographer_ros_msgs::SubmapList>(
       //     kSubmapListTopic, kLatestOnlyPublisherQueueSize);
+  submap_textures_publisher_ =
+      node_handle_->create_publisher<::cartographer_ros_msgs::msg::SubmapTextures>(
+          kSubmapTexturesTopic, custom_qos_profile);
   trajectory_node_list_publisher_ =
       node_handle_->create_publisher<::visualization_msgs::msg::MarkerArray>(
           kTrajectoryNodeListTopic, custom_qos_profile);
@@ -112,156 +158,486 @@ Node::Node(const NodeOptions& node_options, rclcpp::Node::SharedPtr node_handle,
       // node_handle_.advertise<::visualization_msgs::MarkerArray>(
       //     kConstraintListTopic, kLatestOnlyPublisherQueueSize);
   service_servers_.push_back(node_handle_->create_service<cartographer_ros_msgs::srv::SubmapQuery>(
-      kSubmapQueryServiceName, std::bind(&Node::HandleSubmapQuery, this, std::placeholders::_1, std::placeholders::_2)));
+      kSubmapQueryServiceName, std::bind(&Node::HandleSubmapQuery, this, std::placeholders::_1, std::placeholders::_2),
+      rmw_qos_profile_services_default, service_callback_group_));
+  service_servers_.push_back(node_handle_->create_service<cartographer_ros_msgs::srv::PoseQuery>(
+      kPoseQueryServiceName, std::bind(&Node::HandlePoseQuery, this, std::placeholders::_1, std::placeholders::_2),
+      rmw_qos_profile_services_default, service_callback_group_));
   service_servers_.push_back(node_handle_->create_service<cartographer_ros_msgs::srv::StartTrajectory>(
-      kStartTrajectoryServiceName, std::bind(&Node::HandleStartTrajectory, this, std::placeholders::_1, std::placeholders::_2)));
+      kStartTrajectoryServiceName, std::bind(&Node::HandleStartTrajectory, this, std::placeholders::_1, std::placeholders::_2),
+      rmw_qos_profile_services_default, service_callback_group_));
   service_servers_.push_back(node_handle_->create_service<cartographer_ros_msgs::srv::FinishTrajectory>(
-      kFinishTrajectoryServiceName, std::bind(&Node::HandleFinishTrajectory, this, std::placeholders::_1, std::placeholders::_2)));
+      kFinishTrajectoryServiceName, std::bind(&Node::HandleFinishTrajectory, this, std::placeholders::_1, std::placeholders::_2),
+      rmw_qos_profile_services_default, service_callback_group_));
   service_servers_.push_back(node_handle_->create_service<cartographer_ros_msgs::srv::WriteState>(
-      kWriteStateServiceName, std::bind(&Node::HandleWriteState, this, std::placeholders::_1, std::placeholders::_2)));
+      kWriteStateServiceName, std::bind(&Node::HandleWriteState, this, std::placeholders::_1, std::placeholders::_2),
+      rmw_qos_profile_services_default, service_callback_group_));
+  service_servers_.push_back(node_handle_->create_service<cartographer_ros_msgs::srv::GetRuntimeStatistics>(
+      kGetRuntimeStatisticsServiceName, std::bind(&Node::HandleGetRuntimeStatistics, this, std::placeholders::_1, std::placeholders::_2),
+      rmw_qos_profile_services_default, service_callback_group_));
+  service_servers_.push_back(node_handle_->create_service<cartographer_ros_msgs::srv::OccupancyGridQuery>(
+      kOccupancyGridQueryServiceName, std::bind(&Node::HandleOccupancyGridQuery, this, std::placeholders::_1, std::placeholders::_2),
+      rmw_qos_profile_services_default, service_callback_group_));
 
   scan_matched_point_cloud_publisher_ =
       node_handle_->create_publisher<sensor_msgs::msg::PointCloud2>(
           kScanMatchedPointCloudTopic, custom_qos_profile);
+  tracked_pose_publisher_ =
+      node_handle_->create_publisher<::cartographer_ros_msgs::msg::TrajectoryPose>(
+          kTrackedPoseTopic, custom_qos_profile);
+  ingest_statistics_publisher_ =
+      node_handle_->create_publisher<::cartographer_ros_msgs::msg::IngestStatistics>(
+          kIngestStatisticsTopic, custom_qos_profile);
+  runtime_statistics_publisher_ =
+      node_handle_->create_publisher<::cartographer_ros_msgs::msg::RuntimeStatistics>(
+          kRuntimeStatisticsTopic, custom_qos_profile);
+  write_state_status_publisher_ =
+      node_handle_->create_publisher<::cartographer_ros_msgs::msg::WriteStateStatus>(
+          kWriteStateStatusTopic, custom_qos_profile);
+  if (node_options_.occupancy_grid_publish_period_sec > 0.) {
+    occupancy_grid_publisher_ =
+        node_handle_->create_publisher<::nav_msgs::msg::OccupancyGrid>(
+            kOccupancyGridTopic, custom_qos_profile);
+  }
 
   tf_broadcaster_ = std::make_shared<tf2_ros::TransformBroadcaster>(node_handle_);
 
+  // Latched like the static transforms are published.
+  rmw_qos_profile_t static_transforms_qos_profile = rmw_qos_profile_default;
+  static_transforms_qos_profile.depth = 100;
+  static_transforms_qos_profile.durability =
+      RMW_QOS_POLICY_DURABILITY_TRANSIENT_LOCAL;
+  static_transforms_subscriber_ =
+      node_handle_->create_subscription<tf2_msgs::msg::TFMessage>(
+          kTfStaticTopic,
+          std::bind(&Node::HandleStaticTransforms, this,
+                    std::placeholders::_1),
+          static_transforms_qos_profile);
+
   wall_timers_.push_back(node_handle_->create_wall_timer(
     std::chrono::milliseconds(int(node_options_.submap_publish_period_sec * 1000)),
-    std::bind(&Node::PublishSubmapList, this)));
+    std::bind(&Node::PublishSubmapList, this), publishing_callback_group_));
   wall_timers_.push_back(node_handle_->create_wall_timer(
-    std::chrono::milliseconds(int(node_options_.pose_publish_period_sec * 1000)),
-    std::bind(&Node::PublishTrajectoryStates, this)));
+    std::chrono::milliseconds(int(node_options_.point_cloud_publish_period_sec * 1000)),
+    std::bind(&Node::PublishTrajectoryStates, this), publishing_callback_group_));
   wall_timers_.push_back(node_handle_->create_wall_timer(
     std::chrono::milliseconds(int(node_options_.trajectory_publish_period_sec * 1000)),
-    std::bind(&Node::PublishTrajectoryNodeList, this)));
+    std::bind(&Node::PublishTrajectoryNodeList, this), publishing_callback_group_));
   wall_timers_.push_back(node_handle_->create_wall_timer(
     std::chrono::milliseconds(int(kConstraintPublishPeriodSec * 1000)),
-    std::bind(&Node::PublishConstraintList, this)));
+    std::bind(&Node::PublishConstraintList, this), publishing_callback_group_));
+  wall_timers_.push_back(node_handle_->create_wall_timer(
+    std::chrono::milliseconds(int(kIngestStatisticsPublishPeriodSec * 1000)),
+    std::bind(&Node::PublishIngestStatistics, this), publishing_callback_group_));
+  wall_timers_.push_back(node_handle_->create_wall_timer(
+    std::chrono::milliseconds(int(kRuntimeStatisticsPublishPeriodSec * 1000)),
+    std::bind(&Node::PublishRuntimeStatistics, this), publishing_callback_group_));
 
   ts_ = std::make_shared<rclcpp::TimeSource>(node_handle_);
   clock_ = std::make_shared<rclcpp::Clock>(RCL_ROS_TIME);
   ts_->attachClock(clock_);
+
+  pose_publisher_thread_ =
+      std::thread([this] { SpinPosePublisherThreadForever(); });
+  if (occupancy_grid_publisher_ != nullptr) {
+    occupancy_grid_thread_ =
+        std::thread([this] { SpinOccupancyGridThreadForever(); });
+  }
 }
 
-Node::~Node() {}
+Node::~Node() {
+  pose_publisher_shutdown_ = true;
+  occupancy_grid_shutdown_ = true;
+  pose_publisher_thread_.join();
+  if (occupancy_grid_thread_.joinable()) {
+    occupancy_grid_thread_.join();
+  }
+  // The background writer publishes its result.
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
+  map_builder_bridge_.WaitForSerialization();
+}
 
 ::rclcpp::Node::SharedPtr Node::node_handle() { return node_handle_; }
 
 void Node::HandleSubmapQuery(
     const std::shared_ptr<::cartographer_ros_msgs::srv::SubmapQuery::Request> request,
     std::shared_ptr<::cartographer_ros_msgs::srv::SubmapQuery::Response> response) {
-  carto::common::MutexLocker lock(&mutex_);
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "HandleSubmapQuery");
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   map_builder_bridge_.HandleSubmapQuery(request, response);
   return;
 }
 
+void Node::HandlePoseQuery(
+    const std::shared_ptr<::cartographer_ros_msgs::srv::PoseQuery::Request> request,
+    std::shared_ptr<::cartographer_ros_msgs::srv::PoseQuery::Response> response) {
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_, "HandlePoseQuery");
+  std::unique_ptr<Rigid3d> pose;
+  {
+    carto::common::MutexLocker lock(&pose_history_mutex_);
+    const auto it = pose_histories_.find(request->trajectory_id);
+    if (it == pose_histories_.end()) {
+      response->error_message = "No poses were published for trajectory " +
+                                std::to_string(request->trajectory_id) + ".";
+      return;
+    }
+    pose = it->second->LookUp(FromRos(request->stamp));
+  }
+  if (pose == nullptr) {
+    response->error_message = "The requested time is not in the pose history.";
+    return;
+  }
+  response->pose = ToGeometryMsgPose(*pose);
+}
+
 void Node::PublishSubmapList() {
-  carto::common::MutexLocker lock(&mutex_);
-  submap_list_publisher_->publish(map_builder_bridge_.GetSubmapList(clock_));
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "PublishSubmapList");
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
+  // Subscribers which just connected need a full update to start from. This
+  // also resynchronizes them if nothing was published for a while.
+  const size_t num_subscribers =
+      node_handle_->count_subscribers(kSubmapListTopic);
+  const bool has_new_subscribers =
+      num_subscribers > num_submap_list_subscribers_;
+  num_submap_list_subscribers_ = num_subscribers;
+  const size_t num_textures_subscribers =
+      node_handle_->count_subscribers(kSubmapTexturesTopic);
+  // Subscribers get the current textures from the submap query service, so
+  // only changes after they connected are pushed.
+  const bool start_pushing_textures =
+      num_textures_subscribers > 0 && num_submap_textures_subscribers_ == 0;
+  num_submap_textures_subscribers_ = num_textures_subscribers;
+  if (num_subscribers == 0 && num_textures_subscribers == 0) {
+    return;
+  }
+  const auto submap_list = map_builder_bridge_.GetSubmapList(clock_);
+  // The textures go out before the list, so that subscribers of both do not
+  // query the textures of the updated submaps.
+  if (num_textures_subscribers > 0) {
+    PushSubmapTextures(submap_list, start_pushing_textures);
+  }
+  if (num_subscribers > 0) {
+    submap_list_publisher_->publish(
+        submap_list_encoder_.Encode(submap_list, has_new_subscribers));
+  }
 }
 
-void Node::AddExtrapolator(const int trajectory_id,
-                           const TrajectoryOptions& options) {
+void Node::PushSubmapTextures(
+    const ::cartographer_ros_msgs::msg::SubmapList& submap_list,
+    const bool only_record_versions) {
+  std::map<std::pair<int, int>, int> pushed_submap_versions;
+  for (const auto& submap_entry : submap_list.submap) {
+    const std::pair<int, int> key(submap_entry.trajectory_id,
+                                  submap_entry.submap_index);
+    const auto it = pushed_submap_versions_.find(key);
+    if (only_record_versions || (it != pushed_submap_versions_.end() &&
+                                 it->second == submap_entry.submap_version)) {
+      pushed_submap_versions.emplace(key, submap_entry.submap_version);
+      continue;
+    }
+    ::cartographer_ros_msgs::msg::SubmapTextures submap_textures;
+    const auto textures = map_builder_bridge_.GetSubmapTextures(
+        carto::mapping::SubmapId{submap_entry.trajectory_id,
+                                 submap_entry.submap_index},
+        &submap_textures.submap_version);
+    if (textures == nullptr) {
+      continue;
+    }
+    submap_textures.header = submap_list.header;
+    submap_textures.trajectory_id = submap_entry.trajectory_id;
+    submap_textures.submap_index = submap_entry.submap_index;
+    submap_textures.textures = *textures;
+    submap_textures_publisher_->publish(submap_textures);
+    pushed_submap_versions.emplace(key, submap_textures.submap_version);
+  }
+  pushed_submap_versions_ = std::move(pushed_submap_versions);
+}
+
+void Node::AddTrajectoryIngestion(const int trajectory_id,
+                                  const TrajectoryOptions& options) {
   constexpr double kExtrapolationEstimationTimeSec = 0.001;  // 1 ms
-  CHECK(extrapolators_.count(trajectory_id) == 0);
   const double gravity_time_constant =
       node_options_.map_builder_options.use_trajectory_builder_3d()
           ? options.trajectory_builder_options.trajectory_builder_3d_options()
                 .imu_gravity_time_constant()
           : options.trajectory_builder_options.trajectory_builder_2d_options()
                 .imu_gravity_time_constant();
-  extrapolators_.emplace(
-      std::piecewise_construct, std::forward_as_tuple(trajectory_id),
-      std::forward_as_tuple(
-          ::cartographer::common::FromSeconds(kExtrapolationEstimationTimeSec),
-          gravity_time_constant));
+  auto ingestion = carto::common::make_unique<TrajectoryIngestion>(
+      map_builder_bridge_.sensor_bridge(trajectory_id),
+      ::cartographer::common::FromSeconds(kExtrapolationEstimationTimeSec),
+      gravity_time_constant, options);
+  carto::common::MutexLocker lock(&ingestion_mutex_);
+  CHECK(trajectory_ingestions_.count(trajectory_id) == 0);
+  trajectory_ingestions_.emplace(trajectory_id, std::move(ingestion));
 }
 
-void Node::AddSensorSamplers(const int trajectory_id,
-                             const TrajectoryOptions& options) {
-  CHECK(sensor_samplers_.count(trajectory_id) == 0);
-  sensor_samplers_.emplace(
-      std::piecewise_construct, std::forward_as_tuple(trajectory_id),
-      std::forward_as_tuple(options.rangefinder_sampling_ratio,
-                            options.odometry_sampling_ratio,
-                            options.imu_sampling_ratio));
+Node::TrajectoryIngestion* Node::GetTrajectoryIngestion(
+    const int trajectory_id) {
+  carto::common::MutexLocker lock(&ingestion_mutex_);
+  return trajectory_ingestions_.at(trajectory_id).get();
+}
+
+void Node::AddLocalPoseToExtrapolator(const int trajectory_id,
+                                      const carto::common::Time time,
+                                      const Rigid3d& local_pose) {
+  TrajectoryIngestion* ingestion;
+  {
+    carto::common::MutexLocker lock(&ingestion_mutex_);
+    const auto it = trajectory_ingestions_.find(trajectory_id);
+    if (it == trajectory_ingestions_.end()) {
+      return;
+    }
+    ingestion = it->second.get();
+  }
+  carto::common::MutexLocker lock(&ingestion->extrapolator_mutex);
+  ingestion->extrapolator.AddPose(time, local_pose);
+}
+
+void Node::ReportRangefinderLatency(const int trajectory_id,
+                                    const std::string& sensor_id,
+                                    const builtin_interfaces::msg::Time& stamp,
+                                    TrajectoryIngestion* const ingestion) {
+  AdaptiveSampler& sampler = ingestion->sensor_samplers.rangefinder_sampler;
+  const double latency_sec =
+      carto::common::ToSeconds(FromRos(clock_->now()) - FromRos(stamp));
+  if (sampler.ReportLatency(latency_sec)) {
+    LOG(WARNING) << "Rangefinder latency of trajectory " << trajectory_id
+                 << " is " << sampler.latency_sec()
+                 << " s, using a sampling ratio of " << sampler.ratio()
+                 << " now.";
+  }
+  ingest_statistics_.RecordSamplingRatio(trajectory_id, sensor_id,
+                                         sampler.ratio());
 }
 
 void Node::PublishTrajectoryStates() {
-  carto::common::MutexLocker lock(&mutex_);
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "PublishTrajectoryStates");
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
+  const bool publish_point_clouds =
+      node_handle_->count_subscribers(kScanMatchedPointCloudTopic) > 0;
+  auto pose_publisher_states = std::make_shared<PosePublisherStates>();
   for (const auto& entry : map_builder_bridge_.GetTrajectoryStates()) {
     const auto& trajectory_state = entry.second;
 
-    auto& extrapolator = extrapolators_.at(entry.first);
+    TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(entry.first);
     // We only publish a point cloud if it has changed. It is not needed at high
     // frequency, and republishing it would be computationally wasteful.
-    if (trajectory_state.local_slam_data->time !=
-        extrapolator.GetLastPoseTime()) {
-      // TODO(gaschler): Consider using other message without time information.
-      carto::sensor::TimedPointCloud point_cloud;
-      point_cloud.reserve(
-          trajectory_state.local_slam_data->range_data_in_local.returns.size());
-      for (const Eigen::Vector3f point :
-           trajectory_state.local_slam_data->range_data_in_local.returns) {
-        Eigen::Vector4f point_time;
-        point_time << point, 0.f;
-        point_cloud.push_back(point_time);
+    carto::common::Time& last_local_slam_time =
+        last_local_slam_times_[entry.first];
+    const bool has_new_local_pose =
+        trajectory_state.local_slam_data->time != last_local_slam_time;
+    last_local_slam_time = trajectory_state.local_slam_data->time;
+    if (has_new_local_pose && publish_point_clouds) {
+      const carto::common::int64 timestamp =
+          carto::common::ToUniversal(trajectory_state.local_slam_data->time);
+      const carto::transform::Rigid3f local_to_map =
+          trajectory_state.local_to_map.cast<float>();
+      const auto& returns =
+          trajectory_state.local_slam_data->range_data_in_local.returns;
+      if (node_options_.use_intra_process_comms) {
+        // The message is handed over as a unique_ptr, so subscribers in the
+        // same process get it without serialization or another copy.
+        auto point_cloud_msg =
+            carto::common::make_unique<sensor_msgs::msg::PointCloud2>();
+        ToPointCloud2Message(timestamp, node_options_.map_frame, local_to_map,
+                             returns, point_cloud_msg.get());
+        scan_matched_point_cloud_publisher_->publish(point_cloud_msg);
+      } else {
+        // The message is serialized right away, so its buffer can be reused
+        // for the next point cloud.
+        ToPointCloud2Message(timestamp, node_options_.map_frame, local_to_map,
+                             returns, &scan_matched_point_cloud_);
+        scan_matched_point_cloud_publisher_->publish(
+            scan_matched_point_cloud_);
       }
-      scan_matched_point_cloud_publisher_->publish(ToPointCloud2Message(
-          carto::common::ToUniversal(trajectory_state.local_slam_data->time),
-          node_options_.map_frame,
-          carto::sensor::TransformTimedPointCloud(
-              point_cloud, trajectory_state.local_to_map.cast<float>())));
-      extrapolator.AddPose(trajectory_state.local_slam_data->time,
-                           trajectory_state.local_slam_data->local_pose);
     }
-    geometry_msgs::msg::TransformStamped stamped_transform;
-    // If we do not publish a new point cloud, we still allow time of the
-    // published poses to advance. If we already know a newer pose, we use its
-    // time instead. Since tf knows how to interpolate, providing newer
-    // information is better.
-    const ::cartographer::common::Time now = std::max(
-	FromRos(clock_->now()), extrapolator.GetLastExtrapolatedTime());
+    if (trajectory_state.published_to_tracking != nullptr) {
+      pose_publisher_states->emplace(
+          entry.first,
+          PosePublisherState{
+              trajectory_state.local_to_map,
+              *trajectory_state.published_to_tracking,
+              trajectory_state.trajectory_options.provide_odom_frame,
+              trajectory_state.trajectory_options.odom_frame,
+              trajectory_state.trajectory_options.published_frame, ingestion});
+    }
+  }
+  std::atomic_store(&pose_publisher_states_,
+                    std::shared_ptr<const PosePublisherStates>(
+                        std::move(pose_publisher_states)));
+}
+
+void Node::SpinPosePublisherThreadForever() {
+  const auto period =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(node_options_.pose_publish_period_sec));
+  auto next_publish_time = std::chrono::steady_clock::now();
+  while (!pose_publisher_shutdown_) {
+    next_publish_time += period;
+    std::this_thread::sleep_until(next_publish_time);
+    const std::shared_ptr<const PosePublisherStates> states =
+        std::atomic_load(&pose_publisher_states_);
+    if (states == nullptr) {
+      continue;
+    }
+    const bool publish_tracked_poses =
+        node_handle_->count_subscribers(kTrackedPoseTopic) > 0;
+    for (const auto& entry : *states) {
+      PublishPose(entry.first, entry.second, publish_tracked_poses);
+    }
+  }
+}
+
+void Node::HandleOccupancyGridQuery(
+    const std::shared_ptr<
+        ::cartographer_ros_msgs::srv::OccupancyGridQuery::Request>
+        request,
+    std::shared_ptr<::cartographer_ros_msgs::srv::OccupancyGridQuery::Response>
+        response) {
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "HandleOccupancyGridQuery");
+  if (!(request->min_x < request->max_x && request->min_y < request->max_y)) {
+    response->error_message = "Requested box is empty.";
+    return;
+  }
+  carto::common::MutexLocker lock(&occupancy_grid_mutex_);
+  UpdateOccupancyGrid();
+  if (occupancy_grid_slices_.empty()) {
+    response->error_message = "No submaps yet.";
+    return;
+  }
+  const Eigen::AlignedBox2i box =
+      occupancy_grid_compositor_
+          .ToCanvasBox(Eigen::AlignedBox2d(
+              Eigen::Vector2d(request->min_x, request->min_y),
+              Eigen::Vector2d(request->max_x, request->max_y)))
+          .intersection(occupancy_grid_compositor_.bounds());
+  if (box.isEmpty()) {
+    response->error_message = "No submaps in the requested box.";
+    return;
+  }
+  const double resolution = occupancy_grid_compositor_.resolution();
+  const double requested_resolution =
+      request->resolution > 0. ? request->resolution : resolution;
+  auto painted_slices = occupancy_grid_compositor_.Paint(box);
+  if (requested_resolution != resolution) {
+    painted_slices =
+        ScalePaintedSlices(painted_slices, resolution / requested_resolution);
+  }
+  response->map = CreateOccupancyGrid(painted_slices, requested_resolution,
+                                      node_options_.map_frame, clock_->now());
+}
+
+void Node::UpdateOccupancyGrid() {
+  carto::mapping::MapById<carto::mapping::SubmapId,
+                          carto::mapping::PoseGraph::SubmapData>
+      submap_data;
+  carto::common::Mutex* active_submaps_mutex;
+  {
+    TimedMutexLocker lock(&mutex_, lock_statistics_);
+    submap_data = map_builder_bridge_.GetAllSubmapData();
+    active_submaps_mutex = map_builder_bridge_.trajectory_builder_mutex();
+  }
+  UpdateSubmapSlices(submap_data, active_submaps_mutex,
+                     &occupancy_grid_slices_);
+  occupancy_grid_compositor_.Update(occupancy_grid_slices_);
+}
+
+void Node::SpinOccupancyGridThreadForever() {
+  const auto period =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(
+              node_options_.occupancy_grid_publish_period_sec));
+  auto next_publish_time = std::chrono::steady_clock::now();
+  while (!occupancy_grid_shutdown_) {
+    next_publish_time += period;
+    std::this_thread::sleep_until(next_publish_time);
+    // We do not do any work if nobody listens.
+    if (node_handle_->count_subscribers(kOccupancyGridTopic) == 0) {
+      continue;
+    }
+    carto::common::MutexLocker lock(&occupancy_grid_mutex_);
+    UpdateOccupancyGrid();
+    const Eigen::AlignedBox2i bounds = occupancy_grid_compositor_.bounds();
+    if (bounds.isEmpty()) {
+      continue;
+    }
+    occupancy_grid_publisher_->publish(CreateOccupancyGrid(
+        occupancy_grid_compositor_.Paint(bounds),
+        occupancy_grid_compositor_.resolution(), node_options_.map_frame,
+        clock_->now()));
+  }
+}
+
+void Node::PublishPose(const int trajectory_id,
+                       const PosePublisherState& state,
+                       const bool publish_tracked_pose) {
+  geometry_msgs::msg::TransformStamped stamped_transform;
+  ::cartographer::common::Time now;
+  Rigid3d tracking_to_local;
+  {
+    auto& extrapolator = state.ingestion->extrapolator;
+    carto::common::MutexLocker lock(&state.ingestion->extrapolator_mutex);
+    // If we did not receive a new pose, we still allow time of the published
+    // poses to advance. If we already know a newer pose, we use its time
+    // instead. Since tf knows how to interpolate, providing newer information
+    // is better.
+    now = std::max(FromRos(clock_->now()),
+                   extrapolator.GetLastExtrapolatedTime());
     stamped_transform.header.stamp = ToRos(now);
-    const Rigid3d tracking_to_local = extrapolator.ExtrapolatePose(now);
-    const Rigid3d tracking_to_map =
-	trajectory_state.local_to_map * tracking_to_local;
+    tracking_to_local = extrapolator.ExtrapolatePose(now);
+  }
+  const Rigid3d tracking_to_map = state.local_to_map * tracking_to_local;
 
-    if (trajectory_state.published_to_tracking != nullptr) {
-      if (trajectory_state.trajectory_options.provide_odom_frame) {
-	std::vector<geometry_msgs::msg::TransformStamped> stamped_transforms;
-
-	stamped_transform.header.frame_id = node_options_.map_frame;
-	stamped_transform.child_frame_id =
-	    trajectory_state.trajectory_options.odom_frame;
-	stamped_transform.transform =
-	    ToGeometryMsgTransform(trajectory_state.local_to_map);
-	stamped_transforms.push_back(stamped_transform);
-
-	stamped_transform.header.frame_id =
-	    trajectory_state.trajectory_options.odom_frame;
-	stamped_transform.child_frame_id =
-	    trajectory_state.trajectory_options.published_frame;
-	stamped_transform.transform = ToGeometryMsgTransform(
-	    tracking_to_local * (*trajectory_state.published_to_tracking));
-	stamped_transforms.push_back(stamped_transform);
-
-	tf_broadcaster_->sendTransform(stamped_transforms);
-      } else {
-	stamped_transform.header.frame_id = node_options_.map_frame;
-	stamped_transform.child_frame_id =
-	    trajectory_state.trajectory_options.published_frame;
-	stamped_transform.transform = ToGeometryMsgTransform(
-	    tracking_to_map * (*trajectory_state.published_to_tracking));
-	tf_broadcaster_->sendTransform(stamped_transform);
-      }
+  if (node_options_.pose_history_duration_sec > 0.) {
+    carto::common::MutexLocker lock(&pose_history_mutex_);
+    auto& pose_history = pose_histories_[trajectory_id];
+    if (pose_history == nullptr) {
+      pose_history = carto::common::make_unique<PoseHistory>(
+          ComputePoseHistorySize(node_options_));
     }
+    pose_history->Add(now, tracking_to_map);
+  }
+  if (publish_tracked_pose) {
+    ::cartographer_ros_msgs::msg::TrajectoryPose tracked_pose;
+    tracked_pose.header.stamp = stamped_transform.header.stamp;
+    tracked_pose.header.frame_id = node_options_.map_frame;
+    tracked_pose.trajectory_id = trajectory_id;
+    tracked_pose.pose = ToGeometryMsgPose(tracking_to_map);
+    tracked_pose_publisher_->publish(tracked_pose);
+  }
+
+  if (state.provide_odom_frame) {
+    std::vector<geometry_msgs::msg::TransformStamped> stamped_transforms;
+
+    stamped_transform.header.frame_id = node_options_.map_frame;
+    stamped_transform.child_frame_id = state.odom_frame;
+    stamped_transform.transform = ToGeometryMsgTransform(state.local_to_map);
+    stamped_transforms.push_back(stamped_transform);
+
+    stamped_transform.header.frame_id = state.odom_frame;
+    stamped_transform.child_frame_id = state.published_frame;
+    stamped_transform.transform =
+        ToGeometryMsgTransform(tracking_to_local * state.published_to_tracking);
+    stamped_transforms.push_back(stamped_transform);
+
+    tf_broadcaster_->sendTransform(stamped_transforms);
+  } else {
+    stamped_transform.header.frame_id = node_options_.map_frame;
+    stamped_transform.child_frame_id = state.published_frame;
+    stamped_transform.transform =
+        ToGeometryMsgTransform(tracking_to_map * state.published_to_tracking);
+    tf_broadcaster_->sendTransform(stamped_transform);
   }
 }
 
 void Node::PublishTrajectoryNodeList() {
-  carto::common::MutexLocker lock(&mutex_);
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "PublishTrajectoryNodeList");
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   if (node_handle_->count_subscribers(kTrajectoryNodeListTopic) > 0) {
     trajectory_node_list_publisher_->publish(
         map_builder_bridge_.GetTrajectoryNodeList(clock_));
@@ -269,12 +645,47 @@ void Node::PublishTrajectoryNodeList() {
 }
 
 void Node::PublishConstraintList() {
-  carto::common::MutexLocker lock(&mutex_);
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "PublishConstraintList");
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   if (node_handle_->count_subscribers(kConstraintListTopic) > 0) {
     constraint_list_publisher_->publish(map_builder_bridge_.GetConstraintList(clock_));
   }
 }
 
+void Node::PublishIngestStatistics() {
+  // Always taken, so each message covers one publish period.
+  ::cartographer_ros_msgs::msg::IngestStatistics ingest_statistics =
+      ingest_statistics_.TakeStatistics();
+  if (node_handle_->count_subscribers(kIngestStatisticsTopic) > 0) {
+    ingest_statistics.header.stamp = clock_->now();
+    ingest_statistics_publisher_->publish(ingest_statistics);
+  }
+}
+
+void Node::PublishRuntimeStatistics() {
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "PublishRuntimeStatistics");
+  // Always taken, so each message covers one publish period.
+  ::cartographer_ros_msgs::msg::RuntimeStatistics runtime_statistics =
+      runtime_statistics_.TakeStatistics();
+  if (node_handle_->count_subscribers(kRuntimeStatisticsTopic) > 0) {
+    {
+      TimedMutexLocker lock(&mutex_, lock_statistics_);
+      map_builder_bridge_.AddPoseGraphStatistics(&runtime_statistics);
+      map_builder_bridge_.AddSubmapTextureCacheStatistics(&runtime_statistics);
+    }
+    runtime_statistics.header.stamp = clock_->now();
+    runtime_statistics_publisher_->publish(runtime_statistics);
+  }
+}
+
+void Node::HandleStaticTransforms(
+    const tf2_msgs::msg::TFMessage::ConstSharedPtr) {
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
+  map_builder_bridge_.ClearTransformCaches();
+}
+
 std::unordered_set<std::string> Node::ComputeExpectedTopics(
     const TrajectoryOptions& options,
     const cartographer_ros_msgs::msg::SensorTopics& topics) {
@@ -314,8 +725,7 @@ int Node::AddTrajectory(const TrajectoryOptions& options,
       ComputeExpectedTopics(options, topics);
   const int trajectory_id =
       map_builder_bridge_.AddTrajectory(expected_sensor_ids, options);
-  AddExtrapolator(trajectory_id, options);
-  AddSensorSamplers(trajectory_id, options);
+  AddTrajectoryIngestion(trajectory_id, options);
   LaunchSubscribers(options, topics, trajectory_id);
   is_active_trajectory_[trajectory_id] = true;
   subscribed_topics_.insert(expected_sensor_ids.begin(),
@@ -326,12 +736,20 @@ int Node::AddTrajectory(const TrajectoryOptions& options,
 void Node::LaunchSubscribers(const TrajectoryOptions& options,
                              const cartographer_ros_msgs::msg::SensorTopics& topics,
                              const int trajectory_id) {
+  // All sensor callbacks of a trajectory share a mutually exclusive callback
+  // group, so that messages of a sensor are handled in order, while different
+  // trajectories can be handled concurrently.
+  const auto callback_group = node_handle_->create_callback_group(
+      ::rclcpp::callback_group::CallbackGroupType::MutuallyExclusive);
+  sensor_callback_groups_[trajectory_id] = callback_group;
   rmw_qos_profile_t custom_qos_profile = rmw_qos_profile_default;
 
   custom_qos_profile.history = RMW_QOS_POLICY_HISTORY_KEEP_LAST;
   custom_qos_profile.depth = 50;
   custom_qos_profile.reliability = RMW_QOS_POLICY_RELIABILITY_BEST_EFFORT;
   custom_qos_profile.durability = RMW_QOS_POLICY_DURABILITY_VOLATILE;
+  // With 'use_intra_process_comms', publishers in the same process hand their
+  // messages over directly, which needs the keep last history.
 
   // TODO(mikaelarguedas) pass qos profile aroung
   for (const std::string& topic : ComputeRepeatedTopicNames(
@@ -339,7 +757,7 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<sensor_msgs::msg::LaserScan>(
              &Node::HandleLaserScanMessage, trajectory_id, topic, node_handle_,
-             this, custom_qos_profile),
+             this, custom_qos_profile, callback_group),
          topic});
   }
   for (const std::string& topic :
@@ -348,7 +766,7 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<sensor_msgs::msg::MultiEchoLaserScan>(
              &Node::HandleMultiEchoLaserScanMessage, trajectory_id, topic,
-             node_handle_, this, custom_qos_profile),
+             node_handle_, this, custom_qos_profile, callback_group),
          topic});
   }
   for (const std::string& topic : ComputeRepeatedTopicNames(
@@ -356,7 +774,7 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<sensor_msgs::msg::PointCloud2>(
              &Node::HandlePointCloud2Message, trajectory_id, topic,
-             node_handle_, this, custom_qos_profile),
+             node_handle_, this, custom_qos_profile, callback_group),
          topic});
   }
 
@@ -370,7 +788,7 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<sensor_msgs::msg::Imu>(&Node::HandleImuMessage,
                                                      trajectory_id, topic,
-                                                     node_handle_, this, custom_qos_profile),
+                                                     node_handle_, this, custom_qos_profile, callback_group),
          topic});
   }
 
@@ -379,7 +797,7 @@ void Node::LaunchSubscribers(const TrajectoryOptions& options,
     subscribers_[trajectory_id].push_back(
         {SubscribeWithHandler<nav_msgs::msg::Odometry>(&Node::HandleOdometryMessage,
                                                        trajectory_id, topic,
-                                                       node_handle_, this, custom_qos_profile),
+                                                       node_handle_, this, custom_qos_profile, callback_group),
          topic});
   }
 }
@@ -425,7 +843,13 @@ bool Node::FinishTrajectoryUnderLock(const int trajectory_id) {
     LOG(INFO) << "Shutdown the subscriber of [" << entry.topic << "]";
   }
   CHECK_EQ(subscribers_.erase(trajectory_id), 1);
+  sensor_callback_groups_.erase(trajectory_id);
   CHECK(is_active_trajectory_.at(trajectory_id));
+  // Holding the ingestion lock makes sure no callback is still using the
+  // SensorBridge which is destroyed when finishing the trajectory.
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  carto::common::MutexLocker ingestion_lock(&ingestion->mutex);
+  ingestion->sensor_bridge = nullptr;
   map_builder_bridge_.FinishTrajectory(trajectory_id);
   is_active_trajectory_[trajectory_id] = false;
   return true;
@@ -434,7 +858,9 @@ bool Node::FinishTrajectoryUnderLock(const int trajectory_id) {
 void Node::HandleStartTrajectory(
     const std::shared_ptr<::cartographer_ros_msgs::srv::StartTrajectory::Request> request,
     std::shared_ptr<::cartographer_ros_msgs::srv::StartTrajectory::Response> response) {
-  carto::common::MutexLocker lock(&mutex_);
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "HandleStartTrajectory");
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   TrajectoryOptions options;
   if (!FromRosMessage(request->options, &options) ||
       !ValidateTrajectoryOptions(options)) {
@@ -450,25 +876,24 @@ void Node::HandleStartTrajectory(
 }
 
 void Node::StartTrajectoryWithDefaultTopics(const TrajectoryOptions& options) {
-  carto::common::MutexLocker lock(&mutex_);
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   CHECK(ValidateTrajectoryOptions(options));
   AddTrajectory(options, DefaultSensorTopics());
 }
 
 std::unordered_set<std::string> Node::ComputeDefaultTopics(
     const TrajectoryOptions& options) {
-  carto::common::MutexLocker lock(&mutex_);
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   return ComputeExpectedTopics(options, DefaultSensorTopics());
 }
 
 int Node::AddOfflineTrajectory(
     const std::unordered_set<std::string>& expected_sensor_ids,
     const TrajectoryOptions& options) {
-  carto::common::MutexLocker lock(&mutex_);
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   const int trajectory_id =
       map_builder_bridge_.AddTrajectory(expected_sensor_ids, options);
-  AddExtrapolator(trajectory_id, options);
-  AddSensorSamplers(trajectory_id, options);
+  AddTrajectoryIngestion(trajectory_id, options);
   is_active_trajectory_[trajectory_id] = true;
   return trajectory_id;
 }
@@ -476,8 +901,10 @@ int Node::AddOfflineTrajectory(
 void Node::HandleFinishTrajectory(
     const std::shared_ptr<::cartographer_ros_msgs::srv::FinishTrajectory::Request> request,
     std::shared_ptr<::cartographer_ros_msgs::srv::FinishTrajectory::Response> response) {
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "HandleFinishTrajectory");
   (void)response;
-  carto::common::MutexLocker lock(&mutex_);
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   FinishTrajectoryUnderLock(request->trajectory_id);
   return;
 }
@@ -485,14 +912,48 @@ void Node::HandleFinishTrajectory(
 void Node::HandleWriteState(
     const std::shared_ptr<::cartographer_ros_msgs::srv::WriteState::Request> request,
     std::shared_ptr<::cartographer_ros_msgs::srv::WriteState::Response> response) {
-  (void)response;
-  carto::common::MutexLocker lock(&mutex_);
-  map_builder_bridge_.SerializeState(request->filename);
-  return;
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "HandleWriteState");
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
+  if (!request->asynchronous) {
+    map_builder_bridge_.SerializeState(request->filename);
+    return;
+  }
+  const std::string filename = request->filename;
+  const auto start_time = std::chrono::steady_clock::now();
+  if (!map_builder_bridge_.SerializeStateAsync(
+          filename, [this, filename, start_time](const std::string& error_message) {
+            ::cartographer_ros_msgs::msg::WriteStateStatus status;
+            status.filename = filename;
+            status.success = error_message.empty();
+            status.error_message = error_message;
+            status.duration_sec =
+                std::chrono::duration_cast<std::chrono::duration<double>>(
+                    std::chrono::steady_clock::now() - start_time)
+                    .count();
+            write_state_status_publisher_->publish(status);
+          })) {
+    response->error_message = "A state is still being written.";
+  }
+}
+
+void Node::HandleGetRuntimeStatistics(
+    const std::shared_ptr<
+        ::cartographer_ros_msgs::srv::GetRuntimeStatistics::Request>,
+    std::shared_ptr<
+        ::cartographer_ros_msgs::srv::GetRuntimeStatistics::Response>
+        response) {
+  RuntimeStatistics::ScopedTimer timer(&runtime_statistics_,
+                                       "HandleGetRuntimeStatistics");
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
+  response->statistics = runtime_statistics_.GetStatistics();
+  map_builder_bridge_.AddPoseGraphStatistics(&response->statistics);
+  map_builder_bridge_.AddSubmapTextureCacheStatistics(&response->statistics);
+  response->statistics.header.stamp = clock_->now();
 }
 
 void Node::FinishAllTrajectories() {
-  carto::common::MutexLocker lock(&mutex_);
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   for (auto& entry : is_active_trajectory_) {
     const int trajectory_id = entry.first;
     if (entry.second) {
@@ -502,13 +963,13 @@ void Node::FinishAllTrajectories() {
 }
 
 bool Node::FinishTrajectory(const int trajectory_id) {
-  carto::common::MutexLocker lock(&mutex_);
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   return FinishTrajectoryUnderLock(trajectory_id);
 }
 
 void Node::RunFinalOptimization() {
   {
-    carto::common::MutexLocker lock(&mutex_);
+    TimedMutexLocker lock(&mutex_, lock_statistics_);
     for (const auto& entry : is_active_trajectory_) {
       CHECK(!entry.second);
     }
@@ -521,73 +982,108 @@ void Node::RunFinalOptimization() {
 void Node::HandleOdometryMessage(const int trajectory_id,
                                  const std::string& sensor_id,
                                  const nav_msgs::msg::Odometry::ConstSharedPtr msg) {
-  carto::common::MutexLocker lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).odometry_sampler.Pulse()) {
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  carto::common::MutexLocker lock(&ingestion->mutex);
+  if (ingestion->sensor_bridge == nullptr) {
     return;
   }
-  auto sensor_bridge_ptr = map_builder_bridge_.sensor_bridge(trajectory_id);
-  auto odometry_data_ptr = sensor_bridge_ptr->ToOdometryData(msg);
+  ingest_statistics_.RecordReceived(trajectory_id, sensor_id);
+  if (!ingestion->sensor_samplers.odometry_sampler.Pulse()) {
+    ingest_statistics_.RecordSampledOut(trajectory_id, sensor_id);
+    return;
+  }
+  auto odometry_data_ptr = ingestion->sensor_bridge->ToOdometryData(msg);
   if (odometry_data_ptr != nullptr) {
-    extrapolators_.at(trajectory_id).AddOdometryData(*odometry_data_ptr);
+    carto::common::MutexLocker extrapolator_lock(
+        &ingestion->extrapolator_mutex);
+    ingestion->extrapolator.AddOdometryData(*odometry_data_ptr);
   }
-  sensor_bridge_ptr->HandleOdometryMessage(sensor_id, msg);
+  ingestion->sensor_bridge->HandleOdometryMessage(sensor_id, msg);
 }
 
 void Node::HandleImuMessage(const int trajectory_id,
                             const std::string& sensor_id,
                             const sensor_msgs::msg::Imu::ConstSharedPtr msg) {
-  carto::common::MutexLocker lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).imu_sampler.Pulse()) {
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  carto::common::MutexLocker lock(&ingestion->mutex);
+  if (ingestion->sensor_bridge == nullptr) {
+    return;
+  }
+  ingest_statistics_.RecordReceived(trajectory_id, sensor_id);
+  if (!ingestion->sensor_samplers.imu_sampler.Pulse()) {
+    ingest_statistics_.RecordSampledOut(trajectory_id, sensor_id);
     return;
   }
-  auto sensor_bridge_ptr = map_builder_bridge_.sensor_bridge(trajectory_id);
-  auto imu_data_ptr = sensor_bridge_ptr->ToImuData(msg);
+  auto imu_data_ptr = ingestion->sensor_bridge->ToImuData(msg);
   if (imu_data_ptr != nullptr) {
-    extrapolators_.at(trajectory_id).AddImuData(*imu_data_ptr);
+    carto::common::MutexLocker extrapolator_lock(
+        &ingestion->extrapolator_mutex);
+    ingestion->extrapolator.AddImuData(*imu_data_ptr);
   }
-  sensor_bridge_ptr->HandleImuMessage(sensor_id, msg);
+  ingestion->sensor_bridge->HandleImuMessage(sensor_id, msg);
 }
 
 void Node::HandleLaserScanMessage(const int trajectory_id,
                                   const std::string& sensor_id,
                                   const sensor_msgs::msg::LaserScan::ConstSharedPtr msg) {
-  carto::common::MutexLocker lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).rangefinder_sampler.Pulse()) {
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  carto::common::MutexLocker lock(&ingestion->mutex);
+  if (ingestion->sensor_bridge == nullptr) {
     return;
   }
-  map_builder_bridge_.sensor_bridge(trajectory_id)
-      ->HandleLaserScanMessage(sensor_id, msg);
+  ingest_statistics_.RecordReceived(trajectory_id, sensor_id);
+  if (!ingestion->sensor_samplers.rangefinder_sampler.Pulse()) {
+    ingest_statistics_.RecordSampledOut(trajectory_id, sensor_id);
+    return;
+  }
+  ingestion->sensor_bridge->HandleLaserScanMessage(sensor_id, msg);
+  ReportRangefinderLatency(trajectory_id, sensor_id, msg->header.stamp,
+                           ingestion);
 }
 
 void Node::HandleMultiEchoLaserScanMessage(
     int trajectory_id, const std::string& sensor_id,
     const sensor_msgs::msg::MultiEchoLaserScan::ConstSharedPtr msg) {
-  carto::common::MutexLocker lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).rangefinder_sampler.Pulse()) {
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  carto::common::MutexLocker lock(&ingestion->mutex);
+  if (ingestion->sensor_bridge == nullptr) {
+    return;
+  }
+  ingest_statistics_.RecordReceived(trajectory_id, sensor_id);
+  if (!ingestion->sensor_samplers.rangefinder_sampler.Pulse()) {
+    ingest_statistics_.RecordSampledOut(trajectory_id, sensor_id);
     return;
   }
-  map_builder_bridge_.sensor_bridge(trajectory_id)
-      ->HandleMultiEchoLaserScanMessage(sensor_id, msg);
+  ingestion->sensor_bridge->HandleMultiEchoLaserScanMessage(sensor_id, msg);
+  ReportRangefinderLatency(trajectory_id, sensor_id, msg->header.stamp,
+                           ingestion);
 }
 
 void Node::HandlePointCloud2Message(
     const int trajectory_id, const std::string& sensor_id,
     const sensor_msgs::msg::PointCloud2::ConstSharedPtr msg) {
-  carto::common::MutexLocker lock(&mutex_);
-  if (!sensor_samplers_.at(trajectory_id).rangefinder_sampler.Pulse()) {
+  TrajectoryIngestion* const ingestion = GetTrajectoryIngestion(trajectory_id);
+  carto::common::MutexLocker lock(&ingestion->mutex);
+  if (ingestion->sensor_bridge == nullptr) {
+    return;
+  }
+  ingest_statistics_.RecordReceived(trajectory_id, sensor_id);
+  if (!ingestion->sensor_samplers.rangefinder_sampler.Pulse()) {
+    ingest_statistics_.RecordSampledOut(trajectory_id, sensor_id);
     return;
   }
-  map_builder_bridge_.sensor_bridge(trajectory_id)
-      ->HandlePointCloud2Message(sensor_id, msg);
+  ingestion->sensor_bridge->HandlePointCloud2Message(sensor_id, msg);
+  ReportRangefinderLatency(trajectory_id, sensor_id, msg->header.stamp,
+                           ingestion);
 }
 
 void Node::SerializeState(const std::string& filename) {
-  carto::common::MutexLocker lock(&mutex_);
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   map_builder_bridge_.SerializeState(filename);
 }
 
 void Node::LoadMap(const std::string& map_filename) {
-  carto::common::MutexLocker lock(&mutex_);
+  TimedMutexLocker lock(&mutex_, lock_statistics_);
   map_builder_bridge_.LoadMap(map_filename);
 }
 
@@ -17,8 +17,10 @@
 #ifndef CARTOGRAPHER_ROS_NODE_H_
 #define CARTOGRAPHER_ROS_NODE_H_
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -26,20 +28,36 @@
 #include "cartographer/common/fixed_ratio_sampler.h"
 #include "cartographer/common/mutex.h"
 #include "cartographer/mapping/pose_extrapolator.h"
+#include "cartographer_ros/adaptive_sampler.h"
+#include "cartographer_ros/ingest_statistics.h"
 #include "cartographer_ros/map_builder_bridge.h"
 #include "cartographer_ros/node_constants.h"
 #include "cartographer_ros/node_options.h"
+#include "cartographer_ros/pose_history.h"
+#include "cartographer_ros/runtime_statistics.h"
+#include "cartographer_ros/submap_list_encoder.h"
+#include "cartographer_ros/tiled_submap_compositor.h"
 #include "cartographer_ros/trajectory_options.h"
 #include "cartographer_ros_msgs/srv/finish_trajectory.hpp"
+#include "cartographer_ros_msgs/srv/get_runtime_statistics.hpp"
+#include "cartographer_ros_msgs/srv/occupancy_grid_query.hpp"
+#include "cartographer_ros_msgs/msg/ingest_statistics.hpp"
+#include "cartographer_ros_msgs/srv/pose_query.hpp"
+#include "cartographer_ros_msgs/msg/runtime_statistics.hpp"
 #include "cartographer_ros_msgs/msg/sensor_topics.hpp"
 #include "cartographer_ros_msgs/srv/start_trajectory.hpp"
 #include "cartographer_ros_msgs/msg/submap_entry.hpp"
 #include "cartographer_ros_msgs/msg/submap_list.hpp"
+#include "cartographer_ros_msgs/msg/submap_textures.hpp"
 #include "cartographer_ros_msgs/srv/submap_query.hpp"
 #include "cartographer_ros_msgs/msg/trajectory_options.hpp"
+#include "cartographer_ros_msgs/msg/trajectory_pose.hpp"
+#include "cartographer_ros_msgs/msg/write_state_status.hpp"
 #include "cartographer_ros_msgs/srv/write_state.hpp"
 
+#include <nav_msgs/msg/occupancy_grid.hpp>
 #include <nav_msgs/msg/odometry.hpp>
+#include <tf2_msgs/msg/tf_message.hpp>
 #include <tf2_ros/transform_broadcaster.h>
 #include <rclcpp/rclcpp.hpp>
 
@@ -110,6 +128,10 @@ class Node {
   void HandleSubmapQuery(
       const std::shared_ptr<cartographer_ros_msgs::srv::SubmapQuery::Request> request,
       std::shared_ptr<cartographer_ros_msgs::srv::SubmapQuery::Response> response);
+  void HandlePoseQuery(
+      const std::shared_ptr<cartographer_ros_msgs::srv::PoseQuery::Request> request,
+      std::shared_ptr<cartographer_ros_msgs::srv::PoseQuery::Response> response)
+      EXCLUDES(pose_history_mutex_);
   void HandleStartTrajectory(
       const std::shared_ptr<cartographer_ros_msgs::srv::StartTrajectory::Request> request,
       std::shared_ptr<cartographer_ros_msgs::srv::StartTrajectory::Response> response);
@@ -119,6 +141,13 @@ class Node {
   void HandleWriteState(
       const std::shared_ptr<cartographer_ros_msgs::srv::WriteState::Request> request,
       std::shared_ptr<cartographer_ros_msgs::srv::WriteState::Response> response);
+  void HandleGetRuntimeStatistics(
+      const std::shared_ptr<
+          cartographer_ros_msgs::srv::GetRuntimeStatistics::Request>
+          request,
+      std::shared_ptr<
+          cartographer_ros_msgs::srv::GetRuntimeStatistics::Response>
+          response) EXCLUDES(mutex_);
   // Returns the set of topic names we want to subscribe to.
   std::unordered_set<std::string> ComputeExpectedTopics(
       const TrajectoryOptions& options,
@@ -128,50 +157,183 @@ class Node {
   void LaunchSubscribers(const TrajectoryOptions& options,
                          const cartographer_ros_msgs::msg::SensorTopics& topics,
                          int trajectory_id);
-  void PublishSubmapList();
-  void AddExtrapolator(int trajectory_id, const TrajectoryOptions& options);
-  void AddSensorSamplers(int trajectory_id, const TrajectoryOptions& options);
+  void PublishSubmapList() EXCLUDES(mutex_);
+  // Publishes the textures of the submaps in 'submap_list' whose version
+  // changed since they were last pushed. If 'only_record_versions', nothing
+  // is published, but the current versions are considered pushed.
+  void PushSubmapTextures(
+      const ::cartographer_ros_msgs::msg::SubmapList& submap_list,
+      bool only_record_versions) REQUIRES(mutex_);
+  void AddTrajectoryIngestion(int trajectory_id,
+                              const TrajectoryOptions& options)
+      REQUIRES(mutex_) EXCLUDES(ingestion_mutex_);
+  // Publishes scan matched point clouds and hands the latest trajectory
+  // states to the pose publisher thread.
   void PublishTrajectoryStates();
   void PublishTrajectoryNodeList();
   void PublishConstraintList();
-  void SpinOccupancyGridThreadForever();
+  void PublishIngestStatistics();
+  // Drops the cached static transforms, which may have changed.
+  void HandleStaticTransforms(
+      const tf2_msgs::msg::TFMessage::ConstSharedPtr transforms)
+      EXCLUDES(mutex_);
+  void PublishRuntimeStatistics() EXCLUDES(mutex_);
+  // Returns the occupancy grid of the requested box, which is painted from the
+  // tiles of the current occupancy grid.
+  void HandleOccupancyGridQuery(
+      const std::shared_ptr<
+          ::cartographer_ros_msgs::srv::OccupancyGridQuery::Request>
+          request,
+      std::shared_ptr<::cartographer_ros_msgs::srv::OccupancyGridQuery::Response>
+          response) EXCLUDES(mutex_, occupancy_grid_mutex_);
+  // Brings the occupancy grid tiles up to date with the pose graph. Submaps
+  // are drawn straight from the pose graph, and 'mutex_' is only held to get
+  // them. Active submaps are drawn under the bridge's trajectory builder lock.
+  void UpdateOccupancyGrid() REQUIRES(occupancy_grid_mutex_) EXCLUDES(mutex_);
+  // Draws and publishes the occupancy grid at
+  // 'occupancy_grid_publish_period_sec' until the node is destroyed.
+  void SpinOccupancyGridThreadForever() EXCLUDES(occupancy_grid_mutex_);
   bool ValidateTrajectoryOptions(const TrajectoryOptions& options);
   bool ValidateTopicNames(const ::cartographer_ros_msgs::msg::SensorTopics& topics,
                           const TrajectoryOptions& options);
   bool FinishTrajectoryUnderLock(int trajectory_id) REQUIRES(mutex_);
 
+  struct TrajectoryIngestion;
+  // What the pose publisher thread needs to know about a trajectory.
+  struct PosePublisherState {
+    ::cartographer::transform::Rigid3d local_to_map;
+    ::cartographer::transform::Rigid3d published_to_tracking;
+    bool provide_odom_frame;
+    std::string odom_frame;
+    std::string published_frame;
+    TrajectoryIngestion* ingestion;
+  };
+  using PosePublisherStates = std::map<int, PosePublisherState>;
+
+  // Extrapolates and publishes the poses of all trajectories at
+  // 'pose_publish_period_sec' until the node is destroyed. It only reads
+  // immutable snapshots of the trajectory states and briefly locks the
+  // extrapolators, so it never waits for 'mutex_' or sensor processing.
+  void SpinPosePublisherThreadForever();
+  // Publishes the pose of 'trajectory_id' and records it in its pose history.
+  void PublishPose(int trajectory_id, const PosePublisherState& state,
+                   bool publish_tracked_pose) EXCLUDES(pose_history_mutex_);
+  // Returns the ingestion state of 'trajectory_id'. Entries are never removed,
+  // so the returned pointer stays valid for the lifetime of the node.
+  TrajectoryIngestion* GetTrajectoryIngestion(int trajectory_id)
+      EXCLUDES(ingestion_mutex_);
+  // Feeds a pose estimated by local SLAM to the extrapolator of
+  // 'trajectory_id'. Called on the sensor thread from the local SLAM result
+  // callback, so the published poses do not wait for 'mutex_'.
+  void AddLocalPoseToExtrapolator(int trajectory_id,
+                                  ::cartographer::common::Time time,
+                                  const ::cartographer::transform::Rigid3d&
+                                      local_pose) EXCLUDES(ingestion_mutex_);
+  // Reports the latency of a handled rangefinder message with 'stamp' to the
+  // adaptive rangefinder sampler, and its resulting ratio to the ingest
+  // statistics of 'sensor_id'. 'ingestion->mutex' has to be held.
+  void ReportRangefinderLatency(int trajectory_id, const std::string& sensor_id,
+                                const builtin_interfaces::msg::Time& stamp,
+                                TrajectoryIngestion* ingestion);
+
   const NodeOptions node_options_;
 
   std::shared_ptr<tf2_ros::TransformBroadcaster> tf_broadcaster_;
 
+  // Has to outlive the sensor bridges owned by 'map_builder_bridge_'.
+  IngestStatistics ingest_statistics_;
+  // Has to outlive 'map_builder_bridge_', which records its lock in here.
+  RuntimeStatistics runtime_statistics_;
+
+  RuntimeStatistics::LockStatistics* const lock_statistics_;
   cartographer::common::Mutex mutex_;
   MapBuilderBridge map_builder_bridge_ GUARDED_BY(mutex_);
+  SubmapListEncoder submap_list_encoder_ GUARDED_BY(mutex_);
+  size_t num_submap_list_subscribers_ GUARDED_BY(mutex_) = 0;
+  size_t num_submap_textures_subscribers_ GUARDED_BY(mutex_) = 0;
+  // Versions of the submaps as last pushed, keyed by trajectory ID and submap
+  // index.
+  std::map<std::pair<int, int>, int> pushed_submap_versions_ GUARDED_BY(mutex_);
 
   ::rclcpp::Node::SharedPtr node_handle_;
   ::rclcpp::Publisher<::cartographer_ros_msgs::msg::SubmapList>::SharedPtr submap_list_publisher_;
+  ::rclcpp::Publisher<::cartographer_ros_msgs::msg::SubmapTextures>::SharedPtr submap_textures_publisher_;
   ::rclcpp::Publisher<::visualization_msgs::msg::MarkerArray>::SharedPtr trajectory_node_list_publisher_;
   ::rclcpp::Publisher<::visualization_msgs::msg::MarkerArray>::SharedPtr constraint_list_publisher_;
   // These rclcpp::ServiceBases need to live for the lifetime of the node.
   std::vector<::rclcpp::ServiceBase::SharedPtr> service_servers_;
+  ::rclcpp::SubscriptionBase::SharedPtr static_transforms_subscriber_;
+  // Callback groups are only weakly referenced by the node, so we keep them.
+  ::rclcpp::callback_group::CallbackGroup::SharedPtr publishing_callback_group_;
+  ::rclcpp::callback_group::CallbackGroup::SharedPtr service_callback_group_;
   ::rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr scan_matched_point_cloud_publisher_;
+  // Reused for publishing if intra-process communication is disabled.
+  sensor_msgs::msg::PointCloud2 scan_matched_point_cloud_ GUARDED_BY(mutex_);
+  // Time of the local SLAM result last seen by PublishTrajectoryStates(),
+  // keyed with 'trajectory_id'.
+  std::unordered_map<int, ::cartographer::common::Time> last_local_slam_times_
+      GUARDED_BY(mutex_);
+  ::rclcpp::Publisher<::cartographer_ros_msgs::msg::IngestStatistics>::SharedPtr ingest_statistics_publisher_;
+  ::rclcpp::Publisher<::cartographer_ros_msgs::msg::RuntimeStatistics>::SharedPtr runtime_statistics_publisher_;
+  ::rclcpp::Publisher<::cartographer_ros_msgs::msg::TrajectoryPose>::SharedPtr tracked_pose_publisher_;
+  ::rclcpp::Publisher<::nav_msgs::msg::OccupancyGrid>::SharedPtr occupancy_grid_publisher_;
+  ::rclcpp::Publisher<::cartographer_ros_msgs::msg::WriteStateStatus>::SharedPtr write_state_status_publisher_;
 
   struct TrajectorySensorSamplers {
     TrajectorySensorSamplers(double rangefinder_sampling_ratio,
+                             double rangefinder_min_sampling_ratio,
+                             double rangefinder_max_latency_sec,
                              double odometry_sampling_ratio,
                              double imu_sampling_ratio)
-        : rangefinder_sampler(rangefinder_sampling_ratio),
+        : rangefinder_sampler(rangefinder_sampling_ratio,
+                              rangefinder_min_sampling_ratio,
+                              rangefinder_max_latency_sec),
           odometry_sampler(odometry_sampling_ratio),
           imu_sampler(imu_sampling_ratio) {}
 
-    ::cartographer::common::FixedRatioSampler rangefinder_sampler;
+    AdaptiveSampler rangefinder_sampler;
     ::cartographer::common::FixedRatioSampler odometry_sampler;
     ::cartographer::common::FixedRatioSampler imu_sampler;
   };
 
+  // Sensor ingestion state of a single trajectory. It has its own mutex, so
+  // sensor callbacks only wait for other messages of the same trajectory and
+  // never for publishing or service calls holding 'mutex_'. If both are
+  // needed, 'mutex_' has to be acquired first.
+  struct TrajectoryIngestion {
+    TrajectoryIngestion(SensorBridge* const sensor_bridge,
+                        const ::cartographer::common::Duration
+                            extrapolation_estimation_time,
+                        const double gravity_time_constant,
+                        const TrajectoryOptions& options)
+        : sensor_bridge(sensor_bridge),
+          sensor_samplers(options.rangefinder_sampling_ratio,
+                          options.rangefinder_min_sampling_ratio,
+                          options.rangefinder_max_latency_sec,
+                          options.odometry_sampling_ratio,
+                          options.imu_sampling_ratio),
+          extrapolator(extrapolation_estimation_time, gravity_time_constant) {}
+
+    ::cartographer::common::Mutex mutex;
+    // Set to nullptr once the trajectory is finished.
+    SensorBridge* sensor_bridge GUARDED_BY(mutex);
+    TrajectorySensorSamplers sensor_samplers GUARDED_BY(mutex);
+    // Only held for updating or querying the extrapolator, so the pose
+    // publisher thread is not delayed by sensor processing. If both are
+    // needed, 'mutex' has to be acquired first.
+    ::cartographer::common::Mutex extrapolator_mutex;
+    ::cartographer::mapping::PoseExtrapolator extrapolator
+        GUARDED_BY(extrapolator_mutex);
+  };
+
+  // Only guards lookups in 'trajectory_ingestions_'.
+  ::cartographer::common::Mutex ingestion_mutex_;
   // These are keyed with 'trajectory_id'.
-  std::map<int, ::cartographer::mapping::PoseExtrapolator> extrapolators_;
-  std::unordered_map<int, TrajectorySensorSamplers> sensor_samplers_;
+  std::map<int, std::unique_ptr<TrajectoryIngestion>> trajectory_ingestions_
+      GUARDED_BY(ingestion_mutex_);
   std::unordered_map<int, std::vector<Subscriber>> subscribers_;
+  std::unordered_map<int, ::rclcpp::callback_group::CallbackGroup::SharedPtr>
+      sensor_callback_groups_;
   std::unordered_set<std::string> subscribed_topics_;
   std::unordered_map<int, bool> is_active_trajectory_ GUARDED_BY(mutex_);
 
@@ -181,6 +343,27 @@ class Node {
 
   std::shared_ptr<rclcpp::TimeSource> ts_;
   rclcpp::Clock::SharedPtr clock_;
+
+  // Only accessed through std::atomic_load() and std::atomic_store(), so
+  // replacing the snapshot never blocks the pose publisher thread.
+  std::shared_ptr<const PosePublisherStates> pose_publisher_states_;
+  std::atomic<bool> pose_publisher_shutdown_{false};
+  // Poses published by the pose publisher thread, keyed by 'trajectory_id'.
+  ::cartographer::common::Mutex pose_history_mutex_;
+  std::map<int, std::unique_ptr<PoseHistory>> pose_histories_
+      GUARDED_BY(pose_history_mutex_);
+  std::thread pose_publisher_thread_;
+  // Tiles of the occupancy grid, shared by the occupancy grid thread and the
+  // occupancy grid query. If both are needed, 'occupancy_grid_mutex_' has to be
+  // acquired before 'mutex_'.
+  ::cartographer::common::Mutex occupancy_grid_mutex_;
+  TiledSubmapCompositor occupancy_grid_compositor_
+      GUARDED_BY(occupancy_grid_mutex_);
+  std::map<::cartographer::mapping::SubmapId, ::cartographer::io::SubmapSlice>
+      occupancy_grid_slices_ GUARDED_BY(occupancy_grid_mutex_);
+  // Only started if 'occupancy_grid_publish_period_sec' is positive.
+  std::atomic<bool> occupancy_grid_shutdown_{false};
+  std::thread occupancy_grid_thread_;
 };
 
 }  // namespace cartographer_ros
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/node_component.h"
+
+#include "cartographer/common/make_unique.h"
+#include "cartographer_ros/node_options.h"
+#include "class_loader/class_loader_register_macro.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+NodeComponent::NodeComponent()
+    : ::rclcpp::Node("cartographer_node", "",
+                     true /* use_intra_process_comms */),
+      tf_buffer_(get_clock(),
+                 ::tf2::durationFromSec(kTfBufferCacheTimeInSeconds)),
+      tf_listener_(tf_buffer_) {
+  const std::string configuration_directory =
+      GetParameterOrDefault<std::string>("configuration_directory", "");
+  const std::string configuration_basename =
+      GetParameterOrDefault<std::string>("configuration_basename", "");
+  CHECK(!configuration_directory.empty())
+      << "Parameter 'configuration_directory' is missing.";
+  CHECK(!configuration_basename.empty())
+      << "Parameter 'configuration_basename' is missing.";
+  save_map_filename_ =
+      GetParameterOrDefault<std::string>("save_map_filename", "");
+
+  NodeOptions node_options;
+  TrajectoryOptions trajectory_options;
+  std::tie(node_options, trajectory_options) =
+      LoadOptions(configuration_directory, configuration_basename);
+  // This node is created with intra-process communication, so its own
+  // publishers hand over their messages as well.
+  node_options.use_intra_process_comms = true;
+
+  // The container owns this node and destroys 'node_' first, so the handle
+  // does not need to own it. Being empty, it also leaves the container's
+  // shared pointer to be used by shared_from_this().
+  const ::rclcpp::Node::SharedPtr node_handle(std::shared_ptr<void>(), this);
+  node_ = ::cartographer::common::make_unique<::cartographer_ros::Node>(
+      node_options, node_handle, &tf_buffer_);
+  const std::string map_filename =
+      GetParameterOrDefault<std::string>("map_filename", "");
+  if (!map_filename.empty()) {
+    node_->LoadMap(map_filename);
+  }
+  if (GetParameterOrDefault<bool>("start_trajectory_with_default_topics",
+                                  true)) {
+    node_->StartTrajectoryWithDefaultTopics(trajectory_options);
+  }
+}
+
+NodeComponent::~NodeComponent() {
+  node_->FinishAllTrajectories();
+  node_->RunFinalOptimization();
+  if (!save_map_filename_.empty()) {
+    node_->SerializeState(save_map_filename_);
+  }
+  node_.reset();
+}
+
+template <typename ParameterType>
+ParameterType NodeComponent::GetParameterOrDefault(
+    const std::string& name, const ParameterType& default_value) {
+  ParameterType value;
+  if (!get_parameter(name, value)) {
+    return default_value;
+  }
+  return value;
+}
+
+}  // namespace cartographer_ros
+
+CLASS_LOADER_REGISTER_CLASS(cartographer_ros::NodeComponent, rclcpp::Node)
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_NODE_COMPONENT_H_
+#define CARTOGRAPHER_ROS_NODE_COMPONENT_H_
+
+#include <memory>
+#include <string>
+
+#include "cartographer_ros/node.h"
+#include "cartographer_ros/ros_log_sink.h"
+
+#include <rclcpp/rclcpp.hpp>
+#include <tf2_ros/buffer.h>
+#include <tf2_ros/transform_listener.h>
+
+namespace cartographer_ros {
+
+// The 'cartographer_node' as a component, which a container process loads
+// next to the sensor drivers. Intra-process communication is enabled, so
+// drivers publishing on the node's sensor topics hand over their messages
+// without serialization or a copy.
+//
+// It is configured by the parameters 'configuration_directory',
+// 'configuration_basename', and optionally 'map_filename',
+// 'start_trajectory_with_default_topics' and 'save_map_filename', which have
+// the meaning of the flags of the 'cartographer_node'.
+class NodeComponent : public ::rclcpp::Node {
+ public:
+  NodeComponent();
+  // Finishes all trajectories, runs the final optimization and, if
+  // 'save_map_filename' is set, writes the state.
+  ~NodeComponent() override;
+
+  NodeComponent(const NodeComponent&) = delete;
+  NodeComponent& operator=(const NodeComponent&) = delete;
+
+ private:
+  template <typename ParameterType>
+  ParameterType GetParameterOrDefault(const std::string& name,
+                                      const ParameterType& default_value);
+
+  ScopedRosLogSink ros_log_sink_;
+  std::string save_map_filename_;
+  tf2_ros::Buffer tf_buffer_;
+  tf2_ros::TransformListener tf_listener_;
+  std::unique_ptr<::cartographer_ros::Node> node_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_NODE_COMPONENT_H_
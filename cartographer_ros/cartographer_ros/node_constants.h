@@ -30,14 +30,26 @@ constexpr char kImuTopic[] = "imu";
 constexpr char kOdometryTopic[] = "odom";
 constexpr char kFinishTrajectoryServiceName[] = "finish_trajectory";
 constexpr char kOccupancyGridTopic[] = "map";
+constexpr char kOccupancyGridUpdatesTopic[] = "map_updates";
+constexpr char kOccupancyGridQueryServiceName[] = "occupancy_grid_query";
 constexpr char kScanMatchedPointCloudTopic[] = "scan_matched_points2";
 constexpr char kSubmapListTopic[] = "submap_list";
+constexpr char kSubmapTexturesTopic[] = "submap_textures";
 constexpr char kSubmapQueryServiceName[] = "submap_query";
 constexpr char kStartTrajectoryServiceName[] = "start_trajectory";
+constexpr char kPoseQueryServiceName[] = "pose_query";
+constexpr char kTrackedPoseTopic[] = "tracked_pose";
+constexpr char kTfStaticTopic[] = "/tf_static";
 constexpr char kWriteStateServiceName[] = "write_state";
+constexpr char kWriteStateStatusTopic[] = "write_state_status";
 constexpr char kTrajectoryNodeListTopic[] = "trajectory_node_list";
 constexpr char kConstraintListTopic[] = "constraint_list";
 constexpr double kConstraintPublishPeriodSec = 0.5;
+constexpr char kIngestStatisticsTopic[] = "ingest_statistics";
+constexpr double kIngestStatisticsPublishPeriodSec = 1.;
+constexpr char kRuntimeStatisticsTopic[] = "runtime_statistics";
+constexpr char kGetRuntimeStatisticsServiceName[] = "get_runtime_statistics";
+constexpr double kRuntimeStatisticsPublishPeriodSec = 1.;
 
 constexpr int kInfiniteSubscriberQueueSize = 0;
 constexpr int kLatestOnlyPublisherQueueSize = 1;
@@ -42,16 +42,17 @@ namespace cartographer_ros {
 namespace {
 
 void Run() {
-  auto node_handle = rclcpp::Node::make_shared("cartographer_node");
-  constexpr double kTfBufferCacheTimeInSeconds = 1e6;
-  tf2_ros::Buffer tf_buffer(
-    node_handle->get_clock(), ::tf2::durationFromSec(kTfBufferCacheTimeInSeconds));
-  tf2_ros::TransformListener tf(tf_buffer);
   NodeOptions node_options;
   TrajectoryOptions trajectory_options;
   std::tie(node_options, trajectory_options) =
       LoadOptions(FLAGS_configuration_directory, FLAGS_configuration_basename);
 
+  auto node_handle = rclcpp::Node::make_shared(
+      "cartographer_node", "", node_options.use_intra_process_comms);
+  tf2_ros::Buffer tf_buffer(
+    node_handle->get_clock(), ::tf2::durationFromSec(kTfBufferCacheTimeInSeconds));
+  tf2_ros::TransformListener tf(tf_buffer);
+
   Node node(node_options, node_handle, &tf_buffer);
   if (!FLAGS_map_filename.empty()) {
     node.LoadMap(FLAGS_map_filename);
@@ -61,7 +62,13 @@ void Run() {
     node.StartTrajectoryWithDefaultTopics(trajectory_options);
   }
 
-  rclcpp::spin(node.node_handle());
+  // Sensor data, publishing and services use separate callback groups which
+  // the executor runs concurrently.
+  rclcpp::executors::MultiThreadedExecutor executor(
+      rclcpp::executor::create_default_executor_arguments(),
+      node_options.num_executor_threads);
+  executor.add_node(node.node_handle());
+  executor.spin();
 
   node.FinishAllTrajectories();
   node.RunFinalOptimization();
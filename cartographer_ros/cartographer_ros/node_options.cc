@@ -36,10 +36,25 @@ NodeOptions CreateNodeOptions(
       lua_parameter_dictionary->GetDouble("lookup_transform_timeout_sec");
   options.submap_publish_period_sec =
       lua_parameter_dictionary->GetDouble("submap_publish_period_sec");
+  options.submap_list_full_update_period_sec =
+      lua_parameter_dictionary->GetDouble(
+          "submap_list_full_update_period_sec");
   options.pose_publish_period_sec =
       lua_parameter_dictionary->GetDouble("pose_publish_period_sec");
+  options.point_cloud_publish_period_sec =
+      lua_parameter_dictionary->GetDouble("point_cloud_publish_period_sec");
+  options.pose_history_duration_sec =
+      lua_parameter_dictionary->GetDouble("pose_history_duration_sec");
   options.trajectory_publish_period_sec =
       lua_parameter_dictionary->GetDouble("trajectory_publish_period_sec");
+  options.occupancy_grid_publish_period_sec =
+      lua_parameter_dictionary->GetDouble("occupancy_grid_publish_period_sec");
+  options.occupancy_grid_resolution =
+      lua_parameter_dictionary->GetDouble("occupancy_grid_resolution");
+  options.num_executor_threads =
+      lua_parameter_dictionary->GetNonNegativeInt("num_executor_threads");
+  options.use_intra_process_comms =
+      lua_parameter_dictionary->GetBool("use_intra_process_comms");
   return options;
 }
 
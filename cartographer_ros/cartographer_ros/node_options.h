@@ -27,14 +27,25 @@
 
 namespace cartographer_ros {
 
+// Past poses of the tracking frame are kept in the node's pose history, so the
+// tf buffer of the node only needs to cover the sensor data in flight.
+constexpr double kTfBufferCacheTimeInSeconds = 10.;
+
 // Top-level options of Cartographer's ROS integration.
 struct NodeOptions {
   ::cartographer::mapping::proto::MapBuilderOptions map_builder_options;
   std::string map_frame;
   double lookup_transform_timeout_sec;
   double submap_publish_period_sec;
+  double submap_list_full_update_period_sec;
   double pose_publish_period_sec;
+  double point_cloud_publish_period_sec;
+  double pose_history_duration_sec;
   double trajectory_publish_period_sec;
+  double occupancy_grid_publish_period_sec;
+  double occupancy_grid_resolution;
+  int num_executor_threads;
+  bool use_intra_process_comms;
 };
 
 NodeOptions CreateNodeOptions(
@@ -0,0 +1,244 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/occupancy_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cartographer/common/port.h"
+#include "cartographer/io/image.h"
+#include "cartographer/mapping/probability_values.h"
+#include "cartographer/mapping/proto/submap_visualization.pb.h"
+#include "cartographer/mapping_2d/submaps.h"
+#include "cartographer/mapping_2d/xy_index.h"
+#include "cartographer/transform/transform.h"
+#include "cartographer_ros/ros_map.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+using ::cartographer::io::SubmapSlice;
+using ::cartographer::mapping::SubmapId;
+
+// We use the red channel to track intensity information. The green channel we
+// use to track if a cell was ever observed.
+uint32_t ToCairoPixel(const uint8_t intensity, const uint8_t alpha) {
+  const uint32_t observed = (intensity != 0 || alpha != 0) ? 255 : 0;
+  return (static_cast<uint32_t>(alpha) << 24) |
+         (static_cast<uint32_t>(intensity) << 16) | (observed << 8);
+}
+
+// Creates the surface of 'submap_slice' once its 'cairo_data' is filled.
+void CreateSurface(SubmapSlice* const submap_slice) {
+  const int stride = 4 * submap_slice->width;
+  CHECK_EQ(stride, cairo_format_stride_for_width(
+                       ::cartographer::io::kCairoFormat, submap_slice->width));
+  submap_slice->surface = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create_for_data(
+          reinterpret_cast<unsigned char*>(submap_slice->cairo_data.data()),
+          ::cartographer::io::kCairoFormat, submap_slice->width,
+          submap_slice->height, stride));
+  CHECK_EQ(cairo_surface_status(submap_slice->surface.get()),
+           CAIRO_STATUS_SUCCESS);
+}
+
+// Same cells as ::cartographer::mapping_2d::Submap::ToResponseProto()
+// produces, before they get compressed.
+void FillSubmapSlice2D(const ::cartographer::mapping_2d::Submap& submap,
+                       SubmapSlice* const submap_slice) {
+  const ::cartographer::mapping_2d::ProbabilityGrid& probability_grid =
+      submap.probability_grid();
+  Eigen::Array2i offset;
+  ::cartographer::mapping_2d::CellLimits limits;
+  probability_grid.ComputeCroppedLimits(&offset, &limits);
+  const double resolution = probability_grid.limits().resolution();
+  const double max_x =
+      probability_grid.limits().max().x() - resolution * offset.y();
+  const double max_y =
+      probability_grid.limits().max().y() - resolution * offset.x();
+  submap_slice->width = limits.num_x_cells;
+  submap_slice->height = limits.num_y_cells;
+  submap_slice->resolution = resolution;
+  submap_slice->slice_pose =
+      submap.local_pose().inverse() *
+      ::cartographer::transform::Rigid3d::Translation(
+          Eigen::Vector3d(max_x, max_y, 0.));
+  submap_slice->cairo_data.resize(limits.num_x_cells * limits.num_y_cells);
+  uint32_t* pixel = submap_slice->cairo_data.data();
+  for (const Eigen::Array2i& xy_index :
+       ::cartographer::mapping_2d::XYIndexRangeIterator(limits)) {
+    *pixel = 0;
+    if (probability_grid.IsKnown(xy_index + offset)) {
+      const int delta =
+          128 - ::cartographer::mapping::ProbabilityToLogOddsInteger(
+                    probability_grid.GetProbability(xy_index + offset));
+      const uint8_t alpha = delta > 0 ? 0 : -delta;
+      const uint8_t value = delta > 0 ? delta : 0;
+      *pixel = ToCairoPixel(value, (value || alpha) ? alpha : 1);
+    }
+    ++pixel;
+  }
+}
+
+void FillSubmapSliceFromResponse(
+    const ::cartographer::mapping::Submap& submap,
+    const ::cartographer::transform::Rigid3d& global_submap_pose,
+    SubmapSlice* const submap_slice) {
+  ::cartographer::mapping::proto::SubmapQuery::Response response;
+  submap.ToResponseProto(global_submap_pose, &response);
+  CHECK_GT(response.textures_size(), 0);
+  const auto& texture = response.textures(0);
+  std::string cells;
+  ::cartographer::common::FastGunzipString(texture.cells(), &cells);
+  const int num_pixels = texture.width() * texture.height();
+  CHECK_EQ(cells.size(), 2 * num_pixels);
+  submap_slice->width = texture.width();
+  submap_slice->height = texture.height();
+  submap_slice->resolution = texture.resolution();
+  submap_slice->slice_pose =
+      ::cartographer::transform::ToRigid3(texture.slice_pose());
+  submap_slice->cairo_data.resize(num_pixels);
+  for (int i = 0; i < num_pixels; ++i) {
+    submap_slice->cairo_data[i] = ToCairoPixel(cells[2 * i], cells[2 * i + 1]);
+  }
+}
+
+}  // namespace
+
+void FillSubmapSlice(
+    const ::cartographer::mapping::Submap& submap,
+    const ::cartographer::transform::Rigid3d& global_submap_pose,
+    SubmapSlice* const submap_slice) {
+  // The old surface uses 'cairo_data', which is reused.
+  submap_slice->surface.reset();
+  submap_slice->pose = global_submap_pose;
+  submap_slice->version = submap.num_range_data();
+  submap_slice->metadata_version = submap_slice->version;
+  const auto* const submap_2d =
+      dynamic_cast<const ::cartographer::mapping_2d::Submap*>(&submap);
+  if (submap_2d != nullptr) {
+    FillSubmapSlice2D(*submap_2d, submap_slice);
+  } else {
+    FillSubmapSliceFromResponse(submap, global_submap_pose, submap_slice);
+  }
+  CreateSurface(submap_slice);
+}
+
+void UpdateSubmapSlices(
+    const ::cartographer::mapping::MapById<
+        SubmapId, ::cartographer::mapping::PoseGraph::SubmapData>& submap_data,
+    ::cartographer::common::Mutex* const active_submaps_mutex,
+    std::map<SubmapId, SubmapSlice>* const submap_slices) {
+  for (auto it = submap_slices->begin(); it != submap_slices->end();) {
+    if (submap_data.Contains(it->first)) {
+      ++it;
+    } else {
+      it = submap_slices->erase(it);
+    }
+  }
+  for (const auto& submap_id_data : submap_data) {
+    SubmapSlice& submap_slice = (*submap_slices)[submap_id_data.id];
+    const auto& submap = *submap_id_data.data.submap;
+    bool needs_drawing;
+    {
+      ::cartographer::common::MutexLocker lock(active_submaps_mutex);
+      needs_drawing = submap_slice.surface == nullptr ||
+                      submap_slice.version != submap.num_range_data();
+      if (needs_drawing && !submap.finished()) {
+        FillSubmapSlice(submap, submap_id_data.data.pose, &submap_slice);
+        continue;
+      }
+    }
+    if (needs_drawing) {
+      FillSubmapSlice(submap, submap_id_data.data.pose, &submap_slice);
+    } else {
+      submap_slice.pose = submap_id_data.data.pose;
+    }
+  }
+}
+
+::cartographer::io::PaintSubmapSlicesResult ScalePaintedSlices(
+    const ::cartographer::io::PaintSubmapSlicesResult& painted_slices,
+    const double scale) {
+  cairo_surface_t* const source = painted_slices.surface.get();
+  const int width = std::max(
+      1, static_cast<int>(
+             std::ceil(cairo_image_surface_get_width(source) * scale)));
+  const int height = std::max(
+      1, static_cast<int>(
+             std::ceil(cairo_image_surface_get_height(source) * scale)));
+  auto surface = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create(::cartographer::io::kCairoFormat, width,
+                                 height));
+  {
+    auto cr =
+        ::cartographer::io::MakeUniqueCairoPtr(cairo_create(surface.get()));
+    // Same as the background of unknown cells.
+    cairo_set_source_rgba(cr.get(), 0.5, 0., 0., 1.);
+    cairo_paint(cr.get());
+    cairo_scale(cr.get(), scale, scale);
+    cairo_set_source_surface(cr.get(), source, 0., 0.);
+    cairo_paint(cr.get());
+  }
+  cairo_surface_flush(surface.get());
+  return ::cartographer::io::PaintSubmapSlicesResult(
+      std::move(surface), painted_slices.origin * scale);
+}
+
+::nav_msgs::msg::OccupancyGrid CreateOccupancyGrid(
+    const ::cartographer::io::PaintSubmapSlicesResult& painted_slices,
+    const double resolution, const std::string& frame_id,
+    const ::builtin_interfaces::msg::Time& time) {
+  cairo_surface_t* const surface = painted_slices.surface.get();
+  const int width = cairo_image_surface_get_width(surface);
+  const int height = cairo_image_surface_get_height(surface);
+  ::nav_msgs::msg::OccupancyGrid occupancy_grid;
+  occupancy_grid.header.stamp = time;
+  occupancy_grid.header.frame_id = frame_id;
+  occupancy_grid.info.map_load_time = time;
+  occupancy_grid.info.resolution = resolution;
+  occupancy_grid.info.width = width;
+  occupancy_grid.info.height = height;
+  occupancy_grid.info.origin.position.x =
+      -painted_slices.origin.x() * resolution;
+  occupancy_grid.info.origin.position.y =
+      (-height + painted_slices.origin.y()) * resolution;
+  occupancy_grid.info.origin.position.z = 0.;
+  occupancy_grid.info.origin.orientation.w = 1.;
+  occupancy_grid.info.origin.orientation.x = 0.;
+  occupancy_grid.info.origin.orientation.y = 0.;
+  occupancy_grid.info.origin.orientation.z = 0.;
+
+  // Rows of the grid go up, while the rows of the surface go down.
+  cairo_surface_flush(surface);
+  const unsigned char* const pixel_data = cairo_image_surface_get_data(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  occupancy_grid.data.resize(width * height);
+  for (int y = 0; y != height; ++y) {
+    ConvertPixelRow(
+        reinterpret_cast<const uint32_t*>(pixel_data + y * stride), width,
+        OccupancyValueTable(),
+        reinterpret_cast<uint8_t*>(occupancy_grid.data.data() +
+                                   (height - 1 - y) * width));
+  }
+  return occupancy_grid;
+}
+
+}  // namespace cartographer_ros
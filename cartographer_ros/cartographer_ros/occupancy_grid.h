@@ -0,0 +1,69 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_OCCUPANCY_GRID_H_
+#define CARTOGRAPHER_ROS_OCCUPANCY_GRID_H_
+
+#include <map>
+#include <string>
+
+#include "cartographer/common/mutex.h"
+#include "cartographer/io/submap_painter.h"
+#include "cartographer/mapping/id.h"
+#include "cartographer/mapping/pose_graph.h"
+#include "cartographer/mapping/submaps.h"
+#include "cartographer/transform/rigid_transform.h"
+
+#include <builtin_interfaces/msg/time.hpp>
+#include <nav_msgs/msg/occupancy_grid.hpp>
+
+namespace cartographer_ros {
+
+// Draws the highest resolution texture of 'submap' at 'global_submap_pose'
+// into 'submap_slice'. 2D submaps are drawn straight from their probability
+// grid, so unlike for the submap query, the cells are never compressed.
+void FillSubmapSlice(
+    const ::cartographer::mapping::Submap& submap,
+    const ::cartographer::transform::Rigid3d& global_submap_pose,
+    ::cartographer::io::SubmapSlice* submap_slice);
+
+// Updates 'submap_slices' to 'submap_data' of the pose graph. Slices of
+// removed submaps are erased, and only submaps whose version changed are drawn
+// again. Active submaps are drawn with 'active_submaps_mutex' held, under
+// which local SLAM inserts into them. Finished submaps do not change anymore
+// and are drawn without it.
+void UpdateSubmapSlices(
+    const ::cartographer::mapping::MapById<
+        ::cartographer::mapping::SubmapId,
+        ::cartographer::mapping::PoseGraph::SubmapData>& submap_data,
+    ::cartographer::common::Mutex* active_submaps_mutex,
+    std::map<::cartographer::mapping::SubmapId,
+             ::cartographer::io::SubmapSlice>* submap_slices);
+
+// Scales 'painted_slices' by 'scale', e.g. to downsample a region of the map.
+::cartographer::io::PaintSubmapSlicesResult ScalePaintedSlices(
+    const ::cartographer::io::PaintSubmapSlicesResult& painted_slices,
+    double scale);
+
+// Converts 'painted_slices' of 'resolution' into an occupancy grid.
+::nav_msgs::msg::OccupancyGrid CreateOccupancyGrid(
+    const ::cartographer::io::PaintSubmapSlicesResult& painted_slices,
+    double resolution, const std::string& frame_id,
+    const ::builtin_interfaces::msg::Time& time);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_OCCUPANCY_GRID_H_
@@ -23,6 +23,7 @@
 #include "cairo/cairo.h"
 #include "cartographer/common/mutex.h"
 #include "cartographer/common/port.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/io/image.h"
 #include "cartographer/io/submap_painter.h"
 #include "cartographer/mapping/id.h"
@@ -30,10 +31,14 @@
 #include "cartographer_ros/msg_conversion.h"
 #include "cartographer_ros/node_constants.h"
 #include "cartographer_ros/ros_log_sink.h"
+#include "cartographer_ros/ros_map.h"
 #include "cartographer_ros/submap.h"
+#include "cartographer_ros/tiled_submap_compositor.h"
 #include "cartographer_ros_msgs/SubmapList.h"
 #include "cartographer_ros_msgs/SubmapQuery.h"
+#include "cartographer_ros_msgs/SubmapTextures.h"
 #include "gflags/gflags.h"
+#include "map_msgs/OccupancyGridUpdate.h"
 #include "nav_msgs/OccupancyGrid.h"
 #include "ros/ros.h"
 
@@ -48,32 +53,115 @@ using ::cartographer::io::PaintSubmapSlicesResult;
 using ::cartographer::io::SubmapSlice;
 using ::cartographer::mapping::SubmapId;
 
+constexpr int kSubmapTexturesQueueSize = 10;
+constexpr int kTileSizeInPixels = 256;
+constexpr int kNumFetchThreads = 4;
+constexpr size_t kMaxFetchesInFlight = 8;
+
+// Converts the pixels of 'surface' into occupancy grid 'data', starting with
+// the bottom row.
+void ToOccupancyGridData(cairo_surface_t* const surface,
+                         std::vector<int8_t>* const data) {
+  const int width = cairo_image_surface_get_width(surface);
+  const int height = cairo_image_surface_get_height(surface);
+  const unsigned char* const pixel_data = cairo_image_surface_get_data(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  data->resize(width * height);
+  for (int y = 0; y != height; ++y) {
+    ConvertPixelRow(
+        reinterpret_cast<const uint32_t*>(pixel_data + y * stride), width,
+        OccupancyValueTable(),
+        reinterpret_cast<uint8_t*>(data->data() + (height - 1 - y) * width));
+  }
+}
+
+// Draws the first of the 'textures' into 'submap_slice'. By convention this is
+// the highest resolution texture and that is the one we want to use to
+// construct the map for ROS.
+void UpdateSubmapSlice(const SubmapTextures& textures,
+                       SubmapSlice* const submap_slice) {
+  CHECK(!textures.textures.empty());
+  submap_slice->version = textures.version;
+  const auto texture = textures.textures.begin();
+  submap_slice->width = texture->width;
+  submap_slice->height = texture->height;
+  submap_slice->slice_pose = texture->slice_pose;
+  submap_slice->resolution = texture->resolution;
+  submap_slice->surface = DrawTexture(texture->cells, texture->width,
+                                      texture->height,
+                                      &submap_slice->cairo_data);
+}
+
+// Moves the surface of 'drawn_slice' into 'submap_slice', keeping its pose.
+void TakeSurface(SubmapSlice* const drawn_slice,
+                 SubmapSlice* const submap_slice) {
+  submap_slice->version = drawn_slice->version;
+  submap_slice->width = drawn_slice->width;
+  submap_slice->height = drawn_slice->height;
+  submap_slice->slice_pose = drawn_slice->slice_pose;
+  submap_slice->resolution = drawn_slice->resolution;
+  // Moving the vector keeps the pixels the surface points to.
+  submap_slice->cairo_data = std::move(drawn_slice->cairo_data);
+  submap_slice->surface = std::move(drawn_slice->surface);
+}
+
 class Node {
  public:
   explicit Node(double resolution, double publish_period_sec);
-  ~Node() {}
+  // Waits for the fetches in flight.
+  ~Node();
 
   Node(const Node&) = delete;
   Node& operator=(const Node&) = delete;
 
  private:
   void HandleSubmapList(const cartographer_ros_msgs::SubmapList::ConstPtr& msg);
+  void HandleSubmapTextures(
+      const cartographer_ros_msgs::SubmapTextures::ConstPtr& msg);
+  // Schedules fetching the textures of submaps whose surface is missing or
+  // outdated on 'fetch_thread_pool_', so that at most 'kMaxFetchesInFlight'
+  // are in flight. The newest submaps are fetched first.
+  void MaybeScheduleFetches() REQUIRES(mutex_);
+  // Takes the surface of 'drawn_slice' for the slice of 'id', unless it was
+  // removed or is already current.
+  void MergeSubmapSlice(const SubmapId& id, SubmapSlice* drawn_slice)
+      REQUIRES(mutex_);
   void DrawAndPublish(const ::ros::WallTimerEvent& timer_event);
   void PublishOccupancyGrid(const std::string& frame_id, const ros::Time& time,
                             const Eigen::Array2f& origin,
                             cairo_surface_t* surface);
+  // Publishes the cells in 'box' of the last published occupancy grid.
+  void PublishOccupancyGridUpdate(const std::string& frame_id,
+                                  const ros::Time& time,
+                                  const Eigen::AlignedBox2i& box)
+      REQUIRES(mutex_);
 
   ::ros::NodeHandle node_handle_;
   const double resolution_;
 
   ::cartographer::common::Mutex mutex_;
-  ::ros::ServiceClient client_ GUARDED_BY(mutex_);
+  // Only called by the fetching threads, which may call it concurrently.
+  ::ros::ServiceClient client_;
   ::ros::Subscriber submap_list_subscriber_ GUARDED_BY(mutex_);
+  ::ros::Subscriber submap_textures_subscriber_ GUARDED_BY(mutex_);
   ::ros::Publisher occupancy_grid_publisher_ GUARDED_BY(mutex_);
+  ::ros::Publisher occupancy_grid_update_publisher_ GUARDED_BY(mutex_);
   std::map<SubmapId, SubmapSlice> submap_slices_ GUARDED_BY(mutex_);
+  std::set<SubmapId> fetches_in_flight_ GUARDED_BY(mutex_);
+  bool shutting_down_ GUARDED_BY(mutex_) = false;
+  TiledSubmapCompositor compositor_ GUARDED_BY(mutex_);
+  // Canvas pixels of the last published occupancy grid, and those which
+  // changed since it or the last update was published.
+  Eigen::AlignedBox2i published_bounds_ GUARDED_BY(mutex_);
+  Eigen::AlignedBox2i dirty_box_ GUARDED_BY(mutex_);
+  uint32_t num_occupancy_grid_subscribers_ GUARDED_BY(mutex_) = 0;
+  // Incremental submap lists can only be applied on top of the previous list.
+  bool has_submap_list_ GUARDED_BY(mutex_) = false;
+  uint64_t last_submap_list_sequence_ GUARDED_BY(mutex_) = 0;
   ::ros::WallTimer occupancy_grid_publisher_timer_;
   std::string last_frame_id_;
   ros::Time last_timestamp_;
+  ::cartographer::common::ThreadPool fetch_thread_pool_;
 };
 
 Node::Node(const double resolution, const double publish_period_sec)
@@ -87,13 +175,28 @@ Node::Node(const double resolution, const double publish_period_sec)
               [this](const cartographer_ros_msgs::SubmapList::ConstPtr& msg) {
                 HandleSubmapList(msg);
               }))),
+      submap_textures_subscriber_(node_handle_.subscribe(
+          kSubmapTexturesTopic, kSubmapTexturesQueueSize,
+          &Node::HandleSubmapTextures, this)),
       occupancy_grid_publisher_(
           node_handle_.advertise<::nav_msgs::OccupancyGrid>(
               kOccupancyGridTopic, kLatestOnlyPublisherQueueSize,
               true /* latched */)),
+      occupancy_grid_update_publisher_(
+          node_handle_.advertise<::map_msgs::OccupancyGridUpdate>(
+              kOccupancyGridUpdatesTopic, kLatestOnlyPublisherQueueSize)),
+      compositor_(resolution, kTileSizeInPixels),
       occupancy_grid_publisher_timer_(
           node_handle_.createWallTimer(::ros::WallDuration(publish_period_sec),
-                                       &Node::DrawAndPublish, this)) {}
+                                       &Node::DrawAndPublish, this)),
+      fetch_thread_pool_(kNumFetchThreads) {}
+
+Node::~Node() {
+  ::cartographer::common::MutexLocker locker(&mutex_);
+  shutting_down_ = true;
+  locker.Await(
+      [this]() REQUIRES(mutex_) { return fetches_in_flight_.empty(); });
+}
 
 void Node::HandleSubmapList(
     const cartographer_ros_msgs::SubmapList::ConstPtr& msg) {
@@ -104,10 +207,27 @@ void Node::HandleSubmapList(
     return;
   }
 
-  // Keep track of submap IDs that don't appear in the message anymore.
+  if (!msg->is_full_update &&
+      (!has_submap_list_ || msg->sequence != last_submap_list_sequence_ + 1)) {
+    // We missed an update, wait for the next full list.
+    has_submap_list_ = false;
+    return;
+  }
+  has_submap_list_ = true;
+  last_submap_list_sequence_ = msg->sequence;
+
   std::set<SubmapId> submap_ids_to_delete;
-  for (const auto& pair : submap_slices_) {
-    submap_ids_to_delete.insert(pair.first);
+  if (msg->is_full_update) {
+    // Keep track of submap IDs that don't appear in the message anymore.
+    for (const auto& pair : submap_slices_) {
+      submap_ids_to_delete.insert(pair.first);
+    }
+  } else {
+    // Unchanged submaps are not listed, only delete the removed ones.
+    for (const auto& submap_msg : msg->deleted_submap) {
+      submap_ids_to_delete.insert(
+          SubmapId{submap_msg.trajectory_id, submap_msg.submap_index});
+    }
   }
 
   for (const auto& submap_msg : msg->submap) {
@@ -116,41 +236,95 @@ void Node::HandleSubmapList(
     SubmapSlice& submap_slice = submap_slices_[id];
     submap_slice.pose = ToRigid3d(submap_msg.pose);
     submap_slice.metadata_version = submap_msg.submap_version;
-    if (submap_slice.surface != nullptr &&
-        submap_slice.version == submap_msg.submap_version) {
-      continue;
-    }
+  }
 
-    auto fetched_textures =
-        ::cartographer_ros::FetchSubmapTextures(id, &client_);
-    if (fetched_textures == nullptr) {
-      continue;
-    }
-    CHECK(!fetched_textures->textures.empty());
-    submap_slice.version = fetched_textures->version;
-
-    // We use the first texture only. By convention this is the highest
-    // resolution texture and that is the one we want to use to construct the
-    // map for ROS.
-    const auto fetched_texture = fetched_textures->textures.begin();
-    submap_slice.width = fetched_texture->width;
-    submap_slice.height = fetched_texture->height;
-    submap_slice.slice_pose = fetched_texture->slice_pose;
-    submap_slice.resolution = fetched_texture->resolution;
-    submap_slice.cairo_data.clear();
-    submap_slice.surface =
-        DrawTexture(fetched_texture->pixels.intensity,
-                    fetched_texture->pixels.alpha, fetched_texture->width,
-                    fetched_texture->height, &submap_slice.cairo_data);
-  }
-
-  // Delete all submaps that didn't appear in the message.
+  // Delete all submaps that didn't appear in the message or were removed.
   for (const auto& id : submap_ids_to_delete) {
     submap_slices_.erase(id);
   }
 
   last_timestamp_ = msg->header.stamp;
   last_frame_id_ = msg->header.frame_id;
+  MaybeScheduleFetches();
+}
+
+void Node::MaybeScheduleFetches() {
+  if (shutting_down_) {
+    return;
+  }
+  for (auto it = submap_slices_.rbegin(); it != submap_slices_.rend() &&
+                                          fetches_in_flight_.size() <
+                                              kMaxFetchesInFlight;
+       ++it) {
+    const SubmapSlice& submap_slice = it->second;
+    if ((submap_slice.surface != nullptr &&
+         submap_slice.version == submap_slice.metadata_version) ||
+        fetches_in_flight_.count(it->first) != 0) {
+      continue;
+    }
+    const SubmapId id = it->first;
+    fetches_in_flight_.insert(id);
+    fetch_thread_pool_.Schedule([this, id]() {
+      // Fetching and drawing happen without holding 'mutex_', so publishing
+      // continues with the current slices meanwhile.
+      const auto fetched_textures =
+          ::cartographer_ros::FetchSubmapTextures(id, &client_);
+      SubmapSlice drawn_slice;
+      if (fetched_textures != nullptr) {
+        UpdateSubmapSlice(*fetched_textures, &drawn_slice);
+      }
+      ::cartographer::common::MutexLocker locker(&mutex_);
+      fetches_in_flight_.erase(id);
+      if (fetched_textures == nullptr) {
+        // Retried with the next submap list.
+        return;
+      }
+      MergeSubmapSlice(id, &drawn_slice);
+      MaybeScheduleFetches();
+    });
+  }
+}
+
+void Node::MergeSubmapSlice(const SubmapId& id,
+                            SubmapSlice* const drawn_slice) {
+  const auto it = submap_slices_.find(id);
+  if (it == submap_slices_.end()) {
+    return;
+  }
+  if (it->second.surface != nullptr &&
+      it->second.version == it->second.metadata_version) {
+    return;
+  }
+  TakeSurface(drawn_slice, &it->second);
+}
+
+void Node::HandleSubmapTextures(
+    const cartographer_ros_msgs::SubmapTextures::ConstPtr& msg) {
+  const SubmapId id{msg->trajectory_id, msg->submap_index};
+  {
+    ::cartographer::common::MutexLocker locker(&mutex_);
+    if (occupancy_grid_publisher_.getNumSubscribers() == 0) {
+      return;
+    }
+    // Only known submaps are updated, new ones are fetched once they are
+    // listed with their pose.
+    const auto it = submap_slices_.find(id);
+    if (it == submap_slices_.end() ||
+        (it->second.surface != nullptr &&
+         it->second.version == msg->submap_version)) {
+      return;
+    }
+  }
+  SubmapSlice drawn_slice;
+  UpdateSubmapSlice(*ToSubmapTextures(msg->submap_version, msg->textures),
+                    &drawn_slice);
+  ::cartographer::common::MutexLocker locker(&mutex_);
+  // Pushed textures are current, even if the submap list announcing them has
+  // not arrived yet.
+  const auto it = submap_slices_.find(id);
+  if (it != submap_slices_.end()) {
+    TakeSurface(&drawn_slice, &it->second);
+  }
 }
 
 void Node::DrawAndPublish(const ::ros::WallTimerEvent& unused_timer_event) {
@@ -159,9 +333,50 @@ void Node::DrawAndPublish(const ::ros::WallTimerEvent& unused_timer_event) {
   }
 
   ::cartographer::common::MutexLocker locker(&mutex_);
-  auto painted_slices = PaintSubmapSlices(submap_slices_, resolution_);
-  PublishOccupancyGrid(last_frame_id_, last_timestamp_, painted_slices.origin,
-                       painted_slices.surface.get());
+  // Only the tiles of changed submaps are composited again.
+  dirty_box_.extend(compositor_.Update(submap_slices_));
+  const Eigen::AlignedBox2i bounds = compositor_.bounds();
+  if (bounds.isEmpty()) {
+    return;
+  }
+  const uint32_t num_subscribers =
+      occupancy_grid_publisher_.getNumSubscribers();
+  const bool has_new_subscribers =
+      num_subscribers > num_occupancy_grid_subscribers_;
+  num_occupancy_grid_subscribers_ = num_subscribers;
+  // The full grid is only published if its bounds have to grow, or to give new
+  // subscribers a current grid. Otherwise updates cover the changed cells.
+  if (has_new_subscribers || published_bounds_.isEmpty() ||
+      !published_bounds_.contains(bounds)) {
+    auto painted_slices = compositor_.Paint(bounds);
+    PublishOccupancyGrid(last_frame_id_, last_timestamp_,
+                         painted_slices.origin, painted_slices.surface.get());
+    published_bounds_ = bounds;
+    dirty_box_.setEmpty();
+    return;
+  }
+  const Eigen::AlignedBox2i update_box =
+      dirty_box_.intersection(published_bounds_);
+  dirty_box_.setEmpty();
+  if (!update_box.isEmpty()) {
+    PublishOccupancyGridUpdate(last_frame_id_, last_timestamp_, update_box);
+  }
+}
+
+void Node::PublishOccupancyGridUpdate(const std::string& frame_id,
+                                      const ros::Time& time,
+                                      const Eigen::AlignedBox2i& box) {
+  auto painted_slices = compositor_.Paint(box);
+  ::map_msgs::OccupancyGridUpdate update;
+  update.header.stamp = time;
+  update.header.frame_id = frame_id;
+  // Rows of the grid go up, while canvas rows go down.
+  update.x = box.min().x() - published_bounds_.min().x();
+  update.y = published_bounds_.max().y() - box.max().y();
+  update.width = box.sizes().x() + 1;
+  update.height = box.sizes().y() + 1;
+  ToOccupancyGridData(painted_slices.surface.get(), &update.data);
+  occupancy_grid_update_publisher_.publish(update);
 }
 
 void Node::PublishOccupancyGrid(const std::string& frame_id,
@@ -185,23 +400,7 @@ void Node::PublishOccupancyGrid(const std::string& frame_id,
   occupancy_grid.info.origin.orientation.y = 0.;
   occupancy_grid.info.origin.orientation.z = 0.;
 
-  const uint32_t* pixel_data =
-      reinterpret_cast<uint32_t*>(cairo_image_surface_get_data(surface));
-  occupancy_grid.data.reserve(width * height);
-  for (int y = height - 1; y >= 0; --y) {
-    for (int x = 0; x < width; ++x) {
-      const uint32_t packed = pixel_data[y * width + x];
-      const unsigned char color = packed >> 16;
-      const unsigned char observed = packed >> 8;
-      const int value =
-          observed == 0
-              ? -1
-              : ::cartographer::common::RoundToInt((1. - color / 255.) * 100.);
-      CHECK_LE(-1, value);
-      CHECK_GE(100, value);
-      occupancy_grid.data.push_back(value);
-    }
-  }
+  ToOccupancyGridData(surface, &occupancy_grid.data);
   occupancy_grid_publisher_.publish(occupancy_grid);
 }
 
@@ -20,21 +20,24 @@
 #include <sys/time.h>
 #include <time.h>
 #include <chrono>
+#include <deque>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include "cartographer/common/make_unique.h"
+#include "cartographer/common/mutex.h"
 #include "cartographer/common/port.h"
 #include "cartographer_ros/node.h"
 #include "cartographer_ros/node_options.h"
+#include "cartographer_ros/pipelined_bag_reader.h"
 #include "cartographer_ros/ros_log_sink.h"
 #include "cartographer_ros/split_string.h"
 #include "cartographer_ros/urdf_reader.h"
 #include "gflags/gflags.h"
 #include "ros/callback_queue.h"
-#include "rosbag/bag.h"
-#include "rosbag/view.h"
 #include "rosgraph_msgs/Clock.h"
 #include "tf2_msgs/TFMessage.h"
 #include "tf2_ros/static_transform_broadcaster.h"
@@ -55,6 +58,16 @@ DEFINE_bool(use_bag_transforms, true,
             "Whether to read, use and republish the transforms from the bag.");
 DEFINE_string(pbstream_filename, "",
               "If non-empty, filename of a pbstream to load.");
+DEFINE_int32(num_decoding_threads, 4,
+             "Number of threads deserializing the messages read from bags.");
+DEFINE_bool(headless, false,
+            "Only feed the bags to SLAM as fast as possible: transforms from "
+            "the bags are not republished and the clock is only published at "
+            "a bounded wall clock rate.");
+DEFINE_bool(concurrent_bags, false,
+            "Replay all bags at the same time as concurrent trajectories. The "
+            "frames of the i-th bag, its URDF transforms and the frames of "
+            "the trajectory options are prefixed with 'bag_<i>/'.");
 DEFINE_bool(keep_running, false,
             "Keep running the offline node after all messages from the bag "
             "have been processed.");
@@ -67,6 +80,193 @@ constexpr char kTfStaticTopic[] = "/tf_static";
 constexpr char kTfTopic[] = "tf";
 constexpr double kClockPublishFrequencySec = 1. / 30.;
 constexpr int kSingleThreaded = 1;
+constexpr size_t kMaxQueuedMessages = 256;
+constexpr double kHeadlessProgressPeriodSec = 10.;
+
+// Replays bags into a node. Several bags may be replayed concurrently.
+class BagReplayer {
+ public:
+  BagReplayer(Node* const node, tf2_ros::Buffer* const tf_buffer,
+              const std::unordered_set<std::string>* const expected_sensor_ids,
+              ::ros::Publisher* const tf_publisher,
+              ::ros::Publisher* const clock_publisher)
+      : node_(node),
+        tf_buffer_(tf_buffer),
+        expected_sensor_ids_(expected_sensor_ids),
+        tf_publisher_(tf_publisher),
+        clock_publisher_(clock_publisher),
+        next_clock_publish_time_(std::chrono::steady_clock::now()),
+        next_progress_time_(next_clock_publish_time_) {}
+
+  BagReplayer(const BagReplayer&) = delete;
+  BagReplayer& operator=(const BagReplayer&) = delete;
+
+  // Replays 'bag_filename' as the trajectory 'trajectory_id' and finishes it.
+  // 'frame_prefix' is prepended to the frames of all messages.
+  void Replay(const std::string& bag_filename, int trajectory_id,
+              const std::string& frame_prefix) EXCLUDES(mutex_);
+
+  rosgraph_msgs::Clock clock() EXCLUDES(mutex_) {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    return clock_;
+  }
+
+  size_t num_handled_messages() EXCLUDES(mutex_) {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    return num_handled_messages_;
+  }
+
+  double handled_bag_seconds() EXCLUDES(mutex_) {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    return handled_bag_seconds_;
+  }
+
+ private:
+  // Hands 'msg' to the node for 'trajectory_id'.
+  void HandleMessage(const PipelinedBagReader::Message& msg,
+                     int trajectory_id);
+  // Advances the clock to 'time' of a handled message, 'bag_seconds' into a
+  // bag of 'bag_duration_sec'. The clock never goes back, even if bags are
+  // replayed concurrently.
+  void AdvanceClock(const ::ros::Time& time, double bag_seconds,
+                    double bag_duration_sec) EXCLUDES(mutex_);
+
+  Node* const node_;
+  tf2_ros::Buffer* const tf_buffer_;
+  const std::unordered_set<std::string>* const expected_sensor_ids_;
+  ::ros::Publisher* const tf_publisher_;
+  ::ros::Publisher* const clock_publisher_;
+
+  ::cartographer::common::Mutex mutex_;
+  rosgraph_msgs::Clock clock_ GUARDED_BY(mutex_);
+  std::chrono::steady_clock::time_point next_clock_publish_time_
+      GUARDED_BY(mutex_);
+  std::chrono::steady_clock::time_point next_progress_time_ GUARDED_BY(mutex_);
+  size_t num_handled_messages_ GUARDED_BY(mutex_) = 0;
+  double handled_bag_seconds_ GUARDED_BY(mutex_) = 0.;
+};
+
+void BagReplayer::Replay(const std::string& bag_filename,
+                         const int trajectory_id,
+                         const std::string& frame_prefix) {
+  // Messages are read and deserialized ahead on other threads, while this
+  // thread only hands them to the node in bag order.
+  PipelinedBagReader reader(
+      bag_filename,
+      [this](const rosbag::MessageInstance& msg) {
+        if (FLAGS_use_bag_transforms && msg.isType<tf2_msgs::TFMessage>()) {
+          return true;
+        }
+        return expected_sensor_ids_->count(node_->node_handle()->resolveName(
+                   msg.getTopic(), false /* resolve */)) != 0;
+      },
+      FLAGS_num_decoding_threads, kMaxQueuedMessages, frame_prefix);
+  const ::ros::Time begin_time = reader.begin_time();
+  const double duration_in_seconds = (reader.end_time() - begin_time).toSec();
+
+  // We need to keep 'tf_buffer' small because it becomes very inefficient
+  // otherwise. We make sure that tf_messages are published before any data
+  // messages, so that tf lookups always work.
+  std::deque<PipelinedBagReader::Message> delayed_messages;
+  // We publish tf messages one second earlier than other messages. Under
+  // the assumption of higher frequency tf this should ensure that tf can
+  // always interpolate.
+  const ::ros::Duration kDelay(1.);
+  PipelinedBagReader::Message msg;
+  ::ros::Time last_message_time = begin_time;
+  while (::ros::ok() && reader.GetNextMessage(&msg)) {
+    last_message_time = msg.time;
+    if (msg.tf_message != nullptr) {
+      if (!FLAGS_headless) {
+        tf_publisher_->publish(msg.tf_message);
+      }
+
+      for (const auto& transform : msg.tf_message->transforms) {
+        try {
+          tf_buffer_->setTransform(transform, "unused_authority",
+                                   msg.topic == kTfStaticTopic);
+        } catch (const tf2::TransformException& ex) {
+          LOG(WARNING) << ex.what();
+        }
+      }
+    }
+
+    while (!delayed_messages.empty() &&
+           delayed_messages.front().time < msg.time - kDelay) {
+      const PipelinedBagReader::Message& delayed_msg = delayed_messages.front();
+      HandleMessage(delayed_msg, trajectory_id);
+      AdvanceClock(delayed_msg.time, (delayed_msg.time - begin_time).toSec(),
+                   duration_in_seconds);
+      delayed_messages.pop_front();
+    }
+
+    if (msg.tf_message == nullptr) {
+      delayed_messages.push_back(std::move(msg));
+    }
+  }
+
+  {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    handled_bag_seconds_ += (last_message_time - begin_time).toSec();
+  }
+  node_->FinishTrajectory(trajectory_id);
+}
+
+void BagReplayer::HandleMessage(const PipelinedBagReader::Message& msg,
+                                const int trajectory_id) {
+  const std::string topic =
+      node_->node_handle()->resolveName(msg.topic, false /* resolve */);
+  if (msg.laser_scan != nullptr) {
+    node_->HandleLaserScanMessage(trajectory_id, topic, msg.laser_scan);
+  }
+  if (msg.multi_echo_laser_scan != nullptr) {
+    node_->HandleMultiEchoLaserScanMessage(trajectory_id, topic,
+                                           msg.multi_echo_laser_scan);
+  }
+  if (msg.point_cloud2 != nullptr) {
+    node_->HandlePointCloud2Message(trajectory_id, topic, msg.point_cloud2);
+  }
+  if (msg.imu != nullptr) {
+    node_->HandleImuMessage(trajectory_id, topic, msg.imu);
+  }
+  if (msg.odometry != nullptr) {
+    node_->HandleOdometryMessage(trajectory_id, topic, msg.odometry);
+  }
+}
+
+void BagReplayer::AdvanceClock(const ::ros::Time& time,
+                               const double bag_seconds,
+                               const double bag_duration_sec) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  ++num_handled_messages_;
+  if (time > clock_.clock) {
+    clock_.clock = time;
+  }
+  if (!FLAGS_headless) {
+    clock_publisher_->publish(clock_);
+
+    LOG_EVERY_N(INFO, 100000) << "Processed " << bag_seconds << " of "
+                              << bag_duration_sec << " bag time seconds...";
+    return;
+  }
+  // Nobody needs every clock tick, so it is only published at the same rate
+  // as after the bags were processed.
+  const auto now = std::chrono::steady_clock::now();
+  if (now < next_clock_publish_time_) {
+    return;
+  }
+  clock_publisher_->publish(clock_);
+  next_clock_publish_time_ =
+      now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(kClockPublishFrequencySec));
+  if (now >= next_progress_time_) {
+    LOG(INFO) << "Processed " << bag_seconds << " of " << bag_duration_sec
+              << " bag time seconds...";
+    next_progress_time_ =
+        now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                  std::chrono::duration<double>(kHeadlessProgressPeriodSec));
+  }
+}
 
 void Run(const std::vector<std::string>& bag_filenames) {
   const std::chrono::time_point<std::chrono::steady_clock> start_time =
@@ -120,104 +320,58 @@ void Run(const std::vector<std::string>& bag_filenames) {
 
   ros::AsyncSpinner async_spinner(kSingleThreaded);
   async_spinner.start();
-  rosgraph_msgs::Clock clock;
+  BagReplayer bag_replayer(&node, &tf_buffer, &expected_sensor_ids,
+                           &tf_publisher, &clock_publisher);
   auto clock_republish_timer = node.node_handle()->createWallTimer(
       ::ros::WallDuration(kClockPublishFrequencySec),
-      [&clock_publisher, &clock](const ::ros::WallTimerEvent&) {
-        clock_publisher.publish(clock);
+      [&clock_publisher, &bag_replayer](const ::ros::WallTimerEvent&) {
+        clock_publisher.publish(bag_replayer.clock());
       },
       false /* oneshot */, false /* autostart */);
 
-  for (const std::string& bag_filename : bag_filenames) {
-    if (!::ros::ok()) {
-      break;
+  if (FLAGS_concurrent_bags) {
+    // Each bag gets its own frames, reader and replaying thread, so only
+    // adding the data to the map builder is serialized.
+    std::vector<geometry_msgs::TransformStamped> prefixed_urdf_transforms;
+    std::vector<std::thread> replaying_threads;
+    for (size_t i = 0; i < bag_filenames.size(); ++i) {
+      const std::string frame_prefix = "bag_" + std::to_string(i) + "/";
+      for (geometry_msgs::TransformStamped transform : urdf_transforms) {
+        transform.header.frame_id =
+            PrefixFrameId(frame_prefix, transform.header.frame_id);
+        transform.child_frame_id =
+            PrefixFrameId(frame_prefix, transform.child_frame_id);
+        tf_buffer.setTransform(transform, "urdf", true /* is_static */);
+        prefixed_urdf_transforms.push_back(transform);
+      }
+      TrajectoryOptions options = trajectory_options;
+      options.tracking_frame =
+          PrefixFrameId(frame_prefix, options.tracking_frame);
+      options.published_frame =
+          PrefixFrameId(frame_prefix, options.published_frame);
+      options.odom_frame = PrefixFrameId(frame_prefix, options.odom_frame);
+      const int trajectory_id =
+          node.AddOfflineTrajectory(expected_sensor_ids, options);
+      replaying_threads.emplace_back(
+          [&bag_replayer, &bag_filenames, i, trajectory_id, frame_prefix]() {
+            bag_replayer.Replay(bag_filenames[i], trajectory_id, frame_prefix);
+          });
     }
-
-    const int trajectory_id =
-        node.AddOfflineTrajectory(expected_sensor_ids, trajectory_options);
-
-    rosbag::Bag bag;
-    bag.open(bag_filename, rosbag::bagmode::Read);
-    rosbag::View view(bag);
-    const ::ros::Time begin_time = view.getBeginTime();
-    const double duration_in_seconds = (view.getEndTime() - begin_time).toSec();
-
-    // We need to keep 'tf_buffer' small because it becomes very inefficient
-    // otherwise. We make sure that tf_messages are published before any data
-    // messages, so that tf lookups always work.
-    std::deque<rosbag::MessageInstance> delayed_messages;
-    // We publish tf messages one second earlier than other messages. Under
-    // the assumption of higher frequency tf this should ensure that tf can
-    // always interpolate.
-    const ::ros::Duration kDelay(1.);
-    for (const rosbag::MessageInstance& msg : view) {
+    if (!prefixed_urdf_transforms.empty()) {
+      static_tf_broadcaster.sendTransform(prefixed_urdf_transforms);
+    }
+    for (std::thread& replaying_thread : replaying_threads) {
+      replaying_thread.join();
+    }
+  } else {
+    for (const std::string& bag_filename : bag_filenames) {
       if (!::ros::ok()) {
         break;
       }
-
-      if (FLAGS_use_bag_transforms && msg.isType<tf2_msgs::TFMessage>()) {
-        auto tf_message = msg.instantiate<tf2_msgs::TFMessage>();
-        tf_publisher.publish(tf_message);
-
-        for (const auto& transform : tf_message->transforms) {
-          try {
-            tf_buffer.setTransform(transform, "unused_authority",
-                                   msg.getTopic() == kTfStaticTopic);
-          } catch (const tf2::TransformException& ex) {
-            LOG(WARNING) << ex.what();
-          }
-        }
-      }
-
-      while (!delayed_messages.empty() &&
-             delayed_messages.front().getTime() < msg.getTime() - kDelay) {
-        const rosbag::MessageInstance& delayed_msg = delayed_messages.front();
-        const std::string topic = node.node_handle()->resolveName(
-            delayed_msg.getTopic(), false /* resolve */);
-        if (delayed_msg.isType<sensor_msgs::LaserScan>()) {
-          node.HandleLaserScanMessage(
-              trajectory_id, topic,
-              delayed_msg.instantiate<sensor_msgs::LaserScan>());
-        }
-        if (delayed_msg.isType<sensor_msgs::MultiEchoLaserScan>()) {
-          node.HandleMultiEchoLaserScanMessage(
-              trajectory_id, topic,
-              delayed_msg.instantiate<sensor_msgs::MultiEchoLaserScan>());
-        }
-        if (delayed_msg.isType<sensor_msgs::PointCloud2>()) {
-          node.HandlePointCloud2Message(
-              trajectory_id, topic,
-              delayed_msg.instantiate<sensor_msgs::PointCloud2>());
-        }
-        if (delayed_msg.isType<sensor_msgs::Imu>()) {
-          node.HandleImuMessage(trajectory_id, topic,
-                                delayed_msg.instantiate<sensor_msgs::Imu>());
-        }
-        if (delayed_msg.isType<nav_msgs::Odometry>()) {
-          node.HandleOdometryMessage(
-              trajectory_id, topic,
-              delayed_msg.instantiate<nav_msgs::Odometry>());
-        }
-        clock.clock = delayed_msg.getTime();
-        clock_publisher.publish(clock);
-
-        LOG_EVERY_N(INFO, 100000)
-            << "Processed " << (delayed_msg.getTime() - begin_time).toSec()
-            << " of " << duration_in_seconds << " bag time seconds...";
-
-        delayed_messages.pop_front();
-      }
-
-      const std::string topic =
-          node.node_handle()->resolveName(msg.getTopic(), false /* resolve */);
-      if (expected_sensor_ids.count(topic) == 0) {
-        continue;
-      }
-      delayed_messages.push_back(msg);
+      const int trajectory_id =
+          node.AddOfflineTrajectory(expected_sensor_ids, trajectory_options);
+      bag_replayer.Replay(bag_filename, trajectory_id, "" /* frame_prefix */);
     }
-
-    bag.close();
-    node.FinishTrajectory(trajectory_id);
   }
 
   // Ensure the clock is republished after the bag has been finished, during the
@@ -234,6 +388,12 @@ void Run(const std::vector<std::string>& bag_filenames) {
           .count();
 
   LOG(INFO) << "Elapsed wall clock time: " << wall_clock_seconds << " s";
+  LOG(INFO) << "Processed " << bag_replayer.num_handled_messages()
+            << " messages, i.e. "
+            << bag_replayer.num_handled_messages() / wall_clock_seconds
+            << " messages per second, at "
+            << bag_replayer.handled_bag_seconds() / wall_clock_seconds
+            << " times the speed of bag time.";
 #ifdef __linux__
   timespec cpu_timespec = {};
   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_timespec);
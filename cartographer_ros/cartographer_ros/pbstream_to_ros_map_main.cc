@@ -14,9 +14,15 @@
  * limitations under the License.
  */
 
+#include <deque>
+#include <limits>
 #include <map>
+#include <memory>
 #include <string>
 
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/io/proto_stream.h"
 #include "cartographer/io/submap_painter.h"
 #include "cartographer/mapping/proto/pose_graph.pb.h"
@@ -28,6 +34,7 @@
 #include "cartographer/mapping_3d/submaps.h"
 #include "cartographer_ros/ros_map.h"
 #include "cartographer_ros/submap.h"
+#include "cartographer_ros/tiled_submap_compositor.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
@@ -35,10 +42,23 @@ DEFINE_string(pbstream_filename, "",
               "Filename of a pbstream to draw a map from.");
 DEFINE_string(map_filestem, "map", "Stem of the output files.");
 DEFINE_double(resolution, 0.05, "Resolution of a grid cell in the drawn map.");
+DEFINE_int32(num_threads, 4, "Number of threads rendering submaps.");
+DEFINE_double(min_x, -std::numeric_limits<double>::infinity(),
+              "If given, crops the map to the region in meters from 'min_x' "
+              "to 'max_x' and 'min_y' to 'max_y'.");
+DEFINE_double(min_y, -std::numeric_limits<double>::infinity(),
+              "See 'min_x'.");
+DEFINE_double(max_x, std::numeric_limits<double>::infinity(), "See 'min_x'.");
+DEFINE_double(max_y, std::numeric_limits<double>::infinity(), "See 'min_x'.");
 
 namespace cartographer_ros {
 namespace {
 
+using ::cartographer::io::SubmapSlice;
+using ::cartographer::mapping::SubmapId;
+
+constexpr int kTileSizeInPixels = 256;
+
 void FillSubmapSlice(
     const ::cartographer::transform::Rigid3d& global_submap_pose,
     const ::cartographer::mapping::proto::Submap& proto,
@@ -57,7 +77,7 @@ void FillSubmapSlice(
   submap_slice->pose = global_submap_pose;
 
   auto& texture_proto = response.textures(0);
-  const SubmapTexture::Pixels pixels = UnpackTextureData(
+  const std::string cells = UnpackTextureData(
       texture_proto.cells(), texture_proto.width(), texture_proto.height());
   submap_slice->width = texture_proto.width();
   submap_slice->height = texture_proto.height();
@@ -65,52 +85,104 @@ void FillSubmapSlice(
   submap_slice->slice_pose =
       ::cartographer::transform::ToRigid3(texture_proto.slice_pose());
   submap_slice->surface =
-      DrawTexture(pixels.intensity, pixels.alpha, texture_proto.width(),
-                  texture_proto.height(), &submap_slice->cairo_data);
+      DrawTexture(cells, texture_proto.width(), texture_proto.height(),
+                  &submap_slice->cairo_data);
 }
 
 void Run(const std::string& pbstream_filename, const std::string& map_filestem,
-         const double resolution) {
+         const double resolution, const int num_threads,
+         const Eigen::AlignedBox2d& region) {
   ::cartographer::io::ProtoStreamReader reader(pbstream_filename);
 
   ::cartographer::mapping::proto::PoseGraph pose_graph;
   CHECK(reader.ReadProto(&pose_graph));
 
-  LOG(INFO) << "Loading submap slices from serialized data.";
-  std::map<::cartographer::mapping::SubmapId, ::cartographer::io::SubmapSlice>
-      submap_slices;
-  for (;;) {
-    ::cartographer::mapping::proto::SerializedData proto;
-    if (!reader.ReadProto(&proto)) {
-      break;
+  // Submaps are rendered on a thread pool and composited into the tiles in
+  // the order they were read, i.e. in the order of their IDs. Only a bounded
+  // number of slices is kept in memory at any time.
+  LOG(INFO) << "Rendering submap slices from serialized data.";
+  const size_t max_pending_slices = 2 * num_threads;
+  TiledSubmapCompositor compositor(resolution, kTileSizeInPixels);
+  const Eigen::AlignedBox2i clip_box = compositor.ToCanvasBox(region);
+  ::cartographer::common::Mutex mutex;
+  std::map<SubmapId, std::unique_ptr<SubmapSlice>> rendered_slices;
+  std::deque<SubmapId> pending_ids;
+  // Composites the rendered slices at the front of 'pending_ids', waiting for
+  // them while more than 'max_pending' are pending.
+  const auto composite_rendered_slices = [&](const size_t max_pending) {
+    while (!pending_ids.empty()) {
+      const SubmapId id = pending_ids.front();
+      std::unique_ptr<SubmapSlice> submap_slice;
+      {
+        ::cartographer::common::MutexLocker lock(&mutex);
+        if (pending_ids.size() > max_pending) {
+          lock.Await(
+              [&rendered_slices, &id]() REQUIRES(mutex) {
+                return rendered_slices.count(id) != 0;
+              });
+        }
+        const auto it = rendered_slices.find(id);
+        if (it == rendered_slices.end()) {
+          return;
+        }
+        submap_slice = std::move(it->second);
+        rendered_slices.erase(it);
+      }
+      pending_ids.pop_front();
+      compositor.Composite(*submap_slice, clip_box);
     }
-    if (proto.has_submap()) {
-      const auto& submap = proto.submap();
-      const ::cartographer::mapping::SubmapId id{
-          submap.submap_id().trajectory_id(),
-          submap.submap_id().submap_index()};
-      const ::cartographer::transform::Rigid3d global_submap_pose =
-          ::cartographer::transform::ToRigid3(
-              pose_graph.trajectory(id.trajectory_id)
-                  .submap(id.submap_index)
-                  .pose());
-      FillSubmapSlice(global_submap_pose, submap, &submap_slices[id]);
+  };
+  {
+    ::cartographer::common::ThreadPool thread_pool(num_threads);
+    for (;;) {
+      ::cartographer::mapping::proto::SerializedData proto;
+      if (!reader.ReadProto(&proto)) {
+        break;
+      }
+      if (proto.has_submap()) {
+        const auto submap =
+            std::make_shared<::cartographer::mapping::proto::Submap>();
+        submap->Swap(proto.mutable_submap());
+        const SubmapId id{submap->submap_id().trajectory_id(),
+                          submap->submap_id().submap_index()};
+        const ::cartographer::transform::Rigid3d global_submap_pose =
+            ::cartographer::transform::ToRigid3(
+                pose_graph.trajectory(id.trajectory_id)
+                    .submap(id.submap_index)
+                    .pose());
+        pending_ids.push_back(id);
+        thread_pool.Schedule([&mutex, &rendered_slices, id, global_submap_pose,
+                              submap]() {
+          auto submap_slice =
+              ::cartographer::common::make_unique<SubmapSlice>();
+          FillSubmapSlice(global_submap_pose, *submap, submap_slice.get());
+          ::cartographer::common::MutexLocker lock(&mutex);
+          rendered_slices[id] = std::move(submap_slice);
+        });
+        composite_rendered_slices(max_pending_slices);
+      }
     }
+    CHECK(reader.eof());
+    composite_rendered_slices(0);
   }
-  CHECK(reader.eof());
-
-  LOG(INFO) << "Generating combined map image from submap slices.";
-  auto result =
-      ::cartographer::io::PaintSubmapSlices(submap_slices, resolution);
 
+  const Eigen::AlignedBox2i bounds = compositor.bounds();
+  CHECK(!bounds.isEmpty()) << "No submaps in the map region.";
+  LOG(INFO) << "Writing combined map image from submap tiles.";
   ::cartographer::io::StreamFileWriter pgm_writer(map_filestem + ".pgm");
-
-  ::cartographer::io::Image image(std::move(result.surface));
-  WritePgm(image, resolution, &pgm_writer);
-
-  const Eigen::Vector2d origin(
-      -result.origin.x() * resolution,
-      (result.origin.y() - image.height()) * resolution);
+  // The map is written one row of tiles at a time, so it never has to be
+  // painted in full on top of the tiles.
+  const Eigen::Vector2i size = bounds.sizes() + Eigen::Vector2i::Ones();
+  WritePgmHeader(size.x(), size.y(), resolution, &pgm_writer);
+  compositor.PaintBands(
+      bounds, [&pgm_writer](
+                  const ::cartographer::io::PaintSubmapSlicesResult& band) {
+        WritePgmRows(band.surface.get(), &pgm_writer);
+      });
+
+  // The origin is the lower left corner of the bottom row of pixels.
+  const Eigen::Vector2d origin(bounds.min().x() * resolution,
+                               -(bounds.max().y() + 1) * resolution);
 
   ::cartographer::io::StreamFileWriter yaml_writer(map_filestem + ".yaml");
   WriteYaml(resolution, origin, pgm_writer.GetFilename(), &yaml_writer);
@@ -127,6 +199,13 @@ int main(int argc, char** argv) {
   CHECK(!FLAGS_pbstream_filename.empty()) << "-pbstream_filename is missing.";
   CHECK(!FLAGS_map_filestem.empty()) << "-map_filestem is missing.";
 
-  ::cartographer_ros::Run(FLAGS_pbstream_filename, FLAGS_map_filestem,
-                          FLAGS_resolution);
+  CHECK_GT(FLAGS_num_threads, 0) << "-num_threads must be positive.";
+  CHECK_LT(FLAGS_min_x, FLAGS_max_x) << "The map region is empty.";
+  CHECK_LT(FLAGS_min_y, FLAGS_max_y) << "The map region is empty.";
+
+  ::cartographer_ros::Run(
+      FLAGS_pbstream_filename, FLAGS_map_filestem, FLAGS_resolution,
+      FLAGS_num_threads,
+      Eigen::AlignedBox2d(Eigen::Vector2d(FLAGS_min_x, FLAGS_min_y),
+                          Eigen::Vector2d(FLAGS_max_x, FLAGS_max_y)));
 }
@@ -0,0 +1,185 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/pipelined_bag_reader.h"
+
+#include <vector>
+
+#include "boost/make_shared.hpp"
+#include "cartographer/common/make_unique.h"
+#include "glog/logging.h"
+#include "ros/serialization.h"
+
+namespace cartographer_ros {
+
+struct PipelinedBagReader::QueuedMessage {
+  Message message;
+  // Serialized message, freed once deserialized.
+  std::vector<uint8_t> buffer;
+  bool decoded = false;
+};
+
+std::string PrefixFrameId(const std::string& prefix,
+                          const std::string& frame_id) {
+  if (!frame_id.empty() && frame_id[0] == '/') {
+    return prefix + frame_id.substr(1);
+  }
+  return prefix + frame_id;
+}
+
+namespace {
+
+template <typename MessageType>
+void PrefixFrameIds(const std::string& prefix, MessageType* const message) {
+  message->header.frame_id = PrefixFrameId(prefix, message->header.frame_id);
+}
+
+void PrefixFrameIds(const std::string& prefix,
+                    nav_msgs::Odometry* const message) {
+  message->header.frame_id = PrefixFrameId(prefix, message->header.frame_id);
+  message->child_frame_id = PrefixFrameId(prefix, message->child_frame_id);
+}
+
+void PrefixFrameIds(const std::string& prefix,
+                    tf2_msgs::TFMessage* const message) {
+  for (auto& transform : message->transforms) {
+    transform.header.frame_id =
+        PrefixFrameId(prefix, transform.header.frame_id);
+    transform.child_frame_id = PrefixFrameId(prefix, transform.child_frame_id);
+  }
+}
+
+// Sets 'decode' to deserialize a buffer into 'field' of a message if 'msg' is
+// of 'MessageType', prepending 'frame_prefix' to its frame IDs. 'frame_prefix'
+// has to outlive 'decode'.
+template <typename MessageType>
+bool SetDecoder(
+    const rosbag::MessageInstance& msg,
+    boost::shared_ptr<const MessageType> PipelinedBagReader::Message::*field,
+    const std::string* const frame_prefix,
+    std::function<void(PipelinedBagReader::Message*,
+                       std::vector<uint8_t>*)>* decode) {
+  if (!msg.isType<MessageType>()) {
+    return false;
+  }
+  *decode = [field, frame_prefix](PipelinedBagReader::Message* const message,
+                                  std::vector<uint8_t>* const buffer) {
+    auto decoded_message = boost::make_shared<MessageType>();
+    ::ros::serialization::IStream stream(buffer->data(), buffer->size());
+    ::ros::serialization::deserialize(stream, *decoded_message);
+    if (!frame_prefix->empty()) {
+      PrefixFrameIds(*frame_prefix, decoded_message.get());
+    }
+    message->*field = decoded_message;
+    std::vector<uint8_t>().swap(*buffer);
+  };
+  return true;
+}
+
+}  // namespace
+
+PipelinedBagReader::PipelinedBagReader(
+    const std::string& bag_filename,
+    std::function<bool(const rosbag::MessageInstance&)> filter,
+    const int num_decoding_threads, const size_t max_queued_messages,
+    const std::string& frame_prefix)
+    : filter_(std::move(filter)),
+      max_queued_messages_(max_queued_messages),
+      frame_prefix_(frame_prefix),
+      thread_pool_(num_decoding_threads) {
+  CHECK_GT(max_queued_messages_, 0);
+  bag_.open(bag_filename, rosbag::bagmode::Read);
+  view_ = ::cartographer::common::make_unique<rosbag::View>(bag_);
+  reader_thread_ = std::thread([this] { ReadAllMessages(); });
+}
+
+PipelinedBagReader::~PipelinedBagReader() {
+  {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    shutting_down_ = true;
+  }
+  reader_thread_.join();
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  lock.Await([this]() REQUIRES(mutex_) { return num_decoding_ == 0; });
+}
+
+::ros::Time PipelinedBagReader::begin_time() const {
+  return view_->getBeginTime();
+}
+
+::ros::Time PipelinedBagReader::end_time() const { return view_->getEndTime(); }
+
+bool PipelinedBagReader::GetNextMessage(Message* const message) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  lock.Await([this]() REQUIRES(mutex_) {
+    return queued_messages_.empty() ? reading_done_
+                                    : queued_messages_.front()->decoded;
+  });
+  if (queued_messages_.empty()) {
+    return false;
+  }
+  *message = std::move(queued_messages_.front()->message);
+  queued_messages_.pop_front();
+  return true;
+}
+
+void PipelinedBagReader::ReadAllMessages() {
+  for (const rosbag::MessageInstance& msg : *view_) {
+    if (!filter_(msg)) {
+      continue;
+    }
+    std::function<void(Message*, std::vector<uint8_t>*)> decode;
+    if (!(SetDecoder(msg, &Message::tf_message, &frame_prefix_, &decode) ||
+          SetDecoder(msg, &Message::laser_scan, &frame_prefix_, &decode) ||
+          SetDecoder(msg, &Message::multi_echo_laser_scan, &frame_prefix_,
+                     &decode) ||
+          SetDecoder(msg, &Message::point_cloud2, &frame_prefix_, &decode) ||
+          SetDecoder(msg, &Message::imu, &frame_prefix_, &decode) ||
+          SetDecoder(msg, &Message::odometry, &frame_prefix_, &decode))) {
+      continue;
+    }
+    // Only this thread accesses the bag.
+    auto queued_message = std::make_shared<QueuedMessage>();
+    queued_message->message.topic = msg.getTopic();
+    queued_message->message.time = msg.getTime();
+    queued_message->buffer.resize(msg.size());
+    ::ros::serialization::OStream stream(queued_message->buffer.data(),
+                                         queued_message->buffer.size());
+    msg.write(stream);
+    {
+      ::cartographer::common::MutexLocker lock(&mutex_);
+      lock.Await([this]() REQUIRES(mutex_) {
+        return shutting_down_ ||
+               queued_messages_.size() < max_queued_messages_;
+      });
+      if (shutting_down_) {
+        break;
+      }
+      queued_messages_.push_back(queued_message);
+      ++num_decoding_;
+    }
+    thread_pool_.Schedule([this, queued_message, decode]() {
+      decode(&queued_message->message, &queued_message->buffer);
+      ::cartographer::common::MutexLocker lock(&mutex_);
+      queued_message->decoded = true;
+      --num_decoding_;
+    });
+  }
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  reading_done_ = true;
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_PIPELINED_BAG_READER_H_
+#define CARTOGRAPHER_ROS_PIPELINED_BAG_READER_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/thread_pool.h"
+#include "nav_msgs/Odometry.h"
+#include "ros/time.h"
+#include "rosbag/bag.h"
+#include "rosbag/view.h"
+#include "sensor_msgs/Imu.h"
+#include "sensor_msgs/LaserScan.h"
+#include "sensor_msgs/MultiEchoLaserScan.h"
+#include "sensor_msgs/PointCloud2.h"
+#include "tf2_msgs/TFMessage.h"
+
+namespace cartographer_ros {
+
+// Returns 'frame_id' with 'prefix' prepended. tf2 ignores a leading slash.
+std::string PrefixFrameId(const std::string& prefix,
+                          const std::string& frame_id);
+
+// Reads the messages of a bag as a pipeline: a reader thread copies the
+// serialized messages out of the bag, a pool of threads deserializes them and
+// the messages are handed out in bag order.
+class PipelinedBagReader {
+ public:
+  struct Message {
+    std::string topic;
+    ::ros::Time time;
+    // Exactly one of these is set.
+    tf2_msgs::TFMessage::ConstPtr tf_message;
+    sensor_msgs::LaserScan::ConstPtr laser_scan;
+    sensor_msgs::MultiEchoLaserScan::ConstPtr multi_echo_laser_scan;
+    sensor_msgs::PointCloud2::ConstPtr point_cloud2;
+    sensor_msgs::Imu::ConstPtr imu;
+    nav_msgs::Odometry::ConstPtr odometry;
+  };
+
+  // Reads the messages of 'bag_filename' of the types above for which
+  // 'filter' returns true. 'filter' is called on the reader thread. At most
+  // 'max_queued_messages' are read ahead. If 'frame_prefix' is not empty, it
+  // is prepended to all frame IDs of the messages, e.g. to keep the frames of
+  // several bags apart.
+  PipelinedBagReader(
+      const std::string& bag_filename,
+      std::function<bool(const rosbag::MessageInstance&)> filter,
+      int num_decoding_threads, size_t max_queued_messages,
+      const std::string& frame_prefix);
+  // Stops reading and waits for the messages being deserialized.
+  ~PipelinedBagReader();
+
+  PipelinedBagReader(const PipelinedBagReader&) = delete;
+  PipelinedBagReader& operator=(const PipelinedBagReader&) = delete;
+
+  ::ros::Time begin_time() const;
+  ::ros::Time end_time() const;
+
+  // Waits for the next message of the bag to be deserialized. Returns false
+  // once all messages have been returned.
+  bool GetNextMessage(Message* message) EXCLUDES(mutex_);
+
+ private:
+  struct QueuedMessage;
+
+  void ReadAllMessages() EXCLUDES(mutex_);
+
+  const std::function<bool(const rosbag::MessageInstance&)> filter_;
+  const size_t max_queued_messages_;
+  const std::string frame_prefix_;
+  rosbag::Bag bag_;
+  std::unique_ptr<rosbag::View> view_;
+
+  ::cartographer::common::Mutex mutex_;
+  // In bag order, including those which are still deserialized.
+  std::deque<std::shared_ptr<QueuedMessage>> queued_messages_
+      GUARDED_BY(mutex_);
+  int num_decoding_ GUARDED_BY(mutex_) = 0;
+  bool reading_done_ GUARDED_BY(mutex_) = false;
+  bool shutting_down_ GUARDED_BY(mutex_) = false;
+  std::thread reader_thread_;
+  // Declared last, so its threads are joined before everything they use is
+  // destroyed.
+  ::cartographer::common::ThreadPool thread_pool_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_PIPELINED_BAG_READER_H_
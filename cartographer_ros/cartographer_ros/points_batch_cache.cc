@@ -0,0 +1,166 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/points_batch_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/time.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// Identifies the format, which is a sequence of batches, each of which is
+//   int64 start time in universal time scale ticks
+//   int32 trajectory ID
+//   float[3] origin
+//   uint32 number of bytes of the frame ID, uint32 number of points,
+//   uint32 number of intensities (0 or the number of points)
+//   the frame ID, the points as float[3] and the intensities as float
+// in host byte order. The file is only meant to live as long as the process.
+constexpr char kMagic[] = "CARTOGRAPHER_ROS_POINTS_BATCH_CACHE_1";
+
+static_assert(sizeof(Eigen::Vector3f) == 3 * sizeof(float),
+              "Points are written as they are laid out in memory.");
+
+template <typename T>
+void Write(const T& value, std::ofstream* const stream) {
+  stream->write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// Reads from a memory mapped file, checking that it does not run past its end.
+class Cursor {
+ public:
+  Cursor(const char* const begin, const char* const end)
+      : position_(begin), end_(end) {}
+
+  bool AtEnd() const { return position_ == end_; }
+
+  void Read(void* const destination, const size_t num_bytes) {
+    CHECK_LE(num_bytes, static_cast<size_t>(end_ - position_))
+        << "Truncated points batch cache.";
+    std::memcpy(destination, position_, num_bytes);
+    position_ += num_bytes;
+  }
+
+  template <typename T>
+  T Read() {
+    T value;
+    Read(&value, sizeof(T));
+    return value;
+  }
+
+ private:
+  const char* position_;
+  const char* const end_;
+};
+
+}  // namespace
+
+PointsBatchCacheWriter::PointsBatchCacheWriter(
+    const std::string& filename,
+    ::cartographer::io::PointsProcessor* const next)
+    : next_(next), stream_(filename, std::ios::out | std::ios::binary) {
+  CHECK(stream_.good()) << "Could not open '" << filename << "'.";
+  stream_.write(kMagic, sizeof(kMagic));
+}
+
+void PointsBatchCacheWriter::Process(
+    std::unique_ptr<::cartographer::io::PointsBatch> batch) {
+  CHECK(batch->colors.empty())
+      << "The points batch cache must come before any stage adding colors.";
+  CHECK(batch->intensities.empty() ||
+        batch->intensities.size() == batch->points.size());
+  Write<int64_t>(::cartographer::common::ToUniversal(batch->start_time),
+                 &stream_);
+  Write<int32_t>(batch->trajectory_id, &stream_);
+  for (int i = 0; i < 3; ++i) {
+    Write<float>(batch->origin[i], &stream_);
+  }
+  Write<uint32_t>(batch->frame_id.size(), &stream_);
+  Write<uint32_t>(batch->points.size(), &stream_);
+  Write<uint32_t>(batch->intensities.size(), &stream_);
+  stream_.write(batch->frame_id.data(), batch->frame_id.size());
+  stream_.write(reinterpret_cast<const char*>(batch->points.data()),
+                batch->points.size() * sizeof(Eigen::Vector3f));
+  stream_.write(reinterpret_cast<const char*>(batch->intensities.data()),
+                batch->intensities.size() * sizeof(float));
+  next_->Process(std::move(batch));
+}
+
+::cartographer::io::PointsProcessor::FlushResult
+PointsBatchCacheWriter::Flush() {
+  stream_.close();
+  CHECK(!stream_.fail()) << "Writing the points batch cache failed.";
+  return next_->Flush();
+}
+
+void ReadPointsBatchCache(const std::string& filename,
+                          ::cartographer::io::PointsProcessor* const next) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_NE(fd, -1) << "Could not open '" << filename << "': "
+                   << strerror(errno);
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << strerror(errno);
+  const size_t num_bytes = file_stat.st_size;
+  CHECK_GE(num_bytes, sizeof(kMagic)) << "Truncated points batch cache.";
+  void* const data = mmap(nullptr, num_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  CHECK(data != MAP_FAILED) << strerror(errno);
+  CHECK_EQ(close(fd), 0);
+  // The batches are read front to back, so the kernel can read ahead
+  // aggressively and drop the pages behind.
+  madvise(data, num_bytes, MADV_SEQUENTIAL);
+
+  const char* const begin = static_cast<const char*>(data);
+  Cursor cursor(begin, begin + num_bytes);
+  char magic[sizeof(kMagic)];
+  cursor.Read(magic, sizeof(magic));
+  CHECK_EQ(std::memcmp(magic, kMagic, sizeof(kMagic)), 0)
+      << "'" << filename << "' is not a points batch cache.";
+  while (!cursor.AtEnd()) {
+    auto batch = ::cartographer::common::make_unique<
+        ::cartographer::io::PointsBatch>();
+    batch->start_time =
+        ::cartographer::common::FromUniversal(cursor.Read<int64_t>());
+    batch->trajectory_id = cursor.Read<int32_t>();
+    for (int i = 0; i < 3; ++i) {
+      batch->origin[i] = cursor.Read<float>();
+    }
+    const uint32_t frame_id_size = cursor.Read<uint32_t>();
+    const uint32_t num_points = cursor.Read<uint32_t>();
+    const uint32_t num_intensities = cursor.Read<uint32_t>();
+    batch->frame_id.resize(frame_id_size);
+    cursor.Read(&batch->frame_id[0], frame_id_size);
+    batch->points.resize(num_points);
+    cursor.Read(batch->points.data(), num_points * sizeof(Eigen::Vector3f));
+    batch->intensities.resize(num_intensities);
+    cursor.Read(batch->intensities.data(), num_intensities * sizeof(float));
+    next->Process(std::move(batch));
+  }
+  CHECK_EQ(munmap(data, num_bytes), 0) << strerror(errno);
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_POINTS_BATCH_CACHE_H_
+#define CARTOGRAPHER_ROS_POINTS_BATCH_CACHE_H_
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "cartographer/io/points_batch.h"
+#include "cartographer/io/points_processor.h"
+
+namespace cartographer_ros {
+
+// Writes the batches passing through it to 'filename', from which
+// ReadPointsBatchCache() can read them back much faster than they were
+// created. Only points and intensities are kept, so it should come before any
+// stage which adds colors. 'Flush' closes the file.
+class PointsBatchCacheWriter : public ::cartographer::io::PointsProcessor {
+ public:
+  PointsBatchCacheWriter(const std::string& filename, PointsProcessor* next);
+  PointsBatchCacheWriter(const PointsBatchCacheWriter&) = delete;
+  PointsBatchCacheWriter& operator=(const PointsBatchCacheWriter&) = delete;
+
+  ~PointsBatchCacheWriter() override {}
+
+  void Process(std::unique_ptr<::cartographer::io::PointsBatch> batch) override;
+  FlushResult Flush() override;
+
+ private:
+  PointsProcessor* const next_;
+  std::ofstream stream_;
+};
+
+// Memory maps the file written by a PointsBatchCacheWriter and hands all
+// batches in it to 'next' in order. Does not flush 'next'.
+void ReadPointsBatchCache(const std::string& filename,
+                          ::cartographer::io::PointsProcessor* next);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_POINTS_BATCH_CACHE_H_
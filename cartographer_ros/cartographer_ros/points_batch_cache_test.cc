@@ -0,0 +1,98 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/points_batch_cache.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "cartographer/common/make_unique.h"
+#include "cartographer/common/time.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::io::PointsBatch;
+using ::cartographer::io::PointsProcessor;
+
+class CollectingPointsProcessor : public PointsProcessor {
+ public:
+  void Process(std::unique_ptr<PointsBatch> batch) override {
+    batches.push_back(std::move(batch));
+  }
+  FlushResult Flush() override { return FlushResult::kFinished; }
+
+  std::vector<std::unique_ptr<PointsBatch>> batches;
+};
+
+std::unique_ptr<PointsBatch> CreatePointsBatch(const int trajectory_id,
+                                               const std::string& frame_id,
+                                               const int num_points,
+                                               const bool with_intensities) {
+  auto batch = ::cartographer::common::make_unique<PointsBatch>();
+  batch->start_time =
+      ::cartographer::common::FromUniversal(1234567 + 10 * trajectory_id);
+  batch->trajectory_id = trajectory_id;
+  batch->frame_id = frame_id;
+  batch->origin = Eigen::Vector3f(1.f, -2.f, 0.5f);
+  for (int i = 0; i < num_points; ++i) {
+    batch->points.emplace_back(0.1f * i, -0.2f * i, 3.f);
+    if (with_intensities) {
+      batch->intensities.push_back(10.f + i);
+    }
+  }
+  return batch;
+}
+
+TEST(PointsBatchCacheTest, ReadsBackWrittenBatches) {
+  char filename[] = "/tmp/points_batch_cache_test_XXXXXX";
+  const int fd = mkstemp(filename);
+  ASSERT_NE(fd, -1);
+  close(fd);
+
+  std::vector<std::unique_ptr<PointsBatch>> expected_batches;
+  expected_batches.push_back(CreatePointsBatch(0, "horizontal_laser", 5, true));
+  expected_batches.push_back(CreatePointsBatch(0, "", 0, false));
+  expected_batches.push_back(CreatePointsBatch(1, "vertical_laser", 7, false));
+
+  CollectingPointsProcessor written;
+  PointsBatchCacheWriter writer(filename, &written);
+  for (const auto& batch : expected_batches) {
+    writer.Process(::cartographer::common::make_unique<PointsBatch>(*batch));
+  }
+  EXPECT_EQ(PointsProcessor::FlushResult::kFinished, writer.Flush());
+  EXPECT_EQ(expected_batches.size(), written.batches.size());
+
+  CollectingPointsProcessor read;
+  ReadPointsBatchCache(filename, &read);
+  unlink(filename);
+  ASSERT_EQ(expected_batches.size(), read.batches.size());
+  for (size_t i = 0; i < expected_batches.size(); ++i) {
+    const PointsBatch& expected = *expected_batches[i];
+    const PointsBatch& actual = *read.batches[i];
+    EXPECT_EQ(expected.start_time, actual.start_time);
+    EXPECT_EQ(expected.trajectory_id, actual.trajectory_id);
+    EXPECT_EQ(expected.frame_id, actual.frame_id);
+    EXPECT_EQ(expected.origin, actual.origin);
+    EXPECT_EQ(expected.points, actual.points);
+    EXPECT_EQ(expected.intensities, actual.intensities);
+  }
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/pose_graph_markers.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "cartographer/io/color.h"
+#include "cartographer/transform/rigid_transform.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "geometry_msgs/msg/point.hpp"
+#include "std_msgs/msg/color_rgba.hpp"
+
+namespace cartographer_ros {
+
+namespace {
+
+constexpr double kTrajectoryLineStripMarkerScale = 0.07;
+constexpr double kConstraintMarkerScale = 0.025;
+// Below this many constraints, the constraint markers are computed on a single
+// thread.
+constexpr size_t kMinConstraintsPerThread = 10000;
+
+// The intra and inter submap constraint and residual line lists.
+struct ConstraintMarkers {
+  visualization_msgs::msg::Marker constraint_intra;
+  visualization_msgs::msg::Marker residual_intra;
+  visualization_msgs::msg::Marker constraint_inter;
+  visualization_msgs::msg::Marker residual_inter;
+};
+
+::std_msgs::msg::ColorRGBA ToMessage(
+    const ::cartographer::io::FloatColor& color) {
+  ::std_msgs::msg::ColorRGBA result;
+  result.r = color[0];
+  result.g = color[1];
+  result.b = color[2];
+  result.a = 1.f;
+  return result;
+}
+
+visualization_msgs::msg::Marker CreateTrajectoryMarker(
+    const int trajectory_id, const std::string& frame_id,
+    const builtin_interfaces::msg::Time& stamp) {
+  visualization_msgs::msg::Marker marker;
+  marker.ns = "Trajectory " + std::to_string(trajectory_id);
+  marker.id = 0;
+  marker.type = visualization_msgs::msg::Marker::LINE_STRIP;
+  marker.header.stamp = stamp;
+  marker.header.frame_id = frame_id;
+  marker.color = ToMessage(::cartographer::io::GetColor(trajectory_id));
+  marker.scale.x = kTrajectoryLineStripMarkerScale;
+  marker.pose.orientation.w = 1.;
+  marker.pose.position.z = 0.05;
+  return marker;
+}
+
+void PushAndResetLineMarker(
+    visualization_msgs::msg::Marker* marker,
+    std::vector<visualization_msgs::msg::Marker>* markers) {
+  if (marker->points.size() > 1) {
+    markers->push_back(*marker);
+    ++marker->id;
+  }
+  marker->points.clear();
+}
+
+// Appends the points and colors of the line list 'source' to 'destination'.
+void AppendLineMarker(const visualization_msgs::msg::Marker& source,
+                      visualization_msgs::msg::Marker* destination) {
+  destination->points.insert(destination->points.end(), source.points.begin(),
+                             source.points.end());
+  destination->colors.insert(destination->colors.end(), source.colors.begin(),
+                             source.colors.end());
+}
+
+}  // namespace
+
+void UpdateTrajectoryNodeMarkers(
+    const int trajectory_id,
+    const ::cartographer::mapping::MapById<
+        ::cartographer::mapping::NodeId,
+        ::cartographer::mapping::TrajectoryNode>& nodes,
+    const int optimization_generation, const std::string& frame_id,
+    const builtin_interfaces::msg::Time& stamp,
+    TrajectoryNodeMarkers* const markers) {
+  if (markers->optimization_generation != optimization_generation) {
+    // Global poses have moved, so all markers have to be rebuilt.
+    *markers = TrajectoryNodeMarkers();
+    markers->optimization_generation = optimization_generation;
+    markers->marker = CreateTrajectoryMarker(trajectory_id, frame_id, stamp);
+  }
+
+  for (const auto& node_id_data : nodes.trajectory(trajectory_id)) {
+    if (node_id_data.id.node_index < markers->next_node_index) {
+      continue;
+    }
+    markers->next_node_index = node_id_data.id.node_index + 1;
+    if (node_id_data.data.constant_data == nullptr) {
+      PushAndResetLineMarker(&markers->marker, &markers->markers);
+      continue;
+    }
+    const ::geometry_msgs::msg::Point node_point =
+        ToGeometryMsgPoint(node_id_data.data.global_pose.translation());
+    markers->marker.points.push_back(node_point);
+    // Work around the 16384 point limit in RViz by splitting the
+    // trajectory into multiple markers.
+    if (markers->marker.points.size() == 16384) {
+      PushAndResetLineMarker(&markers->marker, &markers->markers);
+      // Push back the last point, so the two markers appear connected.
+      markers->marker.points.push_back(node_point);
+    }
+  }
+}
+
+visualization_msgs::msg::MarkerArray ComputeConstraintList(
+    const std::vector<::cartographer::mapping::PoseGraph::Constraint>&
+        constraints,
+    const ::cartographer::mapping::MapById<
+        ::cartographer::mapping::NodeId,
+        ::cartographer::mapping::TrajectoryNode>& trajectory_nodes,
+    const ::cartographer::mapping::MapById<
+        ::cartographer::mapping::SubmapId,
+        ::cartographer::mapping::PoseGraph::SubmapData>& submap_data,
+    const std::string& frame_id, const builtin_interfaces::msg::Time& stamp) {
+  int marker_id = 0;
+  ConstraintMarkers markers;
+  markers.constraint_intra.id = marker_id++;
+  markers.constraint_intra.ns = "Intra constraints";
+  markers.constraint_intra.type = visualization_msgs::msg::Marker::LINE_LIST;
+  markers.constraint_intra.header.stamp = stamp;
+  markers.constraint_intra.header.frame_id = frame_id;
+  markers.constraint_intra.scale.x = kConstraintMarkerScale;
+  markers.constraint_intra.pose.orientation.w = 1.0;
+
+  markers.residual_intra = markers.constraint_intra;
+  markers.residual_intra.id = marker_id++;
+  markers.residual_intra.ns = "Intra residuals";
+  // This and other markers which are less numerous are set to be slightly
+  // above the intra constraints marker in order to ensure that they are
+  // visible.
+  markers.residual_intra.pose.position.z = 0.1;
+
+  markers.constraint_inter = markers.constraint_intra;
+  markers.constraint_inter.id = marker_id++;
+  markers.constraint_inter.ns = "Inter constraints";
+  markers.constraint_inter.pose.position.z = 0.1;
+
+  markers.residual_inter = markers.constraint_intra;
+  markers.residual_inter.id = marker_id++;
+  markers.residual_inter.ns = "Inter residuals";
+  markers.residual_inter.pose.position.z = 0.1;
+
+  const auto add_constraint_markers = [&](const size_t begin, const size_t end,
+                                          ConstraintMarkers* const result) {
+    for (size_t i = begin; i != end; ++i) {
+      const auto& constraint = constraints[i];
+      visualization_msgs::msg::Marker *constraint_marker, *residual_marker;
+      std_msgs::msg::ColorRGBA color_constraint, color_residual;
+      if (constraint.tag ==
+          ::cartographer::mapping::PoseGraph::Constraint::INTRA_SUBMAP) {
+        constraint_marker = &result->constraint_intra;
+        residual_marker = &result->residual_intra;
+        // Color mapping for submaps of various trajectories - add trajectory
+        // id to ensure different starting colors. Also add a fixed offset of
+        // 25 to avoid having identical colors as trajectories.
+        color_constraint = ToMessage(::cartographer::io::GetColor(
+            constraint.submap_id.submap_index +
+            constraint.submap_id.trajectory_id + 25));
+        color_residual.a = 1.0;
+        color_residual.r = 1.0;
+      } else {
+        constraint_marker = &result->constraint_inter;
+        residual_marker = &result->residual_inter;
+        // Bright yellow
+        color_constraint.a = 1.0;
+        color_constraint.r = color_constraint.g = 1.0;
+        // Bright cyan
+        color_residual.a = 1.0;
+        color_residual.b = color_residual.g = 1.0;
+      }
+
+      for (int j = 0; j < 2; ++j) {
+        constraint_marker->colors.push_back(color_constraint);
+        residual_marker->colors.push_back(color_residual);
+      }
+
+      const auto submap_it = submap_data.find(constraint.submap_id);
+      if (submap_it == submap_data.end()) {
+        continue;
+      }
+      const auto& submap_pose = submap_it->data.pose;
+      const auto node_it = trajectory_nodes.find(constraint.node_id);
+      if (node_it == trajectory_nodes.end()) {
+        continue;
+      }
+      const auto& trajectory_node_pose = node_it->data.global_pose;
+      const ::cartographer::transform::Rigid3d constraint_pose =
+          submap_pose * constraint.pose.zbar_ij;
+
+      constraint_marker->points.push_back(
+          ToGeometryMsgPoint(submap_pose.translation()));
+      constraint_marker->points.push_back(
+          ToGeometryMsgPoint(constraint_pose.translation()));
+
+      residual_marker->points.push_back(
+          ToGeometryMsgPoint(constraint_pose.translation()));
+      residual_marker->points.push_back(
+          ToGeometryMsgPoint(trajectory_node_pose.translation()));
+    }
+  };
+
+  // Large pose graphs are converted in chunks on several threads, which are
+  // appended in order afterwards.
+  const size_t num_threads = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()),
+      constraints.size() / kMinConstraintsPerThread + 1);
+  if (num_threads == 1) {
+    add_constraint_markers(0, constraints.size(), &markers);
+  } else {
+    std::vector<ConstraintMarkers> chunks(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != num_threads; ++i) {
+      threads.emplace_back([&, i] {
+        add_constraint_markers(constraints.size() * i / num_threads,
+                               constraints.size() * (i + 1) / num_threads,
+                               &chunks[i]);
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    for (const ConstraintMarkers& chunk : chunks) {
+      AppendLineMarker(chunk.constraint_intra, &markers.constraint_intra);
+      AppendLineMarker(chunk.residual_intra, &markers.residual_intra);
+      AppendLineMarker(chunk.constraint_inter, &markers.constraint_inter);
+      AppendLineMarker(chunk.residual_inter, &markers.residual_inter);
+    }
+  }
+
+  visualization_msgs::msg::MarkerArray constraint_list;
+  constraint_list.markers.push_back(std::move(markers.constraint_intra));
+  constraint_list.markers.push_back(std::move(markers.residual_intra));
+  constraint_list.markers.push_back(std::move(markers.constraint_inter));
+  constraint_list.markers.push_back(std::move(markers.residual_inter));
+  return constraint_list;
+}
+
+}  // namespace cartographer_ros
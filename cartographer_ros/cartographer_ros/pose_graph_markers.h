@@ -0,0 +1,72 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_POSE_GRAPH_MARKERS_H_
+#define CARTOGRAPHER_ROS_POSE_GRAPH_MARKERS_H_
+
+#include <string>
+#include <vector>
+
+#include "builtin_interfaces/msg/time.hpp"
+#include "cartographer/mapping/id.h"
+#include "cartographer/mapping/pose_graph.h"
+#include "cartographer/mapping/trajectory_node.h"
+#include "visualization_msgs/msg/marker.hpp"
+#include "visualization_msgs/msg/marker_array.hpp"
+
+namespace cartographer_ros {
+
+// Trajectory node markers of a single trajectory, which are extended by the
+// nodes added since they were last updated.
+struct TrajectoryNodeMarkers {
+  // Generation the global poses of the markers are from.
+  int optimization_generation = -1;
+  // Line strips which will not be extended anymore.
+  std::vector<visualization_msgs::msg::Marker> markers;
+  // Line strip new nodes are appended to.
+  visualization_msgs::msg::Marker marker;
+  // All nodes with a lower 'node_index' have been added.
+  int next_node_index = 0;
+};
+
+// Appends the nodes of 'trajectory_id' in 'nodes' which are not yet part of
+// 'markers'. If the global poses of 'markers' are from another
+// 'optimization_generation', they are rebuilt from scratch.
+void UpdateTrajectoryNodeMarkers(
+    int trajectory_id,
+    const ::cartographer::mapping::MapById<
+        ::cartographer::mapping::NodeId,
+        ::cartographer::mapping::TrajectoryNode>& nodes,
+    int optimization_generation, const std::string& frame_id,
+    const builtin_interfaces::msg::Time& stamp, TrajectoryNodeMarkers* markers);
+
+// Returns the intra and inter submap constraint and residual line lists of
+// 'constraints' between 'submap_data' and 'trajectory_nodes'. Large pose
+// graphs are converted on several threads.
+visualization_msgs::msg::MarkerArray ComputeConstraintList(
+    const std::vector<::cartographer::mapping::PoseGraph::Constraint>&
+        constraints,
+    const ::cartographer::mapping::MapById<
+        ::cartographer::mapping::NodeId,
+        ::cartographer::mapping::TrajectoryNode>& trajectory_nodes,
+    const ::cartographer::mapping::MapById<
+        ::cartographer::mapping::SubmapId,
+        ::cartographer::mapping::PoseGraph::SubmapData>& submap_data,
+    const std::string& frame_id, const builtin_interfaces::msg::Time& stamp);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_POSE_GRAPH_MARKERS_H_
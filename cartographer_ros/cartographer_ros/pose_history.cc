@@ -0,0 +1,95 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/pose_history.h"
+
+#include "cartographer/common/make_unique.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace carto = ::cartographer;
+
+PoseHistory::PoseHistory(const size_t capacity)
+    : times_(capacity), poses_(capacity) {
+  CHECK_GT(capacity, 0);
+}
+
+void PoseHistory::Add(const carto::common::Time time,
+                      const carto::transform::Rigid3d& pose) {
+  const carto::common::int64 ticks = carto::common::ToUniversal(time);
+  if (size_ != 0 && ticks <= times_[ToBufferIndex(size_ - 1)]) {
+    return;
+  }
+  if (size_ == times_.size()) {
+    begin_ = ToBufferIndex(1);
+    --size_;
+  }
+  const size_t index = ToBufferIndex(size_);
+  times_[index] = ticks;
+  poses_[index] = pose;
+  ++size_;
+}
+
+std::unique_ptr<carto::transform::Rigid3d> PoseHistory::LookUp(
+    const carto::common::Time time) const {
+  const carto::common::int64 ticks = carto::common::ToUniversal(time);
+  if (size_ == 0 || ticks < times_[ToBufferIndex(0)] ||
+      ticks > times_[ToBufferIndex(size_ - 1)]) {
+    return nullptr;
+  }
+  // Binary search for the first pose not older than 'time'.
+  size_t low = 0;
+  size_t high = size_ - 1;
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    if (times_[ToBufferIndex(middle)] < ticks) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  const size_t end_index = ToBufferIndex(low);
+  if (times_[end_index] == ticks) {
+    return carto::common::make_unique<carto::transform::Rigid3d>(
+        poses_[end_index]);
+  }
+  const size_t start_index = ToBufferIndex(low - 1);
+  const double factor =
+      static_cast<double>(ticks - times_[start_index]) /
+      static_cast<double>(times_[end_index] - times_[start_index]);
+  const carto::transform::Rigid3d& start = poses_[start_index];
+  const carto::transform::Rigid3d& end = poses_[end_index];
+  return carto::common::make_unique<carto::transform::Rigid3d>(
+      start.translation() + (end.translation() - start.translation()) * factor,
+      start.rotation().slerp(factor, end.rotation()));
+}
+
+carto::common::Time PoseHistory::earliest_time() const {
+  CHECK_NE(size_, 0);
+  return carto::common::FromUniversal(times_[ToBufferIndex(0)]);
+}
+
+carto::common::Time PoseHistory::latest_time() const {
+  CHECK_NE(size_, 0);
+  return carto::common::FromUniversal(times_[ToBufferIndex(size_ - 1)]);
+}
+
+size_t PoseHistory::ToBufferIndex(const size_t i) const {
+  return (begin_ + i) % times_.size();
+}
+
+}  // namespace cartographer_ros
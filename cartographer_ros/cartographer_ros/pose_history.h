@@ -0,0 +1,68 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_POSE_HISTORY_H_
+#define CARTOGRAPHER_ROS_POSE_HISTORY_H_
+
+#include <memory>
+#include <vector>
+
+#include "cartographer/common/port.h"
+#include "cartographer/common/time.h"
+#include "cartographer/transform/rigid_transform.h"
+
+namespace cartographer_ros {
+
+// Fixed-size ring buffer of the latest poses of a trajectory, which can be
+// looked up by time. Timestamps are kept apart from the poses, so lookups only
+// touch the poses they interpolate between. Not thread-safe.
+class PoseHistory {
+ public:
+  // Keeps at most 'capacity' poses, which must be positive.
+  explicit PoseHistory(size_t capacity);
+
+  PoseHistory(const PoseHistory&) = delete;
+  PoseHistory& operator=(const PoseHistory&) = delete;
+
+  // Adds 'pose' at 'time', replacing the oldest pose once full. Poses which
+  // are not newer than the latest pose are ignored.
+  void Add(::cartographer::common::Time time,
+           const ::cartographer::transform::Rigid3d& pose);
+
+  // Returns the pose at 'time', interpolated between the closest poses, or
+  // nullptr if 'time' is outside of the history.
+  std::unique_ptr<::cartographer::transform::Rigid3d> LookUp(
+      ::cartographer::common::Time time) const;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  // May only be called if not empty().
+  ::cartographer::common::Time earliest_time() const;
+  ::cartographer::common::Time latest_time() const;
+
+ private:
+  // Maps index 'i', counted from the oldest pose, into the ring buffer.
+  size_t ToBufferIndex(size_t i) const;
+
+  std::vector<::cartographer::common::int64> times_;
+  std::vector<::cartographer::transform::Rigid3d> poses_;
+  size_t begin_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_POSE_HISTORY_H_
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/pose_history.h"
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::common::FromUniversal;
+using ::cartographer::transform::Rigid3d;
+
+TEST(PoseHistoryTest, InterpolatesBetweenPoses) {
+  PoseHistory history(10);
+  EXPECT_EQ(nullptr, history.LookUp(FromUniversal(100)));
+  history.Add(FromUniversal(100), Rigid3d::Translation({0., 0., 0.}));
+  history.Add(FromUniversal(200), Rigid3d::Translation({2., 0., 0.}));
+  history.Add(FromUniversal(300), Rigid3d::Rotation(Eigen::AngleAxisd(
+                                      1., Eigen::Vector3d::UnitZ())));
+  EXPECT_EQ(nullptr, history.LookUp(FromUniversal(99)));
+  EXPECT_EQ(nullptr, history.LookUp(FromUniversal(301)));
+
+  auto pose = history.LookUp(FromUniversal(150));
+  ASSERT_NE(nullptr, pose);
+  EXPECT_NEAR(1., pose->translation().x(), 1e-9);
+
+  pose = history.LookUp(FromUniversal(200));
+  ASSERT_NE(nullptr, pose);
+  EXPECT_NEAR(2., pose->translation().x(), 1e-9);
+
+  pose = history.LookUp(FromUniversal(250));
+  ASSERT_NE(nullptr, pose);
+  EXPECT_NEAR(1., pose->translation().x(), 1e-9);
+  EXPECT_NEAR(0.5, Eigen::AngleAxisd(pose->rotation()).angle(), 1e-9);
+}
+
+TEST(PoseHistoryTest, DropsOldestPosesOnceFull) {
+  PoseHistory history(3);
+  for (int i = 0; i != 5; ++i) {
+    history.Add(FromUniversal(i * 10), Rigid3d::Translation({1. * i, 0., 0.}));
+  }
+  history.Add(FromUniversal(35), Rigid3d::Identity());
+  EXPECT_EQ(3, history.size());
+  EXPECT_EQ(FromUniversal(20), history.earliest_time());
+  EXPECT_EQ(FromUniversal(40), history.latest_time());
+  EXPECT_EQ(nullptr, history.LookUp(FromUniversal(15)));
+  const auto pose = history.LookUp(FromUniversal(35));
+  ASSERT_NE(nullptr, pose);
+  EXPECT_NEAR(3.5, pose->translation().x(), 1e-9);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
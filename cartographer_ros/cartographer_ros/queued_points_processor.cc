@@ -0,0 +1,86 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/queued_points_processor.h"
+
+#include "cartographer/common/make_unique.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+QueuedPointsProcessor::QueuedPointsProcessor(
+    const size_t max_queued_batches,
+    ::cartographer::io::PointsProcessor* const next)
+    : max_queued_batches_(max_queued_batches), next_(next) {
+  CHECK_GT(max_queued_batches_, 0);
+  thread_ = std::thread([this]() { ProcessQueuedBatches(); });
+}
+
+std::unique_ptr<QueuedPointsProcessor> QueuedPointsProcessor::FromDictionary(
+    ::cartographer::common::LuaParameterDictionary* const dictionary,
+    ::cartographer::io::PointsProcessor* const next) {
+  return ::cartographer::common::make_unique<QueuedPointsProcessor>(
+      dictionary->GetNonNegativeInt("max_queued_batches"), next);
+}
+
+QueuedPointsProcessor::~QueuedPointsProcessor() {
+  {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    shutting_down_ = true;
+  }
+  thread_.join();
+}
+
+void QueuedPointsProcessor::Process(
+    std::unique_ptr<::cartographer::io::PointsBatch> batch) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  lock.Await([this]() REQUIRES(mutex_) {
+    return queue_.size() < max_queued_batches_;
+  });
+  queue_.push_back(std::move(batch));
+}
+
+::cartographer::io::PointsProcessor::FlushResult
+QueuedPointsProcessor::Flush() {
+  {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    lock.Await(
+        [this]() REQUIRES(mutex_) { return queue_.empty() && !processing_; });
+  }
+  return next_->Flush();
+}
+
+void QueuedPointsProcessor::ProcessQueuedBatches() {
+  for (;;) {
+    std::unique_ptr<::cartographer::io::PointsBatch> batch;
+    {
+      ::cartographer::common::MutexLocker lock(&mutex_);
+      processing_ = false;
+      lock.Await([this]() REQUIRES(mutex_) {
+        return !queue_.empty() || shutting_down_;
+      });
+      if (queue_.empty()) {
+        return;
+      }
+      batch = std::move(queue_.front());
+      queue_.pop_front();
+      processing_ = true;
+    }
+    next_->Process(std::move(batch));
+  }
+}
+
+}  // namespace cartographer_ros
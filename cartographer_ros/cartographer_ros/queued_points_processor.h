@@ -0,0 +1,68 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_QUEUED_POINTS_PROCESSOR_H_
+#define CARTOGRAPHER_ROS_QUEUED_POINTS_PROCESSOR_H_
+
+#include <deque>
+#include <memory>
+#include <thread>
+
+#include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/io/points_processor.h"
+
+namespace cartographer_ros {
+
+// Hands the batches to the next processor on a thread of its own, so that the
+// stages before and after it run concurrently. At most 'max_queued_batches'
+// wait for the next processor, after which 'Process' blocks. 'Flush' waits for
+// all batches to be processed before flushing the next processor on the
+// calling thread, so flushing happens in the order of the pipeline.
+class QueuedPointsProcessor : public ::cartographer::io::PointsProcessor {
+ public:
+  constexpr static const char* kConfigurationFileActionName = "queue";
+  QueuedPointsProcessor(size_t max_queued_batches, PointsProcessor* next);
+  QueuedPointsProcessor(const QueuedPointsProcessor&) = delete;
+  QueuedPointsProcessor& operator=(const QueuedPointsProcessor&) = delete;
+
+  static std::unique_ptr<QueuedPointsProcessor> FromDictionary(
+      ::cartographer::common::LuaParameterDictionary* dictionary,
+      PointsProcessor* next);
+
+  ~QueuedPointsProcessor() override;
+
+  void Process(std::unique_ptr<::cartographer::io::PointsBatch> batch) override
+      EXCLUDES(mutex_);
+  FlushResult Flush() override EXCLUDES(mutex_);
+
+ private:
+  void ProcessQueuedBatches() EXCLUDES(mutex_);
+
+  const size_t max_queued_batches_;
+  PointsProcessor* const next_;
+
+  ::cartographer::common::Mutex mutex_;
+  std::deque<std::unique_ptr<::cartographer::io::PointsBatch>> queue_
+      GUARDED_BY(mutex_);
+  bool processing_ GUARDED_BY(mutex_) = false;
+  bool shutting_down_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_QUEUED_POINTS_PROCESSOR_H_
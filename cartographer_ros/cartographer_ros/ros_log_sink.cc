@@ -17,31 +17,85 @@
 #include "cartographer_ros/ros_log_sink.h"
 
 #include <chrono>
+#include <cstdint>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <thread>
 
 #include "glog/log_severity.h"
 
-#define ROS_INFO_STREAM(str) std::cout << str << std::endl;
-#define ROS_WARN_STREAM(str) std::cout << str << std::endl;
-#define ROS_ERROR_STREAM(str) std::cerr << str << std::endl;
-#define ROS_FATAL_STREAM(str) std::cerr << str << std::endl;
+#define ROS_INFO_STREAM(str) std::cout << str << '\n';
+#define ROS_WARN_STREAM(str) std::cout << str << '\n';
+#define ROS_ERROR_STREAM(str) std::cerr << str << '\n';
+#define ROS_FATAL_STREAM(str) std::cerr << str << '\n';
 
 namespace cartographer_ros {
 
 namespace {
 
+// Must be a power of 2.
+constexpr size_t kNumRecords = 1024;
+constexpr size_t kMaxMessageLength = 1024;
+// Replaces the end of messages longer than 'kMaxMessageLength'.
+constexpr char kTruncationMarker[] = "... (truncated)";
+constexpr size_t kTruncationMarkerLength = sizeof(kTruncationMarker) - 1;
+// Call sites are hashed into this many slots, so rarely two share a limit.
+constexpr size_t kNumCallSites = 512;
+constexpr uint64_t kMaxMessagesPerCallSitePerSecond = 5;
+constexpr std::chrono::milliseconds kDrainPeriod(10);
+constexpr std::chrono::milliseconds kMaxFatalWaitTime(1000);
+
 const char* GetBasename(const char* filepath) {
   const char* base = std::strrchr(filepath, '/');
   return base ? (base + 1) : filepath;
 }
 
+uint64_t GetSecondsSinceEpoch() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 }  // namespace
 
-ScopedRosLogSink::ScopedRosLogSink() : will_die_(false) { AddLogSink(this); }
-ScopedRosLogSink::~ScopedRosLogSink() { RemoveLogSink(this); }
+struct ScopedRosLogSink::Record {
+  // Equal to the enqueue position for which this record can be written, and
+  // to that position plus one once it can be read.
+  std::atomic<size_t> sequence;
+  ::google::LogSeverity severity;
+  size_t length;
+  char text[kMaxMessageLength];
+};
+
+struct ScopedRosLogSink::CallSite {
+  // The lower 32 bits of the current second in the upper half, and the number
+  // of messages logged in that second in the lower half.
+  std::atomic<uint64_t> second_and_count{0};
+  std::atomic<int> num_suppressed{0};
+};
+
+ScopedRosLogSink::ScopedRosLogSink()
+    : records_(new Record[kNumRecords]),
+      call_sites_(new CallSite[kNumCallSites]),
+      enqueue_position_(0),
+      dequeue_position_(0),
+      flushed_position_(0),
+      num_dropped_(0),
+      shutting_down_(false) {
+  for (size_t i = 0; i != kNumRecords; ++i) {
+    records_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  thread_ = std::thread([this]() { DrainUntilShutdown(); });
+  AddLogSink(this);
+}
+
+ScopedRosLogSink::~ScopedRosLogSink() {
+  RemoveLogSink(this);
+  shutting_down_.store(true);
+  thread_.join();
+}
 
 void ScopedRosLogSink::send(const ::google::LogSeverity severity,
                             const char* const filename,
@@ -50,33 +104,158 @@ void ScopedRosLogSink::send(const ::google::LogSeverity severity,
                             const char* const message,
                             const size_t message_len) {
   (void)base_filename;
-  const std::string message_string = ::google::LogSink::ToString(
+  int num_suppressed = 0;
+  if (severity != ::google::GLOG_FATAL &&
+      !CheckRateLimit(filename, line, &num_suppressed)) {
+    return;
+  }
+  std::string message_string = ::google::LogSink::ToString(
       severity, GetBasename(filename), line, tm_time, message, message_len);
-  switch (severity) {
-    case ::google::GLOG_INFO:
-      ROS_INFO_STREAM(message_string);
-      break;
+  if (severity == ::google::GLOG_FATAL) {
+    // The process dies right after, and the ring buffer may be full, so this
+    // is written here. The queued messages usually explain it and go first.
+    WaitForQueuedRecords();
+    ROS_FATAL_STREAM(message_string);
+    std::cerr.flush();
+    return;
+  }
+  if (num_suppressed > 0) {
+    message_string += " (" + std::to_string(num_suppressed) +
+                      " similar messages suppressed)";
+  }
+  if (!Enqueue(severity, message_string)) {
+    ++num_dropped_;
+  }
+}
 
-    case ::google::GLOG_WARNING:
-      ROS_WARN_STREAM(message_string);
-      break;
+void ScopedRosLogSink::WaitTillSent() {
+  // Only fatal messages have to be written before returning, which send()
+  // already did.
+}
+
+void ScopedRosLogSink::WaitForQueuedRecords() {
+  const size_t position = enqueue_position_.load();
+  const auto deadline = std::chrono::steady_clock::now() + kMaxFatalWaitTime;
+  while (flushed_position_.load() < position &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
 
-    case ::google::GLOG_ERROR:
-      ROS_ERROR_STREAM(message_string);
+bool ScopedRosLogSink::CheckRateLimit(const char* const filename,
+                                      const int line,
+                                      int* const num_suppressed) {
+  const size_t hash =
+      std::hash<const void*>()(filename) ^ (static_cast<size_t>(line) << 16);
+  CallSite& call_site = call_sites_[hash % kNumCallSites];
+  const uint64_t second = GetSecondsSinceEpoch() & 0xffffffff;
+  uint64_t second_and_count =
+      call_site.second_and_count.load(std::memory_order_relaxed);
+  for (;;) {
+    uint64_t next_second_and_count = (second << 32) | 1;
+    if (second_and_count >> 32 == second) {
+      if ((second_and_count & 0xffffffff) >= kMaxMessagesPerCallSitePerSecond) {
+        ++call_site.num_suppressed;
+        return false;
+      }
+      next_second_and_count = second_and_count + 1;
+    }
+    if (call_site.second_and_count.compare_exchange_weak(
+            second_and_count, next_second_and_count,
+            std::memory_order_relaxed)) {
       break;
+    }
+  }
+  *num_suppressed = call_site.num_suppressed.exchange(0);
+  return true;
+}
+
+bool ScopedRosLogSink::Enqueue(const ::google::LogSeverity severity,
+                               const std::string& text) {
+  size_t position = enqueue_position_.load(std::memory_order_relaxed);
+  Record* record;
+  for (;;) {
+    record = &records_[position & (kNumRecords - 1)];
+    const size_t sequence = record->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (enqueue_position_.compare_exchange_weak(position, position + 1,
+                                                  std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // The consumer did not read this record yet, so the buffer is full.
+      return false;
+    } else {
+      position = enqueue_position_.load(std::memory_order_relaxed);
+    }
+  }
+  record->severity = severity;
+  if (text.size() <= kMaxMessageLength) {
+    record->length = text.size();
+    std::memcpy(record->text, text.data(), record->length);
+  } else {
+    const size_t prefix_length = kMaxMessageLength - kTruncationMarkerLength;
+    std::memcpy(record->text, text.data(), prefix_length);
+    std::memcpy(record->text + prefix_length, kTruncationMarker,
+                kTruncationMarkerLength);
+    record->length = kMaxMessageLength;
+  }
+  record->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
 
-    case ::google::GLOG_FATAL:
-      ROS_FATAL_STREAM(message_string);
-      will_die_ = true;
+bool ScopedRosLogSink::Drain() {
+  size_t position = dequeue_position_.load(std::memory_order_relaxed);
+  bool wrote_records = false;
+  for (;;) {
+    Record& record = records_[position & (kNumRecords - 1)];
+    if (record.sequence.load(std::memory_order_acquire) != position + 1) {
       break;
+    }
+    const std::string message_string(record.text, record.length);
+    switch (record.severity) {
+      case ::google::GLOG_INFO:
+        ROS_INFO_STREAM(message_string);
+        break;
+
+      case ::google::GLOG_WARNING:
+        ROS_WARN_STREAM(message_string);
+        break;
+
+      case ::google::GLOG_ERROR:
+        ROS_ERROR_STREAM(message_string);
+        break;
+
+      case ::google::GLOG_FATAL:
+        ROS_FATAL_STREAM(message_string);
+        break;
+    }
+    // Hands the record back to the producers, one lap later.
+    record.sequence.store(position + kNumRecords, std::memory_order_release);
+    ++position;
+    dequeue_position_.store(position, std::memory_order_release);
+    wrote_records = true;
+  }
+  const int num_dropped = num_dropped_.exchange(0);
+  if (num_dropped > 0) {
+    ROS_ERROR_STREAM("Dropped " << num_dropped
+                                << " log messages, the log is too busy.");
   }
+  if (wrote_records || num_dropped > 0) {
+    std::cout.flush();
+    std::cerr.flush();
+    flushed_position_.store(position);
+  }
+  return wrote_records;
 }
 
-void ScopedRosLogSink::WaitTillSent() {
-  if (will_die_) {
-    // Give ROS some time to actually publish our message.
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+void ScopedRosLogSink::DrainUntilShutdown() {
+  while (!shutting_down_.load()) {
+    if (!Drain()) {
+      std::this_thread::sleep_for(kDrainPeriod);
+    }
   }
+  Drain();
 }
 
 }  // namespace cartographer_ros
@@ -17,7 +17,12 @@
 #ifndef CARTOGRAPHER_ROS_ROS_LOG_SINK_H_
 #define CARTOGRAPHER_ROS_ROS_LOG_SINK_H_
 
+#include <atomic>
+#include <cstddef>
 #include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
 
 #include "glog/logging.h"
 
@@ -25,11 +30,23 @@ namespace cartographer_ros {
 
 // Makes Google logging use ROS logging for output while an instance of this
 // class exists.
+//
+// Messages are formatted on the logging thread and handed to a background
+// thread through a lock-free ring buffer, so logging never waits for output.
+// Each call site logs at most a few messages per second and reports how many
+// were suppressed with its next message. If the ring buffer is full, messages
+// are dropped and counted. Messages longer than a record are truncated and
+// marked as such. Fatal messages are never suppressed or dropped. They are
+// written on the calling thread after the queued messages, before the process
+// dies.
 class ScopedRosLogSink : public ::google::LogSink {
  public:
   ScopedRosLogSink();
   ~ScopedRosLogSink() override;
 
+  ScopedRosLogSink(const ScopedRosLogSink&) = delete;
+  ScopedRosLogSink& operator=(const ScopedRosLogSink&) = delete;
+
   void send(::google::LogSeverity severity, const char* filename,
             const char* base_filename, int line, const struct std::tm* tm_time,
             const char* message, size_t message_len) override;
@@ -37,7 +54,30 @@ class ScopedRosLogSink : public ::google::LogSink {
   void WaitTillSent() override;
 
  private:
-  bool will_die_;
+  struct Record;
+  struct CallSite;
+
+  // Returns false if the message at 'filename':'line' exceeds its rate.
+  // Otherwise, returns true and sets 'num_suppressed' to the number of
+  // messages suppressed at this call site since its last message.
+  bool CheckRateLimit(const char* filename, int line, int* num_suppressed);
+  // Returns false if the ring buffer is full.
+  bool Enqueue(::google::LogSeverity severity, const std::string& text);
+  // Waits a bounded time for the records queued so far to be written.
+  void WaitForQueuedRecords();
+  // Writes all queued records and returns false if there were none.
+  bool Drain();
+  void DrainUntilShutdown();
+
+  std::unique_ptr<Record[]> records_;
+  std::unique_ptr<CallSite[]> call_sites_;
+  std::atomic<size_t> enqueue_position_;
+  std::atomic<size_t> dequeue_position_;
+  // Records before this position were written and flushed.
+  std::atomic<size_t> flushed_position_;
+  std::atomic<int> num_dropped_;
+  std::atomic<bool> shutting_down_;
+  std::thread thread_;
 };
 
 }  // namespace cartographer_ros
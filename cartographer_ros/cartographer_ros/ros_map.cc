@@ -16,20 +16,84 @@
 
 #include "cartographer_ros/ros_map.h"
 
+#include <vector>
+
+#include "glog/logging.h"
+
 namespace cartographer_ros {
 
-void WritePgm(const ::cartographer::io::Image& image, const double resolution,
+namespace {
+
+constexpr int kNumColors = 256;
+
+}  // namespace
+
+const PixelTable& OccupancyValueTable() {
+  static const PixelTable table = [] {
+    PixelTable table;
+    for (int color = 0; color != kNumColors; ++color) {
+      table[color] = static_cast<uint8_t>(-1);
+      table[kNumColors + color] = static_cast<uint8_t>(
+          ::cartographer::common::RoundToInt((1. - color / 255.) * 100.));
+    }
+    return table;
+  }();
+  return table;
+}
+
+const PixelTable& PgmValueTable() {
+  static const PixelTable table = [] {
+    PixelTable table;
+    for (int color = 0; color != kNumColors; ++color) {
+      table[color] = color;
+      table[kNumColors + color] = color;
+    }
+    return table;
+  }();
+  return table;
+}
+
+void ConvertPixelRow(const uint32_t* const pixels, const int width,
+                     const PixelTable& table, uint8_t* const values) {
+  // Branch-free, so the compiler can unroll and vectorize the unpacking.
+  for (int x = 0; x != width; ++x) {
+    const uint32_t packed = pixels[x];
+    const uint32_t observed = ((packed >> 8) & 0xff) != 0;
+    values[x] = table[(observed << 8) | ((packed >> 16) & 0xff)];
+  }
+}
+
+void WritePgm(cairo_surface_t* const surface, const double resolution,
               ::cartographer::io::FileWriter* file_writer) {
+  WritePgmHeader(cairo_image_surface_get_width(surface),
+                 cairo_image_surface_get_height(surface), resolution,
+                 file_writer);
+  WritePgmRows(surface, file_writer);
+}
+
+void WritePgmHeader(const int width, const int height,
+                    const double resolution,
+                    ::cartographer::io::FileWriter* file_writer) {
   const std::string header = "P5\n# Cartographer map; " +
                              std::to_string(resolution) + " m/pixel\n" +
-                             std::to_string(image.width()) + " " +
-                             std::to_string(image.height()) + "\n255\n";
+                             std::to_string(width) + " " +
+                             std::to_string(height) + "\n255\n";
   file_writer->Write(header.data(), header.size());
-  for (int y = 0; y < image.height(); ++y) {
-    for (int x = 0; x < image.width(); ++x) {
-      const char color = image.GetPixel(x, y)[0];
-      file_writer->Write(&color, 1);
-    }
+}
+
+void WritePgmRows(cairo_surface_t* const surface,
+                  ::cartographer::io::FileWriter* file_writer) {
+  CHECK_EQ(cairo_image_surface_get_format(surface), CAIRO_FORMAT_ARGB32);
+  const int width = cairo_image_surface_get_width(surface);
+  const int height = cairo_image_surface_get_height(surface);
+  cairo_surface_flush(surface);
+  const unsigned char* const data = cairo_image_surface_get_data(surface);
+  const int stride = cairo_image_surface_get_stride(surface);
+  std::vector<uint8_t> row(width);
+  for (int y = 0; y < height; ++y) {
+    ConvertPixelRow(reinterpret_cast<const uint32_t*>(data + y * stride),
+                    width, PgmValueTable(), row.data());
+    file_writer->Write(reinterpret_cast<const char*>(row.data()), row.size());
   }
 }
 
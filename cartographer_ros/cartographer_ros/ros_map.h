@@ -17,20 +17,49 @@
 #ifndef CARTOGRAPHER_ROS_ROS_MAP_H_
 #define CARTOGRAPHER_ROS_ROS_MAP_H_
 
+#include <array>
 #include <string>
 
 #include "Eigen/Core"
+#include "cairo/cairo.h"
+#include "cartographer/common/port.h"
 #include "cartographer/io/file_writer.h"
 #include "cartographer/io/image.h"
 #include "cartographer/mapping_2d/map_limits.h"
 
 namespace cartographer_ros {
 
-// Write 'image' as a pgm into 'file_writer'. The resolution is used in the
-// comment only'
-void WritePgm(const ::cartographer::io::Image& image, const double resolution,
+// Maps the observed flag and the color of a pixel of a painted map to an
+// output value, see ConvertPixelRow().
+using PixelTable = std::array<uint8_t, 2 * 256>;
+
+// Table for nav_msgs/OccupancyGrid values, i.e. -1 for unobserved pixels and
+// the occupancy in [0, 100] otherwise.
+const PixelTable& OccupancyValueTable();
+
+// Table for pgm values, i.e. the color of the pixel.
+const PixelTable& PgmValueTable();
+
+// Converts 'width' ARGB32 'pixels' of a painted map, whose red channel is the
+// color and whose green channel is 0 for unobserved pixels, into 'values'
+// using 'table'.
+void ConvertPixelRow(const uint32_t* pixels, int width,
+                     const PixelTable& table, uint8_t* values);
+
+// Write the ARGB32 'surface' as a pgm into 'file_writer'. The resolution is
+// used in the comment only.
+void WritePgm(cairo_surface_t* surface, const double resolution,
               ::cartographer::io::FileWriter* file_writer);
 
+// Write the header of a 'width' x 'height' pgm into 'file_writer', so that its
+// rows can be written in parts with WritePgmRows().
+void WritePgmHeader(int width, int height, const double resolution,
+                    ::cartographer::io::FileWriter* file_writer);
+
+// Append the rows of the ARGB32 'surface' to the pgm in 'file_writer'.
+void WritePgmRows(cairo_surface_t* surface,
+                  ::cartographer::io::FileWriter* file_writer);
+
 // Write the corresponding yaml into 'file_writer'.
 void WriteYaml(const double resolution, const Eigen::Vector2d& origin,
                const std::string& pgm_filename,
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/ros_map.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+uint32_t Pack(const int color, const bool observed) {
+  return 0xff000000u | (color << 16) | ((observed ? 0xff : 0) << 8);
+}
+
+TEST(RosMapTest, ConvertsOccupancyValues) {
+  const std::vector<uint32_t> pixels = {Pack(0, true), Pack(255, true),
+                                        Pack(128, true), Pack(0, false),
+                                        Pack(128, false)};
+  std::vector<uint8_t> values(pixels.size());
+  ConvertPixelRow(pixels.data(), pixels.size(), OccupancyValueTable(),
+                  values.data());
+  EXPECT_EQ(100, static_cast<int8_t>(values[0]));
+  EXPECT_EQ(0, static_cast<int8_t>(values[1]));
+  EXPECT_EQ(50, static_cast<int8_t>(values[2]));
+  EXPECT_EQ(-1, static_cast<int8_t>(values[3]));
+  EXPECT_EQ(-1, static_cast<int8_t>(values[4]));
+}
+
+TEST(RosMapTest, ConvertsPgmValues) {
+  const std::vector<uint32_t> pixels = {Pack(0, true), Pack(17, true),
+                                        Pack(128, false)};
+  std::vector<uint8_t> values(pixels.size());
+  ConvertPixelRow(pixels.data(), pixels.size(), PgmValueTable(),
+                  values.data());
+  EXPECT_EQ(0, values[0]);
+  EXPECT_EQ(17, values[1]);
+  EXPECT_EQ(128, values[2]);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
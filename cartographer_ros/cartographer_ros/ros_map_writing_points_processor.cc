@@ -17,24 +17,115 @@
 #include "cartographer_ros/ros_map_writing_points_processor.h"
 
 #include "cartographer/common/make_unique.h"
+#include "cartographer/common/math.h"
 #include "cartographer/io/image.h"
 #include "cartographer/io/probability_grid_points_processor.h"
+#include "cartographer/mapping/probability_values.h"
 #include "cartographer_ros/ros_map.h"
 
 namespace cartographer_ros {
 
+namespace {
+
+using ::cartographer::mapping_2d::ProbabilityGrid;
+
+Eigen::Vector2f CellCenter(const ::cartographer::mapping_2d::MapLimits& limits,
+                           const Eigen::Array2i& cell_index) {
+  return (limits.max() -
+          limits.resolution() *
+              Eigen::Vector2d(cell_index.y() + 0.5, cell_index.x() + 0.5))
+      .cast<float>();
+}
+
+// Combines the grids as if all updates had been applied to one grid, except
+// for clamping. Odds multiply, so the result does not depend on the order.
+ProbabilityGrid MergeProbabilityGrids(
+    const std::vector<ProbabilityGrid>& probability_grids) {
+  ProbabilityGrid merged_grid = ::cartographer::io::CreateProbabilityGrid(
+      probability_grids.front().limits().resolution());
+  // All grids grow on the same lattice of cells, so growing the merged grid to
+  // the known corners of each grid covers all their cells.
+  for (const ProbabilityGrid& probability_grid : probability_grids) {
+    Eigen::Array2i offset;
+    ::cartographer::mapping_2d::CellLimits cell_limits;
+    probability_grid.ComputeCroppedLimits(&offset, &cell_limits);
+    if (cell_limits.num_x_cells == 0 || cell_limits.num_y_cells == 0) {
+      continue;
+    }
+    const Eigen::Array2i last_cell =
+        offset + Eigen::Array2i(cell_limits.num_x_cells - 1,
+                                cell_limits.num_y_cells - 1);
+    merged_grid.GrowLimits(CellCenter(probability_grid.limits(), offset));
+    merged_grid.GrowLimits(CellCenter(probability_grid.limits(), last_cell));
+  }
+
+  const ::cartographer::mapping_2d::MapLimits& merged_limits =
+      merged_grid.limits();
+  const int num_x_cells = merged_limits.cell_limits().num_x_cells;
+  // Odds of each cell of 'merged_grid', or 0 if it is unknown.
+  std::vector<float> merged_odds(
+      num_x_cells * merged_limits.cell_limits().num_y_cells, 0.f);
+  for (const ProbabilityGrid& probability_grid : probability_grids) {
+    Eigen::Array2i offset;
+    ::cartographer::mapping_2d::CellLimits cell_limits;
+    probability_grid.ComputeCroppedLimits(&offset, &cell_limits);
+    for (int y = 0; y < cell_limits.num_y_cells; ++y) {
+      for (int x = 0; x < cell_limits.num_x_cells; ++x) {
+        const Eigen::Array2i cell_index = offset + Eigen::Array2i(x, y);
+        if (!probability_grid.IsKnown(cell_index)) {
+          continue;
+        }
+        const Eigen::Array2i merged_index = merged_limits.GetCellIndex(
+            CellCenter(probability_grid.limits(), cell_index));
+        float& odds =
+            merged_odds[merged_index.y() * num_x_cells + merged_index.x()];
+        const float cell_odds = ::cartographer::mapping::Odds(
+            probability_grid.GetProbability(cell_index));
+        odds = odds == 0.f ? cell_odds : odds * cell_odds;
+      }
+    }
+  }
+
+  for (int y = 0; y < merged_limits.cell_limits().num_y_cells; ++y) {
+    for (int x = 0; x < num_x_cells; ++x) {
+      const float odds = merged_odds[y * num_x_cells + x];
+      if (odds == 0.f) {
+        continue;
+      }
+      merged_grid.SetProbability(
+          Eigen::Array2i(x, y),
+          ::cartographer::common::Clamp(
+              ::cartographer::mapping::ProbabilityFromOdds(odds),
+              ::cartographer::mapping::kMinProbability,
+              ::cartographer::mapping::kMaxProbability));
+    }
+  }
+  return merged_grid;
+}
+
+}  // namespace
+
 RosMapWritingPointsProcessor::RosMapWritingPointsProcessor(
     const double resolution,
     const ::cartographer::mapping_2d::proto::RangeDataInserterOptions&
         range_data_inserter_options,
     ::cartographer::io::FileWriterFactory file_writer_factory,
-    const std::string& filestem,
+    const std::string& filestem, const int num_threads,
     ::cartographer::io::PointsProcessor* const next)
     : filestem_(filestem),
       next_(next),
       file_writer_factory_(file_writer_factory),
-      range_data_inserter_(range_data_inserter_options),
-      probability_grid_(::cartographer::io::CreateProbabilityGrid(resolution)) {
+      range_data_inserter_(range_data_inserter_options) {
+  CHECK_GT(num_threads, 0);
+  for (int i = 0; i < num_threads; ++i) {
+    probability_grids_.push_back(
+        ::cartographer::io::CreateProbabilityGrid(resolution));
+  }
+  if (num_threads > 1) {
+    thread_pool_ =
+        ::cartographer::common::make_unique<::cartographer::common::ThreadPool>(
+            num_threads);
+  }
 }
 
 std::unique_ptr<RosMapWritingPointsProcessor>
@@ -46,28 +137,67 @@ RosMapWritingPointsProcessor::FromDictionary(
       dictionary->GetDouble("resolution"),
       ::cartographer::mapping_2d::CreateRangeDataInserterOptions(
           dictionary->GetDictionary("range_data_inserter").get()),
-      file_writer_factory, dictionary->GetString("filestem"), next);
+      file_writer_factory, dictionary->GetString("filestem"),
+      dictionary->HasKey("num_threads")
+          ? dictionary->GetNonNegativeInt("num_threads")
+          : 1,
+      next);
 }
 
 void RosMapWritingPointsProcessor::Process(
     std::unique_ptr<::cartographer::io::PointsBatch> batch) {
-  range_data_inserter_.Insert({batch->origin, batch->points, {}},
-                              &probability_grid_);
+  if (thread_pool_ == nullptr) {
+    range_data_inserter_.Insert({batch->origin, batch->points, {}},
+                                &probability_grids_.front());
+  } else {
+    pending_range_data_.push_back({batch->origin, batch->points, {}});
+    if (pending_range_data_.size() == probability_grids_.size()) {
+      InsertPendingRangeData();
+    }
+  }
   next_->Process(std::move(batch));
 }
 
+void RosMapWritingPointsProcessor::InsertPendingRangeData() {
+  {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    num_inserting_ = pending_range_data_.size();
+  }
+  for (size_t i = 0; i < pending_range_data_.size(); ++i) {
+    thread_pool_->Schedule([this, i]() {
+      range_data_inserter_.Insert(pending_range_data_[i],
+                                  &probability_grids_[i]);
+      ::cartographer::common::MutexLocker lock(&mutex_);
+      --num_inserting_;
+    });
+  }
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  lock.Await([this]() REQUIRES(mutex_) { return num_inserting_ == 0; });
+  pending_range_data_.clear();
+}
+
 ::cartographer::io::PointsProcessor::FlushResult
 RosMapWritingPointsProcessor::Flush() {
+  if (thread_pool_ != nullptr) {
+    if (!pending_range_data_.empty()) {
+      InsertPendingRangeData();
+    }
+    probability_grids_.front() = MergeProbabilityGrids(probability_grids_);
+    probability_grids_.erase(probability_grids_.begin() + 1,
+                             probability_grids_.end());
+  }
+  const ProbabilityGrid& probability_grid = probability_grids_.front();
   Eigen::Array2i offset;
   std::unique_ptr<::cartographer::io::Image> image =
-      ::cartographer::io::DrawProbabilityGrid(probability_grid_, &offset);
+      ::cartographer::io::DrawProbabilityGrid(probability_grid, &offset);
   if (image != nullptr) {
     auto pgm_writer = file_writer_factory_(filestem_ + ".pgm");
     const std::string pgm_filename = pgm_writer->GetFilename();
-    const auto& limits = probability_grid_.limits();
+    const auto& limits = probability_grid.limits();
     image->Rotate90DegreesClockwise();
 
-    WritePgm(*image, limits.resolution(), pgm_writer.get());
+    WritePgm(image->GetCairoSurface().get(), limits.resolution(),
+             pgm_writer.get());
     CHECK(pgm_writer->Close());
 
     const Eigen::Vector2d origin(
@@ -17,16 +17,29 @@
 #ifndef CARTOGRAPHER_ROS_ROS_MAP_WRITING_POINTS_PROCESSOR_H_
 #define CARTOGRAPHER_ROS_ROS_MAP_WRITING_POINTS_PROCESSOR_H_
 
+#include <memory>
+#include <vector>
+
 #include "cartographer/common/lua_parameter_dictionary.h"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/thread_pool.h"
 #include "cartographer/io/file_writer.h"
 #include "cartographer/io/points_processor.h"
 #include "cartographer/mapping_2d/proto/range_data_inserter_options.pb.h"
+#include "cartographer/mapping_2d/probability_grid.h"
 #include "cartographer/mapping_2d/range_data_inserter.h"
+#include "cartographer/sensor/range_data.h"
 
 namespace cartographer_ros {
 
 // Very similar to Cartographer's ProbabilityGridPointsProcessor, but writes
 // out a PGM and YAML suitable for ROS map server to consume.
+//
+// With 'num_threads' > 1, consecutive batches are inserted in parallel into
+// as many probability grids, which are merged deterministically by
+// multiplying their odds when flushing. Since each grid clamps its
+// probabilities on its own, the map can differ slightly from the one inserted
+// with a single thread.
 class RosMapWritingPointsProcessor
     : public ::cartographer::io::PointsProcessor {
  public:
@@ -36,7 +49,7 @@ class RosMapWritingPointsProcessor
       const ::cartographer::mapping_2d::proto::RangeDataInserterOptions&
           range_data_inserter_options,
       ::cartographer::io::FileWriterFactory file_writer_factory,
-      const std::string& filestem, PointsProcessor* next);
+      const std::string& filestem, int num_threads, PointsProcessor* next);
   RosMapWritingPointsProcessor(const RosMapWritingPointsProcessor&) = delete;
   RosMapWritingPointsProcessor& operator=(const RosMapWritingPointsProcessor&) =
       delete;
@@ -52,11 +65,20 @@ class RosMapWritingPointsProcessor
   FlushResult Flush() override;
 
  private:
+  // Inserts the i-th pending range data into the i-th probability grid.
+  void InsertPendingRangeData() EXCLUDES(mutex_);
+
   const std::string filestem_;
   PointsProcessor* const next_;
   ::cartographer::io::FileWriterFactory file_writer_factory_;
   ::cartographer::mapping_2d::RangeDataInserter range_data_inserter_;
-  ::cartographer::mapping_2d::ProbabilityGrid probability_grid_;
+  std::vector<::cartographer::mapping_2d::ProbabilityGrid> probability_grids_;
+  std::vector<::cartographer::sensor::RangeData> pending_range_data_;
+
+  ::cartographer::common::Mutex mutex_;
+  int num_inserting_ GUARDED_BY(mutex_) = 0;
+  // Only used with more than one thread.
+  std::unique_ptr<::cartographer::common::ThreadPool> thread_pool_;
 };
 
 }  // namespace cartographer_ros
@@ -14,13 +14,19 @@
  * limitations under the License.
  */
 
+#include <time.h>
+#include <algorithm>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "cartographer/common/histogram.h"
 #include "cartographer/common/make_unique.h"
+#include "cartographer_ros/msg_conversion.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "nav_msgs/Odometry.h"
@@ -41,6 +47,14 @@ DEFINE_string(bag_filename, "", "Bag to process.");
 DEFINE_bool(dump_timing, false,
             "Dump per-sensor timing information in files called "
             "timing_<frame_id>.csv in the current directory.");
+DEFINE_bool(profile_ingestion, false,
+            "Converts each sensor message like Cartographer does and reports "
+            "per topic the data rates and the CPU time spent per message, "
+            "together with the load ingesting the bag puts on the CPU.");
+DEFINE_double(target_cpu_speed, 1.,
+              "Speed of the CPU the load is estimated for, relative to the "
+              "CPU running this tool, e.g. 0.5 for a CPU taking twice as "
+              "long.");
 
 namespace cartographer_ros {
 namespace {
@@ -52,6 +66,69 @@ struct PerFrameId {
   std::unique_ptr<std::ofstream> timing_file;
 };
 
+// Costs of ingesting the messages of a topic.
+struct PerTopicProfile {
+  size_t num_messages = 0;
+  size_t num_bytes = 0;
+  size_t num_points = 0;
+  // Decoding and conversion CPU time of each message.
+  std::vector<double> cpu_seconds;
+  ros::Time first_time;
+  ros::Time last_time;
+};
+
+double GetThreadCpuTimeSeconds() {
+  timespec cpu_timespec = {};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_timespec);
+  return cpu_timespec.tv_sec + 1e-9 * cpu_timespec.tv_nsec;
+}
+
+// Returns the 'quantile' of the sorted 'values'.
+double Quantile(const std::vector<double>& values, const double quantile) {
+  CHECK(!values.empty());
+  const size_t index = std::min(
+      values.size() - 1, static_cast<size_t>(quantile * values.size()));
+  return values[index];
+}
+
+void LogIngestionProfile(std::map<std::string, PerTopicProfile>* profiles,
+                         const double bag_duration_sec,
+                         const double target_cpu_speed) {
+  CHECK_GT(target_cpu_speed, 0.);
+  double total_cpu_seconds = 0.;
+  for (auto& entry_pair : *profiles) {
+    PerTopicProfile& profile = entry_pair.second;
+    std::sort(profile.cpu_seconds.begin(), profile.cpu_seconds.end());
+    // Rates are over the time the topic was recorded, so that short topics
+    // are not diluted by the bag.
+    const double duration_sec =
+        std::max((profile.last_time - profile.first_time).toSec(), 1e-9);
+    double cpu_seconds = 0.;
+    for (const double message_cpu_seconds : profile.cpu_seconds) {
+      cpu_seconds += message_cpu_seconds;
+    }
+    total_cpu_seconds += cpu_seconds;
+    std::ostringstream stream;
+    stream << std::fixed << std::setprecision(3) << "Ingestion profile of \""
+           << entry_pair.first << "\": " << profile.num_messages
+           << " messages, " << profile.num_messages / duration_sec
+           << " messages/s, " << profile.num_bytes / duration_sec / 1e6
+           << " MB/s, " << profile.num_points / duration_sec
+           << " points/s, CPU time per message p50 "
+           << 1e3 * Quantile(profile.cpu_seconds, 0.5) << " ms, p99 "
+           << 1e3 * Quantile(profile.cpu_seconds, 0.99) << " ms, "
+           << 1e2 * cpu_seconds / duration_sec / target_cpu_speed
+           << "% of a target CPU core.";
+    LOG(INFO) << stream.str();
+  }
+  if (bag_duration_sec > 0.) {
+    LOG(INFO) << "Ingesting all topics in real time takes "
+              << 1e2 * total_cpu_seconds / bag_duration_sec / target_cpu_speed
+              << "% of a target CPU core for decoding and conversion alone. "
+                 "Insertion into the submaps and scan matching come on top.";
+  }
+}
+
 std::unique_ptr<std::ofstream> CreateTimingFile(const std::string& frame_id) {
   auto timing_file = ::cartographer::common::make_unique<std::ofstream>(
       std::string("timing_") + frame_id + ".csv", std::ios_base::out);
@@ -76,29 +153,45 @@ std::unique_ptr<std::ofstream> CreateTimingFile(const std::string& frame_id) {
   return timing_file;
 }
 
-void Run(const std::string& bag_filename, const bool dump_timing) {
+void Run(const std::string& bag_filename, const bool dump_timing,
+         const bool profile_ingestion) {
   rosbag::Bag bag;
   bag.open(bag_filename, rosbag::bagmode::Read);
   rosbag::View view(bag);
 
   std::map<std::string, PerFrameId> per_frame_id;
+  std::map<std::string, PerTopicProfile> per_topic_profile;
   size_t message_index = 0;
   for (const rosbag::MessageInstance& message : view) {
     ++message_index;
     std::string frame_id;
     ros::Time time;
+    // Range data is converted into a point cloud as the SensorBridge does.
+    size_t num_points = 0;
+    const double cpu_start_seconds =
+        profile_ingestion ? GetThreadCpuTimeSeconds() : 0.;
     if (message.isType<sensor_msgs::PointCloud2>()) {
       auto msg = message.instantiate<sensor_msgs::PointCloud2>();
       time = msg->header.stamp;
       frame_id = msg->header.frame_id;
+      if (profile_ingestion) {
+        num_points =
+            std::get<0>(ToPointCloudWithIntensities(*msg)).points.size();
+      }
     } else if (message.isType<sensor_msgs::MultiEchoLaserScan>()) {
       auto msg = message.instantiate<sensor_msgs::MultiEchoLaserScan>();
       time = msg->header.stamp;
       frame_id = msg->header.frame_id;
+      if (profile_ingestion) {
+        num_points = ToPointCloudWithIntensities(*msg).points.size();
+      }
     } else if (message.isType<sensor_msgs::LaserScan>()) {
       auto msg = message.instantiate<sensor_msgs::LaserScan>();
       time = msg->header.stamp;
       frame_id = msg->header.frame_id;
+      if (profile_ingestion) {
+        num_points = ToPointCloudWithIntensities(*msg).points.size();
+      }
     } else if (message.isType<sensor_msgs::Imu>()) {
       auto msg = message.instantiate<sensor_msgs::Imu>();
       time = msg->header.stamp;
@@ -110,6 +203,18 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
     } else {
       continue;
     }
+    if (profile_ingestion) {
+      PerTopicProfile& profile = per_topic_profile[message.getTopic()];
+      if (profile.num_messages == 0) {
+        profile.first_time = message.getTime();
+      }
+      ++profile.num_messages;
+      profile.num_bytes += message.size();
+      profile.num_points += num_points;
+      profile.cpu_seconds.push_back(GetThreadCpuTimeSeconds() -
+                                    cpu_start_seconds);
+      profile.last_time = message.getTime();
+    }
 
     bool first_packet = false;
     if (!per_frame_id.count(frame_id)) {
@@ -148,8 +253,15 @@ void Run(const std::string& bag_filename, const bool dump_timing) {
                            << time.toNSec() << std::endl;
     }
   }
+  const double bag_duration_sec =
+      (view.getEndTime() - view.getBeginTime()).toSec();
   bag.close();
 
+  if (profile_ingestion) {
+    LogIngestionProfile(&per_topic_profile, bag_duration_sec,
+                        FLAGS_target_cpu_speed);
+  }
+
   constexpr int kNumBucketsForHistogram = 10;
   for (const auto& entry_pair : per_frame_id) {
     LOG(INFO) << "Time delta histogram for consecutive messages on topic \""
@@ -177,5 +289,6 @@ int main(int argc, char** argv) {
   google::ParseCommandLineFlags(&argc, &argv, true);
 
   CHECK(!FLAGS_bag_filename.empty()) << "-bag_filename is missing.";
-  ::cartographer_ros::Run(FLAGS_bag_filename, FLAGS_dump_timing);
+  ::cartographer_ros::Run(FLAGS_bag_filename, FLAGS_dump_timing,
+                          FLAGS_profile_ingestion);
 }
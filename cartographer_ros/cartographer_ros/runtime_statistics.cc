@@ -0,0 +1,223 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/runtime_statistics.h"
+
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "cartographer/common/make_unique.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// Waiting longer than this for a mutex means some other thread held it.
+constexpr std::chrono::microseconds kContendedWaitTime(1);
+
+double GetThreadCpuSeconds() {
+  struct timespec cpu_time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time) != 0) {
+    return 0.;
+  }
+  return cpu_time.tv_sec + 1e-9 * cpu_time.tv_nsec;
+}
+
+::cartographer::common::int64 GetResidentMemoryBytes() {
+  std::ifstream statm("/proc/self/statm");
+  ::cartographer::common::int64 num_total_pages = 0;
+  ::cartographer::common::int64 num_resident_pages = 0;
+  if (!(statm >> num_total_pages >> num_resident_pages)) {
+    return 0;
+  }
+  return num_resident_pages * sysconf(_SC_PAGESIZE);
+}
+
+::cartographer::common::int64 GetPeakResidentMemoryBytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // Linux reports kilobytes.
+  return static_cast<::cartographer::common::int64>(usage.ru_maxrss) * 1024;
+}
+
+void UpdateMax(const ::cartographer::common::int64 value,
+               std::atomic<::cartographer::common::int64>* max) {
+  ::cartographer::common::int64 current = max->load(std::memory_order_relaxed);
+  while (value > current &&
+         !max->compare_exchange_weak(current, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+double ToSeconds(const ::cartographer::common::int64 nanoseconds) {
+  return 1e-9 * nanoseconds;
+}
+
+}  // namespace
+
+void RuntimeStatistics::LockStatistics::RecordAcquisition(
+    const std::chrono::steady_clock::duration wait_time) {
+  const ::cartographer::common::int64 wait_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(wait_time).count();
+  num_acquisitions_.fetch_add(1, std::memory_order_relaxed);
+  if (wait_time > kContendedWaitTime) {
+    num_contended_.fetch_add(1, std::memory_order_relaxed);
+  }
+  total_wait_ns_.fetch_add(wait_ns, std::memory_order_relaxed);
+  UpdateMax(wait_ns, &max_wait_ns_);
+  UpdateMax(wait_ns, &period_max_wait_ns_);
+}
+
+RuntimeStatistics::ScopedTimer::ScopedTimer(
+    RuntimeStatistics* const statistics, const char* const name)
+    : statistics_(statistics),
+      name_(name),
+      start_time_(std::chrono::steady_clock::now()),
+      start_cpu_sec_(GetThreadCpuSeconds()) {}
+
+RuntimeStatistics::ScopedTimer::~ScopedTimer() {
+  const double cpu_sec = GetThreadCpuSeconds() - start_cpu_sec_;
+  const double wall_sec = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start_time_)
+                              .count();
+  statistics_->RecordCall(name_, wall_sec, cpu_sec);
+}
+
+RuntimeStatistics::RuntimeStatistics()
+    : start_time_(std::chrono::steady_clock::now()),
+      last_taken_time_(start_time_) {}
+
+RuntimeStatistics::LockStatistics* RuntimeStatistics::AddLock(
+    const std::string& name) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  auto& lock_statistics = locks_[name];
+  CHECK(lock_statistics == nullptr) << "Duplicate lock '" << name << "'.";
+  lock_statistics = ::cartographer::common::make_unique<LockStatistics>();
+  return lock_statistics.get();
+}
+
+void RuntimeStatistics::RecordCall(const char* const name,
+                                   const double wall_sec,
+                                   const double cpu_sec) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  ScopeStatistics& statistics = scopes_[name];
+  for (ScopeCounters* counters : {&statistics.total, &statistics.period}) {
+    ++counters->num_calls;
+    counters->total_wall_sec += wall_sec;
+    counters->max_wall_sec = std::max(counters->max_wall_sec, wall_sec);
+    counters->total_cpu_sec += cpu_sec;
+  }
+}
+
+cartographer_ros_msgs::msg::RuntimeStatistics
+RuntimeStatistics::GetStatistics() {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  return CollectStatistics(false /* take */);
+}
+
+cartographer_ros_msgs::msg::RuntimeStatistics
+RuntimeStatistics::TakeStatistics() {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  return CollectStatistics(true /* take */);
+}
+
+cartographer_ros_msgs::msg::RuntimeStatistics
+RuntimeStatistics::CollectStatistics(const bool take) {
+  const auto now = std::chrono::steady_clock::now();
+  cartographer_ros_msgs::msg::RuntimeStatistics statistics;
+  statistics.period_sec =
+      std::chrono::duration<double>(now - (take ? last_taken_time_
+                                                : start_time_))
+          .count();
+  for (auto& entry : scopes_) {
+    ScopeCounters& counters = take ? entry.second.period : entry.second.total;
+    cartographer_ros_msgs::msg::ScopeStatistics scope;
+    scope.name = entry.first;
+    scope.num_calls = counters.num_calls;
+    scope.total_wall_sec = counters.total_wall_sec;
+    scope.max_wall_sec = counters.max_wall_sec;
+    scope.total_cpu_sec = counters.total_cpu_sec;
+    statistics.scopes.push_back(scope);
+    if (take) {
+      counters = ScopeCounters();
+    }
+  }
+  std::sort(statistics.scopes.begin(), statistics.scopes.end(),
+            [](const cartographer_ros_msgs::msg::ScopeStatistics& lhs,
+               const cartographer_ros_msgs::msg::ScopeStatistics& rhs) {
+              return lhs.name < rhs.name;
+            });
+  for (auto& entry : locks_) {
+    LockStatistics& counters = *entry.second;
+    const ::cartographer::common::int64 num_acquisitions =
+        counters.num_acquisitions_.load(std::memory_order_relaxed);
+    const ::cartographer::common::int64 num_contended =
+        counters.num_contended_.load(std::memory_order_relaxed);
+    const ::cartographer::common::int64 total_wait_ns =
+        counters.total_wait_ns_.load(std::memory_order_relaxed);
+    cartographer_ros_msgs::msg::LockStatistics lock_statistics;
+    lock_statistics.name = entry.first;
+    if (take) {
+      lock_statistics.num_acquisitions =
+          num_acquisitions - counters.taken_num_acquisitions_;
+      lock_statistics.num_contended =
+          num_contended - counters.taken_num_contended_;
+      lock_statistics.total_wait_sec =
+          ToSeconds(total_wait_ns - counters.taken_total_wait_ns_);
+      lock_statistics.max_wait_sec = ToSeconds(
+          counters.period_max_wait_ns_.exchange(0, std::memory_order_relaxed));
+      counters.taken_num_acquisitions_ = num_acquisitions;
+      counters.taken_num_contended_ = num_contended;
+      counters.taken_total_wait_ns_ = total_wait_ns;
+    } else {
+      lock_statistics.num_acquisitions = num_acquisitions;
+      lock_statistics.num_contended = num_contended;
+      lock_statistics.total_wait_sec = ToSeconds(total_wait_ns);
+      lock_statistics.max_wait_sec =
+          ToSeconds(counters.max_wait_ns_.load(std::memory_order_relaxed));
+    }
+    statistics.locks.push_back(lock_statistics);
+  }
+  if (take) {
+    last_taken_time_ = now;
+  }
+  const ::cartographer::common::int64 resident_memory_bytes =
+      GetResidentMemoryBytes();
+  statistics.resident_memory_bytes = resident_memory_bytes;
+  // The peak is only updated by the kernel now and then.
+  statistics.peak_resident_memory_bytes =
+      std::max(resident_memory_bytes, GetPeakResidentMemoryBytes());
+  return statistics;
+}
+
+TimedMutexLocker::TimedMutexLocker(
+    ::cartographer::common::Mutex* const mutex,
+    RuntimeStatistics::LockStatistics* const statistics)
+    : start_time_(std::chrono::steady_clock::now()), lock_(mutex) {
+  statistics->RecordAcquisition(std::chrono::steady_clock::now() -
+                                start_time_);
+}
+
+TimedMutexLocker::~TimedMutexLocker() {}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_RUNTIME_STATISTICS_H_
+#define CARTOGRAPHER_ROS_RUNTIME_STATISTICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/port.h"
+#include "cartographer_ros_msgs/msg/runtime_statistics.hpp"
+
+namespace cartographer_ros {
+
+// Collects the wall and CPU time spent in timed scopes, e.g. the publishing
+// callbacks and service handlers, and the time spent waiting for mutexes.
+// Thread-safe.
+class RuntimeStatistics {
+ public:
+  // Acquisition counters of a single mutex. These are atomic, so recording an
+  // acquisition does not serialize the threads any further.
+  class LockStatistics {
+   public:
+    void RecordAcquisition(std::chrono::steady_clock::duration wait_time);
+
+   private:
+    friend class RuntimeStatistics;
+
+    std::atomic<::cartographer::common::int64> num_acquisitions_{0};
+    std::atomic<::cartographer::common::int64> num_contended_{0};
+    std::atomic<::cartographer::common::int64> total_wait_ns_{0};
+    std::atomic<::cartographer::common::int64> max_wait_ns_{0};
+    // Like 'max_wait_ns_', but reset by TakeStatistics().
+    std::atomic<::cartographer::common::int64> period_max_wait_ns_{0};
+
+    // The counters when TakeStatistics() was last called. Only accessed with
+    // the mutex of the owning RuntimeStatistics held.
+    ::cartographer::common::int64 taken_num_acquisitions_ = 0;
+    ::cartographer::common::int64 taken_num_contended_ = 0;
+    ::cartographer::common::int64 taken_total_wait_ns_ = 0;
+  };
+
+  // Records the wall and CPU time of the calling thread from construction to
+  // destruction under 'name', which has to be a string literal. Scopes are
+  // told apart by the address of their name.
+  class ScopedTimer {
+   public:
+    ScopedTimer(RuntimeStatistics* statistics, const char* name);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+   private:
+    RuntimeStatistics* const statistics_;
+    const char* const name_;
+    const std::chrono::steady_clock::time_point start_time_;
+    const double start_cpu_sec_;
+  };
+
+  RuntimeStatistics();
+
+  RuntimeStatistics(const RuntimeStatistics&) = delete;
+  RuntimeStatistics& operator=(const RuntimeStatistics&) = delete;
+
+  // Returns the counters of the mutex called 'name', which stay valid for the
+  // lifetime of this object.
+  LockStatistics* AddLock(const std::string& name) EXCLUDES(mutex_);
+  void RecordCall(const char* name, double wall_sec, double cpu_sec)
+      EXCLUDES(mutex_);
+
+  // Returns the statistics collected since construction. The pose graph
+  // fields are left to the caller.
+  cartographer_ros_msgs::msg::RuntimeStatistics GetStatistics()
+      EXCLUDES(mutex_);
+  // Like GetStatistics(), but returns what was collected since the last call.
+  cartographer_ros_msgs::msg::RuntimeStatistics TakeStatistics()
+      EXCLUDES(mutex_);
+
+ private:
+  struct ScopeCounters {
+    ::cartographer::common::int64 num_calls = 0;
+    double total_wall_sec = 0.;
+    double max_wall_sec = 0.;
+    double total_cpu_sec = 0.;
+  };
+
+  struct ScopeStatistics {
+    ScopeCounters total;
+    // Reset by TakeStatistics().
+    ScopeCounters period;
+  };
+
+  cartographer_ros_msgs::msg::RuntimeStatistics CollectStatistics(
+      bool take) REQUIRES(mutex_);
+
+  const std::chrono::steady_clock::time_point start_time_;
+
+  ::cartographer::common::Mutex mutex_;
+  std::map<const char*, ScopeStatistics> scopes_ GUARDED_BY(mutex_);
+  std::map<std::string, std::unique_ptr<LockStatistics>> locks_
+      GUARDED_BY(mutex_);
+  std::chrono::steady_clock::time_point last_taken_time_ GUARDED_BY(mutex_);
+};
+
+// Like a MutexLocker, but records the time spent waiting for 'mutex' in
+// 'statistics'.
+class SCOPED_CAPABILITY TimedMutexLocker {
+ public:
+  TimedMutexLocker(::cartographer::common::Mutex* mutex,
+                   RuntimeStatistics::LockStatistics* statistics)
+      ACQUIRE(mutex);
+  ~TimedMutexLocker() RELEASE();
+
+  TimedMutexLocker(const TimedMutexLocker&) = delete;
+  TimedMutexLocker& operator=(const TimedMutexLocker&) = delete;
+
+ private:
+  const std::chrono::steady_clock::time_point start_time_;
+  ::cartographer::common::MutexLocker lock_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_RUNTIME_STATISTICS_H_
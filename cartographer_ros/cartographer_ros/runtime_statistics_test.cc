@@ -0,0 +1,95 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/runtime_statistics.h"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+TEST(RuntimeStatisticsTest, RecordsCalls) {
+  RuntimeStatistics runtime_statistics;
+  for (int i = 0; i < 3; ++i) {
+    RuntimeStatistics::ScopedTimer timer(&runtime_statistics, "Scope");
+  }
+  runtime_statistics.RecordCall("Other", 2., 1.);
+  const auto statistics = runtime_statistics.GetStatistics();
+  ASSERT_EQ(2, statistics.scopes.size());
+  EXPECT_EQ("Other", statistics.scopes[0].name);
+  EXPECT_EQ(1, statistics.scopes[0].num_calls);
+  EXPECT_EQ(2., statistics.scopes[0].total_wall_sec);
+  EXPECT_EQ(2., statistics.scopes[0].max_wall_sec);
+  EXPECT_EQ(1., statistics.scopes[0].total_cpu_sec);
+  EXPECT_EQ("Scope", statistics.scopes[1].name);
+  EXPECT_EQ(3, statistics.scopes[1].num_calls);
+  EXPECT_GT(statistics.resident_memory_bytes, 0);
+  EXPECT_GE(statistics.peak_resident_memory_bytes,
+            statistics.resident_memory_bytes);
+}
+
+TEST(RuntimeStatisticsTest, TakeStatisticsResetsPeriod) {
+  RuntimeStatistics runtime_statistics;
+  RuntimeStatistics::LockStatistics* const lock_statistics =
+      runtime_statistics.AddLock("mutex");
+  ::cartographer::common::Mutex mutex;
+  { TimedMutexLocker lock(&mutex, lock_statistics); }
+  runtime_statistics.RecordCall("Scope", 2., 1.);
+  auto statistics = runtime_statistics.TakeStatistics();
+  ASSERT_EQ(1, statistics.locks.size());
+  EXPECT_EQ(1, statistics.locks[0].num_acquisitions);
+  ASSERT_EQ(1, statistics.scopes.size());
+  EXPECT_EQ(1, statistics.scopes[0].num_calls);
+
+  { TimedMutexLocker lock(&mutex, lock_statistics); }
+  { TimedMutexLocker lock(&mutex, lock_statistics); }
+  runtime_statistics.RecordCall("Scope", 1., 1.);
+  statistics = runtime_statistics.TakeStatistics();
+  EXPECT_EQ(2, statistics.locks[0].num_acquisitions);
+  EXPECT_EQ(1, statistics.scopes[0].num_calls);
+  EXPECT_EQ(1., statistics.scopes[0].max_wall_sec);
+
+  statistics = runtime_statistics.GetStatistics();
+  EXPECT_EQ(3, statistics.locks[0].num_acquisitions);
+  EXPECT_EQ(2, statistics.scopes[0].num_calls);
+  EXPECT_EQ(2., statistics.scopes[0].max_wall_sec);
+}
+
+TEST(RuntimeStatisticsTest, CountsContendedAcquisitions) {
+  RuntimeStatistics runtime_statistics;
+  RuntimeStatistics::LockStatistics* const lock_statistics =
+      runtime_statistics.AddLock("mutex");
+  ::cartographer::common::Mutex mutex;
+  std::thread thread;
+  {
+    TimedMutexLocker lock(&mutex, lock_statistics);
+    thread = std::thread([&mutex, lock_statistics] {
+      TimedMutexLocker lock(&mutex, lock_statistics);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  thread.join();
+  const auto statistics = runtime_statistics.GetStatistics();
+  EXPECT_EQ(2, statistics.locks[0].num_acquisitions);
+  EXPECT_LE(1, statistics.locks[0].num_contended);
+  EXPECT_GT(statistics.locks[0].max_wait_sec, 1e-3);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -16,6 +16,8 @@
 
 #include "cartographer_ros/sensor_bridge.h"
 
+#include <tuple>
+
 #include "cartographer/common/make_unique.h"
 #include "cartographer_ros/msg_conversion.h"
 #include "cartographer_ros/time_conversion.h"
@@ -37,16 +39,51 @@ const std::string& CheckNoLeadingSlash(const std::string& frame_id) {
   return frame_id;
 }
 
+uint64_t ToVoxelKey(const Eigen::Vector3f& point, const float inverse_size) {
+  // 21 bits per axis, i.e. keys only collide for voxels which are 2^21 voxels
+  // apart.
+  constexpr uint64_t kMask = (uint64_t{1} << 21) - 1;
+  const Eigen::Array3i index =
+      (point.array() * inverse_size).floor().cast<int>();
+  return (static_cast<uint64_t>(index.x()) & kMask) << 42 |
+         (static_cast<uint64_t>(index.y()) & kMask) << 21 |
+         (static_cast<uint64_t>(index.z()) & kMask);
+}
+
+// Keeps the first point in each voxel of edge length 'voxel_size', preserving
+// the order of 'points'.
+void VoxelFilterInPlace(const float voxel_size,
+                        std::unordered_set<uint64_t>* const occupied_voxels,
+                        carto::sensor::TimedPointCloud* const points) {
+  const float inverse_size = 1.f / voxel_size;
+  occupied_voxels->clear();
+  size_t num_kept = 0;
+  for (size_t i = 0; i != points->size(); ++i) {
+    const Eigen::Vector4f& point = (*points)[i];
+    if (occupied_voxels->insert(ToVoxelKey(point.head<3>(), inverse_size))
+            .second) {
+      (*points)[num_kept++] = point;
+    }
+  }
+  points->resize(num_kept);
+}
+
 }  // namespace
 
 SensorBridge::SensorBridge(
-    const int num_subdivisions_per_laser_scan,
-    const std::string& tracking_frame,
+    const int trajectory_id, const int num_subdivisions_per_laser_scan,
+    const double voxel_filter_size, const std::string& tracking_frame,
     const double lookup_transform_timeout_sec, tf2_ros::Buffer* const tf_buffer,
-    carto::mapping::TrajectoryBuilder* const trajectory_builder)
-    : num_subdivisions_per_laser_scan_(num_subdivisions_per_laser_scan),
+    carto::common::Mutex* const trajectory_builder_mutex,
+    carto::mapping::TrajectoryBuilder* const trajectory_builder,
+    IngestStatistics* const ingest_statistics)
+    : trajectory_id_(trajectory_id),
+      num_subdivisions_per_laser_scan_(num_subdivisions_per_laser_scan),
+      voxel_filter_size_(voxel_filter_size),
       tf_bridge_(tracking_frame, lookup_transform_timeout_sec, tf_buffer),
-      trajectory_builder_(trajectory_builder) {}
+      trajectory_builder_mutex_(trajectory_builder_mutex),
+      trajectory_builder_(trajectory_builder),
+      ingest_statistics_(ingest_statistics) {}
 
 std::unique_ptr<::cartographer::sensor::OdometryData>
 SensorBridge::ToOdometryData(const nav_msgs::msg::Odometry::ConstSharedPtr& msg) {
@@ -66,10 +103,17 @@ void SensorBridge::HandleOdometryMessage(
     const std::string& sensor_id, const nav_msgs::msg::Odometry::ConstSharedPtr& msg) {
   std::unique_ptr<::cartographer::sensor::OdometryData> odometry_data =
       ToOdometryData(msg);
-  if (odometry_data != nullptr) {
+  if (odometry_data == nullptr) {
+    ingest_statistics_->RecordTransformUnavailable(trajectory_id_, sensor_id);
+    return;
+  }
+  {
+    carto::common::MutexLocker lock(trajectory_builder_mutex_);
     trajectory_builder_->AddOdometerData(sensor_id, odometry_data->time,
                                          odometry_data->pose);
   }
+  ingest_statistics_->RecordHandedOver(trajectory_id_, sensor_id,
+                                       odometry_data->time);
 }
 
 std::unique_ptr<::cartographer::sensor::ImuData> SensorBridge::ToImuData(
@@ -105,37 +149,57 @@ std::unique_ptr<::cartographer::sensor::ImuData> SensorBridge::ToImuData(
 void SensorBridge::HandleImuMessage(const std::string& sensor_id,
                                     const sensor_msgs::msg::Imu::ConstSharedPtr& msg) {
   std::unique_ptr<::cartographer::sensor::ImuData> imu_data = ToImuData(msg);
-  if (imu_data != nullptr) {
+  if (imu_data == nullptr) {
+    ingest_statistics_->RecordTransformUnavailable(trajectory_id_, sensor_id);
+    return;
+  }
+  {
+    carto::common::MutexLocker lock(trajectory_builder_mutex_);
     trajectory_builder_->AddImuData(sensor_id, imu_data->time,
                                     imu_data->linear_acceleration,
                                     imu_data->angular_velocity);
   }
+  ingest_statistics_->RecordHandedOver(trajectory_id_, sensor_id,
+                                       imu_data->time);
+}
+
+template <typename LaserMessageType>
+const LaserScanGeometry& SensorBridge::GetLaserScanGeometry(
+    const std::string& sensor_id, const LaserMessageType& msg) {
+  LaserScanGeometry& geometry = laser_scan_geometries_[sensor_id];
+  if (!GeometryMatches(geometry, msg)) {
+    geometry = ComputeLaserScanGeometry(msg);
+  }
+  return geometry;
 }
 
 void SensorBridge::HandleLaserScanMessage(
     const std::string& sensor_id, const sensor_msgs::msg::LaserScan::ConstSharedPtr& msg) {
-  HandleLaserScan(sensor_id, FromRos(msg->header.stamp), msg->header.frame_id,
-                  ToPointCloudWithIntensities(*msg));
+  HandleLaserScan(
+      sensor_id, FromRos(msg->header.stamp), msg->header.frame_id,
+      ToPointCloudWithIntensities(*msg, GetLaserScanGeometry(sensor_id, *msg)));
 }
 
 void SensorBridge::HandleMultiEchoLaserScanMessage(
     const std::string& sensor_id,
     const sensor_msgs::msg::MultiEchoLaserScan::ConstSharedPtr& msg) {
-  HandleLaserScan(sensor_id, FromRos(msg->header.stamp), msg->header.frame_id,
-                  ToPointCloudWithIntensities(*msg));
+  HandleLaserScan(
+      sensor_id, FromRos(msg->header.stamp), msg->header.frame_id,
+      ToPointCloudWithIntensities(*msg, GetLaserScanGeometry(sensor_id, *msg)));
 }
 
 void SensorBridge::HandlePointCloud2Message(
     const std::string& sensor_id,
     const sensor_msgs::msg::PointCloud2::ConstSharedPtr& msg) {
-  pcl::PointCloud<pcl::PointXYZ> pcl_point_cloud;
-  pcl::fromROSMsg(*msg, pcl_point_cloud);
-  carto::sensor::TimedPointCloud point_cloud;
-  for (const auto& point : pcl_point_cloud) {
-    point_cloud.emplace_back(point.x, point.y, point.z, 0.f);
+  PointCloud2Layout& layout = point_cloud2_layouts_[sensor_id];
+  if (!LayoutMatches(layout, *msg)) {
+    layout = ComputePointCloud2Layout(*msg);
   }
-  HandleRangefinder(sensor_id, FromRos(msg->header.stamp), msg->header.frame_id,
-                    point_cloud);
+  carto::sensor::PointCloudWithIntensities point_cloud;
+  carto::common::Time time;
+  std::tie(point_cloud, time) = ToPointCloudWithIntensities(*msg, layout);
+  HandleRangefinder(sensor_id, time, msg->header.frame_id,
+                    std::move(point_cloud.points));
 }
 
 const TfBridge& SensorBridge::tf_bridge() const { return tf_bridge_; }
@@ -143,15 +207,13 @@ const TfBridge& SensorBridge::tf_bridge() const { return tf_bridge_; }
 void SensorBridge::HandleLaserScan(
     const std::string& sensor_id, const carto::common::Time start_time,
     const std::string& frame_id,
-    const carto::sensor::PointCloudWithIntensities& points) {
+    carto::sensor::PointCloudWithIntensities points) {
   // TODO(gaschler): Use per-point time instead of subdivisions.
+  const size_t num_points = points.points.size();
   for (int i = 0; i != num_subdivisions_per_laser_scan_; ++i) {
-    const size_t start_index =
-        points.points.size() * i / num_subdivisions_per_laser_scan_;
+    const size_t start_index = num_points * i / num_subdivisions_per_laser_scan_;
     const size_t end_index =
-        points.points.size() * (i + 1) / num_subdivisions_per_laser_scan_;
-    const carto::sensor::TimedPointCloud subdivision(
-        points.points.begin() + start_index, points.points.begin() + end_index);
+        num_points * (i + 1) / num_subdivisions_per_laser_scan_;
     if (start_index == end_index) {
       continue;
     }
@@ -159,21 +221,42 @@ void SensorBridge::HandleLaserScan(
     const carto::common::Time subdivision_time =
         start_time +
         carto::common::FromSeconds(points.points.at(middle_index)[3]);
-    HandleRangefinder(sensor_id, subdivision_time, frame_id, subdivision);
+    carto::sensor::TimedPointCloud subdivision;
+    if (start_index == 0 && end_index == num_points) {
+      // The subdivision is the whole scan, which we own.
+      subdivision = std::move(points.points);
+    } else {
+      subdivision.assign(points.points.begin() + start_index,
+                         points.points.begin() + end_index);
+    }
+    HandleRangefinder(sensor_id, subdivision_time, frame_id,
+                      std::move(subdivision));
   }
 }
 
-void SensorBridge::HandleRangefinder(
-    const std::string& sensor_id, const carto::common::Time time,
-    const std::string& frame_id, const carto::sensor::TimedPointCloud& ranges) {
+void SensorBridge::HandleRangefinder(const std::string& sensor_id,
+                                     const carto::common::Time time,
+                                     const std::string& frame_id,
+                                     carto::sensor::TimedPointCloud ranges) {
   const auto sensor_to_tracking =
       tf_bridge_.LookupToTracking(time, CheckNoLeadingSlash(frame_id));
-  if (sensor_to_tracking != nullptr) {
+  if (sensor_to_tracking == nullptr) {
+    ingest_statistics_->RecordTransformUnavailable(trajectory_id_, sensor_id);
+    return;
+  }
+  if (voxel_filter_size_ > 0.f) {
+    VoxelFilterInPlace(voxel_filter_size_, &occupied_voxels_, &ranges);
+  }
+  const carto::transform::Rigid3f transform = sensor_to_tracking->cast<float>();
+  for (Eigen::Vector4f& point : ranges) {
+    point.head<3>() = transform * Eigen::Vector3f(point.head<3>());
+  }
+  {
+    carto::common::MutexLocker lock(trajectory_builder_mutex_);
     trajectory_builder_->AddRangefinderData(
-        sensor_id, time, sensor_to_tracking->translation().cast<float>(),
-        carto::sensor::TransformTimedPointCloud(
-            ranges, sensor_to_tracking->cast<float>()));
+        sensor_id, time, transform.translation(), std::move(ranges));
   }
+  ingest_statistics_->RecordHandedOver(trajectory_id_, sensor_id, time);
 }
 
 }  // namespace cartographer_ros
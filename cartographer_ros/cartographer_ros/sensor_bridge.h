@@ -17,14 +17,19 @@
 #ifndef CARTOGRAPHER_ROS_SENSOR_BRIDGE_H_
 #define CARTOGRAPHER_ROS_SENSOR_BRIDGE_H_
 
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_set>
 
+#include "cartographer/common/mutex.h"
 #include "cartographer/mapping/trajectory_builder.h"
 #include "cartographer/sensor/imu_data.h"
 #include "cartographer/sensor/odometry_data.h"
 #include "cartographer/transform/rigid_transform.h"
 #include "cartographer/transform/transform.h"
+#include "cartographer_ros/ingest_statistics.h"
+#include "cartographer_ros/msg_conversion.h"
 #include "cartographer_ros/tf_bridge.h"
 
 #include <geometry_msgs/msg/transform.hpp>
@@ -39,12 +44,20 @@
 namespace cartographer_ros {
 
 // Converts ROS messages into SensorData in tracking frame for the MapBuilder.
+//
+// Calls into the 'trajectory_builder' are serialized on
+// 'trajectory_builder_mutex' which is shared by all trajectories, since the
+// MapBuilder collates the sensor data of all trajectories. Conversion and
+// transform lookups happen outside of it.
 class SensorBridge {
  public:
   explicit SensorBridge(
-      int num_subdivisions_per_laser_scan, const std::string& tracking_frame,
+      int trajectory_id, int num_subdivisions_per_laser_scan,
+      double voxel_filter_size, const std::string& tracking_frame,
       double lookup_transform_timeout_sec, tf2_ros::Buffer* tf_buffer,
-      ::cartographer::mapping::TrajectoryBuilder* trajectory_builder);
+      ::cartographer::common::Mutex* trajectory_builder_mutex,
+      ::cartographer::mapping::TrajectoryBuilder* trajectory_builder,
+      IngestStatistics* ingest_statistics);
 
   SensorBridge(const SensorBridge&) = delete;
   SensorBridge& operator=(const SensorBridge&) = delete;
@@ -68,18 +81,37 @@ class SensorBridge {
   const TfBridge& tf_bridge() const;
 
  private:
+  template <typename LaserMessageType>
+  const LaserScanGeometry& GetLaserScanGeometry(const std::string& sensor_id,
+                                                const LaserMessageType& msg);
+  // Takes ownership of 'points' so that a scan which is not subdivided reaches
+  // the trajectory builder without being copied.
   void HandleLaserScan(
       const std::string& sensor_id, ::cartographer::common::Time start_time,
       const std::string& frame_id,
-      const ::cartographer::sensor::PointCloudWithIntensities& points);
+      ::cartographer::sensor::PointCloudWithIntensities points);
+  // Voxel filters 'ranges' if enabled and transforms them into the tracking
+  // frame in place.
   void HandleRangefinder(const std::string& sensor_id,
                          ::cartographer::common::Time time,
                          const std::string& frame_id,
-                         const ::cartographer::sensor::TimedPointCloud& ranges);
+                         ::cartographer::sensor::TimedPointCloud ranges);
 
+  const int trajectory_id_;
   const int num_subdivisions_per_laser_scan_;
+  const float voxel_filter_size_;
   const TfBridge tf_bridge_;
+  ::cartographer::common::Mutex* const trajectory_builder_mutex_;
   ::cartographer::mapping::TrajectoryBuilder* const trajectory_builder_;
+  IngestStatistics* const ingest_statistics_;
+
+  // These are keyed with 'sensor_id' and are recomputed whenever the geometry
+  // or layout of an incoming message changes.
+  std::map<std::string, LaserScanGeometry> laser_scan_geometries_;
+  std::map<std::string, PointCloud2Layout> point_cloud2_layouts_;
+
+  // Scratch space of the voxel filter, kept to reuse its buckets.
+  std::unordered_set<uint64_t> occupied_voxels_;
 };
 
 }  // namespace cartographer_ros
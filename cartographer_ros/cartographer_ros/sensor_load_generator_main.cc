@@ -0,0 +1,524 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Publishes synthetic sensor data on the default topics of the
+// cartographer_node, as seen by a robot driving a circle inside a box shaped
+// room, and measures how long it takes until the node has processed it.
+//
+// The tf transforms published by the node are extrapolated to the current
+// time, so their stamps do not tell which range data was already matched.
+// Instead, the latency of range data is measured until the arrival of the
+// first scan matched point cloud which PublishTrajectoryStates() sends for a
+// local SLAM result at or after its stamp.
+//
+// For each comma separated multiplier in -rate_multipliers, all sensor rates
+// are scaled and traffic is generated for -step_duration_sec. Each step
+// yields one point of the latency/throughput curve.
+
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/time.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "cartographer_ros/node_constants.h"
+#include "cartographer_ros/split_string.h"
+#include "cartographer_ros/time_conversion.h"
+#include "gflags/gflags.h"
+#include "geometry_msgs/msg/transform_stamped.hpp"
+#include "glog/logging.h"
+#include "nav_msgs/msg/odometry.hpp"
+#include "rclcpp/rclcpp.hpp"
+#include "sensor_msgs/msg/imu.hpp"
+#include "sensor_msgs/msg/laser_scan.hpp"
+#include "sensor_msgs/msg/point_cloud2.hpp"
+#include "tf2_ros/static_transform_broadcaster.h"
+
+DEFINE_double(laser_scan_rate_hz, 40.,
+              "Rate of the LaserScan messages. 0 disables them.");
+DEFINE_int32(num_laser_scan_beams, 1080, "Number of beams of each LaserScan.");
+DEFINE_double(point_cloud2_rate_hz, 0.,
+              "Rate of the PointCloud2 messages. 0 disables them.");
+DEFINE_int32(num_point_cloud2_rows, 16,
+             "Number of rows, i.e. beams, of each PointCloud2.");
+DEFINE_int32(num_point_cloud2_columns, 1024,
+             "Number of points per row of each PointCloud2.");
+DEFINE_double(imu_rate_hz, 200., "Rate of the Imu messages. 0 disables them.");
+DEFINE_double(odometry_rate_hz, 50.,
+              "Rate of the Odometry messages. 0 disables them.");
+DEFINE_string(rate_multipliers, "1",
+              "Comma separated factors by which all sensor rates are scaled, "
+              "one measurement step per factor.");
+DEFINE_double(step_duration_sec, 30., "Duration of each measurement step.");
+DEFINE_string(tracking_frame, "base_link",
+              "Frame of the Imu and child frame of the Odometry messages. "
+              "Must match the tracking_frame of the configuration.");
+DEFINE_int32(node_pid, 0,
+             "If non-zero, process ID of the cartographer_node whose CPU time "
+             "per published message is reported.");
+DEFINE_string(output_filename, "",
+              "If non-empty, the latency/throughput curve is written to this "
+              "file as CSV.");
+
+namespace cartographer_ros {
+namespace {
+
+namespace carto = ::cartographer;
+
+constexpr char kLaserScanFrame[] = "horizontal_laser_link";
+constexpr char kPointCloud2Frame[] = "vertical_laser_link";
+constexpr char kOdometryFrame[] = "odom";
+// The room spans [-kRoomHalfSize, kRoomHalfSize] horizontally and [0,
+// kRoomHeight] vertically. The sensors are mounted at kSensorHeight.
+constexpr double kRoomHalfSize = 10.;
+constexpr double kRoomHeight = 3.;
+constexpr double kSensorHeight = 0.5;
+constexpr double kCircleRadius = 3.;
+constexpr double kAngularVelocity = 0.2;
+constexpr double kGravity = 9.80665;
+constexpr double kPointCloud2VerticalFieldOfView = 0.5;
+
+struct Pose2D {
+  Eigen::Vector2d translation;
+  double yaw;
+};
+
+// Pose of the tracking frame at 'seconds' after the start, driving the circle
+// counterclockwise.
+Pose2D PoseAt(const double seconds) {
+  const double angle = kAngularVelocity * seconds;
+  return Pose2D{kCircleRadius * Eigen::Vector2d(std::cos(angle),
+                                                std::sin(angle)),
+                angle + M_PI / 2.};
+}
+
+// Returns the distance from 'origin' inside the room to its boundary along the
+// unit vector 'direction'.
+double CastRay(const Eigen::Vector3d& origin,
+               const Eigen::Vector3d& direction) {
+  const Eigen::Vector3d min(-kRoomHalfSize, -kRoomHalfSize, 0.);
+  const Eigen::Vector3d max(kRoomHalfSize, kRoomHalfSize, kRoomHeight);
+  double distance = std::numeric_limits<double>::infinity();
+  for (int i = 0; i != 3; ++i) {
+    if (direction[i] > 0.) {
+      distance = std::min(distance, (max[i] - origin[i]) / direction[i]);
+    } else if (direction[i] < 0.) {
+      distance = std::min(distance, (min[i] - origin[i]) / direction[i]);
+    }
+  }
+  return distance;
+}
+
+Eigen::Vector3d SensorOrigin(const Pose2D& pose) {
+  return Eigen::Vector3d(pose.translation.x(), pose.translation.y(),
+                         kSensorHeight);
+}
+
+geometry_msgs::msg::Quaternion ToYawQuaternion(const double yaw) {
+  geometry_msgs::msg::Quaternion quaternion;
+  quaternion.z = std::sin(0.5 * yaw);
+  quaternion.w = std::cos(0.5 * yaw);
+  return quaternion;
+}
+
+double ReadProcessCpuSeconds(const int pid) {
+  std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+  CHECK(stat_file) << "Cannot read the CPU time of process " << pid << ".";
+  std::string stat;
+  std::getline(stat_file, stat);
+  // The process name in parentheses may contain spaces, the fields after it
+  // are separated by spaces. utime and stime are the 12th and 13th of them.
+  std::istringstream fields(stat.substr(stat.rfind(')') + 2));
+  std::string field;
+  for (int i = 0; i != 11; ++i) {
+    fields >> field;
+  }
+  double utime_ticks = 0.;
+  double stime_ticks = 0.;
+  fields >> utime_ticks >> stime_ticks;
+  return (utime_ticks + stime_ticks) / sysconf(_SC_CLK_TCK);
+}
+
+double GetOwnCpuSeconds() {
+  rusage usage;
+  CHECK_EQ(getrusage(RUSAGE_SELF, &usage), 0);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+double Quantile(const std::vector<double>& sorted_values,
+                const double quantile) {
+  if (sorted_values.empty()) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  const size_t index =
+      std::min(sorted_values.size() - 1,
+               static_cast<size_t>(quantile * sorted_values.size()));
+  return sorted_values[index];
+}
+
+// Matches the stamps of published range data with the scan matched point
+// clouds of the node.
+class LatencyRecorder {
+ public:
+  LatencyRecorder(rclcpp::Node::SharedPtr node, rclcpp::Clock::SharedPtr clock)
+      : clock_(clock),
+        subscription_(node->create_subscription<sensor_msgs::msg::PointCloud2>(
+            kScanMatchedPointCloudTopic,
+            [this](const sensor_msgs::msg::PointCloud2::SharedPtr msg) {
+              HandleScanMatchedPointCloud(*msg);
+            },
+            rmw_qos_profile_sensor_data)) {}
+
+  struct Step {
+    // Sorted latencies in seconds of the range data with a local SLAM result.
+    std::vector<double> latencies;
+    int num_range_data = 0;
+    int num_results = 0;
+  };
+
+  void AddRangeData(const carto::common::Time time) EXCLUDES(mutex_) {
+    carto::common::MutexLocker lock(&mutex_);
+    pending_times_.push_back(time);
+    ++step_.num_range_data;
+  }
+
+  // Returns what was recorded since the last call. Range data still waiting
+  // for a local SLAM result is forgotten, so it does not skew the next step.
+  Step TakeStep() EXCLUDES(mutex_) {
+    Step step;
+    {
+      carto::common::MutexLocker lock(&mutex_);
+      std::swap(step, step_);
+      pending_times_.clear();
+    }
+    std::sort(step.latencies.begin(), step.latencies.end());
+    return step;
+  }
+
+ private:
+  void HandleScanMatchedPointCloud(const sensor_msgs::msg::PointCloud2& msg)
+      EXCLUDES(mutex_) {
+    const carto::common::Time now = FromRos(clock_->now());
+    const carto::common::Time result_time = FromRos(msg.header.stamp);
+    carto::common::MutexLocker lock(&mutex_);
+    ++step_.num_results;
+    while (!pending_times_.empty() && pending_times_.front() <= result_time) {
+      step_.latencies.push_back(
+          carto::common::ToSeconds(now - pending_times_.front()));
+      pending_times_.pop_front();
+    }
+  }
+
+  const rclcpp::Clock::SharedPtr clock_;
+  carto::common::Mutex mutex_;
+  std::deque<carto::common::Time> pending_times_ GUARDED_BY(mutex_);
+  Step step_ GUARDED_BY(mutex_);
+  rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr subscription_;
+};
+
+class SensorLoadGenerator {
+ public:
+  SensorLoadGenerator(rclcpp::Node::SharedPtr node,
+                      rclcpp::Clock::SharedPtr clock,
+                      LatencyRecorder* latency_recorder)
+      : clock_(clock),
+        latency_recorder_(latency_recorder),
+        start_time_(FromRos(clock_->now())),
+        laser_scan_publisher_(
+            node->create_publisher<sensor_msgs::msg::LaserScan>(
+                kLaserScanTopic, rmw_qos_profile_sensor_data)),
+        point_cloud2_publisher_(
+            node->create_publisher<sensor_msgs::msg::PointCloud2>(
+                kPointCloud2Topic, rmw_qos_profile_sensor_data)),
+        imu_publisher_(node->create_publisher<sensor_msgs::msg::Imu>(
+            kImuTopic, rmw_qos_profile_sensor_data)),
+        odometry_publisher_(node->create_publisher<nav_msgs::msg::Odometry>(
+            kOdometryTopic, rmw_qos_profile_sensor_data)),
+        static_tf_broadcaster_(node) {
+    std::vector<geometry_msgs::msg::TransformStamped> transforms;
+    for (const std::string& frame_id : {kLaserScanFrame, kPointCloud2Frame}) {
+      geometry_msgs::msg::TransformStamped transform;
+      transform.header.stamp = ToRos(start_time_);
+      transform.header.frame_id = FLAGS_tracking_frame;
+      transform.child_frame_id = frame_id;
+      transform.transform.translation.z = kSensorHeight;
+      transform.transform.rotation.w = 1.;
+      transforms.push_back(transform);
+    }
+    static_tf_broadcaster_.sendTransform(transforms);
+  }
+
+  // Publishes all streams at their rates scaled by 'rate_multiplier' for
+  // 'duration_sec'. Returns the number of published messages.
+  int Run(const double rate_multiplier, const double duration_sec) {
+    struct Stream {
+      double period_sec;
+      std::function<void(carto::common::Time)> publish;
+      std::chrono::steady_clock::time_point next_publish_time;
+    };
+    std::vector<Stream> streams;
+    const auto add_stream =
+        [&streams, rate_multiplier](
+            const double rate_hz,
+            std::function<void(carto::common::Time)> publish) {
+          if (rate_hz > 0.) {
+            streams.push_back(Stream{1. / (rate_hz * rate_multiplier),
+                                     std::move(publish),
+                                     std::chrono::steady_clock::now()});
+          }
+        };
+    add_stream(FLAGS_laser_scan_rate_hz,
+               [this](const carto::common::Time time) {
+                 PublishLaserScan(time);
+               });
+    add_stream(FLAGS_point_cloud2_rate_hz,
+               [this](const carto::common::Time time) {
+                 PublishPointCloud2(time);
+               });
+    add_stream(FLAGS_imu_rate_hz,
+               [this](const carto::common::Time time) { PublishImu(time); });
+    add_stream(FLAGS_odometry_rate_hz,
+               [this](const carto::common::Time time) {
+                 PublishOdometry(time);
+               });
+    CHECK(!streams.empty()) << "All sensor rates are 0.";
+
+    const auto end_time = std::chrono::steady_clock::now() +
+                          std::chrono::duration_cast<
+                              std::chrono::steady_clock::duration>(
+                              std::chrono::duration<double>(duration_sec));
+    int num_published_messages = 0;
+    while (rclcpp::ok()) {
+      Stream& stream = *std::min_element(
+          streams.begin(), streams.end(),
+          [](const Stream& lhs, const Stream& rhs) {
+            return lhs.next_publish_time < rhs.next_publish_time;
+          });
+      if (stream.next_publish_time >= end_time) {
+        break;
+      }
+      std::this_thread::sleep_until(stream.next_publish_time);
+      stream.publish(FromRos(clock_->now()));
+      ++num_published_messages;
+      stream.next_publish_time +=
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(stream.period_sec));
+    }
+    return num_published_messages;
+  }
+
+ private:
+  double SecondsSinceStart(const carto::common::Time time) const {
+    return carto::common::ToSeconds(time - start_time_);
+  }
+
+  void PublishLaserScan(const carto::common::Time time) {
+    const Pose2D pose = PoseAt(SecondsSinceStart(time));
+    sensor_msgs::msg::LaserScan msg;
+    msg.header.stamp = ToRos(time);
+    msg.header.frame_id = kLaserScanFrame;
+    msg.angle_min = -M_PI;
+    msg.angle_increment = 2. * M_PI / FLAGS_num_laser_scan_beams;
+    msg.angle_max =
+        msg.angle_min + (FLAGS_num_laser_scan_beams - 1) * msg.angle_increment;
+    msg.range_min = 0.1f;
+    msg.range_max = 2.f * kRoomHalfSize * std::sqrt(2.f);
+    msg.ranges.reserve(FLAGS_num_laser_scan_beams);
+    for (int i = 0; i != FLAGS_num_laser_scan_beams; ++i) {
+      const double angle = pose.yaw + msg.angle_min + i * msg.angle_increment;
+      msg.ranges.push_back(
+          CastRay(SensorOrigin(pose),
+                  Eigen::Vector3d(std::cos(angle), std::sin(angle), 0.)));
+    }
+    latency_recorder_->AddRangeData(time);
+    laser_scan_publisher_->publish(msg);
+  }
+
+  void PublishPointCloud2(const carto::common::Time time) {
+    const Pose2D pose = PoseAt(SecondsSinceStart(time));
+    const Eigen::AngleAxisd rotation(pose.yaw, Eigen::Vector3d::UnitZ());
+    carto::sensor::PointCloud points;
+    points.reserve(FLAGS_num_point_cloud2_rows *
+                   FLAGS_num_point_cloud2_columns);
+    for (int row = 0; row != FLAGS_num_point_cloud2_rows; ++row) {
+      const double elevation =
+          kPointCloud2VerticalFieldOfView *
+          (row / std::max(1., FLAGS_num_point_cloud2_rows - 1.) - 0.5);
+      for (int column = 0; column != FLAGS_num_point_cloud2_columns;
+           ++column) {
+        const double azimuth =
+            2. * M_PI * column / FLAGS_num_point_cloud2_columns;
+        const Eigen::Vector3d direction(
+            std::cos(azimuth) * std::cos(elevation),
+            std::sin(azimuth) * std::cos(elevation), std::sin(elevation));
+        points.push_back(
+            (CastRay(SensorOrigin(pose), rotation * direction) * direction)
+                .cast<float>());
+      }
+    }
+    sensor_msgs::msg::PointCloud2 msg;
+    ToPointCloud2Message(carto::common::ToUniversal(time), kPointCloud2Frame,
+                         carto::transform::Rigid3f::Identity(), points, &msg);
+    latency_recorder_->AddRangeData(time);
+    point_cloud2_publisher_->publish(msg);
+  }
+
+  void PublishImu(const carto::common::Time time) {
+    const Pose2D pose = PoseAt(SecondsSinceStart(time));
+    sensor_msgs::msg::Imu msg;
+    msg.header.stamp = ToRos(time);
+    msg.header.frame_id = FLAGS_tracking_frame;
+    msg.orientation = ToYawQuaternion(pose.yaw);
+    msg.angular_velocity.z = kAngularVelocity;
+    // The centripetal acceleration points to the left, towards the center of
+    // the circle.
+    msg.linear_acceleration.y =
+        kCircleRadius * kAngularVelocity * kAngularVelocity;
+    msg.linear_acceleration.z = kGravity;
+    imu_publisher_->publish(msg);
+  }
+
+  void PublishOdometry(const carto::common::Time time) {
+    const Pose2D pose = PoseAt(SecondsSinceStart(time));
+    nav_msgs::msg::Odometry msg;
+    msg.header.stamp = ToRos(time);
+    msg.header.frame_id = kOdometryFrame;
+    msg.child_frame_id = FLAGS_tracking_frame;
+    msg.pose.pose.position.x = pose.translation.x();
+    msg.pose.pose.position.y = pose.translation.y();
+    msg.pose.pose.orientation = ToYawQuaternion(pose.yaw);
+    msg.twist.twist.linear.x = kCircleRadius * kAngularVelocity;
+    msg.twist.twist.angular.z = kAngularVelocity;
+    odometry_publisher_->publish(msg);
+  }
+
+  const rclcpp::Clock::SharedPtr clock_;
+  LatencyRecorder* const latency_recorder_;
+  const carto::common::Time start_time_;
+  const rclcpp::Publisher<sensor_msgs::msg::LaserScan>::SharedPtr
+      laser_scan_publisher_;
+  const rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr
+      point_cloud2_publisher_;
+  const rclcpp::Publisher<sensor_msgs::msg::Imu>::SharedPtr imu_publisher_;
+  const rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr
+      odometry_publisher_;
+  tf2_ros::StaticTransformBroadcaster static_tf_broadcaster_;
+};
+
+void Run() {
+  std::vector<double> rate_multipliers;
+  for (const std::string& multiplier :
+       SplitString(FLAGS_rate_multipliers, ',')) {
+    rate_multipliers.push_back(std::stod(multiplier));
+    CHECK_GT(rate_multipliers.back(), 0.);
+  }
+  CHECK(!rate_multipliers.empty()) << "-rate_multipliers is empty.";
+
+  auto node = rclcpp::Node::make_shared("cartographer_sensor_load_generator");
+  auto clock = std::make_shared<rclcpp::Clock>(RCL_SYSTEM_TIME);
+  LatencyRecorder latency_recorder(node, clock);
+  SensorLoadGenerator generator(node, clock, &latency_recorder);
+  std::thread spin_thread([node] { rclcpp::spin(node); });
+
+  std::ofstream output;
+  if (!FLAGS_output_filename.empty()) {
+    output.open(FLAGS_output_filename);
+    CHECK(output) << "Cannot open " << FLAGS_output_filename << ".";
+    output << "rate_multiplier,messages_per_sec,results_per_sec,"
+              "latency_p50_sec,latency_p90_sec,latency_p99_sec,"
+              "latency_max_sec,num_lost_range_data,generator_cpu_ms_per_msg,"
+              "node_cpu_ms_per_msg\n";
+  }
+  for (const double rate_multiplier : rate_multipliers) {
+    // Drops what is left over from the previous step.
+    latency_recorder.TakeStep();
+    const double own_cpu_seconds_before = GetOwnCpuSeconds();
+    const double node_cpu_seconds_before =
+        FLAGS_node_pid != 0 ? ReadProcessCpuSeconds(FLAGS_node_pid) : 0.;
+    const int num_published_messages =
+        generator.Run(rate_multiplier, FLAGS_step_duration_sec);
+    const double own_cpu_ms_per_message =
+        1e3 * (GetOwnCpuSeconds() - own_cpu_seconds_before) /
+        std::max(1, num_published_messages);
+    const double node_cpu_ms_per_message =
+        FLAGS_node_pid != 0
+            ? 1e3 *
+                  (ReadProcessCpuSeconds(FLAGS_node_pid) -
+                   node_cpu_seconds_before) /
+                  std::max(1, num_published_messages)
+            : std::numeric_limits<double>::quiet_NaN();
+    if (!rclcpp::ok()) {
+      break;
+    }
+
+    const LatencyRecorder::Step step = latency_recorder.TakeStep();
+    const std::vector<double>& latencies = step.latencies;
+    const double messages_per_sec =
+        num_published_messages / FLAGS_step_duration_sec;
+    const double results_per_sec = step.num_results / FLAGS_step_duration_sec;
+    // Range data without a local SLAM result was dropped or is still queued
+    // at the end of the step.
+    const int num_lost_range_data =
+        step.num_range_data - static_cast<int>(latencies.size());
+    LOG(INFO) << "Rates x" << rate_multiplier << ": " << messages_per_sec
+              << " messages/s, " << results_per_sec
+              << " local SLAM results/s, latency p50 "
+              << Quantile(latencies, 0.5) << " s, p90 "
+              << Quantile(latencies, 0.9) << " s, p99 "
+              << Quantile(latencies, 0.99) << " s, max "
+              << Quantile(latencies, 1.) << " s, " << num_lost_range_data
+              << " range data without result, generator "
+              << own_cpu_ms_per_message << " ms CPU/message, node "
+              << node_cpu_ms_per_message << " ms CPU/message.";
+    if (output.is_open()) {
+      output << rate_multiplier << "," << messages_per_sec << ","
+             << results_per_sec << "," << Quantile(latencies, 0.5) << ","
+             << Quantile(latencies, 0.9) << "," << Quantile(latencies, 0.99)
+             << "," << Quantile(latencies, 1.) << "," << num_lost_range_data
+             << "," << own_cpu_ms_per_message << "," << node_cpu_ms_per_message
+             << "\n";
+    }
+  }
+  rclcpp::shutdown();
+  spin_thread.join();
+}
+
+}  // namespace
+}  // namespace cartographer_ros
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK_GT(FLAGS_step_duration_sec, 0.);
+
+  ::rclcpp::init(argc, argv);
+  cartographer_ros::Run();
+}
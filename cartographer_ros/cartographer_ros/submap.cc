@@ -24,44 +24,37 @@
 
 namespace cartographer_ros {
 
-SubmapTexture::Pixels UnpackTextureData(const std::string& compressed_cells,
-                                        const int width, const int height) {
-  SubmapTexture::Pixels pixels;
+std::string UnpackTextureData(const std::string& compressed_cells,
+                              const int width, const int height) {
   std::string cells;
   ::cartographer::common::FastGunzipString(compressed_cells, &cells);
-  const int num_pixels = width * height;
-  CHECK_EQ(cells.size(), 2 * num_pixels);
-  pixels.intensity.reserve(num_pixels);
-  pixels.alpha.reserve(num_pixels);
-  for (int i = 0; i < height; ++i) {
-    for (int j = 0; j < width; ++j) {
-      pixels.intensity.push_back(cells[(i * width + j) * 2]);
-      pixels.alpha.push_back(cells[(i * width + j) * 2 + 1]);
-    }
-  }
-  return pixels;
+  CHECK_EQ(cells.size(), 2 * width * height);
+  return cells;
 }
 
 ::cartographer::io::UniqueCairoSurfacePtr DrawTexture(
-    const std::vector<char>& intensity, const std::vector<char>& alpha,
-    const int width, const int height,
+    const std::string& cells, const int width, const int height,
     std::vector<uint32_t>* const cairo_data) {
-  CHECK(cairo_data->empty());
+  const int num_pixels = width * height;
+  CHECK_EQ(cells.size(), 2 * num_pixels);
 
   // Properly dealing with a non-common stride would make this code much more
   // complicated. Let's check that it is not needed.
   const int expected_stride = 4 * width;
   CHECK_EQ(expected_stride, cairo_format_stride_for_width(
                                 ::cartographer::io::kCairoFormat, width));
-  for (size_t i = 0; i < intensity.size(); ++i) {
+  cairo_data->resize(num_pixels);
+  const uint8_t* const source = reinterpret_cast<const uint8_t*>(cells.data());
+  uint32_t* const destination = cairo_data->data();
+  // Branch-free, so the compiler can vectorize it.
+  for (int i = 0; i < num_pixels; ++i) {
     // We use the red channel to track intensity information. The green
     // channel we use to track if a cell was ever observed.
-    const uint8_t intensity_value = intensity.at(i);
-    const uint8_t alpha_value = alpha.at(i);
-    const uint8_t observed =
-        (intensity_value == 0 && alpha_value == 0) ? 0 : 255;
-    cairo_data->push_back((alpha_value << 24) | (intensity_value << 16) |
-                          (observed << 8) | 0);
+    const uint32_t intensity_value = source[2 * i];
+    const uint32_t alpha_value = source[2 * i + 1];
+    const uint32_t observed = ((intensity_value | alpha_value) != 0) * 255;
+    destination[i] = (alpha_value << 24) | (intensity_value << 16) |
+                     (observed << 8);
   }
 
   auto surface = ::cartographer::io::MakeUniqueCairoSurfacePtr(
@@ -76,16 +69,30 @@ SubmapTexture::Pixels UnpackTextureData(const std::string& compressed_cells,
 std::unique_ptr<SubmapTextures> FetchSubmapTextures(
     const ::cartographer::mapping::SubmapId& submap_id,
     ros::ServiceClient* client) {
+  return FetchSubmapTextures(submap_id, {} /* texture_indices */, client);
+}
+
+std::unique_ptr<SubmapTextures> FetchSubmapTextures(
+    const ::cartographer::mapping::SubmapId& submap_id,
+    const std::vector<int>& texture_indices, ros::ServiceClient* client) {
   ::cartographer_ros_msgs::SubmapQuery srv;
   srv.request.trajectory_id = submap_id.trajectory_id;
   srv.request.submap_index = submap_id.submap_index;
+  srv.request.texture_indices.assign(texture_indices.begin(),
+                                     texture_indices.end());
   if (!client->call(srv)) {
     return nullptr;
   }
-  CHECK(!srv.response.textures.empty());
+  return ToSubmapTextures(srv.response.submap_version, srv.response.textures);
+}
+
+std::unique_ptr<SubmapTextures> ToSubmapTextures(
+    const int version,
+    const std::vector<::cartographer_ros_msgs::SubmapTexture>& textures) {
+  CHECK(!textures.empty());
   auto response = ::cartographer::common::make_unique<SubmapTextures>();
-  response->version = srv.response.submap_version;
-  for (const auto& texture : srv.response.textures) {
+  response->version = version;
+  for (const auto& texture : textures) {
     const std::string compressed_cells(texture.cells.begin(),
                                        texture.cells.end());
     response->textures.emplace_back(SubmapTexture{
@@ -24,16 +24,14 @@
 #include "cartographer/io/image.h"
 #include "cartographer/mapping/id.h"
 #include "cartographer/transform/rigid_transform.h"
+#include "cartographer_ros_msgs/SubmapTexture.h"
 #include "ros/ros.h"
 
 namespace cartographer_ros {
 
 struct SubmapTexture {
-  struct Pixels {
-    std::vector<char> intensity;
-    std::vector<char> alpha;
-  };
-  Pixels pixels;
+  // Decompressed cell data, i.e. interleaved intensity and alpha values.
+  std::string cells;
   int width;
   int height;
   double resolution;
@@ -51,15 +49,28 @@ std::unique_ptr<SubmapTextures> FetchSubmapTextures(
     const ::cartographer::mapping::SubmapId& submap_id,
     ros::ServiceClient* client);
 
-// Unpacks cell data as provided by the backend into 'intensity' and 'alpha'.
-SubmapTexture::Pixels UnpackTextureData(const std::string& compressed_cells,
-                                        int width, int height);
+// Same as above, but only fetches the textures at 'texture_indices', where
+// index 0 is the highest resolution texture.
+std::unique_ptr<SubmapTextures> FetchSubmapTextures(
+    const ::cartographer::mapping::SubmapId& submap_id,
+    const std::vector<int>& texture_indices, ros::ServiceClient* client);
+
+// Converts the 'textures' of version 'version', e.g. as published on the
+// submap textures topic, unpacking their cell data.
+std::unique_ptr<SubmapTextures> ToSubmapTextures(
+    int version,
+    const std::vector<::cartographer_ros_msgs::SubmapTexture>& textures);
+
+// Decompresses cell data as provided by the backend.
+std::string UnpackTextureData(const std::string& compressed_cells, int width,
+                              int height);
 
-// Draw a texture into a cairo surface. 'cairo_data' will store the pixel data
-// for the surface and must therefore outlive the use of the surface.
+// Draw the decompressed 'cells' of a texture into a cairo surface in a single
+// pass. 'cairo_data' will store the pixel data for the surface and must
+// therefore outlive the use of the surface. It is resized as needed.
 ::cartographer::io::UniqueCairoSurfacePtr DrawTexture(
-    const std::vector<char>& intensity, const std::vector<char>& alpha,
-    int width, int height, std::vector<uint32_t>* cairo_data);
+    const std::string& cells, int width, int height,
+    std::vector<uint32_t>* cairo_data);
 
 }  // namespace cartographer_ros
 
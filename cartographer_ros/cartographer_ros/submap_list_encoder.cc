@@ -0,0 +1,76 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_list_encoder.h"
+
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+namespace {
+
+bool PoseEquals(const geometry_msgs::msg::Pose& lhs,
+                const geometry_msgs::msg::Pose& rhs) {
+  return lhs.position.x == rhs.position.x &&
+         lhs.position.y == rhs.position.y &&
+         lhs.position.z == rhs.position.z &&
+         lhs.orientation.w == rhs.orientation.w &&
+         lhs.orientation.x == rhs.orientation.x &&
+         lhs.orientation.y == rhs.orientation.y &&
+         lhs.orientation.z == rhs.orientation.z;
+}
+
+}  // namespace
+
+SubmapListEncoder::SubmapListEncoder(const int full_update_interval)
+    : full_update_interval_(full_update_interval) {
+  CHECK_GE(full_update_interval_, 1);
+}
+
+cartographer_ros_msgs::msg::SubmapList SubmapListEncoder::Encode(
+    const cartographer_ros_msgs::msg::SubmapList& submap_list,
+    const bool force_full_update) {
+  cartographer_ros_msgs::msg::SubmapList update;
+  update.header = submap_list.header;
+  update.sequence = next_sequence_;
+  update.is_full_update =
+      force_full_update || next_sequence_ % full_update_interval_ == 0;
+  ++next_sequence_;
+
+  std::map<SubmapKey, cartographer_ros_msgs::msg::SubmapEntry> submaps;
+  for (const auto& submap_entry : submap_list.submap) {
+    const SubmapKey key(submap_entry.trajectory_id, submap_entry.submap_index);
+    const auto it = published_submaps_.find(key);
+    if (update.is_full_update || it == published_submaps_.end() ||
+        it->second.submap_version != submap_entry.submap_version ||
+        !PoseEquals(it->second.pose, submap_entry.pose)) {
+      update.submap.push_back(submap_entry);
+    }
+    if (it != published_submaps_.end()) {
+      published_submaps_.erase(it);
+    }
+    submaps.emplace(key, submap_entry);
+  }
+  // What is left has not been listed anymore.
+  if (!update.is_full_update) {
+    for (const auto& entry : published_submaps_) {
+      update.deleted_submap.push_back(entry.second);
+    }
+  }
+  published_submaps_ = std::move(submaps);
+  return update;
+}
+
+}  // namespace cartographer_ros
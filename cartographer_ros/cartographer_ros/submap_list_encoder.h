@@ -0,0 +1,58 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_SUBMAP_LIST_ENCODER_H_
+#define CARTOGRAPHER_ROS_SUBMAP_LIST_ENCODER_H_
+
+#include <map>
+#include <utility>
+
+#include "cartographer/common/port.h"
+#include "cartographer_ros_msgs/msg/submap_entry.hpp"
+#include "cartographer_ros_msgs/msg/submap_list.hpp"
+
+namespace cartographer_ros {
+
+// Turns complete submap lists into incremental updates which only contain the
+// submaps that changed since the previously encoded list. Every
+// 'full_update_interval'th list, and whenever requested, is sent in full so
+// that subscribers which joined late or missed an update can resynchronize.
+class SubmapListEncoder {
+ public:
+  // A 'full_update_interval' of 1 sends every list in full.
+  explicit SubmapListEncoder(int full_update_interval);
+
+  SubmapListEncoder(const SubmapListEncoder&) = delete;
+  SubmapListEncoder& operator=(const SubmapListEncoder&) = delete;
+
+  // Returns the message to publish for 'submap_list' listing all submaps.
+  cartographer_ros_msgs::msg::SubmapList Encode(
+      const cartographer_ros_msgs::msg::SubmapList& submap_list,
+      bool force_full_update);
+
+ private:
+  using SubmapKey = std::pair<int, int>;
+
+  const int full_update_interval_;
+  ::cartographer::common::uint64 next_sequence_ = 0;
+  // Submaps as known to subscribers after the last encoded list.
+  std::map<SubmapKey, cartographer_ros_msgs::msg::SubmapEntry>
+      published_submaps_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_SUBMAP_LIST_ENCODER_H_
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_list_encoder.h"
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+cartographer_ros_msgs::msg::SubmapEntry CreateSubmapEntry(
+    const int submap_index, const int submap_version, const double x) {
+  cartographer_ros_msgs::msg::SubmapEntry submap_entry;
+  submap_entry.trajectory_id = 0;
+  submap_entry.submap_index = submap_index;
+  submap_entry.submap_version = submap_version;
+  submap_entry.pose.position.x = x;
+  submap_entry.pose.orientation.w = 1.;
+  return submap_entry;
+}
+
+TEST(SubmapListEncoderTest, OnlySendsChanges) {
+  SubmapListEncoder encoder(100);
+  cartographer_ros_msgs::msg::SubmapList submap_list;
+  submap_list.submap.push_back(CreateSubmapEntry(0, 10, 0.));
+  submap_list.submap.push_back(CreateSubmapEntry(1, 5, 1.));
+
+  auto update = encoder.Encode(submap_list, false /* force_full_update */);
+  EXPECT_EQ(0, update.sequence);
+  EXPECT_TRUE(update.is_full_update);
+  EXPECT_EQ(2, update.submap.size());
+
+  update = encoder.Encode(submap_list, false /* force_full_update */);
+  EXPECT_EQ(1, update.sequence);
+  EXPECT_FALSE(update.is_full_update);
+  EXPECT_TRUE(update.submap.empty());
+  EXPECT_TRUE(update.deleted_submap.empty());
+
+  submap_list.submap[0].pose.position.x = 0.5;
+  submap_list.submap[1].submap_version = 6;
+  submap_list.submap.push_back(CreateSubmapEntry(2, 1, 2.));
+  update = encoder.Encode(submap_list, false /* force_full_update */);
+  EXPECT_EQ(3, update.submap.size());
+
+  submap_list.submap.erase(submap_list.submap.begin());
+  update = encoder.Encode(submap_list, false /* force_full_update */);
+  EXPECT_TRUE(update.submap.empty());
+  ASSERT_EQ(1, update.deleted_submap.size());
+  EXPECT_EQ(0, update.deleted_submap[0].submap_index);
+}
+
+TEST(SubmapListEncoderTest, SendsFullUpdates) {
+  SubmapListEncoder encoder(3);
+  cartographer_ros_msgs::msg::SubmapList submap_list;
+  submap_list.submap.push_back(CreateSubmapEntry(0, 10, 0.));
+  for (int i = 0; i < 6; ++i) {
+    const auto update = encoder.Encode(submap_list, false);
+    EXPECT_EQ(i % 3 == 0, update.is_full_update);
+    EXPECT_EQ(i % 3 == 0 ? 1 : 0, update.submap.size());
+  }
+  const auto update = encoder.Encode(submap_list, true /* force_full_update */);
+  EXPECT_TRUE(update.is_full_update);
+  EXPECT_EQ(1, update.submap.size());
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_texture_cache.h"
+
+#include <iterator>
+
+namespace cartographer_ros {
+
+namespace {
+
+size_t ComputeNumBytes(const SubmapTextureCache::Textures& textures) {
+  size_t num_bytes = 0;
+  for (const auto& texture : textures) {
+    num_bytes += sizeof(texture) + texture.cells.size();
+  }
+  return num_bytes;
+}
+
+}  // namespace
+
+SubmapTextureCache::SubmapTextureCache(const size_t max_num_bytes)
+    : max_num_bytes_(max_num_bytes) {}
+
+std::shared_ptr<const SubmapTextureCache::Textures> SubmapTextureCache::Get(
+    const ::cartographer::mapping::SubmapId& submap_id,
+    const int submap_version) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  const auto it = entry_by_submap_id_.find(submap_id);
+  if (it == entry_by_submap_id_.end() ||
+      it->second->submap_version != submap_version) {
+    ++num_misses_;
+    return nullptr;
+  }
+  ++num_hits_;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->textures;
+}
+
+void SubmapTextureCache::Insert(
+    const ::cartographer::mapping::SubmapId& submap_id,
+    const int submap_version, std::shared_ptr<const Textures> textures) {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  const auto it = entry_by_submap_id_.find(submap_id);
+  if (it != entry_by_submap_id_.end()) {
+    Erase(it->second);
+  }
+  const size_t num_bytes = ComputeNumBytes(*textures);
+  if (num_bytes > max_num_bytes_) {
+    return;
+  }
+  entries_.push_front(
+      Entry{submap_id, submap_version, std::move(textures), num_bytes});
+  entry_by_submap_id_[submap_id] = entries_.begin();
+  num_bytes_ += num_bytes;
+  while (num_bytes_ > max_num_bytes_) {
+    Erase(std::prev(entries_.end()));
+  }
+}
+
+::cartographer::common::int64 SubmapTextureCache::num_hits() const {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  return num_hits_;
+}
+
+::cartographer::common::int64 SubmapTextureCache::num_misses() const {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  return num_misses_;
+}
+
+size_t SubmapTextureCache::num_bytes() const {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  return num_bytes_;
+}
+
+void SubmapTextureCache::Erase(const std::list<Entry>::iterator it) {
+  num_bytes_ -= it->num_bytes;
+  entry_by_submap_id_.erase(it->submap_id);
+  entries_.erase(it);
+}
+
+}  // namespace cartographer_ros
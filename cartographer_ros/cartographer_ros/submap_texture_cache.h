@@ -0,0 +1,86 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CACHE_H_
+#define CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CACHE_H_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "cartographer/common/mutex.h"
+#include "cartographer/common/port.h"
+#include "cartographer/mapping/id.h"
+#include "cartographer_ros_msgs/msg/submap_texture.hpp"
+
+namespace cartographer_ros {
+
+// Least recently used cache of the compressed textures of submaps, so that
+// submaps which did not change since they were last queried do not have to be
+// rendered and compressed again. Thread-safe.
+class SubmapTextureCache {
+ public:
+  using Textures = std::vector<::cartographer_ros_msgs::msg::SubmapTexture>;
+
+  // Evicts the least recently used textures once the cells of all cached
+  // textures take more than 'max_num_bytes'.
+  explicit SubmapTextureCache(size_t max_num_bytes);
+
+  SubmapTextureCache(const SubmapTextureCache&) = delete;
+  SubmapTextureCache& operator=(const SubmapTextureCache&) = delete;
+
+  // Returns the textures of 'submap_id' at 'submap_version', or nullptr if
+  // they are not cached.
+  std::shared_ptr<const Textures> Get(
+      const ::cartographer::mapping::SubmapId& submap_id, int submap_version)
+      EXCLUDES(mutex_);
+
+  // Caches 'textures' of 'submap_id' at 'submap_version', replacing textures
+  // of other versions of the same submap.
+  void Insert(const ::cartographer::mapping::SubmapId& submap_id,
+              int submap_version, std::shared_ptr<const Textures> textures)
+      EXCLUDES(mutex_);
+
+  ::cartographer::common::int64 num_hits() const EXCLUDES(mutex_);
+  ::cartographer::common::int64 num_misses() const EXCLUDES(mutex_);
+  size_t num_bytes() const EXCLUDES(mutex_);
+
+ private:
+  struct Entry {
+    ::cartographer::mapping::SubmapId submap_id;
+    int submap_version;
+    std::shared_ptr<const Textures> textures;
+    size_t num_bytes;
+  };
+
+  void Erase(std::list<Entry>::iterator it) REQUIRES(mutex_);
+
+  const size_t max_num_bytes_;
+
+  mutable ::cartographer::common::Mutex mutex_;
+  // Most recently used first.
+  std::list<Entry> entries_ GUARDED_BY(mutex_);
+  std::map<::cartographer::mapping::SubmapId, std::list<Entry>::iterator>
+      entry_by_submap_id_ GUARDED_BY(mutex_);
+  size_t num_bytes_ GUARDED_BY(mutex_) = 0;
+  ::cartographer::common::int64 num_hits_ GUARDED_BY(mutex_) = 0;
+  ::cartographer::common::int64 num_misses_ GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_SUBMAP_TEXTURE_CACHE_H_
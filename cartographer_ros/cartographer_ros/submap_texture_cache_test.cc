@@ -0,0 +1,66 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_texture_cache.h"
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::mapping::SubmapId;
+
+std::shared_ptr<const SubmapTextureCache::Textures> CreateTextures(
+    const size_t num_cells) {
+  auto textures = std::make_shared<SubmapTextureCache::Textures>(1);
+  textures->front().cells.resize(num_cells);
+  return textures;
+}
+
+TEST(SubmapTextureCacheTest, ReturnsOnlyMatchingVersion) {
+  SubmapTextureCache cache(1 << 20);
+  const SubmapId submap_id{0, 1};
+  EXPECT_EQ(nullptr, cache.Get(submap_id, 10));
+  const auto textures = CreateTextures(100);
+  cache.Insert(submap_id, 10, textures);
+  EXPECT_EQ(textures, cache.Get(submap_id, 10));
+  EXPECT_EQ(nullptr, cache.Get(submap_id, 11));
+  EXPECT_EQ(nullptr, cache.Get(SubmapId{1, 1}, 10));
+  EXPECT_EQ(1, cache.num_hits());
+  EXPECT_EQ(3, cache.num_misses());
+
+  cache.Insert(submap_id, 11, CreateTextures(200));
+  EXPECT_EQ(nullptr, cache.Get(submap_id, 10));
+  EXPECT_NE(nullptr, cache.Get(submap_id, 11));
+}
+
+TEST(SubmapTextureCacheTest, EvictsLeastRecentlyUsed) {
+  const size_t entry_size = sizeof(SubmapTextureCache::Textures::value_type) +
+                            1000;
+  SubmapTextureCache cache(2 * entry_size);
+  cache.Insert(SubmapId{0, 0}, 1, CreateTextures(1000));
+  cache.Insert(SubmapId{0, 1}, 1, CreateTextures(1000));
+  EXPECT_EQ(2 * entry_size, cache.num_bytes());
+  EXPECT_NE(nullptr, cache.Get(SubmapId{0, 0}, 1));
+  cache.Insert(SubmapId{0, 2}, 1, CreateTextures(1000));
+  EXPECT_EQ(2 * entry_size, cache.num_bytes());
+  EXPECT_NE(nullptr, cache.Get(SubmapId{0, 0}, 1));
+  EXPECT_EQ(nullptr, cache.Get(SubmapId{0, 1}, 1));
+  EXPECT_NE(nullptr, cache.Get(SubmapId{0, 2}, 1));
+}
+
+}  // namespace
+}  // namespace cartographer_ros
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_texture_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "cartographer/common/port.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+// Allows for rounding errors when the requested resolution is a multiple of
+// the texture resolution.
+constexpr double kDownsamplingFactorTolerance = 1e-3;
+
+// Cells of a texture hold an intensity and an alpha value. Both are 0 only
+// for cells which were never observed.
+constexpr int kNumValuesPerCell = 2;
+
+struct CellRange {
+  int min_column;
+  int max_column;  // Exclusive.
+  int min_row;
+  int max_row;  // Exclusive.
+};
+
+// Returns the cells of 'texture' intersecting 'filter.region'. Cell (column,
+// row) covers [-(row + 1), -row] x [-(column + 1), -column] times the
+// resolution in the slice frame.
+CellRange ComputeCellRange(
+    const ::cartographer_ros_msgs::msg::SubmapTexture& texture,
+    const ::cartographer::transform::Rigid3d& slice_to_map,
+    const SubmapTextureFilter& filter) {
+  CellRange range{0, texture.width, 0, texture.height};
+  if (filter.region.isEmpty()) {
+    return range;
+  }
+  const ::cartographer::transform::Rigid3d map_to_slice =
+      slice_to_map.inverse();
+  const double z = slice_to_map.translation().z();
+  Eigen::AlignedBox2d slice_region;
+  for (const auto corner :
+       {Eigen::AlignedBox2d::BottomLeft, Eigen::AlignedBox2d::BottomRight,
+        Eigen::AlignedBox2d::TopLeft, Eigen::AlignedBox2d::TopRight}) {
+    const Eigen::Vector2d point = filter.region.corner(corner);
+    slice_region.extend(
+        (map_to_slice * Eigen::Vector3d(point.x(), point.y(), z)).head<2>());
+  }
+  const auto clamp = [](const double value, const int min, const int max) {
+    return static_cast<int>(
+        std::min<double>(std::max<double>(value, min), max));
+  };
+  const double resolution = texture.resolution;
+  range.min_column =
+      clamp(std::floor(-slice_region.max().y() / resolution), 0, texture.width);
+  range.max_column = clamp(std::ceil(-slice_region.min().y() / resolution),
+                           range.min_column, texture.width);
+  range.min_row = clamp(std::floor(-slice_region.max().x() / resolution), 0,
+                        texture.height);
+  range.max_row = clamp(std::ceil(-slice_region.min().x() / resolution),
+                        range.min_row, texture.height);
+  return range;
+}
+
+}  // namespace
+
+bool SubmapTextureFilter::IsIdentity() const {
+  return resolution <= 0. && texture_indices.empty() && region.isEmpty();
+}
+
+SubmapTextureFilter FromSubmapQueryRequest(
+    const ::cartographer_ros_msgs::srv::SubmapQuery::Request& request) {
+  SubmapTextureFilter filter;
+  filter.resolution = request.resolution;
+  filter.texture_indices.assign(request.texture_indices.begin(),
+                                request.texture_indices.end());
+  if (request.max_x > request.min_x && request.max_y > request.min_y) {
+    filter.region = Eigen::AlignedBox2d(
+        Eigen::Vector2d(request.min_x, request.min_y),
+        Eigen::Vector2d(request.max_x, request.max_y));
+  }
+  return filter;
+}
+
+::cartographer_ros_msgs::msg::SubmapTexture FilterSubmapTexture(
+    const ::cartographer_ros_msgs::msg::SubmapTexture& texture,
+    const ::cartographer::transform::Rigid3d& submap_pose,
+    const SubmapTextureFilter& filter) {
+  const ::cartographer::transform::Rigid3d slice_pose =
+      ToRigid3d(texture.slice_pose);
+  const CellRange range =
+      ComputeCellRange(texture, submap_pose * slice_pose, filter);
+  const int factor =
+      filter.resolution > texture.resolution
+          ? static_cast<int>(
+                std::ceil(filter.resolution / texture.resolution -
+                          kDownsamplingFactorTolerance))
+          : 1;
+  if (factor == 1 && range.min_column == 0 &&
+      range.max_column == texture.width && range.min_row == 0 &&
+      range.max_row == texture.height) {
+    return texture;
+  }
+
+  std::string cells;
+  ::cartographer::common::FastGunzipString(
+      std::string(texture.cells.begin(), texture.cells.end()), &cells);
+  CHECK_EQ(cells.size(),
+           static_cast<size_t>(kNumValuesPerCell * texture.width *
+                               texture.height));
+
+  ::cartographer_ros_msgs::msg::SubmapTexture result;
+  result.width = (range.max_column - range.min_column + factor - 1) / factor;
+  result.height = (range.max_row - range.min_row + factor - 1) / factor;
+  result.resolution = texture.resolution * factor;
+  result.slice_pose = ToGeometryMsgPose(
+      slice_pose * ::cartographer::transform::Rigid3d::Translation(
+                       Eigen::Vector3d(-range.min_row * texture.resolution,
+                                       -range.min_column * texture.resolution,
+                                       0.)));
+  // Each cell is the average of the observed cells it covers, so that
+  // unobserved cells do not fade out the map.
+  std::string filtered_cells(kNumValuesPerCell * result.width * result.height,
+                             '\0');
+  for (int row = 0; row != result.height; ++row) {
+    const int begin_row = range.min_row + row * factor;
+    const int end_row = std::min(begin_row + factor, range.max_row);
+    for (int column = 0; column != result.width; ++column) {
+      const int begin_column = range.min_column + column * factor;
+      const int end_column = std::min(begin_column + factor, range.max_column);
+      int intensity_sum = 0;
+      int alpha_sum = 0;
+      int num_observed = 0;
+      for (int y = begin_row; y != end_row; ++y) {
+        for (int x = begin_column; x != end_column; ++x) {
+          const int index = kNumValuesPerCell * (y * texture.width + x);
+          const uint8_t intensity = cells[index];
+          const uint8_t alpha = cells[index + 1];
+          if (intensity != 0 || alpha != 0) {
+            intensity_sum += intensity;
+            alpha_sum += alpha;
+            ++num_observed;
+          }
+        }
+      }
+      if (num_observed != 0) {
+        const int index = kNumValuesPerCell * (row * result.width + column);
+        filtered_cells[index] = static_cast<char>(
+            (intensity_sum + num_observed / 2) / num_observed);
+        filtered_cells[index + 1] =
+            static_cast<char>((alpha_sum + num_observed / 2) / num_observed);
+      }
+    }
+  }
+  std::string compressed_cells;
+  ::cartographer::common::FastGzipString(filtered_cells, &compressed_cells);
+  result.cells.assign(compressed_cells.begin(), compressed_cells.end());
+  return result;
+}
+
+std::vector<::cartographer_ros_msgs::msg::SubmapTexture> FilterSubmapTextures(
+    const std::vector<::cartographer_ros_msgs::msg::SubmapTexture>& textures,
+    const ::cartographer::transform::Rigid3d& submap_pose,
+    const SubmapTextureFilter& filter) {
+  std::vector<::cartographer_ros_msgs::msg::SubmapTexture> result;
+  if (filter.texture_indices.empty()) {
+    for (const auto& texture : textures) {
+      result.push_back(FilterSubmapTexture(texture, submap_pose, filter));
+    }
+    return result;
+  }
+  for (const int texture_index : filter.texture_indices) {
+    if (texture_index < 0 ||
+        texture_index >= static_cast<int>(textures.size())) {
+      LOG(WARNING) << "Ignoring unknown texture index " << texture_index;
+      continue;
+    }
+    result.push_back(
+        FilterSubmapTexture(textures[texture_index], submap_pose, filter));
+  }
+  return result;
+}
+
+}  // namespace cartographer_ros
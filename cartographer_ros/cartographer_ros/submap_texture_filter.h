@@ -0,0 +1,64 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_SUBMAP_TEXTURE_FILTER_H_
+#define CARTOGRAPHER_ROS_SUBMAP_TEXTURE_FILTER_H_
+
+#include <vector>
+
+#include "Eigen/Geometry"
+#include "cartographer/transform/rigid_transform.h"
+#include "cartographer_ros_msgs/msg/submap_texture.hpp"
+#include "cartographer_ros_msgs/srv/submap_query.hpp"
+
+namespace cartographer_ros {
+
+// Reduces submap textures to the level of detail and region a client asked
+// for in a SubmapQuery.
+struct SubmapTextureFilter {
+  // If positive, textures with finer cells are downsampled to cells of at
+  // least this size in meters.
+  double resolution = 0.;
+  // If not empty, only the textures at these indices are kept.
+  std::vector<int> texture_indices;
+  // If not empty, textures are cropped to the cells intersecting this box in
+  // the map frame.
+  Eigen::AlignedBox2d region;
+
+  // Returns true if the filter keeps textures as they are.
+  bool IsIdentity() const;
+};
+
+SubmapTextureFilter FromSubmapQueryRequest(
+    const ::cartographer_ros_msgs::srv::SubmapQuery::Request& request);
+
+// Returns the compressed 'texture' downsampled and cropped to 'filter'.
+// 'submap_pose' is the pose of the submap in the map frame.
+::cartographer_ros_msgs::msg::SubmapTexture FilterSubmapTexture(
+    const ::cartographer_ros_msgs::msg::SubmapTexture& texture,
+    const ::cartographer::transform::Rigid3d& submap_pose,
+    const SubmapTextureFilter& filter);
+
+// Returns the 'textures' selected by 'filter', each reduced by
+// FilterSubmapTexture().
+std::vector<::cartographer_ros_msgs::msg::SubmapTexture> FilterSubmapTextures(
+    const std::vector<::cartographer_ros_msgs::msg::SubmapTexture>& textures,
+    const ::cartographer::transform::Rigid3d& submap_pose,
+    const SubmapTextureFilter& filter);
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_SUBMAP_TEXTURE_FILTER_H_
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/submap_texture_filter.h"
+
+#include <string>
+
+#include "cartographer/common/port.h"
+#include "cartographer_ros/msg_conversion.h"
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::transform::Rigid3d;
+
+// Creates a texture with 'width' x 'height' cells, where cell (column, row)
+// has intensity 'row * width + column + 1' and alpha 1.
+::cartographer_ros_msgs::msg::SubmapTexture CreateTexture(const int width,
+                                                           const int height) {
+  std::string cells;
+  for (int i = 0; i != width * height; ++i) {
+    cells.push_back(static_cast<char>(i + 1));
+    cells.push_back(1);
+  }
+  std::string compressed_cells;
+  ::cartographer::common::FastGzipString(cells, &compressed_cells);
+  ::cartographer_ros_msgs::msg::SubmapTexture texture;
+  texture.cells.assign(compressed_cells.begin(), compressed_cells.end());
+  texture.width = width;
+  texture.height = height;
+  texture.resolution = 0.1;
+  texture.slice_pose = ToGeometryMsgPose(Rigid3d::Identity());
+  return texture;
+}
+
+std::string GetCells(
+    const ::cartographer_ros_msgs::msg::SubmapTexture& texture) {
+  std::string cells;
+  ::cartographer::common::FastGunzipString(
+      std::string(texture.cells.begin(), texture.cells.end()), &cells);
+  return cells;
+}
+
+TEST(SubmapTextureFilterTest, IdentityKeepsTextures) {
+  const SubmapTextureFilter filter;
+  EXPECT_TRUE(filter.IsIdentity());
+  const auto texture = CreateTexture(4, 4);
+  const auto filtered_texture =
+      FilterSubmapTexture(texture, Rigid3d::Identity(), filter);
+  EXPECT_EQ(texture.cells, filtered_texture.cells);
+  EXPECT_EQ(4, filtered_texture.width);
+}
+
+TEST(SubmapTextureFilterTest, DownsamplesByAveraging) {
+  SubmapTextureFilter filter;
+  filter.resolution = 0.2;
+  const auto filtered_texture =
+      FilterSubmapTexture(CreateTexture(4, 4), Rigid3d::Identity(), filter);
+  EXPECT_EQ(2, filtered_texture.width);
+  EXPECT_EQ(2, filtered_texture.height);
+  EXPECT_NEAR(0.2, filtered_texture.resolution, 1e-9);
+  const std::string cells = GetCells(filtered_texture);
+  ASSERT_EQ(8, cells.size());
+  // The first cell covers intensities 1, 2, 5 and 6.
+  EXPECT_EQ(4, cells[0]);
+  EXPECT_EQ(1, cells[1]);
+  // The last cell covers intensities 11, 12, 15 and 16.
+  EXPECT_EQ(14, cells[6]);
+}
+
+TEST(SubmapTextureFilterTest, CropsToRegion) {
+  SubmapTextureFilter filter;
+  filter.region = Eigen::AlignedBox2d(Eigen::Vector2d(-0.25, -0.1),
+                                      Eigen::Vector2d(-0.15, -0.05));
+  const auto filtered_texture =
+      FilterSubmapTexture(CreateTexture(4, 4), Rigid3d::Identity(), filter);
+  EXPECT_EQ(1, filtered_texture.width);
+  EXPECT_EQ(2, filtered_texture.height);
+  EXPECT_NEAR(-0.1, filtered_texture.slice_pose.position.x, 1e-9);
+  EXPECT_NEAR(0., filtered_texture.slice_pose.position.y, 1e-9);
+  const std::string cells = GetCells(filtered_texture);
+  ASSERT_EQ(4, cells.size());
+  EXPECT_EQ(5, cells[0]);
+  EXPECT_EQ(9, cells[2]);
+}
+
+TEST(SubmapTextureFilterTest, SelectsTextureIndices) {
+  SubmapTextureFilter filter;
+  filter.texture_indices = {1, 5};
+  const auto filtered_textures = FilterSubmapTextures(
+      {CreateTexture(4, 4), CreateTexture(2, 2)}, Rigid3d::Identity(), filter);
+  ASSERT_EQ(1, filtered_textures.size());
+  EXPECT_EQ(2, filtered_textures.front().width);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
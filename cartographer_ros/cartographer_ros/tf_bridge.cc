@@ -14,59 +14,106 @@
  * limitations under the License.
  */
 
-#include "cartographer/common/make_unique.h"
+#include "cartographer_ros/tf_bridge.h"
+
+#include <cmath>
+#include <memory>
 
+#include "cartographer/common/make_unique.h"
 #include "cartographer_ros/msg_conversion.h"
-#include "cartographer_ros/tf_bridge.h"
 
 namespace cartographer_ros {
 
+namespace {
+
+// Static transforms are also looked up again after this long, in case the
+// static transforms reached the tf buffer only after the cache was cleared.
+constexpr std::chrono::seconds kStaticTransformRevalidationPeriod(5);
+
+// Since the latest transform is looked up, requests this close to each other
+// would get the same result anyway, unless a new transform arrived in between.
+constexpr double kDynamicTransformToleranceSec = 1e-3;
+
+}  // namespace
+
 TfBridge::TfBridge(const std::string& tracking_frame,
                    const double lookup_transform_timeout_sec,
                    const tf2_ros::Buffer* buffer)
     : tracking_frame_(tracking_frame),
       lookup_transform_timeout_sec_(lookup_transform_timeout_sec),
-      buffer_(buffer) {}
+      buffer_(buffer),
+      static_cache_(std::make_shared<const StaticTransformCache>()) {}
 
 std::unique_ptr<::cartographer::transform::Rigid3d> TfBridge::LookupToTracking(
     const ::cartographer::common::Time time,
     const std::string& frame_id) const {
-  tf2::Duration timeout(tf2::durationFromSec(lookup_transform_timeout_sec_));
-  std::unique_ptr<::cartographer::transform::Rigid3d> frame_id_to_tracking;
-  try {
-    const ::builtin_interfaces::msg::Time latest_tf_time =
-        buffer_
-            ->lookupTransform(tracking_frame_, frame_id, std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds>(),
-                              timeout)
-            .header.stamp;
-    const ::builtin_interfaces::msg::Time requested_time = ToRos(time);
-    std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> converted{std::chrono::nanoseconds{requested_time.sec*1000000000LL+requested_time.nanosec}};
-    std::chrono::system_clock::time_point recovered = std::chrono::time_point_cast<std::chrono::system_clock::duration>(converted);
-
-    std::chrono::time_point<std::chrono::system_clock, std::chrono::nanoseconds> converted_tf_time{std::chrono::nanoseconds{latest_tf_time.sec*1000000000LL+latest_tf_time.nanosec}};
-    std::chrono::system_clock::time_point recovered_tf_time = std::chrono::time_point_cast<std::chrono::system_clock::duration>(converted_tf_time);
-
-    if (recovered_tf_time >= recovered) {
-      // We already have newer data, so we do not wait. Otherwise, we would wait
-      // for the full 'timeout' even if we ask for data that is too old.
-      timeout = tf2::durationFromSec(0.0);
+  const auto now = std::chrono::steady_clock::now();
+  {
+    const std::shared_ptr<const StaticTransformCache> static_cache =
+        std::atomic_load(&static_cache_);
+    const auto it = static_cache->find(frame_id);
+    if (it != static_cache->end() &&
+        now - it->second.lookup_time < kStaticTransformRevalidationPeriod) {
+      return ::cartographer::common::make_unique<
+          ::cartographer::transform::Rigid3d>(it->second.transform);
     }
+  }
+  {
+    ::cartographer::common::MutexLocker lock(&mutex_);
+    const auto it = dynamic_cache_.find(frame_id);
+    if (it != dynamic_cache_.end() &&
+        std::abs(::cartographer::common::ToSeconds(time - it->second.time)) <=
+            kDynamicTransformToleranceSec) {
+      return ::cartographer::common::make_unique<
+          ::cartographer::transform::Rigid3d>(it->second.transform);
+    }
+  }
 
+  const tf2::Duration timeout(
+      tf2::durationFromSec(lookup_transform_timeout_sec_));
+  try {
     // TODO(clalancette): We are currently having some problems where the
     // conversions from tf2 time to cartographer time is rounding.  In turn
     // this causes tf2 to complain about extrapolating into the future.  For
     // right now, just always ask for the data "now", which works around the
     // problem.  We'll need to address this for real in the future.
-    //return ::cartographer::common::make_unique<
-    //    ::cartographer::transform::Rigid3d>(ToRigid3d(buffer_->lookupTransform(
-    //    tracking_frame_, frame_id, recovered, timeout)));
+    // Since we ask for the latest data, a single lookup which waits for up to
+    // 'timeout' for the transform to become available is enough.
+    const geometry_msgs::msg::TransformStamped stamped_transform =
+        buffer_->lookupTransform(tracking_frame_, frame_id, tf2::TimePointZero,
+                                 timeout);
+    // The latest common time of a chain of only static transforms is zero.
+    const bool is_static = stamped_transform.header.stamp.sec == 0 &&
+                           stamped_transform.header.stamp.nanosec == 0;
+    const ::cartographer::transform::Rigid3d transform =
+        ToRigid3d(stamped_transform);
+    {
+      ::cartographer::common::MutexLocker lock(&mutex_);
+      if (is_static) {
+        std::shared_ptr<StaticTransformCache> static_cache =
+            std::make_shared<StaticTransformCache>(
+                *std::atomic_load(&static_cache_));
+        (*static_cache)[frame_id] = CachedStaticTransform{transform, now};
+        std::atomic_store(&static_cache_,
+                          std::shared_ptr<const StaticTransformCache>(
+                              std::move(static_cache)));
+      } else {
+        dynamic_cache_[frame_id] = CachedDynamicTransform{transform, time};
+      }
+    }
     return ::cartographer::common::make_unique<
-        ::cartographer::transform::Rigid3d>(ToRigid3d(buffer_->lookupTransform(
-        tracking_frame_, frame_id, tf2::TimePointZero, timeout)));
+        ::cartographer::transform::Rigid3d>(transform);
   } catch (const tf2::TransformException& ex) {
     LOG(WARNING) << ex.what();
   }
   return nullptr;
 }
 
+void TfBridge::ClearCache() const {
+  ::cartographer::common::MutexLocker lock(&mutex_);
+  std::atomic_store(&static_cache_,
+                    std::make_shared<const StaticTransformCache>());
+  dynamic_cache_.clear();
+}
+
 }  // namespace cartographer_ros
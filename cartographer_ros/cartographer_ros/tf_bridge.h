@@ -17,8 +17,12 @@
 #ifndef CARTOGRAPHER_ROS_TF_BRIDGE_H_
 #define CARTOGRAPHER_ROS_TF_BRIDGE_H_
 
+#include <chrono>
+#include <map>
 #include <memory>
+#include <string>
 
+#include "cartographer/common/mutex.h"
 #include "cartographer/transform/rigid_transform.h"
 #include "cartographer_ros/time_conversion.h"
 
@@ -37,13 +41,43 @@ class TfBridge {
 
   // Returns the transform for 'frame_id' to 'tracking_frame_' if it exists at
   // 'time'.
+  //
+  // Frames connected to 'tracking_frame_' only through static transforms are
+  // cached until ClearCache() is called, or for a few seconds at most. For
+  // other frames, the last result is reused for requests within a millisecond
+  // of the 'time' it was looked up for, e.g. for subdivisions of a laser scan.
   std::unique_ptr<::cartographer::transform::Rigid3d> LookupToTracking(
-      ::cartographer::common::Time time, const std::string& frame_id) const;
+      ::cartographer::common::Time time, const std::string& frame_id) const
+      EXCLUDES(mutex_);
+
+  // Drops all cached transforms, e.g. after static transforms were published.
+  void ClearCache() const EXCLUDES(mutex_);
 
  private:
+  struct CachedStaticTransform {
+    ::cartographer::transform::Rigid3d transform;
+    std::chrono::steady_clock::time_point lookup_time;
+  };
+  using StaticTransformCache = std::map<std::string, CachedStaticTransform>;
+
+  struct CachedDynamicTransform {
+    ::cartographer::transform::Rigid3d transform;
+    // The 'time' this was requested for.
+    ::cartographer::common::Time time;
+  };
+
   const std::string tracking_frame_;
   const double lookup_transform_timeout_sec_;
   const tf2_ros::Buffer* const buffer_;
+
+  mutable ::cartographer::common::Mutex mutex_;
+  // Transforms of static chains, keyed with 'frame_id'. Sensor threads read it
+  // through std::atomic_load() without locking, while it is replaced under
+  // 'mutex_' when a transform is added or the cache is cleared.
+  mutable std::shared_ptr<const StaticTransformCache> static_cache_;
+  // Transforms of all other frames, keyed with 'frame_id'.
+  mutable std::map<std::string, CachedDynamicTransform> dynamic_cache_
+      GUARDED_BY(mutex_);
 };
 
 }  // namespace cartographer_ros
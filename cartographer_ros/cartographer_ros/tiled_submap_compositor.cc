@@ -0,0 +1,314 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/tiled_submap_compositor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <set>
+
+#include "glog/logging.h"
+
+namespace cartographer_ros {
+
+namespace {
+
+using ::cartographer::io::SubmapSlice;
+using ::cartographer::mapping::SubmapId;
+
+// Returns the largest integer not greater than 'a' / 'b' for positive 'b'.
+int FloorDivide(const int a, const int b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Returns the matrix mapping pixels of the surface of 'submap_slice' to canvas
+// pixels of 'resolution', the same transform as
+// ::cartographer::io::PaintSubmapSlices() applies.
+cairo_matrix_t ComputeSliceToCanvas(const SubmapSlice& submap_slice,
+                                    const double resolution) {
+  const ::cartographer::transform::Rigid3d slice_to_map =
+      submap_slice.pose * submap_slice.slice_pose;
+  const Eigen::Matrix3d rotation = slice_to_map.rotation().toRotationMatrix();
+  const Eigen::Vector3d& translation = slice_to_map.translation();
+  cairo_matrix_t slice_scale;
+  cairo_matrix_init_scale(&slice_scale, submap_slice.resolution,
+                          submap_slice.resolution);
+  cairo_matrix_t slice_to_map_matrix;
+  cairo_matrix_init(&slice_to_map_matrix, rotation(1, 0), rotation(0, 0),
+                    -rotation(1, 1), -rotation(0, 1), translation.x(),
+                    -translation.y());
+  cairo_matrix_t map_scale;
+  cairo_matrix_init_scale(&map_scale, 1. / resolution, 1. / resolution);
+  cairo_matrix_t scaled_slice_to_map;
+  cairo_matrix_multiply(&scaled_slice_to_map, &slice_scale,
+                        &slice_to_map_matrix);
+  cairo_matrix_t result;
+  cairo_matrix_multiply(&result, &scaled_slice_to_map, &map_scale);
+  return result;
+}
+
+bool Equal(const ::cartographer::transform::Rigid3d& a,
+           const ::cartographer::transform::Rigid3d& b) {
+  return a.translation() == b.translation() &&
+         a.rotation().coeffs() == b.rotation().coeffs();
+}
+
+void PaintBackground(cairo_t* const cr) {
+  // Same as ::cartographer::io::PaintSubmapSlices(), i.e. unknown.
+  cairo_set_source_rgba(cr, 0.5, 0., 0., 1.);
+  cairo_paint(cr);
+}
+
+}  // namespace
+
+TiledSubmapCompositor::TiledSubmapCompositor(const double resolution,
+                                             const int tile_size)
+    : resolution_(resolution), tile_size_(tile_size) {
+  CHECK_GT(resolution_, 0.);
+  CHECK_GT(tile_size_, 0);
+}
+
+Eigen::AlignedBox2i TiledSubmapCompositor::Update(
+    const std::map<SubmapId, SubmapSlice>& submap_slices) {
+  Eigen::AlignedBox2i dirty_box;
+  std::set<TileIndex> dirty_tiles;
+  const auto mark_dirty = [this, &dirty_box,
+                           &dirty_tiles](const Eigen::AlignedBox2i& box) {
+    dirty_box.extend(box);
+    for (int i = FloorDivide(box.min().x(), tile_size_);
+         i <= FloorDivide(box.max().x(), tile_size_); ++i) {
+      for (int j = FloorDivide(box.min().y(), tile_size_);
+           j <= FloorDivide(box.max().y(), tile_size_); ++j) {
+        dirty_tiles.emplace(i, j);
+      }
+    }
+  };
+
+  for (auto it = submap_states_.begin(); it != submap_states_.end();) {
+    const auto slice_it = submap_slices.find(it->first);
+    if (slice_it == submap_slices.end() ||
+        slice_it->second.surface == nullptr) {
+      mark_dirty(it->second.bounds);
+      it = submap_states_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (const auto& entry : submap_slices) {
+    const SubmapSlice& submap_slice = entry.second;
+    if (submap_slice.surface == nullptr) {
+      continue;
+    }
+    const ::cartographer::transform::Rigid3d slice_to_map =
+        submap_slice.pose * submap_slice.slice_pose;
+    const auto it = submap_states_.find(entry.first);
+    if (it != submap_states_.end()) {
+      if (it->second.version == submap_slice.version &&
+          Equal(it->second.slice_to_map, slice_to_map)) {
+        continue;
+      }
+      mark_dirty(it->second.bounds);
+    }
+    const Eigen::AlignedBox2i bounds = ComputeBounds(submap_slice);
+    mark_dirty(bounds);
+    submap_states_[entry.first] =
+        SubmapState{submap_slice.version, slice_to_map, bounds};
+  }
+
+  for (const TileIndex& tile_index : dirty_tiles) {
+    CompositeTile(tile_index, submap_slices);
+  }
+  return dirty_box;
+}
+
+Eigen::AlignedBox2i TiledSubmapCompositor::Composite(
+    const SubmapSlice& submap_slice, const Eigen::AlignedBox2i& clip_box) {
+  CHECK(submap_slice.surface != nullptr);
+  const Eigen::AlignedBox2i box =
+      ComputeBounds(submap_slice).intersection(clip_box);
+  if (box.isEmpty()) {
+    return box;
+  }
+  composited_bounds_.extend(box);
+  for (int i = FloorDivide(box.min().x(), tile_size_);
+       i <= FloorDivide(box.max().x(), tile_size_); ++i) {
+    for (int j = FloorDivide(box.min().y(), tile_size_);
+         j <= FloorDivide(box.max().y(), tile_size_); ++j) {
+      const TileIndex tile_index(i, j);
+      {
+        auto cr = CreateTileContext(tile_index, false /* clear */);
+        PaintSlice(submap_slice, cr.get());
+      }
+      cairo_surface_flush(tiles_.at(tile_index).get());
+    }
+  }
+  return box;
+}
+
+Eigen::AlignedBox2i TiledSubmapCompositor::ToCanvasBox(
+    const Eigen::AlignedBox2d& region) const {
+  const auto to_pixel = [this](const double value) {
+    return static_cast<int>(std::max<double>(
+        std::numeric_limits<int>::min(),
+        std::min<double>(std::numeric_limits<int>::max(),
+                         std::floor(value / resolution_))));
+  };
+  return Eigen::AlignedBox2i(
+      Eigen::Vector2i(to_pixel(region.min().x()), to_pixel(-region.max().y())),
+      Eigen::Vector2i(to_pixel(region.max().x()), to_pixel(-region.min().y())));
+}
+
+Eigen::AlignedBox2i TiledSubmapCompositor::bounds() const {
+  Eigen::AlignedBox2i bounds = composited_bounds_;
+  for (const auto& entry : submap_states_) {
+    bounds.extend(entry.second.bounds);
+  }
+  return bounds;
+}
+
+::cartographer::io::PaintSubmapSlicesResult TiledSubmapCompositor::Paint(
+    const Eigen::AlignedBox2i& box) const {
+  CHECK(!box.isEmpty());
+  const Eigen::Vector2i size = box.sizes() + Eigen::Vector2i::Ones();
+  auto surface = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create(::cartographer::io::kCairoFormat, size.x(),
+                                 size.y()));
+  {
+    auto cr =
+        ::cartographer::io::MakeUniqueCairoPtr(cairo_create(surface.get()));
+    PaintBackground(cr.get());
+    // Tiles are opaque, so they replace the background.
+    cairo_set_operator(cr.get(), CAIRO_OPERATOR_SOURCE);
+    for (int i = FloorDivide(box.min().x(), tile_size_);
+         i <= FloorDivide(box.max().x(), tile_size_); ++i) {
+      for (int j = FloorDivide(box.min().y(), tile_size_);
+           j <= FloorDivide(box.max().y(), tile_size_); ++j) {
+        const auto it = tiles_.find(TileIndex(i, j));
+        if (it == tiles_.end()) {
+          continue;
+        }
+        const double x = i * tile_size_ - box.min().x();
+        const double y = j * tile_size_ - box.min().y();
+        cairo_set_source_surface(cr.get(), it->second.get(), x, y);
+        cairo_rectangle(cr.get(), x, y, tile_size_, tile_size_);
+        cairo_fill(cr.get());
+      }
+    }
+    cairo_surface_flush(surface.get());
+  }
+  return ::cartographer::io::PaintSubmapSlicesResult(
+      std::move(surface), Eigen::Array2f(-box.min().cast<float>().array()));
+}
+
+void TiledSubmapCompositor::PaintBands(
+    const Eigen::AlignedBox2i& box,
+    const std::function<
+        void(const ::cartographer::io::PaintSubmapSlicesResult&)>& paint_band)
+    const {
+  CHECK(!box.isEmpty());
+  for (int j = FloorDivide(box.min().y(), tile_size_);
+       j <= FloorDivide(box.max().y(), tile_size_); ++j) {
+    const Eigen::AlignedBox2i band(
+        Eigen::Vector2i(box.min().x(), std::max(box.min().y(), j * tile_size_)),
+        Eigen::Vector2i(box.max().x(),
+                        std::min(box.max().y(), (j + 1) * tile_size_ - 1)));
+    paint_band(Paint(band));
+  }
+}
+
+Eigen::AlignedBox2i TiledSubmapCompositor::ComputeBounds(
+    const SubmapSlice& submap_slice) const {
+  const cairo_matrix_t slice_to_canvas =
+      ComputeSliceToCanvas(submap_slice, resolution_);
+  Eigen::AlignedBox2d bounds;
+  for (const auto& corner :
+       {Eigen::Vector2d(0., 0.), Eigen::Vector2d(submap_slice.width, 0.),
+        Eigen::Vector2d(0., submap_slice.height),
+        Eigen::Vector2d(submap_slice.width, submap_slice.height)}) {
+    double x = corner.x();
+    double y = corner.y();
+    cairo_matrix_transform_point(&slice_to_canvas, &x, &y);
+    bounds.extend(Eigen::Vector2d(x, y));
+  }
+  // Filtering may blend a slice into the pixels next to it.
+  return Eigen::AlignedBox2i(
+      Eigen::Vector2i(static_cast<int>(std::floor(bounds.min().x())) - 1,
+                      static_cast<int>(std::floor(bounds.min().y())) - 1),
+      Eigen::Vector2i(static_cast<int>(std::ceil(bounds.max().x())),
+                      static_cast<int>(std::ceil(bounds.max().y()))));
+}
+
+void TiledSubmapCompositor::CompositeTile(
+    const TileIndex& tile_index,
+    const std::map<SubmapId, SubmapSlice>& submap_slices) {
+  const Eigen::AlignedBox2i tile_box(
+      Eigen::Vector2i(tile_index.first * tile_size_,
+                      tile_index.second * tile_size_),
+      Eigen::Vector2i((tile_index.first + 1) * tile_size_ - 1,
+                      (tile_index.second + 1) * tile_size_ - 1));
+  ::cartographer::io::UniqueCairoPtr cr(nullptr, cairo_destroy);
+  // Slices are painted in the same order as by
+  // ::cartographer::io::PaintSubmapSlices(), so tiles are identical to what it
+  // paints, up to the alignment of pixels.
+  for (const auto& entry : submap_states_) {
+    if (entry.second.bounds.intersection(tile_box).isEmpty()) {
+      continue;
+    }
+    if (cr == nullptr) {
+      cr = CreateTileContext(tile_index, true /* clear */);
+    }
+    PaintSlice(submap_slices.at(entry.first), cr.get());
+  }
+  if (cr == nullptr) {
+    tiles_.erase(tile_index);
+    return;
+  }
+  cr.reset();
+  cairo_surface_flush(tiles_.at(tile_index).get());
+}
+
+::cartographer::io::UniqueCairoPtr TiledSubmapCompositor::CreateTileContext(
+    const TileIndex& tile_index, const bool clear) {
+  auto& tile = tiles_[tile_index];
+  bool paint_background = clear;
+  if (tile == nullptr) {
+    tile = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+        cairo_image_surface_create(::cartographer::io::kCairoFormat,
+                                   tile_size_, tile_size_));
+    paint_background = true;
+  }
+  auto cr = ::cartographer::io::MakeUniqueCairoPtr(cairo_create(tile.get()));
+  if (paint_background) {
+    PaintBackground(cr.get());
+  }
+  cairo_translate(cr.get(), -tile_index.first * tile_size_,
+                  -tile_index.second * tile_size_);
+  return cr;
+}
+
+void TiledSubmapCompositor::PaintSlice(const SubmapSlice& submap_slice,
+                                       cairo_t* const cr) const {
+  const cairo_matrix_t slice_to_canvas =
+      ComputeSliceToCanvas(submap_slice, resolution_);
+  cairo_save(cr);
+  cairo_transform(cr, &slice_to_canvas);
+  cairo_set_source_surface(cr, submap_slice.surface.get(), 0., 0.);
+  cairo_paint(cr);
+  cairo_restore(cr);
+}
+
+}  // namespace cartographer_ros
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_ROS_TILED_SUBMAP_COMPOSITOR_H_
+#define CARTOGRAPHER_ROS_TILED_SUBMAP_COMPOSITOR_H_
+
+#include <functional>
+#include <map>
+#include <utility>
+
+#include "Eigen/Geometry"
+#include "cairo/cairo.h"
+#include "cartographer/io/image.h"
+#include "cartographer/io/submap_painter.h"
+#include "cartographer/mapping/id.h"
+#include "cartographer/transform/rigid_transform.h"
+
+namespace cartographer_ros {
+
+// Keeps the submap slices of a map composited into square tiles of a canvas in
+// the map frame. When submaps change, only the tiles they overlap are
+// composited again, instead of painting all submaps for every map.
+//
+// Canvas pixel (x, y) covers the map frame at x * 'resolution' and
+// -y * 'resolution', i.e. the y axis points down like in images.
+class TiledSubmapCompositor {
+ public:
+  // 'resolution' is the size of a pixel in meters, tiles have 'tile_size' x
+  // 'tile_size' pixels.
+  TiledSubmapCompositor(double resolution, int tile_size);
+
+  TiledSubmapCompositor(const TiledSubmapCompositor&) = delete;
+  TiledSubmapCompositor& operator=(const TiledSubmapCompositor&) = delete;
+
+  // Composites the tiles overlapped by the slices which were added, removed,
+  // or changed in version or pose since the last call. Slices without a
+  // surface are ignored. Returns the canvas pixels which were composited
+  // again, which is empty if nothing changed.
+  Eigen::AlignedBox2i Update(
+      const std::map<::cartographer::mapping::SubmapId,
+                     ::cartographer::io::SubmapSlice>& submap_slices);
+
+  // Composites 'submap_slice' over the tiles in 'clip_box' it overlaps, for
+  // rendering a map without keeping all slices in memory. The slice is not
+  // kept, so it can be freed afterwards. Compositing slices in the order of
+  // their submap IDs gives the same tiles as Update(), but both must not be
+  // used with the same compositor. Returns the canvas pixels composited.
+  Eigen::AlignedBox2i Composite(
+      const ::cartographer::io::SubmapSlice& submap_slice,
+      const Eigen::AlignedBox2i& clip_box);
+
+  // Returns the canvas pixels covering 'region' in the map frame.
+  Eigen::AlignedBox2i ToCanvasBox(const Eigen::AlignedBox2d& region) const;
+
+  // Returns the canvas pixels covered by the submaps, empty if there are none.
+  Eigen::AlignedBox2i bounds() const;
+
+  // Paints the canvas pixels in 'box' from the tiles. 'origin' of the result
+  // is the position of the map frame origin in the surface, as for
+  // ::cartographer::io::PaintSubmapSlices().
+  ::cartographer::io::PaintSubmapSlicesResult Paint(
+      const Eigen::AlignedBox2i& box) const;
+
+  // Paints the canvas pixels in 'box' like Paint(), but in bands of one row of
+  // tiles, which are passed to 'paint_band' from top to bottom. Only one band
+  // is kept in memory at a time, e.g. to write a large map into a file.
+  void PaintBands(
+      const Eigen::AlignedBox2i& box,
+      const std::function<
+          void(const ::cartographer::io::PaintSubmapSlicesResult&)>&
+          paint_band) const;
+
+  double resolution() const { return resolution_; }
+
+ private:
+  using TileIndex = std::pair<int, int>;
+
+  struct SubmapState {
+    int version;
+    ::cartographer::transform::Rigid3d slice_to_map;
+    // Canvas pixels the slice paints into.
+    Eigen::AlignedBox2i bounds;
+  };
+
+  // Returns the canvas pixels into which 'submap_slice' paints.
+  Eigen::AlignedBox2i ComputeBounds(
+      const ::cartographer::io::SubmapSlice& submap_slice) const;
+  void CompositeTile(
+      const TileIndex& tile_index,
+      const std::map<::cartographer::mapping::SubmapId,
+                     ::cartographer::io::SubmapSlice>& submap_slices);
+  // Returns a context to paint the canvas into the tile at 'tile_index'. The
+  // tile is created with the background painted if it does not exist, or
+  // always if 'clear' is true.
+  ::cartographer::io::UniqueCairoPtr CreateTileContext(
+      const TileIndex& tile_index, bool clear);
+  void PaintSlice(const ::cartographer::io::SubmapSlice& submap_slice,
+                  cairo_t* cr) const;
+
+  const double resolution_;
+  const int tile_size_;
+  std::map<::cartographer::mapping::SubmapId, SubmapState> submap_states_;
+  // Canvas pixels of the slices passed to Composite().
+  Eigen::AlignedBox2i composited_bounds_;
+  // Tiles no submap paints into are not kept.
+  std::map<TileIndex, ::cartographer::io::UniqueCairoSurfacePtr> tiles_;
+};
+
+}  // namespace cartographer_ros
+
+#endif  // CARTOGRAPHER_ROS_TILED_SUBMAP_COMPOSITOR_H_
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_ros/tiled_submap_compositor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "gtest/gtest.h"
+
+namespace cartographer_ros {
+namespace {
+
+using ::cartographer::io::SubmapSlice;
+using ::cartographer::mapping::SubmapId;
+using ::cartographer::transform::Rigid3d;
+
+constexpr double kResolution = 0.05;
+constexpr int kTileSize = 16;
+
+SubmapSlice CreateSubmapSlice(const Rigid3d& pose, const int version,
+                              const uint32_t color) {
+  SubmapSlice submap_slice;
+  submap_slice.pose = pose;
+  submap_slice.slice_pose = Rigid3d::Identity();
+  submap_slice.resolution = kResolution;
+  submap_slice.width = 20;
+  submap_slice.height = 30;
+  submap_slice.version = version;
+  submap_slice.surface = ::cartographer::io::MakeUniqueCairoSurfacePtr(
+      cairo_image_surface_create(::cartographer::io::kCairoFormat,
+                                 submap_slice.width, submap_slice.height));
+  uint32_t* const data = reinterpret_cast<uint32_t*>(
+      cairo_image_surface_get_data(submap_slice.surface.get()));
+  std::fill(data, data + submap_slice.width * submap_slice.height, color);
+  cairo_surface_mark_dirty(submap_slice.surface.get());
+  return submap_slice;
+}
+
+void ExpectSamePixels(const TiledSubmapCompositor& expected,
+                      const TiledSubmapCompositor& actual) {
+  ASSERT_EQ(expected.bounds().min(), actual.bounds().min());
+  ASSERT_EQ(expected.bounds().max(), actual.bounds().max());
+  const auto expected_result = expected.Paint(expected.bounds());
+  const auto actual_result = actual.Paint(actual.bounds());
+  cairo_surface_t* const expected_surface = expected_result.surface.get();
+  cairo_surface_t* const actual_surface = actual_result.surface.get();
+  const int height = cairo_image_surface_get_height(expected_surface);
+  ASSERT_EQ(height, cairo_image_surface_get_height(actual_surface));
+  const int num_bytes =
+      cairo_image_surface_get_stride(expected_surface) * height;
+  EXPECT_EQ(0, std::memcmp(cairo_image_surface_get_data(expected_surface),
+                           cairo_image_surface_get_data(actual_surface),
+                           num_bytes));
+}
+
+TEST(TiledSubmapCompositorTest, UpdatesOnlyChangedSubmaps) {
+  std::map<SubmapId, SubmapSlice> submap_slices;
+  submap_slices[SubmapId{0, 0}] =
+      CreateSubmapSlice(Rigid3d::Identity(), 1, 0xff402010);
+  submap_slices[SubmapId{0, 1}] =
+      CreateSubmapSlice(Rigid3d::Translation({0.5, 0.2, 0.}), 1, 0x80102040);
+  TiledSubmapCompositor compositor(kResolution, kTileSize);
+  EXPECT_FALSE(compositor.Update(submap_slices).isEmpty());
+  EXPECT_TRUE(compositor.Update(submap_slices).isEmpty());
+
+  submap_slices[SubmapId{0, 1}].version = 2;
+  const Eigen::AlignedBox2i dirty_box = compositor.Update(submap_slices);
+  EXPECT_FALSE(dirty_box.isEmpty());
+  EXPECT_LT(dirty_box.volume(), compositor.bounds().volume());
+}
+
+TEST(TiledSubmapCompositorTest, IncrementalUpdatesMatchFullComposition) {
+  std::map<SubmapId, SubmapSlice> submap_slices;
+  submap_slices[SubmapId{0, 0}] =
+      CreateSubmapSlice(Rigid3d::Identity(), 1, 0xff402010);
+  submap_slices[SubmapId{0, 1}] =
+      CreateSubmapSlice(Rigid3d::Translation({0.5, 0.2, 0.}), 1, 0x80102040);
+  submap_slices[SubmapId{0, 2}] =
+      CreateSubmapSlice(Rigid3d::Translation({-1., 1., 0.}), 1, 0x40ff0000);
+  TiledSubmapCompositor incremental_compositor(kResolution, kTileSize);
+  incremental_compositor.Update(submap_slices);
+
+  submap_slices.erase(SubmapId{0, 2});
+  submap_slices[SubmapId{0, 1}].pose = Rigid3d(
+      Eigen::Vector3d(0.3, -0.4, 0.),
+      Eigen::Quaterniond(Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitZ())));
+  incremental_compositor.Update(submap_slices);
+
+  TiledSubmapCompositor full_compositor(kResolution, kTileSize);
+  full_compositor.Update(submap_slices);
+  ExpectSamePixels(full_compositor, incremental_compositor);
+}
+
+TEST(TiledSubmapCompositorTest, CompositedSlicesMatchUpdate) {
+  std::map<SubmapId, SubmapSlice> submap_slices;
+  submap_slices[SubmapId{0, 0}] =
+      CreateSubmapSlice(Rigid3d::Identity(), 1, 0xff402010);
+  submap_slices[SubmapId{0, 1}] =
+      CreateSubmapSlice(Rigid3d::Translation({0.5, 0.2, 0.}), 1, 0x80102040);
+  TiledSubmapCompositor updated_compositor(kResolution, kTileSize);
+  updated_compositor.Update(submap_slices);
+
+  const Eigen::AlignedBox2i everything(
+      Eigen::Vector2i::Constant(std::numeric_limits<int>::min()),
+      Eigen::Vector2i::Constant(std::numeric_limits<int>::max()));
+  TiledSubmapCompositor streaming_compositor(kResolution, kTileSize);
+  for (const auto& entry : submap_slices) {
+    EXPECT_FALSE(
+        streaming_compositor.Composite(entry.second, everything).isEmpty());
+  }
+  ExpectSamePixels(updated_compositor, streaming_compositor);
+
+  const Eigen::AlignedBox2i clip_box(Eigen::Vector2i(0, 0),
+                                     Eigen::Vector2i(5, 5));
+  TiledSubmapCompositor clipped_compositor(kResolution, kTileSize);
+  clipped_compositor.Composite(submap_slices.at(SubmapId{0, 0}), clip_box);
+  EXPECT_TRUE(clip_box.contains(clipped_compositor.bounds()));
+}
+
+TEST(TiledSubmapCompositorTest, BandsMatchPaint) {
+  std::map<SubmapId, SubmapSlice> submap_slices;
+  submap_slices[SubmapId{0, 0}] =
+      CreateSubmapSlice(Rigid3d::Identity(), 1, 0xff402010);
+  submap_slices[SubmapId{0, 1}] =
+      CreateSubmapSlice(Rigid3d::Translation({0.5, 0.2, 0.}), 1, 0x80102040);
+  TiledSubmapCompositor compositor(kResolution, kTileSize);
+  compositor.Update(submap_slices);
+
+  const Eigen::AlignedBox2i box = compositor.bounds();
+  const auto expected_result = compositor.Paint(box);
+  cairo_surface_t* const expected_surface = expected_result.surface.get();
+  const int width = cairo_image_surface_get_width(expected_surface);
+  const int stride = cairo_image_surface_get_stride(expected_surface);
+  const unsigned char* expected_row =
+      cairo_image_surface_get_data(expected_surface);
+  int num_rows = 0;
+  int num_bands = 0;
+  compositor.PaintBands(
+      box, [&](const ::cartographer::io::PaintSubmapSlicesResult& band) {
+        cairo_surface_t* const surface = band.surface.get();
+        ASSERT_EQ(width, cairo_image_surface_get_width(surface));
+        const int height = cairo_image_surface_get_height(surface);
+        EXPECT_LE(height, kTileSize);
+        for (int y = 0; y != height; ++y) {
+          EXPECT_EQ(0, std::memcmp(expected_row,
+                                   cairo_image_surface_get_data(surface) +
+                                       y * cairo_image_surface_get_stride(
+                                               surface),
+                                   width * sizeof(uint32_t)));
+          expected_row += stride;
+        }
+        num_rows += height;
+        ++num_bands;
+      });
+  EXPECT_EQ(cairo_image_surface_get_height(expected_surface), num_rows);
+  EXPECT_GT(num_bands, 1);
+}
+
+}  // namespace
+}  // namespace cartographer_ros
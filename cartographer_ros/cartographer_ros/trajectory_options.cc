@@ -31,6 +31,10 @@ void CheckTrajectoryOptions(const TrajectoryOptions& options) {
       << "Configuration error: 'num_laser_scans', "
          "'num_multi_echo_laser_scans' and 'num_point_clouds' are "
          "all zero, but at least one is required.";
+  CHECK_GE(options.rangefinder_voxel_filter_size, 0.);
+  CHECK_LE(options.rangefinder_min_sampling_ratio,
+           options.rangefinder_sampling_ratio);
+  CHECK_GE(options.rangefinder_max_latency_sec, 0.);
 }
 
 }  // namespace
@@ -61,10 +65,16 @@ TrajectoryOptions CreateTrajectoryOptions(
       lua_parameter_dictionary->GetNonNegativeInt("num_point_clouds");
   options.rangefinder_sampling_ratio =
       lua_parameter_dictionary->GetDouble("rangefinder_sampling_ratio");
+  options.rangefinder_min_sampling_ratio =
+      lua_parameter_dictionary->GetDouble("rangefinder_min_sampling_ratio");
+  options.rangefinder_max_latency_sec =
+      lua_parameter_dictionary->GetDouble("rangefinder_max_latency_sec");
   options.odometry_sampling_ratio =
       lua_parameter_dictionary->GetDouble("odometry_sampling_ratio");
   options.imu_sampling_ratio =
       lua_parameter_dictionary->GetDouble("imu_sampling_ratio");
+  options.rangefinder_voxel_filter_size =
+      lua_parameter_dictionary->GetDouble("rangefinder_voxel_filter_size");
   CheckTrajectoryOptions(options);
   return options;
 }
@@ -82,8 +92,11 @@ bool FromRosMessage(const cartographer_ros_msgs::msg::TrajectoryOptions& msg,
       msg.num_subdivisions_per_laser_scan;
   options->num_point_clouds = msg.num_point_clouds;
   options->rangefinder_sampling_ratio = msg.rangefinder_sampling_ratio;
+  options->rangefinder_min_sampling_ratio = msg.rangefinder_min_sampling_ratio;
+  options->rangefinder_max_latency_sec = msg.rangefinder_max_latency_sec;
   options->odometry_sampling_ratio = msg.odometry_sampling_ratio;
   options->imu_sampling_ratio = msg.imu_sampling_ratio;
+  options->rangefinder_voxel_filter_size = msg.rangefinder_voxel_filter_size;
   if (!options->trajectory_builder_options.ParseFromString(
           msg.trajectory_builder_options_proto)) {
     LOG(ERROR) << "Failed to parse protobuf";
@@ -106,8 +119,11 @@ cartographer_ros_msgs::msg::TrajectoryOptions ToRosMessage(
   msg.num_subdivisions_per_laser_scan = options.num_subdivisions_per_laser_scan;
   msg.num_point_clouds = options.num_point_clouds;
   msg.rangefinder_sampling_ratio = options.rangefinder_sampling_ratio;
+  msg.rangefinder_min_sampling_ratio = options.rangefinder_min_sampling_ratio;
+  msg.rangefinder_max_latency_sec = options.rangefinder_max_latency_sec;
   msg.odometry_sampling_ratio = options.odometry_sampling_ratio;
   msg.imu_sampling_ratio = options.imu_sampling_ratio;
+  msg.rangefinder_voxel_filter_size = options.rangefinder_voxel_filter_size;
   options.trajectory_builder_options.SerializeToString(
       &msg.trajectory_builder_options_proto);
   return msg;
@@ -39,8 +39,11 @@ struct TrajectoryOptions {
   int num_subdivisions_per_laser_scan;
   int num_point_clouds;
   double rangefinder_sampling_ratio;
+  double rangefinder_min_sampling_ratio;
+  double rangefinder_max_latency_sec;
   double odometry_sampling_ratio;
   double imu_sampling_ratio;
+  double rangefinder_voxel_filter_size;
 };
 
 TrajectoryOptions CreateTrajectoryOptions(
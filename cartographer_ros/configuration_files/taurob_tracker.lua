@@ -30,11 +30,21 @@ options = {
   num_point_clouds = 0,
   lookup_transform_timeout_sec = 0.2,
   submap_publish_period_sec = 0.3,
+  submap_list_full_update_period_sec = 0.,
   pose_publish_period_sec = 5e-3,
+  point_cloud_publish_period_sec = 10e-3,
+  pose_history_duration_sec = 60.,
   trajectory_publish_period_sec = 30e-3,
+  occupancy_grid_publish_period_sec = 0.,
+  occupancy_grid_resolution = 0.05,
+  num_executor_threads = 4,
+  use_intra_process_comms = false,
   rangefinder_sampling_ratio = 1.,
+  rangefinder_min_sampling_ratio = 1.,
+  rangefinder_max_latency_sec = 0.,
   odometry_sampling_ratio = 1.,
   imu_sampling_ratio = 1.,
+  rangefinder_voxel_filter_size = 0.,
 }
 
 TRAJECTORY_BUILDER_3D.num_accumulated_range_data = 180
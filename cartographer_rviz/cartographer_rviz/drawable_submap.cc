@@ -16,8 +16,8 @@
 
 #include "cartographer_rviz/drawable_submap.h"
 
+#include <algorithm>
 #include <chrono>
-#include <future>
 #include <sstream>
 #include <string>
 
@@ -36,6 +36,11 @@ namespace {
 
 constexpr std::chrono::milliseconds kMinQueryDelayInMs(250);
 
+// How much closer, in terms of fetch priority, a submap appears for each
+// second its shown textures are outdated, so that far away submaps are
+// eventually fetched while the view is moving.
+constexpr double kMetersPerOutdatedSecond = 1.;
+
 // Distance before which the submap will be shown at full opacity, and distance
 // over which the submap will then fade out.
 constexpr double kFadeOutStartDistanceInMeters = 1.;
@@ -47,6 +52,21 @@ const Eigen::Vector3d kSubmapIdPosition(0.0, 0.0, 0.3);
 constexpr float kSubmapIdCharHeight = 0.2f;
 constexpr int kNumberOfSlicesPerSubmap = 2;
 
+// Returns whether the 'submap_textures' starting at 'first_texture_slice'
+// contain what is shown at 'level_of_detail'.
+bool HasLevelOfDetail(
+    const ::cartographer_ros::SubmapTextures& submap_textures,
+    const int first_texture_slice, const int level_of_detail) {
+  if (level_of_detail < 0) {
+    return first_texture_slice == 0 &&
+           submap_textures.textures.size() >=
+               static_cast<size_t>(kNumberOfSlicesPerSubmap);
+  }
+  return level_of_detail >= first_texture_slice &&
+         static_cast<size_t>(level_of_detail - first_texture_slice) <
+             submap_textures.textures.size();
+}
+
 }  // namespace
 
 DrawableSubmap::DrawableSubmap(const ::cartographer::mapping::SubmapId& id,
@@ -54,8 +74,10 @@ DrawableSubmap::DrawableSubmap(const ::cartographer::mapping::SubmapId& id,
                                Ogre::SceneNode* const map_node,
                                ::rviz::Property* const submap_category,
                                const bool visible, const float pose_axes_length,
-                               const float pose_axes_radius)
+                               const float pose_axes_radius,
+                               SubmapFetchPool* const fetch_pool)
     : id_(id),
+      fetch_pool_(fetch_pool),
       display_context_(display_context),
       submap_node_(map_node->createChildSceneNode()),
       submap_id_text_node_(submap_node_->createChildSceneNode()),
@@ -65,7 +87,8 @@ DrawableSubmap::DrawableSubmap(const ::cartographer::mapping::SubmapId& id,
                           .arg(id.trajectory_id)
                           .arg(id.submap_index)
                           .toStdString()),
-      last_query_timestamp_(0) {
+      last_query_timestamp_(0),
+      outdated_since_(std::chrono::steady_clock::now()) {
   for (int slice_index = 0; slice_index < kNumberOfSlicesPerSubmap;
        ++slice_index) {
     ogre_slices_.emplace_back(::cartographer::common::make_unique<OgreSlice>(
@@ -91,9 +114,7 @@ DrawableSubmap::DrawableSubmap(const ::cartographer::mapping::SubmapId& id,
 DrawableSubmap::~DrawableSubmap() {
   // 'query_in_progress_' must be true until the Q_EMIT has happened. Qt then
   // makes sure that 'RequestSucceeded' is not called after our destruction.
-  if (QueryInProgress()) {
-    rpc_request_future_.wait();
-  }
+  fetch_pool_->CancelAndWait(id_);
   display_context_->getSceneManager()->destroySceneNode(submap_node_);
   display_context_->getSceneManager()->destroySceneNode(submap_id_text_node_);
 }
@@ -102,7 +123,12 @@ void DrawableSubmap::Update(
     const ::std_msgs::Header& header,
     const ::cartographer_ros_msgs::SubmapEntry& metadata) {
   ::cartographer::common::MutexLocker locker(&mutex_);
+  const bool was_outdated = submap_textures_ == nullptr ||
+                            submap_textures_->version != metadata_version_;
   metadata_version_ = metadata.submap_version;
+  if (!was_outdated && submap_textures_->version != metadata_version_) {
+    outdated_since_ = std::chrono::steady_clock::now();
+  }
   pose_ = ::cartographer_ros::ToRigid3d(metadata.pose);
   submap_node_->setPosition(ToOgre(pose_.translation()));
   submap_node_->setOrientation(ToOgre(pose_.rotation()));
@@ -117,38 +143,78 @@ void DrawableSubmap::Update(
           .arg(metadata_version_));
 }
 
-bool DrawableSubmap::MaybeFetchTexture(ros::ServiceClient* const client) {
+bool DrawableSubmap::MaybeFetchTexture(ros::ServiceClient* const client,
+                                       const Ogre::Vector3& view_position) {
   ::cartographer::common::MutexLocker locker(&mutex_);
   // Received metadata version can also be lower if we restarted Cartographer.
   const bool newer_version_available =
       submap_textures_ == nullptr ||
-      submap_textures_->version != metadata_version_;
+      submap_textures_->version != metadata_version_ ||
+      !HasLevelOfDetail(*submap_textures_, first_texture_slice_,
+                        level_of_detail_);
   const std::chrono::milliseconds now =
       std::chrono::duration_cast<std::chrono::milliseconds>(
           std::chrono::system_clock::now().time_since_epoch());
   const bool recently_queried =
       last_query_timestamp_ + kMinQueryDelayInMs > now;
-  if (!newer_version_available || recently_queried || query_in_progress_) {
+  if (!newer_version_available || recently_queried || query_running_) {
     return false;
   }
+  const double outdated_seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                    outdated_since_)
+          .count();
+  const double priority =
+      submap_node_->_getDerivedPosition().distance(view_position) -
+      kMetersPerOutdatedSecond * outdated_seconds;
   query_in_progress_ = true;
-  last_query_timestamp_ = now;
-  rpc_request_future_ = std::async(std::launch::async, [this, client]() {
+  // Replaces the fetch if it is still queued.
+  const int level_of_detail = level_of_detail_;
+  fetch_pool_->Schedule(id_, priority, [this, client, level_of_detail]() {
+    {
+      ::cartographer::common::MutexLocker locker(&mutex_);
+      query_running_ = true;
+      last_query_timestamp_ =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::system_clock::now().time_since_epoch());
+    }
     std::unique_ptr<::cartographer_ros::SubmapTextures> submap_textures =
-        ::cartographer_ros::FetchSubmapTextures(id_, client);
+        level_of_detail < 0
+            ? ::cartographer_ros::FetchSubmapTextures(id_, client)
+            : ::cartographer_ros::FetchSubmapTextures(
+                  id_, {level_of_detail}, client);
     ::cartographer::common::MutexLocker locker(&mutex_);
     query_in_progress_ = false;
+    query_running_ = false;
     if (submap_textures != nullptr) {
       // We emit a signal to update in the right thread, and pass via the
       // 'submap_texture_' member to simplify the signal-slot connection
       // slightly.
       submap_textures_ = std::move(submap_textures);
+      first_texture_slice_ = std::max(level_of_detail, 0);
       Q_EMIT RequestSucceeded();
     }
   });
   return true;
 }
 
+void DrawableSubmap::SetTextures(
+    std::unique_ptr<::cartographer_ros::SubmapTextures> submap_textures) {
+  ::cartographer::common::MutexLocker locker(&mutex_);
+  if (submap_textures_ != nullptr &&
+      submap_textures_->version == submap_textures->version) {
+    return;
+  }
+  submap_textures_ = std::move(submap_textures);
+  first_texture_slice_ = 0;
+  // A scheduled fetch is superseded if the pushed textures are current.
+  if (submap_textures_->version == metadata_version_ && query_in_progress_ &&
+      !query_running_ && fetch_pool_->CancelQueued(id_)) {
+    query_in_progress_ = false;
+  }
+  Q_EMIT RequestSucceeded();
+}
+
 bool DrawableSubmap::QueryInProgress() {
   ::cartographer::common::MutexLocker locker(&mutex_);
   return query_in_progress_;
@@ -177,12 +243,50 @@ void DrawableSubmap::SetSliceVisibility(size_t slice_index, bool visible) {
   ToggleVisibility();
 }
 
+void DrawableSubmap::SetLevelOfDetail(const int slice_index) {
+  ::cartographer::common::MutexLocker locker(&mutex_);
+  if (slice_index == level_of_detail_) {
+    return;
+  }
+  level_of_detail_ = slice_index;
+  if (level_of_detail_ >= 0) {
+    for (int i = 0; i != static_cast<int>(ogre_slices_.size()); ++i) {
+      ogre_slices_[i]->SetVisibility(i == level_of_detail_);
+      if (i != level_of_detail_) {
+        ogre_slices_[i]->Release();
+      }
+      ogre_slices_[i]->UpdateOgreNodeVisibility(visibility_->getBool());
+    }
+  }
+  // Shows what we already have while a newer version is fetched.
+  UploadTextures();
+}
+
+Ogre::Vector3 DrawableSubmap::GetPosition() const {
+  return submap_node_->_getDerivedPosition();
+}
+
 void DrawableSubmap::UpdateSceneNode() {
   ::cartographer::common::MutexLocker locker(&mutex_);
-  for (size_t slice_index = 0; slice_index < ogre_slices_.size() &&
-                               slice_index < submap_textures_->textures.size();
-       ++slice_index) {
-    ogre_slices_[slice_index]->Update(submap_textures_->textures[slice_index]);
+  UploadTextures();
+}
+
+void DrawableSubmap::UploadTextures() {
+  if (submap_textures_ == nullptr) {
+    return;
+  }
+  for (int slice_index = 0;
+       slice_index < static_cast<int>(ogre_slices_.size()); ++slice_index) {
+    const int texture_index = slice_index - first_texture_slice_;
+    if (texture_index < 0 ||
+        texture_index >= static_cast<int>(submap_textures_->textures.size())) {
+      continue;
+    }
+    // With level of detail, the other slices stay released.
+    if (level_of_detail_ < 0 || slice_index == level_of_detail_) {
+      ogre_slices_[slice_index]->Update(
+          submap_textures_->textures[texture_index]);
+    }
   }
   display_context_->queueRender();
 }
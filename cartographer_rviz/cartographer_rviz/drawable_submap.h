@@ -17,12 +17,13 @@
 #ifndef CARTOGRAPHER_RVIZ_SRC_DRAWABLE_SUBMAP_H_
 #define CARTOGRAPHER_RVIZ_SRC_DRAWABLE_SUBMAP_H_
 
-#include <future>
+#include <chrono>
 #include <memory>
 
 #include "Eigen/Core"
 #include "Eigen/Geometry"
 #include "OgreSceneManager.h"
+#include "OgreVector3.h"
 #include "OgreSceneNode.h"
 #include "cartographer/common/mutex.h"
 #include "cartographer/mapping/id.h"
@@ -31,6 +32,7 @@
 #include "cartographer_ros_msgs/SubmapEntry.h"
 #include "cartographer_ros_msgs/SubmapQuery.h"
 #include "cartographer_rviz/ogre_slice.h"
+#include "cartographer_rviz/submap_fetch_pool.h"
 #include "ros/ros.h"
 #include "rviz/display_context.h"
 #include "rviz/frame_manager.h"
@@ -49,7 +51,8 @@ class DrawableSubmap : public QObject {
   DrawableSubmap(const ::cartographer::mapping::SubmapId& submap_id,
                  ::rviz::DisplayContext* display_context,
                  Ogre::SceneNode* map_node, ::rviz::Property* submap_category,
-                 bool visible, float pose_axes_length, float pose_axes_radius);
+                 bool visible, float pose_axes_length, float pose_axes_radius,
+                 SubmapFetchPool* fetch_pool);
   ~DrawableSubmap() override;
   DrawableSubmap(const DrawableSubmap&) = delete;
   DrawableSubmap& operator=(const DrawableSubmap&) = delete;
@@ -59,11 +62,19 @@ class DrawableSubmap : public QObject {
   void Update(const ::std_msgs::Header& header,
               const ::cartographer_ros_msgs::SubmapEntry& metadata);
 
-  // If an update is needed, it will send an RPC using 'client' to request the
-  // new data for the submap and returns true.
-  bool MaybeFetchTexture(ros::ServiceClient* client);
+  // If an update is needed, schedules an RPC using 'client' to request the new
+  // data for the submap and returns true. Submaps closer to 'view_position'
+  // and submaps which have been outdated for longer are fetched first. Until
+  // the RPC starts, calling this again updates its priority.
+  bool MaybeFetchTexture(ros::ServiceClient* client,
+                         const Ogre::Vector3& view_position);
 
-  // Returns whether an RPC is in progress.
+  // Takes pushed 'submap_textures', unless their version is already shown.
+  // Does not need to wait for the metadata of the new version.
+  void SetTextures(
+      std::unique_ptr<::cartographer_ros::SubmapTextures> submap_textures);
+
+  // Returns whether an RPC is scheduled or in progress.
   bool QueryInProgress();
 
   // Sets the alpha of the submap taking into account its slice height and the
@@ -74,6 +85,14 @@ class DrawableSubmap : public QObject {
   // is also visible.
   void SetSliceVisibility(size_t slice_index, bool visible);
 
+  // If 'slice_index' is not negative, only this slice is fetched and shown,
+  // and the textures of the other slices are released. Otherwise, all slices
+  // are fetched and SetSliceVisibility() has to be called for each.
+  void SetLevelOfDetail(int slice_index);
+
+  // Returns the position of the submap in the Ogre world frame.
+  Ogre::Vector3 GetPosition() const;
+
   ::cartographer::mapping::SubmapId id() const { return id_; }
   int version() const { return metadata_version_; }
   bool visibility() const { return visibility_->getBool(); }
@@ -91,7 +110,11 @@ class DrawableSubmap : public QObject {
   void ToggleVisibility();
 
  private:
+  // Uploads the textures of the slices shown at 'level_of_detail_'.
+  void UploadTextures() REQUIRES(mutex_);
+
   const ::cartographer::mapping::SubmapId id_;
+  SubmapFetchPool* const fetch_pool_;
 
   ::cartographer::common::Mutex mutex_;
   ::rviz::DisplayContext* const display_context_;
@@ -103,10 +126,17 @@ class DrawableSubmap : public QObject {
   ::rviz::MovableText submap_id_text_;
   std::chrono::milliseconds last_query_timestamp_ GUARDED_BY(mutex_);
   bool query_in_progress_ = false GUARDED_BY(mutex_);
+  bool query_running_ = false GUARDED_BY(mutex_);
+  // Slice shown with level of detail, or -1 for all slices.
+  int level_of_detail_ GUARDED_BY(mutex_) = -1;
   int metadata_version_ = -1 GUARDED_BY(mutex_);
-  std::future<void> rpc_request_future_;
+  // Since when the shown textures are older than 'metadata_version_'.
+  std::chrono::steady_clock::time_point outdated_since_ GUARDED_BY(mutex_);
   std::unique_ptr<::cartographer_ros::SubmapTextures> submap_textures_
       GUARDED_BY(mutex_);
+  // Slice of the first texture in 'submap_textures_', which only contains
+  // one texture if it was fetched with level of detail.
+  int first_texture_slice_ GUARDED_BY(mutex_) = 0;
   float current_alpha_ = 0.f;
   std::unique_ptr<::rviz::BoolProperty> visibility_;
 };
@@ -20,8 +20,11 @@
 #include <vector>
 
 #include "OgreGpuProgramParams.h"
+#include "OgreHardwarePixelBuffer.h"
 #include "OgreImage.h"
+#include "OgrePixelFormat.h"
 #include "cartographer/common/port.h"
+#include "glog/logging.h"
 
 namespace cartographer_rviz {
 
@@ -85,17 +88,22 @@ void OgreSlice::Update(
     const ::cartographer_ros::SubmapTexture& submap_texture) {
   slice_node_->setPosition(ToOgre(submap_texture.slice_pose.translation()));
   slice_node_->setOrientation(ToOgre(submap_texture.slice_pose.rotation()));
-  // The call to Ogre's loadRawData below does not work with an RG texture,
-  // therefore we create an RGB one whose blue channel is always 0.
-  std::vector<char> rgb;
-  CHECK_EQ(submap_texture.pixels.intensity.size(),
-           submap_texture.pixels.alpha.size());
-  for (size_t i = 0; i < submap_texture.pixels.intensity.size(); ++i) {
-    rgb.push_back(submap_texture.pixels.intensity[i]);
-    rgb.push_back(submap_texture.pixels.alpha[i]);
-    rgb.push_back(0);
+  if (submap_texture.width != width_ || submap_texture.height != height_ ||
+      submap_texture.resolution != resolution_) {
+    UpdateGeometry(submap_texture);
   }
+  if (texture_.isNull() || submap_texture.width != width_ ||
+      submap_texture.height != height_) {
+    CreateTexture(submap_texture.width, submap_texture.height);
+  }
+  width_ = submap_texture.width;
+  height_ = submap_texture.height;
+  resolution_ = submap_texture.resolution;
+  UploadCells(submap_texture.cells);
+}
 
+void OgreSlice::UpdateGeometry(
+    const ::cartographer_ros::SubmapTexture& submap_texture) {
   manual_object_->clear();
   const float metric_width = submap_texture.resolution * submap_texture.width;
   const float metric_height = submap_texture.resolution * submap_texture.height;
@@ -114,20 +122,21 @@ void OgreSlice::Update(
   manual_object_->position(0.0f, -metric_width, 0.0f);
   manual_object_->textureCoord(1.0f, 0.0f);
   manual_object_->end();
+}
 
-  Ogre::DataStreamPtr pixel_stream;
-  pixel_stream.bind(new Ogre::MemoryDataStream(rgb.data(), rgb.size()));
-
+void OgreSlice::CreateTexture(const int width, const int height) {
   if (!texture_.isNull()) {
     Ogre::TextureManager::getSingleton().remove(texture_->getHandle());
     texture_.setNull();
   }
+  // The texture is only written to, so that new versions of the submap can be
+  // uploaded into it without stalling on the previous contents.
   const std::string texture_name =
       kSubmapTexturePrefix + GetSliceIdentifier(id_, slice_id_);
-  texture_ = Ogre::TextureManager::getSingleton().loadRawData(
+  texture_ = Ogre::TextureManager::getSingleton().createManual(
       texture_name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
-      pixel_stream, submap_texture.width, submap_texture.height,
-      Ogre::PF_BYTE_RGB, Ogre::TEX_TYPE_2D, 0);
+      Ogre::TEX_TYPE_2D, width, height, 0 /* num_mipmaps */,
+      Ogre::PF_BYTE_RGB, Ogre::TU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
 
   Ogre::Pass* const pass = material_->getTechnique(0)->getPass(0);
   pass->setSceneBlending(Ogre::SBF_ONE, Ogre::SBF_ONE_MINUS_SOURCE_ALPHA);
@@ -139,6 +148,51 @@ void OgreSlice::Update(
   texture_unit->setTextureFiltering(Ogre::TFO_NONE);
 }
 
+void OgreSlice::UploadCells(const std::string& cells) {
+  CHECK_EQ(cells.size(), static_cast<size_t>(2 * width_ * height_));
+  const Ogre::HardwarePixelBufferSharedPtr buffer = texture_->getBuffer();
+  buffer->lock(Ogre::HardwareBuffer::HBL_DISCARD);
+  const Ogre::PixelBox& pixel_box = buffer->getCurrentLock();
+  // An RG texture does not work everywhere, therefore we use an RGB one whose
+  // blue channel is always 0.
+  if (pixel_box.format == Ogre::PF_BYTE_RGB) {
+    // Expand straight into the locked buffer, whose rows may be padded.
+    const char* source = cells.data();
+    for (int y = 0; y != height_; ++y) {
+      char* destination = static_cast<char*>(pixel_box.data) +
+                          3 * y * pixel_box.rowPitch;
+      for (int x = 0; x != width_; ++x) {
+        *destination++ = *source++;
+        *destination++ = *source++;
+        *destination++ = 0;
+      }
+    }
+  } else {
+    // The buffer chose a different layout, let Ogre convert into it.
+    rgb_.resize(3 * width_ * height_);
+    for (size_t i = 0; i != rgb_.size() / 3; ++i) {
+      rgb_[3 * i] = cells[2 * i];
+      rgb_[3 * i + 1] = cells[2 * i + 1];
+      rgb_[3 * i + 2] = 0;
+    }
+    Ogre::PixelUtil::bulkPixelConversion(
+        Ogre::PixelBox(width_, height_, 1, Ogre::PF_BYTE_RGB, rgb_.data()),
+        pixel_box);
+  }
+  buffer->unlock();
+}
+
+void OgreSlice::Release() {
+  if (!texture_.isNull()) {
+    Ogre::TextureManager::getSingleton().remove(texture_->getHandle());
+    texture_.setNull();
+  }
+  manual_object_->clear();
+  width_ = -1;
+  height_ = -1;
+  resolution_ = -1.;
+}
+
 void OgreSlice::SetAlpha(const float alpha) {
   const Ogre::GpuProgramParametersSharedPtr parameters =
       material_->getTechnique(0)->getPass(0)->getFragmentProgramParameters();
@@ -17,6 +17,9 @@
 #ifndef CARTOGRAPHER_RVIZ_SRC_OGRE_SLICE_H_
 #define CARTOGRAPHER_RVIZ_SRC_OGRE_SLICE_H_
 
+#include <string>
+#include <vector>
+
 #include "Eigen/Core"
 #include "Eigen/Geometry"
 #include "OgreManualObject.h"
@@ -49,12 +52,16 @@ class OgreSlice {
   OgreSlice& operator=(const OgreSlice&) = delete;
 
   // Updates the texture and pose of the submap using new data from
-  // 'submap_texture'.
+  // 'submap_texture'. The texture is reused and its geometry only rebuilt if
+  // the size or resolution changed.
   void Update(const ::cartographer_ros::SubmapTexture& submap_texture);
 
   // Changes the opacity of the submap to 'alpha'.
   void SetAlpha(float alpha);
 
+  // Frees the texture and geometry until the next call to Update().
+  void Release();
+
   // Sets the local visibility of this slice.
   void SetVisibility(bool visibility);
 
@@ -63,6 +70,11 @@ class OgreSlice {
   void UpdateOgreNodeVisibility(bool submap_visibility);
 
  private:
+  void UpdateGeometry(const ::cartographer_ros::SubmapTexture& submap_texture);
+  void CreateTexture(int width, int height);
+  // Uploads the RG 'cells' of the current size into 'texture_'.
+  void UploadCells(const std::string& cells);
+
   // TODO(gaschler): Pack both ids into a struct.
   const ::cartographer::mapping::SubmapId id_;
   const int slice_id_;
@@ -73,6 +85,12 @@ class OgreSlice {
   Ogre::TexturePtr texture_;
   Ogre::MaterialPtr material_;
   bool visibility_ = true;
+  // Size and resolution of the current texture and geometry.
+  int width_ = -1;
+  int height_ = -1;
+  double resolution_ = -1.;
+  // Scratch space if the pixel buffer does not store RGB.
+  std::vector<char> rgb_;
 };
 
 }  // namespace cartographer_rviz
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cartographer_rviz/submap_fetch_pool.h"
+
+#include "glog/logging.h"
+
+namespace cartographer_rviz {
+
+SubmapFetchPool::SubmapFetchPool(const int num_threads) {
+  CHECK_GT(num_threads, 0);
+  for (int i = 0; i != num_threads; ++i) {
+    threads_.emplace_back([this]() { DoWork(); });
+  }
+}
+
+SubmapFetchPool::~SubmapFetchPool() {
+  {
+    ::cartographer::common::MutexLocker locker(&mutex_);
+    shutting_down_ = true;
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void SubmapFetchPool::Schedule(
+    const ::cartographer::mapping::SubmapId& submap_id, const double priority,
+    std::function<void()> fetch) {
+  ::cartographer::common::MutexLocker locker(&mutex_);
+  CancelQueuedLocked(submap_id);
+  queue_.emplace(priority, submap_id);
+  queued_fetches_.emplace(submap_id, QueuedFetch{priority, std::move(fetch)});
+}
+
+bool SubmapFetchPool::CancelQueued(
+    const ::cartographer::mapping::SubmapId& submap_id) {
+  ::cartographer::common::MutexLocker locker(&mutex_);
+  return CancelQueuedLocked(submap_id);
+}
+
+void SubmapFetchPool::CancelAndWait(
+    const ::cartographer::mapping::SubmapId& submap_id) {
+  ::cartographer::common::MutexLocker locker(&mutex_);
+  CancelQueuedLocked(submap_id);
+  locker.Await([this, &submap_id]() REQUIRES(mutex_) {
+    return running_fetches_.count(submap_id) == 0;
+  });
+}
+
+bool SubmapFetchPool::CancelQueuedLocked(
+    const ::cartographer::mapping::SubmapId& submap_id) {
+  const auto it = queued_fetches_.find(submap_id);
+  if (it == queued_fetches_.end()) {
+    return false;
+  }
+  queue_.erase(std::make_pair(it->second.priority, submap_id));
+  queued_fetches_.erase(it);
+  return true;
+}
+
+void SubmapFetchPool::DoWork() {
+  for (;;) {
+    std::function<void()> fetch;
+    ::cartographer::mapping::SubmapId submap_id{0, 0};
+    {
+      ::cartographer::common::MutexLocker locker(&mutex_);
+      locker.Await([this]() REQUIRES(mutex_) {
+        return !queue_.empty() || shutting_down_;
+      });
+      if (shutting_down_) {
+        return;
+      }
+      submap_id = queue_.begin()->second;
+      queue_.erase(queue_.begin());
+      const auto it = queued_fetches_.find(submap_id);
+      fetch = std::move(it->second.fetch);
+      queued_fetches_.erase(it);
+      running_fetches_.insert(submap_id);
+    }
+    fetch();
+    ::cartographer::common::MutexLocker locker(&mutex_);
+    running_fetches_.erase(running_fetches_.find(submap_id));
+  }
+}
+
+}  // namespace cartographer_rviz
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 The Cartographer Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CARTOGRAPHER_RVIZ_SRC_SUBMAP_FETCH_POOL_H_
+#define CARTOGRAPHER_RVIZ_SRC_SUBMAP_FETCH_POOL_H_
+
+#include <functional>
+#include <map>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cartographer/common/mutex.h"
+#include "cartographer/mapping/id.h"
+
+namespace cartographer_rviz {
+
+// Runs submap texture fetches on a fixed number of threads shared by all
+// submaps of the display. Queued fetches run in order of increasing priority,
+// and at most one fetch per submap is queued: scheduling another one replaces
+// the queued fetch, which is dropped without running.
+class SubmapFetchPool {
+ public:
+  explicit SubmapFetchPool(int num_threads);
+  // Queued fetches are dropped, running ones are waited for.
+  ~SubmapFetchPool();
+
+  SubmapFetchPool(const SubmapFetchPool&) = delete;
+  SubmapFetchPool& operator=(const SubmapFetchPool&) = delete;
+
+  // Queues 'fetch' for 'submap_id' with 'priority', lower values run first.
+  // A fetch for 'submap_id' which is already running is not affected.
+  void Schedule(const ::cartographer::mapping::SubmapId& submap_id,
+                double priority, std::function<void()> fetch)
+      EXCLUDES(mutex_);
+
+  // Drops the queued fetch for 'submap_id' and returns true if there was one.
+  bool CancelQueued(const ::cartographer::mapping::SubmapId& submap_id)
+      EXCLUDES(mutex_);
+
+  // Drops the queued fetch for 'submap_id' and waits for a running one to
+  // finish, so that nothing it uses is accessed afterwards.
+  void CancelAndWait(const ::cartographer::mapping::SubmapId& submap_id)
+      EXCLUDES(mutex_);
+
+ private:
+  struct QueuedFetch {
+    double priority;
+    std::function<void()> fetch;
+  };
+
+  bool CancelQueuedLocked(const ::cartographer::mapping::SubmapId& submap_id)
+      REQUIRES(mutex_);
+  void DoWork() EXCLUDES(mutex_);
+
+  ::cartographer::common::Mutex mutex_;
+  bool shutting_down_ GUARDED_BY(mutex_) = false;
+  // Ordered by priority, ties are broken by the submap ID.
+  std::set<std::pair<double, ::cartographer::mapping::SubmapId>> queue_
+      GUARDED_BY(mutex_);
+  std::map<::cartographer::mapping::SubmapId, QueuedFetch> queued_fetches_
+      GUARDED_BY(mutex_);
+  std::multiset<::cartographer::mapping::SubmapId> running_fetches_
+      GUARDED_BY(mutex_);
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace cartographer_rviz
+
+#endif  // CARTOGRAPHER_RVIZ_SRC_SUBMAP_FETCH_POOL_H_
@@ -16,6 +16,7 @@
 
 #include "cartographer_rviz/submaps_display.h"
 
+#include "OgreCamera.h"
 #include "OgreResourceGroupManager.h"
 #include "cartographer/common/make_unique.h"
 #include "cartographer/common/mutex.h"
@@ -29,23 +30,30 @@
 #include "rviz/display_context.h"
 #include "rviz/frame_manager.h"
 #include "rviz/properties/bool_property.h"
+#include "rviz/properties/float_property.h"
 #include "rviz/properties/string_property.h"
+#include "rviz/view_controller.h"
+#include "rviz/view_manager.h"
 
 namespace cartographer_rviz {
 
 namespace {
 
-constexpr int kMaxOnGoingRequestsPerTrajectory = 6;
+constexpr int kNumSubmapFetchThreads = 6;
 constexpr char kMaterialsDirectory[] = "/ogre_media/materials";
 constexpr char kGlsl120Directory[] = "/glsl120";
 constexpr char kScriptsDirectory[] = "/scripts";
 constexpr char kDefaultMapFrame[] = "map";
 constexpr char kDefaultTrackingFrame[] = "base_link";
 constexpr char kDefaultSubmapQueryServiceName[] = "/submap_query";
+constexpr char kDefaultSubmapTexturesTopic[] = "/submap_textures";
+constexpr int kSubmapTexturesQueueSize = 10;
+constexpr float kDefaultHighResolutionRadiusInMeters = 20.f;
 
 }  // namespace
 
-SubmapsDisplay::SubmapsDisplay() : tf_listener_(tf_buffer_) {
+SubmapsDisplay::SubmapsDisplay()
+    : tf_listener_(tf_buffer_), fetch_pool_(kNumSubmapFetchThreads) {
   submap_query_service_property_ = new ::rviz::StringProperty(
       "Submap query service", kDefaultSubmapQueryServiceName,
       "Submap query service to connect to.", this, SLOT(Reset()));
@@ -58,6 +66,18 @@ SubmapsDisplay::SubmapsDisplay() : tf_listener_(tf_buffer_) {
   slice_low_resolution_enabled_ = new ::rviz::BoolProperty(
       "Low Resolution", false, "Display low resolution slices.", this,
       SLOT(ResolutionToggled()), this);
+  level_of_detail_enabled_ = new ::rviz::BoolProperty(
+      "Level of Detail", false,
+      "Display and fetch high resolution slices only for submaps near the "
+      "camera focus, and low resolution slices for all others. Overrides the "
+      "resolution settings.",
+      this, SLOT(ResolutionToggled()), this);
+  high_resolution_radius_ = new ::rviz::FloatProperty(
+      "High Resolution Radius", kDefaultHighResolutionRadiusInMeters,
+      "Distance in meters from the camera focus within which submaps are "
+      "displayed at high resolution if the level of detail is enabled.",
+      this);
+  high_resolution_radius_->setMin(0.f);
   client_ = update_nh_.serviceClient<::cartographer_ros_msgs::SubmapQuery>("");
   trajectories_category_ = new ::rviz::Property(
       "Submaps", QVariant(), "List of all submaps, organized by trajectories.",
@@ -80,6 +100,7 @@ SubmapsDisplay::SubmapsDisplay() : tf_listener_(tf_buffer_) {
 
 SubmapsDisplay::~SubmapsDisplay() {
   client_.shutdown();
+  submap_textures_subscriber_.shutdown();
   trajectories_.clear();
   scene_manager_->destroySceneNode(map_node_);
 }
@@ -95,19 +116,49 @@ void SubmapsDisplay::onInitialize() {
   MFDClass::onInitialize();
   map_node_ = scene_manager_->getRootSceneNode()->createChildSceneNode();
   CreateClient();
+  submap_textures_subscriber_ = update_nh_.subscribe(
+      kDefaultSubmapTexturesTopic, kSubmapTexturesQueueSize,
+      &SubmapsDisplay::HandleSubmapTextures, this);
+}
+
+void SubmapsDisplay::HandleSubmapTextures(
+    const ::cartographer_ros_msgs::SubmapTextures::ConstPtr& msg) {
+  ::cartographer::common::MutexLocker locker(&mutex_);
+  // Submaps which are not displayed yet fetch their textures once listed.
+  const size_t trajectory_id = msg->trajectory_id;
+  if (trajectory_id >= trajectories_.size()) {
+    return;
+  }
+  const auto& trajectory_submaps = trajectories_[trajectory_id]->submaps;
+  const auto it = trajectory_submaps.find(msg->submap_index);
+  if (it == trajectory_submaps.end()) {
+    return;
+  }
+  it->second->SetTextures(
+      ::cartographer_ros::ToSubmapTextures(msg->submap_version, msg->textures));
 }
 
 void SubmapsDisplay::reset() {
   MFDClass::reset();
   ::cartographer::common::MutexLocker locker(&mutex_);
-  client_.shutdown();
+  // Waits for running fetches, which use the client.
   trajectories_.clear();
+  client_.shutdown();
+  has_submap_list_ = false;
   CreateClient();
 }
 
 void SubmapsDisplay::processMessage(
     const ::cartographer_ros_msgs::SubmapList::ConstPtr& msg) {
   ::cartographer::common::MutexLocker locker(&mutex_);
+  if (!msg->is_full_update &&
+      (!has_submap_list_ || msg->sequence != last_submap_list_sequence_ + 1)) {
+    // We missed an update, keep the current state until the next full list.
+    has_submap_list_ = false;
+    return;
+  }
+  has_submap_list_ = true;
+  last_submap_list_sequence_ = msg->sequence;
   map_frame_ =
       ::cartographer::common::make_unique<std::string>(msg->header.frame_id);
   // In case Cartographer node is relaunched, destroy trajectories from the
@@ -153,7 +204,7 @@ void SubmapsDisplay::processMessage(
           ::cartographer::common::make_unique<DrawableSubmap>(
               id, context_, map_node_, trajectory_visibility.get(),
               trajectory_visibility->getBool(), kSubmapPoseAxesLength,
-              kSubmapPoseAxesRadius));
+              kSubmapPoseAxesRadius, &fetch_pool_));
       trajectory_submaps.at(id.submap_index)
           ->SetSliceVisibility(0, slice_high_resolution_enabled_->getBool());
       trajectory_submaps.at(id.submap_index)
@@ -161,6 +212,17 @@ void SubmapsDisplay::processMessage(
     }
     trajectory_submaps.at(id.submap_index)->Update(msg->header, submap_entry);
   }
+  if (!msg->is_full_update) {
+    // Unchanged submaps are not listed, only remove the deleted ones.
+    for (const ::cartographer_ros_msgs::SubmapEntry& submap_entry :
+         msg->deleted_submap) {
+      const size_t trajectory_id = submap_entry.trajectory_id;
+      if (trajectory_id < trajectories_.size()) {
+        trajectories_[trajectory_id]->submaps.erase(submap_entry.submap_index);
+      }
+    }
+    return;
+  }
   // Remove all submaps not mentioned in the SubmapList.
   for (size_t trajectory_id = 0; trajectory_id < trajectories_.size();
        ++trajectory_id) {
@@ -179,21 +241,30 @@ void SubmapsDisplay::processMessage(
 
 void SubmapsDisplay::update(const float wall_dt, const float ros_dt) {
   ::cartographer::common::MutexLocker locker(&mutex_);
-  // Schedule fetching of new submap textures.
-  for (const auto& trajectory : trajectories_) {
-    int num_ongoing_requests = 0;
-    for (const auto& submap_entry : trajectory->submaps) {
-      if (submap_entry.second->QueryInProgress()) {
-        ++num_ongoing_requests;
+  Ogre::Camera* const camera =
+      context_->getViewManager()->getCurrent() != nullptr
+          ? context_->getViewManager()->getCurrent()->getCamera()
+          : nullptr;
+  if (camera != nullptr && level_of_detail_enabled_->getBool()) {
+    const Ogre::Vector3 view_focus = ComputeViewFocus(*camera);
+    const float high_resolution_radius = high_resolution_radius_->getFloat();
+    for (const auto& trajectory : trajectories_) {
+      for (const auto& submap_entry : trajectory->submaps) {
+        submap_entry.second->SetLevelOfDetail(
+            submap_entry.second->GetPosition().distance(view_focus) <=
+                    high_resolution_radius
+                ? 0
+                : 1);
       }
     }
-    for (auto it = trajectory->submaps.rbegin();
-         it != trajectory->submaps.rend() &&
-         num_ongoing_requests < kMaxOnGoingRequestsPerTrajectory;
-         ++it) {
-      if (it->second->MaybeFetchTexture(&client_)) {
-        ++num_ongoing_requests;
-      }
+  }
+  // Schedule fetching of new submap textures, those closest to the camera
+  // first.
+  const Ogre::Vector3 view_position =
+      camera != nullptr ? camera->getDerivedPosition() : Ogre::Vector3::ZERO;
+  for (const auto& trajectory : trajectories_) {
+    for (const auto& submap_entry : trajectory->submaps) {
+      submap_entry.second->MaybeFetchTexture(&client_, view_position);
     }
   }
   if (map_frame_ == nullptr) {
@@ -225,6 +296,15 @@ void SubmapsDisplay::update(const float wall_dt, const float ros_dt) {
   }
 }
 
+Ogre::Vector3 SubmapsDisplay::ComputeViewFocus(const Ogre::Camera& camera) {
+  const Ogre::Vector3 position = camera.getDerivedPosition();
+  const Ogre::Vector3 direction = camera.getDerivedDirection();
+  if (direction.z >= 0.f || position.z <= 0.f) {
+    return position;
+  }
+  return position - position.z / direction.z * direction;
+}
+
 void SubmapsDisplay::AllEnabledToggled() {
   ::cartographer::common::MutexLocker locker(&mutex_);
   const bool visible = visibility_all_enabled_->getBool();
@@ -235,8 +315,13 @@ void SubmapsDisplay::AllEnabledToggled() {
 
 void SubmapsDisplay::ResolutionToggled() {
   ::cartographer::common::MutexLocker locker(&mutex_);
+  if (level_of_detail_enabled_->getBool()) {
+    // The slices are chosen in the next update().
+    return;
+  }
   for (auto& trajectory : trajectories_) {
     for (auto& submap_entry : trajectory->submaps) {
+      submap_entry.second->SetLevelOfDetail(-1);
       submap_entry.second->SetSliceVisibility(
           0, slice_high_resolution_enabled_->getBool());
       submap_entry.second->SetSliceVisibility(
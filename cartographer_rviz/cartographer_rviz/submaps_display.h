@@ -22,11 +22,15 @@
 #include <string>
 #include <vector>
 
+#include "OgreCamera.h"
 #include "cartographer/common/mutex.h"
 #include "cartographer/common/port.h"
 #include "cartographer_ros_msgs/SubmapList.h"
+#include "cartographer_ros_msgs/SubmapTextures.h"
 #include "cartographer_rviz/drawable_submap.h"
+#include "cartographer_rviz/submap_fetch_pool.h"
 #include "rviz/message_filter_display.h"
+#include "rviz/properties/float_property.h"
 #include "tf2_ros/buffer.h"
 #include "tf2_ros/transform_listener.h"
 
@@ -72,6 +76,8 @@ class SubmapsDisplay
 
  private:
   void CreateClient();
+  void HandleSubmapTextures(
+      const ::cartographer_ros_msgs::SubmapTextures::ConstPtr& msg);
 
   // These are called by RViz and therefore do not adhere to the style guide.
   void onInitialize() override;
@@ -80,17 +86,29 @@ class SubmapsDisplay
       const ::cartographer_ros_msgs::SubmapList::ConstPtr& msg) override;
   void update(float wall_dt, float ros_dt) override;
 
+  // Returns where the 'camera' looks at the ground plane of the fixed frame
+  // or, if it does not look down on it, the camera position.
+  static Ogre::Vector3 ComputeViewFocus(const Ogre::Camera& camera);
+
   ::tf2_ros::Buffer tf_buffer_;
   ::tf2_ros::TransformListener tf_listener_;
   ros::ServiceClient client_;
+  ros::Subscriber submap_textures_subscriber_;
   ::rviz::StringProperty* submap_query_service_property_;
   std::unique_ptr<std::string> map_frame_;
   ::rviz::StringProperty* tracking_frame_property_;
   Ogre::SceneNode* map_node_ = nullptr;  // Represents the map frame.
+  // Shared by all submaps, so it must outlive 'trajectories_'.
+  SubmapFetchPool fetch_pool_;
   std::vector<std::unique_ptr<Trajectory>> trajectories_ GUARDED_BY(mutex_);
+  // Incremental submap lists can only be applied on top of the previous list.
+  bool has_submap_list_ GUARDED_BY(mutex_) = false;
+  uint64_t last_submap_list_sequence_ GUARDED_BY(mutex_) = 0;
   ::cartographer::common::Mutex mutex_;
   ::rviz::BoolProperty* slice_high_resolution_enabled_;
   ::rviz::BoolProperty* slice_low_resolution_enabled_;
+  ::rviz::BoolProperty* level_of_detail_enabled_;
+  ::rviz::FloatProperty* high_resolution_radius_;
   ::rviz::Property* trajectories_category_;
   ::rviz::BoolProperty* visibility_all_enabled_;
 };